@@ -0,0 +1,4 @@
+# the frame sources and sinks of the video loops (include/frame_source.h), one copy for every project: include() this
+# file from the CMakeLists.txt of a project, then add ${FRAME_SOURCE_SOURCES} to the executables that read frames
+include_directories(${CMAKE_CURRENT_LIST_DIR}/include)
+set(FRAME_SOURCE_SOURCES ${CMAKE_CURRENT_LIST_DIR}/src/frame_source.cpp)
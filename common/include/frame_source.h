@@ -0,0 +1,128 @@
+#include <opencv2/opencv.hpp>
+#include <string>
+
+#ifndef COMMON_INCLUDE_FRAME_SOURCE_H_
+#define COMMON_INCLUDE_FRAME_SOURCE_H_
+
+/**
+ * Where the frames of a video loop come from: a camera, a video file, a directory of images or a generator. The loop
+ * reads from it the same way in every case, so it can run without a camera and as fast as it can process.
+ */
+class FrameSource {
+ public:
+  virtual ~FrameSource() {}
+
+  /**
+   * Read the next frame
+   * @param frame the frame, reallocated only when the size or type changes
+   * @return false once the source has no frame left or failed
+   */
+  bool next(cv::Mat &frame);
+
+  /**
+   * @return the size of the frames, as far as it is known before the first read
+   */
+  virtual cv::Size size() const = 0;
+
+  /**
+   * @return true for a camera, which keeps delivering frames whether they are read or not, false for sources that
+   * wait for the reader and should never have frames dropped
+   */
+  virtual bool live() const;
+
+  /**
+   * @return the frames per second the source was recorded at, 0 if it does not say
+   */
+  virtual double frame_rate() const;
+
+  /**
+   * @return the number of frames read so far
+   */
+  int frame_count() const;
+
+  /**
+   * @return the frames per second read since the first frame
+   */
+  double fps() const;
+
+ protected:
+  FrameSource();
+
+  /**
+   * Read the next frame from the underlying source
+   * @param frame the frame
+   * @return false if there is no frame left
+   */
+  virtual bool read(cv::Mat &frame) = 0;
+
+ private:
+  int frames;
+  int64 first_tick, last_tick;
+};
+
+/**
+ * Where the frames of a video loop go: windows on screen, image files or nowhere. The headless sinks replace the key
+ * presses of a user with a fixed list of keys.
+ */
+class FrameSink {
+ public:
+  virtual ~FrameSink() {}
+
+  /**
+   * Show a frame in a window
+   * @param window the name of the window
+   * @param frame the frame
+   */
+  virtual void show(const std::string &window, const cv::Mat &frame) = 0;
+
+  /**
+   * Wait for a key press, like cv::waitKey()
+   * @param delay how long to wait in milliseconds
+   * @return the key, -1 if none was pressed
+   */
+  virtual int wait_key(int delay) = 0;
+};
+
+/**
+ * The command line options choosing the source and the sink, see open_frame_source() and open_frame_sink()
+ */
+struct FrameOptions {
+  std::string source = "camera";
+  std::string sink = "window";
+  std::string keys;
+};
+
+/**
+ * Take --source <spec>, --sink <spec> and --keys <keys> out of the command line and leave the other arguments in
+ * place, so the program can check its own arguments as before
+ * @param argc the number of arguments, reduced by the ones taken
+ * @param argv the argument array
+ * @param options the options found, the others keep their defaults
+ */
+void take_frame_options(int &argc, char *argv[], FrameOptions &options);
+
+/**
+ * Open a frame source:
+ *   camera[:<index>]                                  the camera, 0 by default
+ *   file:<path>                                       a video file
+ *   dir:<path>                                        the images of a directory, in file name order
+ *   synthetic[:<width>x<height>[:<frames>[:still]]]   a moving pattern, the same on every run, 640x480 and 300 frames
+ *                                                     by default; still keeps the background in place
+ * Anything else is taken as the path of a video file.
+ * @param spec the source description
+ * @return the source, nullptr if it could not be opened
+ */
+FrameSource *open_frame_source(const std::string &spec);
+
+/**
+ * Open a frame sink:
+ *   window        show the frames on screen (the default)
+ *   null          drop them
+ *   dir:<path>    write every frame to <path>/<window>_<index>.png
+ * @param spec the sink description
+ * @param keys for the headless sinks, the key pressed after each frame shown in turn; '.' presses nothing
+ * @return the sink, nullptr if the description is not valid
+ */
+FrameSink *open_frame_sink(const std::string &spec, const std::string &keys);
+
+#endif //COMMON_INCLUDE_FRAME_SOURCE_H_
@@ -0,0 +1,135 @@
+#include <opencv2/opencv.hpp>
+#include <string>
+
+#ifndef COMMON_INCLUDE_STAGE_TIMER_H_
+#define COMMON_INCLUDE_STAGE_TIMER_H_
+
+/**
+ * Per-stage latency instrumentation for the video loops of every project, which all build this one copy through
+ * stage_timer.cmake. A stage is a named step of a loop (capture, process, display, ...); every time it runs, its
+ * duration goes into a histogram of the stage kept by the thread that ran it, from which the report and the on-frame
+ * HUD read the 50th, 95th and 99th percentiles of all threads together, and optionally into a Chrome trace
+ * (chrome://tracing or https://ui.perfetto.dev) of the whole session. Recording a stage takes two tick counts and a
+ * few stores into the histogram of the calling thread, without a lock, nothing against the milliseconds of a frame.
+ *
+ * The timers are only built with STAGE_TIMERS defined (the STAGE_TIMERS CMake option, on by default). Without it
+ * STAGE_TIMER() expands to nothing and the functions below are empty inline ones, so the loops keep their calls and pay
+ * nothing for them.
+ */
+
+// the options of the timers on the command line, see take_stage_timer_options()
+struct StageTimerOptions {
+  // where to write the Chrome trace of the session, none if empty
+  std::string trace;
+  // draw the HUD from the first frame on
+  bool hud = false;
+};
+
+/**
+ * Take --trace <file.json> and --hud out of the command line and leave the other arguments in place, like
+ * take_frame_options()
+ * @param argc the number of arguments, reduced by the ones taken
+ * @param argv the argument array
+ * @param options the options found, the others keep their defaults
+ */
+void take_stage_timer_options(int &argc, char *argv[], StageTimerOptions &options);
+
+#ifdef STAGE_TIMERS
+
+/**
+ * @param name the name of a stage
+ * @param traced false for a span that starts on one thread and ends on another, like the age of a frame, which would
+ * overlap the other runs on its row of the trace; it still goes into the histograms
+ * @return the id of the stage, the same for the same name, registering it on first use
+ */
+int stage_timer_id(const char *name, bool traced = true);
+
+/**
+ * Record one run of a stage
+ * @param stage the id from stage_timer_id()
+ * @param start the cv::getTickCount() when it started
+ * @param end the cv::getTickCount() when it ended
+ */
+void record_stage(int stage, int64 start, int64 end);
+
+/**
+ * Name the calling thread in the trace
+ * @param name the name of the thread, e.g. "capture"
+ */
+void name_timer_thread(const char *name);
+
+/**
+ * Start keeping every run of every stage for write_stage_trace(), up to about a million of them, before the timed
+ * threads start
+ * @param path where write_stage_trace() writes the trace
+ */
+void start_stage_trace(const std::string &path);
+
+/**
+ * Write the runs kept since start_stage_trace() as Chrome trace-event JSON, once the timed threads are done
+ * @return 0 if success, -1 if the file could not be written or no trace was started
+ */
+int write_stage_trace();
+
+/**
+ * Draw the percentiles of every stage in the top left corner of a frame
+ * @param frame a CV_8UC3 frame
+ */
+void draw_stage_hud(cv::Mat &frame);
+
+/**
+ * Print the count, percentiles and worst time of every stage
+ */
+void print_stage_report();
+
+// times the scope it lives in as one run of a stage
+class ScopedStageTimer {
+ public:
+  explicit ScopedStageTimer(int stage) : stage(stage), start(cv::getTickCount()) {}
+
+  ~ScopedStageTimer() {
+    record_stage(stage, start, cv::getTickCount());
+  }
+
+ private:
+  int stage;
+  int64 start;
+};
+
+#define STAGE_TIMER_CONCAT_(a, b) a##b
+#define STAGE_TIMER_CONCAT(a, b) STAGE_TIMER_CONCAT_(a, b)
+// time the rest of the enclosing scope as a run of the stage called name, the id is looked up once per call site
+#define STAGE_TIMER(name) \
+  static const int STAGE_TIMER_CONCAT(stage_timer_id_, __LINE__) = stage_timer_id(name); \
+  ScopedStageTimer STAGE_TIMER_CONCAT(stage_timer_, __LINE__)(STAGE_TIMER_CONCAT(stage_timer_id_, __LINE__))
+
+#else
+
+inline int stage_timer_id(const char *, bool = true) {
+  return 0;
+}
+
+inline void record_stage(int, int64, int64) {
+}
+
+inline void name_timer_thread(const char *) {
+}
+
+inline void start_stage_trace(const std::string &) {
+}
+
+inline int write_stage_trace() {
+  return -1;
+}
+
+inline void draw_stage_hud(cv::Mat &) {
+}
+
+inline void print_stage_report() {
+}
+
+#define STAGE_TIMER(name)
+
+#endif
+
+#endif //COMMON_INCLUDE_STAGE_TIMER_H_
@@ -0,0 +1,304 @@
+#include "frame_source.h"
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+FrameSource::FrameSource() : frames(0), first_tick(0), last_tick(0) {
+}
+
+bool FrameSource::next(cv::Mat &frame) {
+  if (!read(frame) || frame.empty()) {
+    return false;
+  }
+  last_tick = cv::getTickCount();
+  if (frames++ == 0) {
+    first_tick = last_tick;
+  }
+  return true;
+}
+
+bool FrameSource::live() const {
+  return false;
+}
+
+double FrameSource::frame_rate() const {
+  return 0;
+}
+
+int FrameSource::frame_count() const {
+  return frames;
+}
+
+double FrameSource::fps() const {
+  if (frames < 2 || last_tick == first_tick) {
+    return 0;
+  }
+  return (frames - 1) * cv::getTickFrequency() / (double) (last_tick - first_tick);
+}
+
+namespace {
+
+// a camera or a video file, whatever cv::VideoCapture can open
+class CaptureSource : public FrameSource {
+ public:
+  CaptureSource(cv::VideoCapture *capture, bool camera) : capture(capture), camera(camera) {}
+
+  ~CaptureSource() override {
+    delete capture;
+  }
+
+  cv::Size size() const override {
+    return cv::Size((int) capture->get(cv::CAP_PROP_FRAME_WIDTH), (int) capture->get(cv::CAP_PROP_FRAME_HEIGHT));
+  }
+
+  bool live() const override {
+    return camera;
+  }
+
+  double frame_rate() const override {
+    return capture->get(cv::CAP_PROP_FPS);
+  }
+
+ protected:
+  bool read(cv::Mat &frame) override {
+    return capture->read(frame);
+  }
+
+ private:
+  cv::VideoCapture *capture;
+  bool camera;
+};
+
+// the images of a directory, every file OpenCV can read in file name order
+class ImageSequenceSource : public FrameSource {
+ public:
+  explicit ImageSequenceSource(const std::vector<cv::String> &files) : files(files), index(0) {
+    cv::Mat first = cv::imread(files[0]);
+    first_size = first.size();
+  }
+
+  cv::Size size() const override {
+    return first_size;
+  }
+
+ protected:
+  bool read(cv::Mat &frame) override {
+    while (index < files.size()) {
+      frame = cv::imread(files[index++]);
+      if (!frame.empty()) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+ private:
+  std::vector<cv::String> files;
+  size_t index;
+  cv::Size first_size;
+};
+
+/*
+ * A dark square sliding over a light gradient that scrolls to the left, a function of the frame index only so every
+ * run sees the same frames. The gradient keeps the filters busy and the square gives the segmentation something to
+ * find. The gradient is drawn once, a frame is two copies per row, so the generator is never the slow part of a run.
+ * A still source keeps the gradient in place, a static scene with a single moving object.
+ */
+class SyntheticSource : public FrameSource {
+ public:
+  SyntheticSource(cv::Size frame_size, int total_frames, bool still)
+      : frame_size(frame_size), total(total_frames), index(0), still(still) {
+    background.create(frame_size.height, frame_size.width, CV_8UC3);
+    for (int i = 0; i < background.rows; i++) {
+      uchar *row = background.ptr<uchar>(i);
+      for (int j = 0; j < background.cols; j++) {
+        row[3 * j] = (uchar) (160 + (i + j) % 96);
+        row[3 * j + 1] = (uchar) (160 + (i * 2) % 96);
+        row[3 * j + 2] = (uchar) (160 + (j * 2) % 96);
+      }
+    }
+  }
+
+  cv::Size size() const override {
+    return frame_size;
+  }
+
+ protected:
+  bool read(cv::Mat &frame) override {
+    if (index >= total) {
+      return false;
+    }
+    frame.create(frame_size.height, frame_size.width, CV_8UC3);
+    int row_bytes = frame_size.width * 3;
+    int scroll = still ? 0 : (index * 4 % frame_size.width) * 3;
+    int side = std::max(std::min(frame_size.width, frame_size.height) / 4, 1);
+    int left = (index * 4) % std::max(frame_size.width - side, 1);
+    int top = (index * 3) % std::max(frame_size.height - side, 1);
+    for (int i = 0; i < frame.rows; i++) {
+      const uchar *src = background.ptr<uchar>(i);
+      uchar *row = frame.ptr<uchar>(i);
+      memcpy(row, src + scroll, row_bytes - scroll);
+      memcpy(row + row_bytes - scroll, src, scroll);
+      if (i >= top && i < top + side) {
+        for (int j = left; j < left + side; j++) {
+          row[3 * j] = 30;
+          row[3 * j + 1] = 20;
+          row[3 * j + 2] = (uchar) (20 + index % 32);
+        }
+      }
+    }
+    index++;
+    return true;
+  }
+
+ private:
+  cv::Size frame_size;
+  int total, index;
+  bool still;
+  cv::Mat background;
+};
+
+// the frames go to windows on screen and the keys come from the user
+class WindowSink : public FrameSink {
+ public:
+  void show(const std::string &window, const cv::Mat &frame) override {
+    cv::imshow(window, frame);
+  }
+
+  int wait_key(int delay) override {
+    return cv::waitKey(delay);
+  }
+};
+
+// the frames are dropped or written to a directory, and the keys come from a fixed list
+class HeadlessSink : public FrameSink {
+ public:
+  HeadlessSink(const std::string &directory, const std::string &keys)
+      : directory(directory), keys(keys), next_key(0), shown(false), frame_index(0) {}
+
+  void show(const std::string &window, const cv::Mat &frame) override {
+    if (!directory.empty()) {
+      cv::imwrite(directory + "/" + window + "_" + std::to_string(frame_index) + ".png", frame);
+    }
+    shown = true;
+  }
+
+  int wait_key(int /*delay*/) override {
+    // one key per frame shown, however often the loop polls
+    if (!shown) {
+      return -1;
+    }
+    shown = false;
+    frame_index++;
+    if (next_key >= keys.size()) {
+      return -1;
+    }
+    char key = keys[next_key++];
+    return key == '.' ? -1 : key;
+  }
+
+ private:
+  std::string directory, keys;
+  size_t next_key;
+  bool shown;
+  int frame_index;
+};
+
+bool has_prefix(const std::string &text, const char *prefix) {
+  return text.compare(0, strlen(prefix), prefix) == 0;
+}
+
+bool is_image_file(const std::string &path) {
+  static const char *extensions[] = {".png", ".jpg", ".jpeg", ".bmp", ".tif", ".tiff", ".ppm", ".pgm"};
+  std::string lower = path;
+  std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+  for (const char *extension: extensions) {
+    size_t length = strlen(extension);
+    if (lower.size() >= length && lower.compare(lower.size() - length, length, extension) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+FrameSource *open_capture(cv::VideoCapture *capture, bool camera) {
+  if (!capture->isOpened()) {
+    delete capture;
+    return nullptr;
+  }
+  return new CaptureSource(capture, camera);
+}
+
+}
+
+void take_frame_options(int &argc, char *argv[], FrameOptions &options) {
+  int kept = 1;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--source") == 0 && i + 1 < argc) {
+      options.source = argv[++i];
+    } else if (strcmp(argv[i], "--sink") == 0 && i + 1 < argc) {
+      options.sink = argv[++i];
+    } else if (strcmp(argv[i], "--keys") == 0 && i + 1 < argc) {
+      options.keys = argv[++i];
+    } else {
+      argv[kept++] = argv[i];
+    }
+  }
+  argc = kept;
+  argv[argc] = nullptr;
+}
+
+FrameSource *open_frame_source(const std::string &spec) {
+  if (spec == "camera") {
+    return open_capture(new cv::VideoCapture(0), true);
+  }
+  if (has_prefix(spec, "camera:")) {
+    return open_capture(new cv::VideoCapture(atoi(spec.c_str() + 7)), true);
+  }
+  if (has_prefix(spec, "file:")) {
+    return open_capture(new cv::VideoCapture(spec.substr(5)), false);
+  }
+  if (has_prefix(spec, "dir:")) {
+    std::vector<cv::String> paths, images;
+    cv::glob(spec.substr(4), paths, false);
+    for (const cv::String &path: paths) {
+      if (is_image_file(path)) {
+        images.push_back(path);
+      }
+    }
+    if (images.empty()) {
+      return nullptr;
+    }
+    std::sort(images.begin(), images.end());
+    return new ImageSequenceSource(images);
+  }
+  if (spec == "synthetic" || has_prefix(spec, "synthetic:")) {
+    int width = 640, height = 480, frames = 300;
+    char mode[16] = "";
+    if (spec.size() > 10 && sscanf(spec.c_str() + 10, "%dx%d:%d:%15s", &width, &height, &frames, mode) < 2) {
+      return nullptr;
+    }
+    bool still = strcmp(mode, "still") == 0;
+    if (width <= 0 || height <= 0 || frames <= 0 || (mode[0] != '\0' && !still)) {
+      return nullptr;
+    }
+    return new SyntheticSource(cv::Size(width, height), frames, still);
+  }
+  return open_capture(new cv::VideoCapture(spec), false);
+}
+
+FrameSink *open_frame_sink(const std::string &spec, const std::string &keys) {
+  if (spec == "window") {
+    return new WindowSink();
+  }
+  if (spec == "null") {
+    return new HeadlessSink("", keys);
+  }
+  if (has_prefix(spec, "dir:") && spec.size() > 4) {
+    return new HeadlessSink(spec.substr(4), keys);
+  }
+  return nullptr;
+}
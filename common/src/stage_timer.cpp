@@ -0,0 +1,325 @@
+#include "stage_timer.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+void take_stage_timer_options(int &argc, char *argv[], StageTimerOptions &options) {
+  int kept = 1;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+      options.trace = argv[++i];
+    } else if (strcmp(argv[i], "--hud") == 0) {
+      options.hud = true;
+    } else {
+      argv[kept++] = argv[i];
+    }
+  }
+  argc = kept;
+  argv[argc] = nullptr;
+#ifndef STAGE_TIMERS
+  if (!options.trace.empty() || options.hud) {
+    printf("the stage timers are compiled out, --trace and --hud do nothing\n");
+  }
+#endif
+}
+
+#ifdef STAGE_TIMERS
+
+// the most stages there can be, and the most runs a trace keeps
+#define MAX_STAGES 32
+#define MAX_TRACE_EVENTS (1 << 20)
+// the histogram buckets: one per microsecond below 32 us, then 16 per power of two, about 6% apart, up to 9 hours
+#define SUB_BUCKETS 16
+#define MAX_OCTAVE 30
+#define BUCKETS (SUB_BUCKETS * (MAX_OCTAVE + 2))
+
+namespace {
+
+// the name of a stage and whether it goes into the trace, set once when it is registered
+struct Stage {
+  std::string name;
+  bool traced;
+};
+
+// the histogram of one stage on one thread, written only by that thread and read by summaries() meanwhile
+struct ThreadStage {
+  std::atomic<long long> buckets[BUCKETS];
+  std::atomic<double> total_us, max_us, last_us;
+  // when the last run ended, the last run of a stage is the one of the thread that ended it last
+  std::atomic<int64> last_end;
+};
+
+// the histograms of every stage on one thread, registered on its first run and kept after the thread ends
+struct ThreadTimers {
+  int index;
+  // set under timers_mutex
+  std::string name;
+  ThreadStage stages[MAX_STAGES];
+
+  explicit ThreadTimers(int index) : index(index), name("thread " + std::to_string(index)) {
+    for (ThreadStage &stage: stages) {
+      for (std::atomic<long long> &bucket: stage.buckets) {
+        bucket.store(0, std::memory_order_relaxed);
+      }
+      stage.total_us.store(0, std::memory_order_relaxed);
+      stage.max_us.store(0, std::memory_order_relaxed);
+      stage.last_us.store(0, std::memory_order_relaxed);
+      stage.last_end.store(0, std::memory_order_relaxed);
+    }
+  }
+};
+
+// one run of a stage, in ticks
+struct TraceEvent {
+  int stage, thread;
+  int64 start, end;
+};
+
+// guards the stages and the threads registered, never taken to record a run
+std::mutex timers_mutex;
+Stage stages[MAX_STAGES];
+int stage_count = 0;
+// every thread that recorded a stage, indexed by the id it has in the trace
+std::vector<std::unique_ptr<ThreadTimers>> threads;
+thread_local ThreadTimers *this_thread = nullptr;
+// the runs of the trace, MAX_TRACE_EVENTS allocated up front, each thread claiming the next one with trace_event_count
+std::atomic<bool> tracing(false);
+std::string trace_path;
+std::unique_ptr<TraceEvent[]> trace_events;
+std::atomic<long long> trace_event_count(0);
+int64 trace_start = 0;
+
+int bucket_of(double us) {
+  long long value = (long long) std::max(us, 0.0);
+  int octave = 0;
+  while ((value >> octave) >= 2 * SUB_BUCKETS && octave < MAX_OCTAVE) {
+    octave++;
+  }
+  return std::min(SUB_BUCKETS * octave + (int) (value >> octave), BUCKETS - 1);
+}
+
+// the middle of a bucket, in microseconds
+double bucket_value(int bucket) {
+  if (bucket < 2 * SUB_BUCKETS) {
+    return bucket + 0.5;
+  }
+  int octave = bucket / SUB_BUCKETS - 1;
+  double low = (double) ((long long) (bucket % SUB_BUCKETS + SUB_BUCKETS) << octave);
+  return low + (double) (1LL << octave) / 2;
+}
+
+// the percentile in milliseconds of the runs counted in buckets
+double percentile_ms(const long long *buckets, long long count, double max_us, double fraction) {
+  long long rank = (long long) (fraction * (double) (count - 1)) + 1, seen = 0;
+  for (int b = 0; b < BUCKETS; b++) {
+    seen += buckets[b];
+    if (seen >= rank) {
+      return std::min(bucket_value(b), max_us) / 1000.0;
+    }
+  }
+  return max_us / 1000.0;
+}
+
+// the timers of the calling thread, registering it on first use
+ThreadTimers &this_thread_timers() {
+  if (this_thread == nullptr) {
+    std::lock_guard<std::mutex> lock(timers_mutex);
+    threads.emplace_back(new ThreadTimers((int) threads.size()));
+    this_thread = threads.back().get();
+  }
+  return *this_thread;
+}
+
+// a value only the calling thread writes, so there is no need for an atomic read-modify-write
+template<typename T>
+void add_relaxed(std::atomic<T> &value, T amount) {
+  value.store(value.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+}
+
+double ticks_to_us(int64 ticks) {
+  return (double) ticks * 1e6 / cv::getTickFrequency();
+}
+
+// what the HUD and the report show of one stage, copied out so the lock is not held while drawing or printing
+struct StageSummary {
+  std::string name;
+  long long count;
+  double mean, p50, p95, p99, max, last;
+};
+
+// the histograms of every thread merged, stage by stage
+std::vector<StageSummary> summaries() {
+  std::lock_guard<std::mutex> lock(timers_mutex);
+  std::vector<StageSummary> result;
+  long long buckets[BUCKETS];
+  for (int s = 0; s < stage_count; s++) {
+    memset(buckets, 0, sizeof(buckets));
+    long long count = 0;
+    double total_us = 0, max_us = 0, last_us = 0;
+    int64 last_end = 0;
+    for (const std::unique_ptr<ThreadTimers> &thread: threads) {
+      const ThreadStage &stage = thread->stages[s];
+      for (int b = 0; b < BUCKETS; b++) {
+        long long runs = stage.buckets[b].load(std::memory_order_relaxed);
+        buckets[b] += runs;
+        count += runs;
+      }
+      total_us += stage.total_us.load(std::memory_order_relaxed);
+      max_us = std::max(max_us, stage.max_us.load(std::memory_order_relaxed));
+      int64 end = stage.last_end.load(std::memory_order_relaxed);
+      if (end > last_end) {
+        last_end = end;
+        last_us = stage.last_us.load(std::memory_order_relaxed);
+      }
+    }
+    if (count == 0) {
+      continue;
+    }
+    StageSummary summary = {stages[s].name, count, total_us / 1000.0 / (double) count,
+                            percentile_ms(buckets, count, max_us, 0.5), percentile_ms(buckets, count, max_us, 0.95),
+                            percentile_ms(buckets, count, max_us, 0.99), max_us / 1000.0, last_us / 1000.0};
+    result.push_back(summary);
+  }
+  return result;
+}
+
+void write_json_string(FILE *file, const std::string &text) {
+  fputc('"', file);
+  for (char c: text) {
+    if (c == '"' || c == '\\') {
+      fputc('\\', file);
+    }
+    fputc(c, file);
+  }
+  fputc('"', file);
+}
+
+}
+
+int stage_timer_id(const char *name, bool traced) {
+  std::lock_guard<std::mutex> lock(timers_mutex);
+  for (int s = 0; s < stage_count; s++) {
+    if (stages[s].name == name) {
+      return s;
+    }
+  }
+  if (stage_count == MAX_STAGES) {
+    return -1;
+  }
+  stages[stage_count].name = name;
+  stages[stage_count].traced = traced;
+  return stage_count++;
+}
+
+void record_stage(int stage, int64 start, int64 end) {
+  if (stage < 0) {
+    return;
+  }
+  double us = ticks_to_us(end - start);
+  ThreadTimers &thread = this_thread_timers();
+  ThreadStage &s = thread.stages[stage];
+  add_relaxed(s.buckets[bucket_of(us)], 1LL);
+  add_relaxed(s.total_us, us);
+  if (us > s.max_us.load(std::memory_order_relaxed)) {
+    s.max_us.store(us, std::memory_order_relaxed);
+  }
+  s.last_us.store(us, std::memory_order_relaxed);
+  s.last_end.store(end, std::memory_order_relaxed);
+  if (tracing.load(std::memory_order_acquire) && stages[stage].traced) {
+    long long slot = trace_event_count.fetch_add(1, std::memory_order_relaxed);
+    if (slot < MAX_TRACE_EVENTS) {
+      TraceEvent event = {stage, thread.index, start, end};
+      trace_events[slot] = event;
+    }
+  }
+}
+
+void name_timer_thread(const char *name) {
+  ThreadTimers &thread = this_thread_timers();
+  std::lock_guard<std::mutex> lock(timers_mutex);
+  thread.name = name;
+}
+
+void start_stage_trace(const std::string &path) {
+  std::lock_guard<std::mutex> lock(timers_mutex);
+  trace_path = path;
+  // allocated up front, so recording never allocates in the middle of a frame
+  if (!trace_events) {
+    trace_events.reset(new TraceEvent[MAX_TRACE_EVENTS]);
+  }
+  trace_event_count.store(0, std::memory_order_relaxed);
+  trace_start = cv::getTickCount();
+  tracing.store(true, std::memory_order_release);
+}
+
+int write_stage_trace() {
+  std::lock_guard<std::mutex> lock(timers_mutex);
+  if (!tracing) {
+    return -1;
+  }
+  FILE *file = fopen(trace_path.c_str(), "w");
+  if (file == nullptr) {
+    printf("Unable to write the trace to %s\n", trace_path.c_str());
+    return -1;
+  }
+  long long claimed = trace_event_count.load(std::memory_order_acquire);
+  int events = (int) std::min(claimed, (long long) MAX_TRACE_EVENTS);
+  fprintf(file, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+  for (const std::unique_ptr<ThreadTimers> &thread: threads) {
+    fprintf(file, "  {\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, \"args\": {\"name\": ",
+            thread->index);
+    write_json_string(file, thread->name);
+    fprintf(file, "}},\n");
+  }
+  for (int e = 0; e < events; e++) {
+    const TraceEvent &event = trace_events[e];
+    fprintf(file, "  {\"name\": ");
+    write_json_string(file, stages[event.stage].name);
+    fprintf(file, ", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f}%s\n", event.thread,
+            ticks_to_us(event.start - trace_start), ticks_to_us(event.end - event.start), e + 1 < events ? "," : "");
+  }
+  fprintf(file, "]}\n");
+  fclose(file);
+  printf("wrote %d stage runs to %s", events, trace_path.c_str());
+  if (claimed > events) {
+    printf(", the %lld after the first %d were dropped", claimed - events, MAX_TRACE_EVENTS);
+  }
+  printf("\n");
+  return 0;
+}
+
+void draw_stage_hud(cv::Mat &frame) {
+  std::vector<StageSummary> lines = summaries();
+  const double scale = 0.4;
+  const int line_height = 15;
+  char text[96];
+  snprintf(text, sizeof(text), "%-10s %6s %6s %6s %6s", "ms", "last", "p50", "p95", "p99");
+  int baseline;
+  cv::Size size = cv::getTextSize(text, cv::FONT_HERSHEY_SIMPLEX, scale, 1, &baseline);
+  int height = std::min((int) (lines.size() + 1) * line_height + 6, frame.rows);
+  cv::rectangle(frame, cv::Rect(0, 0, std::min(size.width + 10, frame.cols), height), cv::Scalar(0, 0, 0),
+                cv::FILLED);
+  cv::putText(frame, text, cv::Point(5, line_height), cv::FONT_HERSHEY_SIMPLEX, scale, cv::Scalar(255, 255, 255));
+  for (size_t i = 0; i < lines.size(); i++) {
+    const StageSummary &line = lines[i];
+    snprintf(text, sizeof(text), "%-10.10s %6.1f %6.1f %6.1f %6.1f", line.name.c_str(), line.last, line.p50, line.p95,
+             line.p99);
+    cv::putText(frame, text, cv::Point(5, (int) (i + 2) * line_height), cv::FONT_HERSHEY_SIMPLEX, scale,
+                cv::Scalar(255, 255, 255));
+  }
+}
+
+void print_stage_report() {
+  std::vector<StageSummary> lines = summaries();
+  printf("%-12s %8s %9s %9s %9s %9s %9s\n", "stage", "runs", "mean ms", "p50 ms", "p95 ms", "p99 ms", "worst ms");
+  for (const StageSummary &line: lines) {
+    printf("%-12s %8lld %9.2f %9.2f %9.2f %9.2f %9.2f\n", line.name.c_str(), line.count, line.mean, line.p50, line.p95,
+           line.p99, line.max);
+  }
+}
+
+#endif
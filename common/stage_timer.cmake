@@ -0,0 +1,8 @@
+# the stage timers of the video loops (include/stage_timer.h), one copy for every project: include() this file from
+# the CMakeLists.txt of a project, then add ${STAGE_TIMER_SOURCES} to the executables that time their stages
+option(STAGE_TIMERS "time the stages of the video loop" ON)
+if (STAGE_TIMERS)
+  add_definitions(-DSTAGE_TIMERS)
+endif ()
+include_directories(${CMAKE_CURRENT_LIST_DIR}/include)
+set(STAGE_TIMER_SOURCES ${CMAKE_CURRENT_LIST_DIR}/src/stage_timer.cpp)
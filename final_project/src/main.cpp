@@ -10,6 +10,8 @@
  * dataset to detect the QR code and write the results into results folder.
  */
 #include "utils.h"
+#include "frame_source.h"
+#include "stage_timer.h"
 #include <dirent.h>
 #include <fstream>
 #include <opencv2/core/utils/filesystem.hpp>
@@ -19,38 +21,60 @@ using namespace std;
 
 string mode;
 string method = "self";
+// where the video mode reads its frames from and shows them, see frame_source.h
+FrameOptions frameOptions;
+// the trace and HUD of the stage timers of the video mode, see stage_timer.h
+StageTimerOptions timerOptions;
 
 /**
  * Real time QR code detection and segmentation in Video
- * @return -1 if the video device is not found, else 0
+ * @return -1 if the video device (or the frame source asked for) is not found, else 0
  */
 int videoDetectSegment() {
-  cv::VideoCapture *capdev;
-  // open the video device
-  capdev = new cv::VideoCapture(0);
-  if (!capdev->isOpened()) {
-    printf("Unable to open video device\n");
+  // open the video device, or whatever source was asked for
+  FrameSource *source = open_frame_source(frameOptions.source);
+  if (source == nullptr) {
+    printf("Unable to open frame source %s\n", frameOptions.source.c_str());
+    return (-1);
+  }
+  FrameSink *sink = open_frame_sink(frameOptions.sink, frameOptions.keys);
+  if (sink == nullptr) {
+    printf("Unknown frame sink %s\n", frameOptions.sink.c_str());
+    delete source;
     return (-1);
   }
   // get some properties of the image
-  cv::Size refS((int) capdev->get(cv::CAP_PROP_FRAME_WIDTH),
-                (int) capdev->get(cv::CAP_PROP_FRAME_HEIGHT));
+  cv::Size refS = source->size();
   printf("Expected size: %d %d\n", refS.width, refS.height);
+  if (!timerOptions.trace.empty()) {
+    start_stage_trace(timerOptions.trace);
+  }
+  bool hud = timerOptions.hud;
   cv::Mat frame;
   std::vector<double> single_feature_vector;
   for (;;) {
-    *capdev >> frame; // get a new frame from the camera, treat as a stream
-    if (frame.empty()) {
-      printf("frame is empty\n");
-      break;
+    // the whole iteration, key wait included
+    STAGE_TIMER("frame");
+    {
+      STAGE_TIMER("read");
+      // get a new frame from the source, treat as a stream
+      if (!source->next(frame)) {
+        printf("frame is empty\n");
+        break;
+      }
+    }
+    vector<Point> pts;
+    {
+      STAGE_TIMER("detect");
+      pts = detectAndDecode(frame, frameOptions.sink == "window");
     }
-    vector<Point> pts = detectAndDecode(frame, true);
     // draw the bbox for the detected rectangles
     if (!pts.empty()) {
+      STAGE_TIMER("draw");
       drawBBox(frame, pts);
     }
     // see if there is a waiting keystroke
-    int key = cv::waitKey(10);
+    int key = sink->wait_key(10);
     // if user types 'q', quit the program
     if (key == 'q') {
       break;
@@ -60,9 +84,23 @@ int videoDetectSegment() {
       imwrite(file_name, frame);
       cout << "This image is saved as " << file_name << endl;
     }
+    // 'i' turns the stage latencies on the video on and off
+    if (key == 'i') {
+      hud = !hud;
+    }
+    if (hud) {
+      draw_stage_hud(frame);
+    }
 
-    cv::imshow("frame", frame);
+    sink->show("frame", frame);
   }
+  printf("read %d frames at %.1f fps\n", source->frame_count(), source->fps());
+  print_stage_report();
+  if (!timerOptions.trace.empty()) {
+    write_stage_trace();
+  }
+  delete sink;
+  delete source;
   return 0;
 }
 
@@ -147,14 +185,22 @@ void imageDetectSegment(String fileName) {
  * @return 0 if works fine, else -1
  */
 int main(int argc, char *argv[]) {
+  // "--source <spec>", "--sink <spec>" and "--keys <keys>" are for the video mode, and so are "--trace <file.json>" and
+  // "--hud"
+  take_frame_options(argc, argv, frameOptions);
+  take_stage_timer_options(argc, argv, timerOptions);
   if (argc < 2 || argc >= 4) {
     std::cout << "Usage: ./main.exe video/eval || ./main.exe image <image_name>" << std::endl;
+    std::cout << "video mode options: [--source <spec>] [--sink <spec>] [--keys <keys>] [--trace <file.json>] [--hud]"
+              << std::endl;
     exit(-1);
   }
   String m = argv[1];
   if (m == "video") {
     mode = "video";
-    videoDetectSegment();
+    if (videoDetectSegment() != 0) {
+      exit(-1);
+    }
   } else if (m == "eval") {
     mode = "eval";
     imagesEvaluation();
@@ -0,0 +1,59 @@
+#include <opencv2/opencv.hpp>
+#include "row_kernels.h"
+
+#ifndef PROJ1_INCLUDE_COLOR_MATRIX_H_
+#define PROJ1_INCLUDE_COLOR_MATRIX_H_
+
+/**
+ * A per-pixel colour transform dst = M * src + offset on BGR pixels, rounded down and saturated to [0, 255]. It runs
+ * in 16-bit fixed point on the row kernels of the current simd level: each coefficient gets as many fraction bits as
+ * the largest coefficient and the largest possible sum leave room for, 6 for sepia. All the presets stay within 1 of
+ * their floating point versions, most pixels match exactly.
+ *
+ * sepia() and greyscale() of filter.h are presets, the operations on each channel on its own are point tables
+ * (point_lut.h).
+ */
+class ColorMatrix {
+ public:
+  /**
+   * The identity
+   */
+  ColorMatrix();
+
+  /**
+   * @param coefficients coefficients[c][k] is the weight of input channel k in output channel c, both in BGR order
+   * @param offset added to each output channel, 0.5 more rounds to the nearest value instead of down
+   */
+  ColorMatrix(const double coefficients[3][3], const double offset[3]);
+
+  /**
+   * @return the weighted sums of sepia_reference()
+   */
+  static ColorMatrix sepia();
+
+  /**
+   * @return the green channel copied to all three channels, like greyscale() always did
+   */
+  static ColorMatrix greyscale();
+
+  /**
+   * Transform a frame
+   * @param src a CV_8UC3 frame
+   * @param dst the result, a CV_8UC3 frame of the same size, may be src itself
+   * @return 0 if success
+   */
+  int apply(cv::Mat &src, cv::Mat &dst) const;
+
+  /**
+   * Transform one row
+   * @param src the BGR row
+   * @param dst the result, may be src itself
+   * @param cols the number of pixels in the row
+   */
+  void apply_row(const uchar *src, uchar *dst, int cols) const;
+
+ private:
+  ColorMatrixKernel kernel;
+};
+
+#endif //PROJ1_INCLUDE_COLOR_MATRIX_H_
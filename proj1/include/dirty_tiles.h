@@ -0,0 +1,88 @@
+#include <opencv2/opencv.hpp>
+#include <vector>
+
+#ifndef PROJ1_INCLUDE_DIRTY_TILES_H_
+#define PROJ1_INCLUDE_DIRTY_TILES_H_
+
+/**
+ * The tiles of a video frame that changed since they were last filtered, so a mostly static scene only pays for the
+ * parts that move. Every tile keeps the pixels it had when it was last found dirty, its reference, and is dirty again
+ * once the mean absolute difference of its bytes from the reference goes over the threshold. Comparing with the
+ * reference rather than with the previous frame lets a slow drift add up until the tile is filtered again.
+ *
+ * refilter() runs a filter on the dirty tiles only and keeps the previous output everywhere else. A filter whose
+ * pixels depend on the input up to halo pixels away runs on every block of dirty tiles grown by twice the halo, and the
+ * block grown by one halo is copied to the output: the first halo is as far as the changed input reaches, the second
+ * is the input that output needs. The result is the output of the whole frame, apart from the border pixels a filter
+ * leaves unfiltered.
+ */
+class DirtyTiles {
+ public:
+  /**
+   * @param tile_size the width and height of a tile in pixels
+   * @param threshold the mean absolute difference per byte above which a tile is dirty
+   */
+  DirtyTiles(int tile_size, int threshold);
+
+  /**
+   * Compare a frame with the references of the tiles and take the dirty ones as their new references. Every tile is
+   * dirty on the first frame, after invalidate() and when the frame size changes.
+   * @param frame a CV_8UC3 frame
+   * @return the share of the tiles that are dirty, from 0 to 1
+   */
+  double update(const cv::Mat &frame);
+
+  /**
+   * Make every tile dirty on the next update(), for when the output of the clean tiles no longer holds, e.g. after
+   * switching to another effect
+   */
+  void invalidate();
+
+  /**
+   * Filter the dirty tiles found by the last update() into output
+   * @param frame the frame given to the last update()
+   * @param output the output of the previous frames, refreshed where the tiles are dirty, allocated (and then filtered
+   * as a whole) if its size is not the frame size
+   * @param halo how many pixels away from an output pixel the filter reads
+   * @param filter body(context, src, dst) filtering src, a region of frame, into dst, a CV_8UC3 region of the same
+   * size; the whole frame and output when most tiles are dirty
+   * @param context passed through to filter
+   */
+  void refilter(cv::Mat &frame, cv::Mat &output, int halo, void (*filter)(void *context, cv::Mat &src, cv::Mat &dst),
+                void *context);
+
+  /**
+   * Same as above for any callable taking (src, dst), usually a lambda
+   */
+  template<typename Filter>
+  void refilter(cv::Mat &frame, cv::Mat &output, int halo, const Filter &filter) {
+    struct Trampoline {
+      static void call(void *context, cv::Mat &src, cv::Mat &dst) {
+        (*static_cast<const Filter *>(context))(src, dst);
+      }
+    };
+    refilter(frame, output, halo, &Trampoline::call, const_cast<Filter *>(&filter));
+  }
+
+  /**
+   * @return the share of the tiles that were dirty over every update() so far, from 0 to 1
+   */
+  double dirty_ratio() const;
+
+ private:
+  int tile_size, threshold;
+  cv::Size tiles;
+  // the pixels every tile was last filtered from
+  cv::Mat reference;
+  std::vector<char> dirty;
+  bool all_dirty;
+  // the blocks of dirty tiles found by the last update(), in pixels
+  std::vector<cv::Rect> blocks;
+  // the blocks that reach the bottom of the previous row of tiles, and of the current one, by their x
+  std::vector<int> open_blocks, next_open_blocks;
+  // where refilter() runs the filter on the grown blocks
+  cv::Mat scratch;
+  long long tile_count, dirty_count;
+};
+
+#endif //PROJ1_INCLUDE_DIRTY_TILES_H_
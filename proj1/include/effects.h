@@ -0,0 +1,63 @@
+#include <opencv2/opencv.hpp>
+#include "filter_graph.h"
+#include "frame_pool.h"
+#include "magnitude.h"
+
+#ifndef PROJ1_INCLUDE_EFFECTS_H_
+#define PROJ1_INCLUDE_EFFECTS_H_
+
+// the effects of video_display, picked with a key each
+enum effect {
+  ORIGIN = 1,
+  GRAY = 2,
+  ALTERNATIVE_GREY = 3,
+  BLUR = 4,
+  X_SOBEL = 5,
+  Y_SOBEL = 6,
+  MAGNITUDE = 7,
+  BLUR_QUANTIZE = 8,
+  CARTOON = 9,
+  NEGATIVE = 10,
+  ADD_CONTRAST = 11,
+  DEC_CONTRAST = 12,
+  ADD_BRIGHTNESS = 13,
+  DEC_BRIGHTNESS = 14,
+  SEPIA = 15,
+  EMBOSS = 16,
+  CHAIN = 17,
+  GAUSSIAN = 18,
+};
+
+/**
+ * The settings of the effects that take any, from the command line of video_display
+ */
+struct EffectSettings {
+  int quantize_level = 15;
+  int threshold = 20;
+  // the effects of the 'k' mode, set by --chain
+  FilterGraph chain;
+  // the radius of the 'f' mode, set by --blur-radius
+  int blur_radius = 20;
+  // how the 'm' and 'c' modes compute the gradient magnitude, set by --magnitude
+  MagnitudeMode magnitude_mode = MAGNITUDE_EXACT;
+};
+
+/**
+ * Run one effect on frame. The scratch frames come from the pool, which needs a CV_16SC3 and a CV_8UC1 buffer, so once
+ * an effect has run a few times this does not allocate.
+ * @param settings the settings of the effects
+ * @param effect the effect, ORIGIN or anything unknown copies the frame
+ * @param frame the BGR frame
+ * @param converted_frame the result, allocated with the size of frame
+ * @param pool the scratch frames, reserved for the size of frame and released by the caller
+ */
+void apply_effect(const EffectSettings &settings, int effect, cv::Mat &frame, cv::Mat &converted_frame,
+                  FramePool &pool);
+
+/**
+ * @return how many pixels away from an output pixel an effect reads, the halo of the tiles the incremental mode
+ * re-filters
+ */
+int effect_halo(const EffectSettings &settings, int effect);
+
+#endif //PROJ1_INCLUDE_EFFECTS_H_
@@ -1,4 +1,5 @@
 #include <opencv2/opencv.hpp>
+#include "magnitude.h"
 
 #ifndef PROJ1__FILTERS_H_
 #define PROJ1__FILTERS_H_
@@ -6,21 +7,53 @@ int greyscale(cv::Mat &src, cv::Mat &dst);
 
 int blur5x5(cv::Mat &src, cv::Mat &dst);
 
+// a box of 2 * radius + 1 pixels, the edge pixels repeated beyond the border; its cost does not depend on the radius
+int box_blur(cv::Mat &src, cv::Mat &dst, int radius);
+
+// a Gaussian of sigma radius / 2 approximated by three stacked boxes, at the cost of three box_blur whatever the
+// radius; a radius of 2 or less is blur5x5 itself
+int gaussian_blur(cv::Mat &src, cv::Mat &dst, int radius);
+
+// how many pixels away from a pixel gaussian_blur of that radius reads, the sum of the radii of its boxes
+int gaussian_blur_halo(int radius);
+
 int sobelX3x3(cv::Mat &src, cv::Mat &dst);
 
 int sobelY3x3(cv::Mat &src, cv::Mat &dst);
 
+// the original float implementations of sobelX3x3 and sobelY3x3, kept as the reference for the integer kernels
+int separable_sobel(cv::Mat &src, cv::Mat &dst, const float horizontal_kernel[3], const float vertical_kernel[3]);
+
+int sobelX3x3_reference(cv::Mat &src, cv::Mat &dst);
+
+int sobelY3x3_reference(cv::Mat &src, cv::Mat &dst);
+
 int transform(cv::Mat &src, cv::Mat &dst);
 
 int magnitude(cv::Mat &sx, cv::Mat &sy, cv::Mat &dst);
 
+// magnitude() in any mode, see magnitude.h; the exact mode is magnitude() itself
+int magnitude(cv::Mat &sx, cv::Mat &sy, cv::Mat &dst, MagnitudeMode mode);
+
+// magnitude() of sobelX3x3 and sobelY3x3 in one pass, without the two CV_16SC3 frames in between
+int sobel_magnitude(cv::Mat &src, cv::Mat &dst, MagnitudeMode mode = MAGNITUDE_EXACT);
+
 int blurQuantize(cv::Mat &src, cv::Mat &dst, int levels);
 
-int cartoon(cv::Mat &src, cv::Mat &dst, int levels, int magThreshold);
+int cartoon(cv::Mat &src, cv::Mat &dst, int levels, int magThreshold, MagnitudeMode mode = MAGNITUDE_EXACT);
 
 int negative(cv::Mat &src, cv::Mat &dst);
 
 int sepia(cv::Mat &src, cv::Mat &dst);
 
+// the original double implementation of sepia, kept as the reference for the fixed-point colour matrix
+int sepia_reference(cv::Mat &src, cv::Mat &dst);
+
+// the 3x3 emboss kernel on the green channel, which is what greyscale() puts in every channel, written to all three;
+// the border pixels are filtered with the edge pixels repeated beyond the frame
 int emboss(cv::Mat &src, cv::Mat &dst);
+
+// the original double implementation of emboss on a greyscale copy, kept as the reference for the fused kernel; it
+// leaves the border pixels of dst as they were
+int emboss_reference(cv::Mat &src, cv::Mat &dst);
 #endif //PROJ1__FILTERS_H_
@@ -0,0 +1,117 @@
+#include <opencv2/opencv.hpp>
+#include "color_matrix.h"
+#include "magnitude.h"
+#include "point_lut.h"
+#include <string>
+#include <vector>
+
+#ifndef PROJ1_INCLUDE_FILTER_GRAPH_H_
+#define PROJ1_INCLUDE_FILTER_GRAPH_H_
+
+enum StageType {
+  // point-wise stages, each output pixel only depends on the same input pixel
+  STAGE_GREYSCALE = 0,
+  STAGE_NEGATIVE = 1,
+  STAGE_SEPIA = 2,
+  STAGE_CONVERT = 3,
+  STAGE_QUANTIZE = 4,
+  // stencil stages, each output pixel depends on a neighbourhood of input pixels
+  STAGE_BLUR = 5,
+  STAGE_SOBEL_X = 6,
+  STAGE_SOBEL_Y = 7,
+  STAGE_MAGNITUDE = 8,
+  STAGE_EMBOSS = 9,
+};
+
+// one stage of a FilterGraph, alpha and beta are only used by STAGE_CONVERT, levels by STAGE_QUANTIZE and
+// magnitude_mode by STAGE_MAGNITUDE
+struct GraphStage {
+  StageType type;
+  double alpha = 1, beta = 0;
+  int levels = 1;
+  MagnitudeMode magnitude_mode = MAGNITUDE_EXACT;
+  // what the greyscale and sepia stages run
+  ColorMatrix matrix;
+  // what the negative, convert and quantize stages run, a run of them is folded into the table of the first one
+  PointLut lut;
+};
+
+/**
+ * An ordered chain of the filters of filter.h, from and to CV_8UC3 frames, e.g. blur -> sepia -> emboss. Every stage
+ * gives the same pixels as the filter it stands for: greyscale(), negative(), sepia(), convertTo() (STAGE_CONVERT),
+ * the quantization of blurQuantize() (STAGE_QUANTIZE), blur5x5(), sobelX3x3() or sobelY3x3() followed by transform(),
+ * both sobels followed by magnitude(), and emboss(). The only difference is that the blur and sobel stages keep the
+ * input value on the border pixels they do not filter, where the separate filters leave some of them as they were in
+ * dst; emboss filters its borders in both.
+ *
+ * The chain runs without full-frame intermediates. Each stencil stage starts a pass and the point-wise stages after
+ * it are applied to each of its output rows while the row is still in L1, so they cost no memory traffic of their
+ * own, and a run of negative, convert and quantize stages collapses into a single table lookup. The passes run strip
+ * by strip, each strip keeping a few rows of every intermediate, halo rows included, small enough for the L2 cache.
+ */
+class FilterGraph {
+ public:
+  /**
+   * Append a stage without parameters
+   * @param type any stage but STAGE_CONVERT and STAGE_QUANTIZE
+   * @return this graph
+   */
+  FilterGraph &add(StageType type);
+
+  /**
+   * Append the point-wise dst = saturate(alpha * src + beta), the contrast and brightness modes of video_display
+   * @return this graph
+   */
+  FilterGraph &add_convert(double alpha, double beta);
+
+  /**
+   * Append the quantization of blurQuantize() without its blur
+   * @param levels the number of levels per channel
+   * @return this graph
+   */
+  FilterGraph &add_quantize(int levels);
+
+  /**
+   * Append both sobels followed by magnitude()
+   * @param mode how the magnitude is computed, see magnitude.h
+   * @return this graph
+   */
+  FilterGraph &add_magnitude(MagnitudeMode mode);
+
+  /**
+   * Replace the chain with one described as comma separated stages, e.g. "blur,sepia,emboss". The stages are
+   * greyscale, negative, sepia, contrast:<alpha>, brightness:<beta>, quantize[:<levels>], blur, sobel_x, sobel_y,
+   * magnitude[:exact|l1|maxmin] and emboss.
+   * @param chain the description
+   * @return 0 if success, -1 if a stage is unknown (the graph is left empty)
+   */
+  int parse(const std::string &chain);
+
+  /**
+   * Remove every stage
+   */
+  void clear();
+
+  /**
+   * @return true if there is no stage, apply() then copies the frame
+   */
+  bool empty() const;
+
+  /**
+   * @return how many pixels away from an output pixel the chain reads, the sum of the radii of its stencil stages
+   */
+  int halo() const;
+
+  /**
+   * Run the chain
+   * @param src a CV_8UC3 frame
+   * @param dst the result, a CV_8UC3 frame of the same size, may be src itself
+   * @return 0 if success
+   */
+  int apply(cv::Mat &src, cv::Mat &dst) const;
+
+ private:
+  std::vector<GraphStage> stages;
+};
+
+#endif //PROJ1_INCLUDE_FILTER_GRAPH_H_
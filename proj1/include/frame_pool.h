@@ -0,0 +1,59 @@
+#include <opencv2/opencv.hpp>
+#include <vector>
+
+#ifndef PROJ1_INCLUDE_FRAME_POOL_H_
+#define PROJ1_INCLUDE_FRAME_POOL_H_
+
+/**
+ * A fixed set of frame-sized buffers allocated up front. Effects take their scratch frames from the pool instead of
+ * declaring new cv::Mat objects, so a running video loop does not touch the heap. Handed out buffers are shallow
+ * cv::Mat headers onto the pooled memory; release_all() makes them all available again.
+ */
+class FramePool {
+ public:
+  /**
+   * @param types the type of every buffer to keep, one entry per buffer, e.g. {CV_16SC3, CV_16SC3, CV_8UC1}
+   */
+  explicit FramePool(const std::vector<int> &types);
+
+  /**
+   * (Re)allocate every buffer for frames of the given size, does nothing if the size did not change
+   * @param size the frame size
+   */
+  void reserve(cv::Size size);
+
+  /**
+   * Hand out a free buffer of the given type. If all of them are in use a new buffer is allocated and kept, which is
+   * counted by grow_count() since it means the pool was sized too small.
+   * @param type the OpenCV type of the buffer
+   * @return a header sharing the pooled buffer
+   */
+  cv::Mat acquire(int type);
+
+  /**
+   * acquire() for an effect running on a region of the frame: a header onto the top left corner of a free buffer
+   * @param type the OpenCV type of the buffer
+   * @param size the size of the region, at most the size given to reserve()
+   * @return a header sharing the pooled buffer
+   */
+  cv::Mat acquire(int type, cv::Size size);
+
+  /**
+   * Give every buffer back to the pool, call it once per frame
+   */
+  void release_all();
+
+  /**
+   * @return the number of buffers allocated by acquire() because the pool had run out
+   */
+  int grow_count() const;
+
+ private:
+  cv::Size frame_size;
+  std::vector<int> buffer_types;
+  std::vector<cv::Mat> buffers;
+  std::vector<char> in_use;
+  int grown;
+};
+
+#endif //PROJ1_INCLUDE_FRAME_POOL_H_
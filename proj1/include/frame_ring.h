@@ -0,0 +1,83 @@
+#include <opencv2/opencv.hpp>
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#ifndef PROJ1_INCLUDE_FRAME_RING_H_
+#define PROJ1_INCLUDE_FRAME_RING_H_
+
+/**
+ * A frame travelling through the video pipeline, with the tick counts (cv::getTickCount()) of the stages it went
+ * through so the display can tell how old it is
+ */
+struct Frame {
+  cv::Mat image;
+  long index;
+  int64 captured, processed;
+};
+
+/**
+ * A bounded queue of frames between two threads, one producing and one consuming. The frame buffers belong to the
+ * ring and only their indices move through it, over lock free index queues, so passing a frame never copies pixels,
+ * allocates or takes a lock. When the queue is full the producer drops the oldest queued frame, so a slow consumer
+ * always gets the freshest frames and never holds the producer up.
+ */
+class FrameRing {
+ public:
+  /**
+   * @param capacity how many frames can wait in the queue, 1 always hands the consumer the newest frame
+   */
+  explicit FrameRing(int capacity);
+
+  /**
+   * Producer side: the buffer to fill next, it belongs to the producer until push()
+   * @return the frame to fill
+   */
+  Frame &producer_frame();
+
+  /**
+   * Producer side: check before push() whether it would drop a frame, for producers that would rather wait
+   * @return true if the queue is full
+   */
+  bool full() const;
+
+  /**
+   * Producer side: queue the filled producer_frame(), dropping the oldest queued frame if the queue is full
+   */
+  void push();
+
+  /**
+   * Consumer side: take the oldest queued frame and hand back the one returned by the previous pop(). The returned
+   * frame stays valid until the next pop() that returns a frame, so the consumer can keep showing it meanwhile.
+   * @return the frame, or nullptr if the queue is empty
+   */
+  Frame *pop();
+
+  /**
+   * @return the number of frames dropped so far because the consumer fell behind
+   */
+  long dropped() const;
+
+ private:
+  // a queue of buffer indices with a single pushing thread, pop() is safe from both ends
+  class IndexQueue {
+   public:
+    explicit IndexQueue(int capacity);
+    bool push(int index);
+    bool pop(int &index);
+    bool full() const;
+
+   private:
+    std::unique_ptr<std::atomic<int>[]> slots;
+    unsigned long long capacity;
+    std::atomic<unsigned long long> head, tail;
+  };
+
+  std::vector<Frame> frames;
+  // filled frames on their way to the consumer, and used ones on their way back to the producer
+  IndexQueue queued, free_frames;
+  int producer_index, consumer_index;
+  std::atomic<long> drop_count;
+};
+
+#endif //PROJ1_INCLUDE_FRAME_RING_H_
@@ -0,0 +1,31 @@
+#ifndef PROJ1_INCLUDE_MAGNITUDE_H_
+#define PROJ1_INCLUDE_MAGNITUDE_H_
+
+/*
+ * How magnitude(), sobel_magnitude() and cartoon() combine the two sobel gradients of an element. Every mode keeps the
+ * low 8 bits of its result, like magnitude() always did, so the values above 255 wrap. The modes are meant for the
+ * gradients of the sobel filters, within [-255, 255].
+ */
+enum MagnitudeMode {
+  // sqrt(gx * gx + gy * gy) in float, truncated
+  MAGNITUDE_EXACT = 0,
+  // |gx| + |gy|, never below the exact value and up to 41% above it
+  MAGNITUDE_L1 = 1,
+  // (123 * max(|gx|, |gy|) + 51 * min(|gx|, |gy|)) / 128, the alpha max plus beta min estimate, within 4% of the
+  // exact value before both are truncated
+  MAGNITUDE_MAX_MIN = 2,
+};
+
+/**
+ * @return "exact", "l1" or "maxmin"
+ */
+const char *magnitude_mode_name(MagnitudeMode mode);
+
+/**
+ * @param name one of the names of magnitude_mode_name()
+ * @param mode set to the mode called name
+ * @return 0 if success, -1 if there is no such mode (mode is left as it was)
+ */
+int parse_magnitude_mode(const char *name, MagnitudeMode &mode);
+
+#endif //PROJ1_INCLUDE_MAGNITUDE_H_
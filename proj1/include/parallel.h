@@ -0,0 +1,46 @@
+#ifndef PROJ1_INCLUDE_PARALLEL_H_
+#define PROJ1_INCLUDE_PARALLEL_H_
+
+// the smallest strip of rows handed to a worker thread, what the filters give parallel_for_rows() as min_strip_rows
+#define MIN_STRIP_ROWS 16
+
+/**
+ * Set the number of threads the filters run on, the calling thread included. The worker threads are created here and
+ * then kept alive, so running a filter never starts a thread.
+ * @param threads the number of threads, 0 for one per hardware thread
+ */
+void set_num_threads(int threads);
+
+/**
+ * @return the number of threads the filters run on
+ */
+int get_num_threads();
+
+/**
+ * Split the rows [0, rows) into horizontal strips and run body(context, begin, end) on every strip, spread over the
+ * worker pool and the calling thread. Returns when all strips are done. The strips never overlap, so a body that only
+ * writes its own rows gives the same result whatever the number of threads. Stencil filters read the halo rows above
+ * and below their strip from the source themselves. If the pool is already busy (a filter called from another filter
+ * or from a second thread), the strips run one after another on the calling thread.
+ * @param rows the number of rows
+ * @param min_strip_rows the smallest strip worth handing to a thread, use rows to force a single strip
+ * @param body the function computing the rows [begin, end)
+ * @param context passed through to body
+ */
+void parallel_for_rows(int rows, int min_strip_rows, void (*body)(void *context, int begin, int end), void *context);
+
+/**
+ * Same as above for any callable taking (begin, end), usually a lambda. Unlike std::function this never allocates, so
+ * the filters stay allocation free per frame.
+ */
+template<typename Body>
+void parallel_for_rows(int rows, int min_strip_rows, const Body &body) {
+  struct Trampoline {
+    static void call(void *context, int begin, int end) {
+      (*static_cast<const Body *>(context))(begin, end);
+    }
+  };
+  parallel_for_rows(rows, min_strip_rows, &Trampoline::call, const_cast<Body *>(&body));
+}
+
+#endif //PROJ1_INCLUDE_PARALLEL_H_
@@ -0,0 +1,58 @@
+#include <opencv2/opencv.hpp>
+
+#ifndef PROJ1_INCLUDE_PLANAR_H_
+#define PROJ1_INCLUDE_PLANAR_H_
+
+/**
+ * A frame stored as three single-channel planes, B, G and R, instead of interleaved BGR pixels. On a plane the
+ * neighbour of a pixel is the next element and every lane of a vector holds the same channel, so the kernels need no
+ * stride of 3 and no per-channel bookkeeping. A pipeline converts once on the way in (to_planar) and once on the way
+ * out (to_interleaved); filter_benchmark times both layouts and the conversions.
+ */
+struct PlanarFrame {
+  cv::Mat planes[3];
+
+  /**
+   * (Re)allocate the three planes, does nothing if they already have this size and type
+   * @param rows the frame height
+   * @param cols the frame width
+   * @param type CV_8UC1 or CV_16SC1
+   */
+  void create(int rows, int cols, int type);
+
+  int rows() const;
+
+  int cols() const;
+};
+
+/**
+ * Split a frame into its planes
+ * @param src a CV_8UC3 frame
+ * @param dst three CV_8UC1 planes of the same size
+ * @return 0 if success
+ */
+int to_planar(cv::Mat &src, PlanarFrame &dst);
+
+/**
+ * Interleave planes back into a frame
+ * @param src three CV_8UC1 or CV_16SC1 planes
+ * @param dst a CV_8UC3 or CV_16SC3 frame of the same size
+ * @return 0 if success
+ */
+int to_interleaved(PlanarFrame &src, cv::Mat &dst);
+
+// the filters of filter.h plane by plane, their to_interleaved() result is exactly the one of the interleaved filter
+int blur5x5_planar(PlanarFrame &src, PlanarFrame &dst);
+
+// CV_16SC1 planes out, like the CV_16SC3 of sobelX3x3
+int sobelX3x3_planar(PlanarFrame &src, PlanarFrame &dst);
+
+int sobelY3x3_planar(PlanarFrame &src, PlanarFrame &dst);
+
+int magnitude_planar(PlanarFrame &sx, PlanarFrame &sy, PlanarFrame &dst);
+
+// emboss reads only the green plane (greyscale() copies green) and writes the same result to all three, the border
+// pixels filtered with the edge pixels repeated like emboss()
+int emboss_planar(PlanarFrame &src, PlanarFrame &dst);
+
+#endif //PROJ1_INCLUDE_PLANAR_H_
@@ -0,0 +1,71 @@
+#include <opencv2/opencv.hpp>
+
+#ifndef PROJ1_INCLUDE_POINT_LUT_H_
+#define PROJ1_INCLUDE_POINT_LUT_H_
+
+/**
+ * A per-channel point operation as a 256-entry table, dst = table[src] on every element of a frame. The table is
+ * filled once when the operation is built, so the per-pixel work is a lookup whatever the operation costs, and
+ * operations chained with then() collapse into a single table. The lookups run on the row kernels of the current simd
+ * level: 16-entry byte shuffles on AVX2 and table instructions on 64-bit NEON, plain loads otherwise.
+ *
+ * negative(), the quantization of blurQuantize() and cartoon(), and the contrast and brightness modes of video_display
+ * are point tables.
+ */
+class PointLut {
+ public:
+  /**
+   * The identity
+   */
+  PointLut();
+
+  /**
+   * @return 255 - v
+   */
+  static PointLut negative();
+
+  /**
+   * @return saturate(alpha * v + beta), exactly what cv::Mat::convertTo(dst, -1, alpha, beta) gives on 8-bit frames
+   */
+  static PointLut convert(double alpha, double beta);
+
+  /**
+   * @param levels the number of levels per channel
+   * @return v / b * b with b = 255 / levels, the quantization of blurQuantize()
+   */
+  static PointLut quantize(int levels);
+
+  /**
+   * @param next the operation to run on the result of this one
+   * @return the single table doing this operation and then next
+   */
+  PointLut then(const PointLut &next) const;
+
+  /**
+   * @return the value v maps to
+   */
+  uchar operator[](uchar v) const {
+    return table[v];
+  }
+
+  /**
+   * Map every element of a frame
+   * @param src a CV_8UC3 frame
+   * @param dst the result, a CV_8UC3 frame of the same size, may be src itself
+   * @return 0 if success
+   */
+  int apply(cv::Mat &src, cv::Mat &dst) const;
+
+  /**
+   * Map the elements of one row
+   * @param src the row
+   * @param dst the result, may be src itself
+   * @param width the number of elements, 3 per BGR pixel
+   */
+  void apply_row(const uchar *src, uchar *dst, int width) const;
+
+ private:
+  uchar table[256];
+};
+
+#endif //PROJ1_INCLUDE_POINT_LUT_H_
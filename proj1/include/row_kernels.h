@@ -0,0 +1,771 @@
+#include "magnitude.h"
+#include "simd.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+#ifndef PROJ1_INCLUDE_ROW_KERNELS_H_
+#define PROJ1_INCLUDE_ROW_KERNELS_H_
+
+/*
+ * Row and column passes of blur5x5, sobelX3x3 and sobelY3x3 on interleaved BGR rows. They work on bytes, so a pixel
+ * neighbour is 3 elements away and the three channels fall out of the same lanes. The horizontal passes fill the
+ * elements [begin, end) of a row and read 6 (blur) or 3 (sobel) elements beyond both ends, the vertical passes combine
+ * the same element of several rows. The _plane versions of the horizontal passes do the same on one plane of a
+ * PlanarFrame (planar.h), where a pixel neighbour is the next element; the vertical passes do not care.
+ */
+/*
+ * A 3x3 colour matrix plus offset in 16-bit fixed point, built by ColorMatrix (color_matrix.h). taps[c][2 + k - c] is
+ * the weight of channel k in output channel c, so each output element reads the interleaved elements up to 2 away on
+ * either side and every element runs the same arithmetic. A tap multiplies (v << 7) and keeps the high 16 bits of
+ * the product, so the sum of the taps plus offset is the result scaled by 2^shift.
+ */
+struct ColorMatrixKernel {
+  short taps[3][5];
+  short offset[3];
+  int shift;
+  // only taps[c][2] is non-zero, every output channel only depends on the same input channel
+  bool diagonal;
+};
+
+struct RowKernels {
+  // (1 2 4 2 1) / 10 along the row
+  void (*blur_h)(const uchar *src, uchar *dst, int begin, int end);
+  // (1 2 4 2 1) / 10 across the rows
+  void (*blur_v)(const uchar *const rows[5], uchar *dst, int width);
+  // (1 0 -1) along the row, the horizontal pass of sobelX3x3
+  void (*diff_h)(const uchar *src, short *dst, int begin, int end);
+  // (1 2 1) / 4 along the row, the horizontal pass of sobelY3x3
+  void (*smooth_h)(const uchar *src, short *dst, int begin, int end);
+  // (1 2 1) / 4 across the rows, the vertical pass of sobelX3x3
+  void (*smooth_v)(const short *const rows[3], short *dst, int width);
+  // (1 0 -1) across the rows, the vertical pass of sobelY3x3
+  void (*diff_v)(const short *const rows[3], short *dst, int width);
+  // dst = saturate(matrix * src + offset) for every pixel of a BGR row, src may be dst
+  void (*color_matrix)(const uchar *src, uchar *dst, int cols, const ColorMatrixKernel &matrix);
+  // dst[x] = the magnitude of the gradient (sx[x], sy[x]) in the given mode, its low 8 bits
+  void (*magnitude)(const short *sx, const short *sy, uchar *dst, int width, MagnitudeMode mode);
+  // dst[x] = table[src[x]] for width elements, src may be dst
+  void (*lut)(const uchar *src, uchar *dst, int width, const uchar table[256]);
+  // blur_h, diff_h and smooth_h on a single-channel plane
+  void (*blur_h_plane)(const uchar *src, uchar *dst, int begin, int end);
+  void (*diff_h_plane)(const uchar *src, short *dst, int begin, int end);
+  void (*smooth_h_plane)(const uchar *src, short *dst, int begin, int end);
+  // the 3x3 emboss kernel of emboss() on the elements [begin, end) of the middle one of three plane rows, saturated
+  void (*emboss_plane)(const uchar *const rows[3], uchar *dst, int begin, int end);
+  // split cols BGR pixels into the three planes B, G and R, and back
+  void (*deinterleave)(const uchar *src, uchar *const planes[3], int cols);
+  void (*interleave)(const uchar *const planes[3], uchar *dst, int cols);
+  // dst[x] = (hi[x] - lo[x]) * scale rounded, a box along the row out of its prefix sums
+  void (*box_h)(const int *hi, const int *lo, uchar *dst, int width, float scale);
+  // dst[x] = sum[x] * scale rounded, then sum[x] += add[x] - sub[x], one row of a box running down the columns
+  void (*box_v)(const uchar *add, const uchar *sub, int *sum, uchar *dst, int width, float scale);
+  // the sum of |a[x] - b[x]| over width bytes, how much a tile of a frame changed (dirty_tiles.h)
+  int (*sad)(const uchar *a, const uchar *b, int width);
+};
+
+/**
+ * @return the row kernels for the current simd level, see set_simd_level()
+ */
+const RowKernels &row_kernels();
+
+/**
+ * Widen width bytes to shorts
+ */
+void widen_row(const uchar *src, short *dst, int width);
+
+/**
+ * Horizontal pass of blur5x5 over a whole BGR row, the 2 pixels on both ends keep the source value
+ * @param k the row kernels to use
+ * @param src the source row
+ * @param dst the filtered row
+ * @param cols the number of pixels in the row
+ */
+void blur_row(const RowKernels &k, const uchar *src, uchar *dst, int cols);
+
+/**
+ * Horizontal pass of sobelX3x3 (y_direction false) or sobelY3x3 over a whole BGR row, the end pixels keep the source
+ * value
+ * @param k the row kernels to use
+ * @param src the source row
+ * @param dst the filtered row
+ * @param cols the number of pixels in the row
+ * @param y_direction false for the (1 0 -1) pass of sobelX3x3, true for the (1 2 1) / 4 pass of sobelY3x3
+ */
+void sobel_row(const RowKernels &k, const uchar *src, short *dst, int cols, bool y_direction);
+
+/**
+ * blur_row() on a row of cols pixels of one plane
+ */
+void blur_plane_row(const RowKernels &k, const uchar *src, uchar *dst, int cols);
+
+/**
+ * sobel_row() on a row of cols pixels of one plane
+ */
+void sobel_plane_row(const RowKernels &k, const uchar *src, short *dst, int cols, bool y_direction);
+
+namespace simd {
+namespace {
+
+// stride is the distance in elements between neighbouring pixels, 3 on BGR rows and 1 on planes
+template<class V, int stride = 3>
+void blur_h(const uchar *src, uchar *dst, int begin, int end);
+template<class V>
+void blur_v(const uchar *const rows[5], uchar *dst, int width, int begin = 0);
+template<class V, int stride = 3>
+void diff_h(const uchar *src, short *dst, int begin, int end);
+template<class V, int stride = 3>
+void smooth_h(const uchar *src, short *dst, int begin, int end);
+template<class V>
+void smooth_v(const short *const rows[3], short *dst, int width, int begin = 0);
+template<class V>
+void diff_v(const short *const rows[3], short *dst, int width, int begin = 0);
+
+// every vector kernel finishes the elements that do not fill a whole vector with the scalar version of itself
+template<class V, int stride>
+void blur_h(const uchar *src, uchar *dst, int begin, int end) {
+  int x = begin;
+  for (; x + V::lanes <= end; x += V::lanes) {
+    typename V::vec outer = V::add(V::load_u8(src + x - 2 * stride), V::load_u8(src + x + 2 * stride));
+    typename V::vec inner = V::add(V::load_u8(src + x - stride), V::load_u8(src + x + stride));
+    typename V::vec sum = V::add(V::add(outer, V::template shl<1>(inner)), V::template shl<2>(V::load_u8(src + x)));
+    V::store_u8(dst + x, V::div10(sum));
+  }
+  if (V::lanes > 1) {
+    blur_h<scalar, stride>(src, dst, x, end);
+  }
+}
+
+template<class V>
+void blur_v(const uchar *const rows[5], uchar *dst, int width, int begin) {
+  int x = begin;
+  for (; x + V::lanes <= width; x += V::lanes) {
+    typename V::vec outer = V::add(V::load_u8(rows[0] + x), V::load_u8(rows[4] + x));
+    typename V::vec inner = V::add(V::load_u8(rows[1] + x), V::load_u8(rows[3] + x));
+    typename V::vec sum = V::add(V::add(outer, V::template shl<1>(inner)), V::template shl<2>(V::load_u8(rows[2] + x)));
+    V::store_u8(dst + x, V::div10(sum));
+  }
+  if (V::lanes > 1) {
+    blur_v<scalar>(rows, dst, width, x);
+  }
+}
+
+template<class V, int stride>
+void diff_h(const uchar *src, short *dst, int begin, int end) {
+  int x = begin;
+  for (; x + V::lanes <= end; x += V::lanes) {
+    V::store(dst + x, V::sub(V::load_u8(src + x - stride), V::load_u8(src + x + stride)));
+  }
+  if (V::lanes > 1) {
+    diff_h<scalar, stride>(src, dst, x, end);
+  }
+}
+
+template<class V, int stride>
+void smooth_h(const uchar *src, short *dst, int begin, int end) {
+  int x = begin;
+  for (; x + V::lanes <= end; x += V::lanes) {
+    typename V::vec outer = V::add(V::load_u8(src + x - stride), V::load_u8(src + x + stride));
+    typename V::vec sum = V::add(outer, V::template shl<1>(V::load_u8(src + x)));
+    // never negative, so a shift is the truncating division
+    V::store(dst + x, V::template shr<2>(sum));
+  }
+  if (V::lanes > 1) {
+    smooth_h<scalar, stride>(src, dst, x, end);
+  }
+}
+
+// the rows above, at and below the output row, each read one element beyond both ends of [begin, end)
+template<class V>
+void emboss_plane(const uchar *const rows[3], uchar *dst, int begin, int end) {
+  const uchar *above = rows[0], *middle = rows[1], *below = rows[2];
+  int x = begin;
+  if (V::lanes > 1) {
+    for (; x + V::lanes <= end; x += V::lanes) {
+      typename V::vec plus = V::add(V::add(V::load_u8(middle + x), V::load_u8(middle + x + 1)),
+                                    V::add(V::load_u8(below + x), V::template shl<1>(V::load_u8(below + x + 1))));
+      typename V::vec minus = V::add(V::add(V::template shl<1>(V::load_u8(above + x - 1)), V::load_u8(above + x)),
+                                     V::load_u8(middle + x - 1));
+      // the store saturates to [0, 255]
+      V::store_u8(dst + x, V::sub(plus, minus));
+    }
+  }
+  for (; x < end; x++) {
+    int sum = middle[x] + middle[x + 1] + below[x] + 2 * below[x + 1] - 2 * above[x - 1] - above[x] - middle[x - 1];
+    dst[x] = (uchar) std::min(std::max(sum, 0), 255);
+  }
+}
+
+// one element at a time, see the SSSE3 shuffles of the AVX2 specializations
+template<class V>
+void deinterleave_row(const uchar *src, uchar *const planes[3], int cols) {
+  uchar *b = planes[0], *g = planes[1], *r = planes[2];
+  for (int x = 0; x < cols; x++, src += 3) {
+    b[x] = src[0];
+    g[x] = src[1];
+    r[x] = src[2];
+  }
+}
+
+template<class V>
+void interleave_row(const uchar *const planes[3], uchar *dst, int cols) {
+  const uchar *b = planes[0], *g = planes[1], *r = planes[2];
+  for (int x = 0; x < cols; x++, dst += 3) {
+    dst[0] = b[x];
+    dst[1] = g[x];
+    dst[2] = r[x];
+  }
+}
+
+#ifdef PROJ1_HAVE_AVX2
+/*
+ * 16 pixels per iteration, as three 16-byte vectors: every plane gathers its bytes out of the three with pshufb and
+ * ORs them, a mask byte of -1 giving 0. AVX2 shuffles stay within 128-bit lanes, so the 128-bit forms are as wide as
+ * this gets.
+ */
+template<>
+inline void deinterleave_row<avx2>(const uchar *src, uchar *const planes[3], int cols) {
+  // shuffle[c][v] picks the bytes of channel c out of the vector v of the 48 loaded bytes
+  __m128i shuffle[3][3];
+  for (int c = 0; c < 3; c++) {
+    for (int v = 0; v < 3; v++) {
+      char mask[16];
+      for (int i = 0; i < 16; i++) {
+        int element = 3 * i + c - 16 * v;
+        mask[i] = (char) (element >= 0 && element < 16 ? element : -1);
+      }
+      shuffle[c][v] = _mm_loadu_si128((const __m128i *) mask);
+    }
+  }
+  int x = 0;
+  for (; x + 16 <= cols; x += 16) {
+    const uchar *s = src + 3 * x;
+    __m128i in[3] = {_mm_loadu_si128((const __m128i *) s), _mm_loadu_si128((const __m128i *) (s + 16)),
+                     _mm_loadu_si128((const __m128i *) (s + 32))};
+    for (int c = 0; c < 3; c++) {
+      __m128i plane = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(in[0], shuffle[c][0]),
+                                                _mm_shuffle_epi8(in[1], shuffle[c][1])),
+                                   _mm_shuffle_epi8(in[2], shuffle[c][2]));
+      _mm_storeu_si128((__m128i *) (planes[c] + x), plane);
+    }
+  }
+  uchar *const rest[3] = {planes[0] + x, planes[1] + x, planes[2] + x};
+  deinterleave_row<scalar>(src + 3 * x, rest, cols - x);
+}
+
+template<>
+inline void interleave_row<avx2>(const uchar *const planes[3], uchar *dst, int cols) {
+  // shuffle[v][c] places the bytes of channel c into the vector v of the 48 stored bytes
+  __m128i shuffle[3][3];
+  for (int v = 0; v < 3; v++) {
+    for (int c = 0; c < 3; c++) {
+      char mask[16];
+      for (int i = 0; i < 16; i++) {
+        int element = 16 * v + i;
+        mask[i] = (char) (element % 3 == c ? element / 3 : -1);
+      }
+      shuffle[v][c] = _mm_loadu_si128((const __m128i *) mask);
+    }
+  }
+  int x = 0;
+  for (; x + 16 <= cols; x += 16) {
+    __m128i in[3] = {_mm_loadu_si128((const __m128i *) (planes[0] + x)),
+                     _mm_loadu_si128((const __m128i *) (planes[1] + x)),
+                     _mm_loadu_si128((const __m128i *) (planes[2] + x))};
+    uchar *d = dst + 3 * x;
+    for (int v = 0; v < 3; v++) {
+      __m128i out = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(in[0], shuffle[v][0]),
+                                              _mm_shuffle_epi8(in[1], shuffle[v][1])),
+                                 _mm_shuffle_epi8(in[2], shuffle[v][2]));
+      _mm_storeu_si128((__m128i *) (d + 16 * v), out);
+    }
+  }
+  const uchar *const rest[3] = {planes[0] + x, planes[1] + x, planes[2] + x};
+  interleave_row<scalar>(rest, dst + 3 * x, cols - x);
+}
+#endif
+
+template<class V>
+void smooth_v(const short *const rows[3], short *dst, int width, int begin) {
+  int x = begin;
+  for (; x + V::lanes <= width; x += V::lanes) {
+    typename V::vec outer = V::add(V::load(rows[0] + x), V::load(rows[2] + x));
+    V::store(dst + x, V::div4(V::add(outer, V::template shl<1>(V::load(rows[1] + x)))));
+  }
+  if (V::lanes > 1) {
+    smooth_v<scalar>(rows, dst, width, x);
+  }
+}
+
+template<class V>
+void diff_v(const short *const rows[3], short *dst, int width, int begin) {
+  int x = begin;
+  for (; x + V::lanes <= width; x += V::lanes) {
+    V::store(dst + x, V::sub(V::load(rows[0] + x), V::load(rows[2] + x)));
+  }
+  if (V::lanes > 1) {
+    diff_v<scalar>(rows, dst, width, x);
+  }
+}
+
+// one pixel of the colour matrix, the same arithmetic as the vector lanes, all three channels are read first
+inline void color_matrix_pixel(const uchar *src, uchar *dst, const ColorMatrixKernel &m) {
+  int out[3];
+  for (int c = 0; c < 3; c++) {
+    int sum = m.offset[c];
+    for (int k = 0; k < 3; k++) {
+      sum += (src[k] * 128 * m.taps[c][2 + k - c]) >> 16;
+    }
+    out[c] = sum >> m.shift;
+  }
+  for (int c = 0; c < 3; c++) {
+    dst[c] = (uchar) std::min(std::max(out[c], 0), 255);
+  }
+}
+
+/*
+ * The colour matrix on the elements [x, ...) of a row, x being the first element of a pixel. An iteration computes 3
+ * vectors, which is a whole number of pixels, and stores them only after all their loads. The taps that reach into a
+ * neighbouring pixel always have a zero weight, so a row transformed in place gives the same result.
+ * @return the element the vectors stopped at, again the first element of a pixel
+ */
+template<class V, bool diagonal>
+int color_matrix_h(const uchar *src, uchar *dst, int width, const ColorMatrixKernel &m, int x) {
+  // the lane l of the vector v of an iteration holds the channel (v * lanes + l) % 3
+  short lane_taps[3][5][V::lanes], lane_offset[3][V::lanes];
+  for (int v = 0; v < 3; v++) {
+    for (int l = 0; l < V::lanes; l++) {
+      int c = (v * V::lanes + l) % 3;
+      for (int t = 0; t < 5; t++) {
+        lane_taps[v][t][l] = m.taps[c][t];
+      }
+      lane_offset[v][l] = m.offset[c];
+    }
+  }
+  typename V::vec taps[3][5], offset[3];
+  for (int v = 0; v < 3; v++) {
+    for (int t = 0; t < 5; t++) {
+      taps[v][t] = V::load(lane_taps[v][t]);
+    }
+    offset[v] = V::load(lane_offset[v]);
+  }
+  for (; x + 3 * V::lanes + 2 <= width; x += 3 * V::lanes) {
+    typename V::vec sum[3];
+    for (int v = 0; v < 3; v++) {
+      const uchar *s = src + x + v * V::lanes;
+      sum[v] = V::add(offset[v], V::mulhi(V::template shl<7>(V::load_u8(s)), taps[v][2]));
+      if (!diagonal) {
+        sum[v] = V::add(sum[v], V::mulhi(V::template shl<7>(V::load_u8(s - 2)), taps[v][0]));
+        sum[v] = V::add(sum[v], V::mulhi(V::template shl<7>(V::load_u8(s - 1)), taps[v][1]));
+        sum[v] = V::add(sum[v], V::mulhi(V::template shl<7>(V::load_u8(s + 1)), taps[v][3]));
+        sum[v] = V::add(sum[v], V::mulhi(V::template shl<7>(V::load_u8(s + 2)), taps[v][4]));
+      }
+    }
+    for (int v = 0; v < 3; v++) {
+      // the store saturates to [0, 255]
+      V::store_u8(dst + x + v * V::lanes, V::sra(sum[v], m.shift));
+    }
+  }
+  return x;
+}
+
+template<class V>
+void color_matrix_row(const uchar *src, uchar *dst, int cols, const ColorMatrixKernel &m) {
+  int width = cols * 3;
+  if (cols < 1) {
+    return;
+  }
+  // the first pixel on its own, the vectors read 2 elements before the one they start at
+  color_matrix_pixel(src, dst, m);
+  int x = 3;
+  if (V::lanes > 1) {
+    x = m.diagonal ? color_matrix_h<V, true>(src, dst, width, m, x) : color_matrix_h<V, false>(src, dst, width, m, x);
+  }
+  for (; x < width; x += 3) {
+    color_matrix_pixel(src + x, dst + x, m);
+  }
+}
+
+// one element of each magnitude mode, the vector versions give the same bytes
+inline uchar magnitude_exact(int gx, int gy) {
+  return (uchar) (int) std::sqrt((float) (gx * gx + gy * gy));
+}
+
+inline uchar magnitude_l1(int gx, int gy) {
+  return (uchar) (std::abs(gx) + std::abs(gy));
+}
+
+inline uchar magnitude_max_min(int gx, int gy) {
+  int a = std::abs(gx), b = std::abs(gy);
+  return (uchar) ((123 * std::max(a, b) + 51 * std::min(a, b)) >> 7);
+}
+
+template<class V>
+void magnitude_row(const short *sx, const short *sy, uchar *dst, int width, MagnitudeMode mode) {
+  switch (mode) {
+    case MAGNITUDE_L1:
+      for (int x = 0; x < width; x++) {
+        dst[x] = magnitude_l1(sx[x], sy[x]);
+      }
+      break;
+    case MAGNITUDE_MAX_MIN:
+      for (int x = 0; x < width; x++) {
+        dst[x] = magnitude_max_min(sx[x], sy[x]);
+      }
+      break;
+    default:
+      for (int x = 0; x < width; x++) {
+        dst[x] = magnitude_exact(sx[x], sy[x]);
+      }
+      break;
+  }
+}
+
+#ifdef PROJ1_HAVE_SSE2
+/*
+ * 8 magnitudes as 32-bit lanes in low (elements 0-3) and high (4-7), out of the gradients gx and gy. The exact mode
+ * squares and adds the pairs (gx, gy) with one pmaddwd and takes the float root, max-min weighs the pairs (max, min)
+ * the same way; all of them stay exact integers, so they match the scalar versions bit for bit.
+ */
+template<int mode>
+inline void magnitude_sse2(__m128i gx, __m128i gy, __m128i &low, __m128i &high) {
+  if (mode == MAGNITUDE_EXACT) {
+    __m128i pairs_low = _mm_unpacklo_epi16(gx, gy), pairs_high = _mm_unpackhi_epi16(gx, gy);
+    low = _mm_cvttps_epi32(_mm_sqrt_ps(_mm_cvtepi32_ps(_mm_madd_epi16(pairs_low, pairs_low))));
+    high = _mm_cvttps_epi32(_mm_sqrt_ps(_mm_cvtepi32_ps(_mm_madd_epi16(pairs_high, pairs_high))));
+    return;
+  }
+  __m128i a = _mm_max_epi16(gx, _mm_sub_epi16(_mm_setzero_si128(), gx));
+  __m128i b = _mm_max_epi16(gy, _mm_sub_epi16(_mm_setzero_si128(), gy));
+  if (mode == MAGNITUDE_L1) {
+    __m128i sum = _mm_add_epi16(a, b);
+    low = _mm_unpacklo_epi16(sum, _mm_setzero_si128());
+    high = _mm_unpackhi_epi16(sum, _mm_setzero_si128());
+    return;
+  }
+  __m128i larger = _mm_max_epi16(a, b), smaller = _mm_min_epi16(a, b);
+  const __m128i weights = _mm_set1_epi32((51 << 16) | 123);
+  low = _mm_srai_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(larger, smaller), weights), 7);
+  high = _mm_srai_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(larger, smaller), weights), 7);
+}
+
+template<int mode>
+inline void magnitude_row_sse2(const short *sx, const short *sy, uchar *dst, int width) {
+  const __m128i byte = _mm_set1_epi32(0xff);
+  int x = 0;
+  for (; x + 8 <= width; x += 8) {
+    __m128i low, high;
+    magnitude_sse2<mode>(_mm_loadu_si128((const __m128i *) (sx + x)), _mm_loadu_si128((const __m128i *) (sy + x)),
+                         low, high);
+    // the low 8 bits of every lane, then packed without saturating anything
+    __m128i words = _mm_packs_epi32(_mm_and_si128(low, byte), _mm_and_si128(high, byte));
+    _mm_storel_epi64((__m128i *) (dst + x), _mm_packus_epi16(words, words));
+  }
+  magnitude_row<scalar>(sx + x, sy + x, dst + x, width - x, (MagnitudeMode) mode);
+}
+
+template<>
+inline void magnitude_row<sse2>(const short *sx, const short *sy, uchar *dst, int width, MagnitudeMode mode) {
+  switch (mode) {
+    case MAGNITUDE_L1:magnitude_row_sse2<MAGNITUDE_L1>(sx, sy, dst, width);
+      break;
+    case MAGNITUDE_MAX_MIN:magnitude_row_sse2<MAGNITUDE_MAX_MIN>(sx, sy, dst, width);
+      break;
+    default:magnitude_row_sse2<MAGNITUDE_EXACT>(sx, sy, dst, width);
+      break;
+  }
+}
+#endif
+
+#ifdef PROJ1_HAVE_AVX2
+// magnitude_sse2() on 16 elements, low holding the elements 0-3 and 8-11 and high 4-7 and 12-15
+template<int mode>
+inline void magnitude_avx2(__m256i gx, __m256i gy, __m256i &low, __m256i &high) {
+  if (mode == MAGNITUDE_EXACT) {
+    __m256i pairs_low = _mm256_unpacklo_epi16(gx, gy), pairs_high = _mm256_unpackhi_epi16(gx, gy);
+    low = _mm256_cvttps_epi32(_mm256_sqrt_ps(_mm256_cvtepi32_ps(_mm256_madd_epi16(pairs_low, pairs_low))));
+    high = _mm256_cvttps_epi32(_mm256_sqrt_ps(_mm256_cvtepi32_ps(_mm256_madd_epi16(pairs_high, pairs_high))));
+    return;
+  }
+  __m256i a = _mm256_abs_epi16(gx), b = _mm256_abs_epi16(gy);
+  if (mode == MAGNITUDE_L1) {
+    __m256i sum = _mm256_add_epi16(a, b);
+    low = _mm256_unpacklo_epi16(sum, _mm256_setzero_si256());
+    high = _mm256_unpackhi_epi16(sum, _mm256_setzero_si256());
+    return;
+  }
+  __m256i larger = _mm256_max_epi16(a, b), smaller = _mm256_min_epi16(a, b);
+  const __m256i weights = _mm256_set1_epi32((51 << 16) | 123);
+  low = _mm256_srai_epi32(_mm256_madd_epi16(_mm256_unpacklo_epi16(larger, smaller), weights), 7);
+  high = _mm256_srai_epi32(_mm256_madd_epi16(_mm256_unpackhi_epi16(larger, smaller), weights), 7);
+}
+
+template<int mode>
+inline void magnitude_row_avx2(const short *sx, const short *sy, uchar *dst, int width) {
+  const __m256i byte = _mm256_set1_epi32(0xff);
+  int x = 0;
+  for (; x + 16 <= width; x += 16) {
+    __m256i low, high;
+    magnitude_avx2<mode>(_mm256_loadu_si256((const __m256i *) (sx + x)),
+                         _mm256_loadu_si256((const __m256i *) (sy + x)), low, high);
+    // packing undoes the lane split of the unpacks, the permute gathers the two 8-byte halves
+    __m256i words = _mm256_packs_epi32(_mm256_and_si256(low, byte), _mm256_and_si256(high, byte));
+    __m256i bytes = _mm256_permute4x64_epi64(_mm256_packus_epi16(words, words), 0xd8);
+    _mm_storeu_si128((__m128i *) (dst + x), _mm256_castsi256_si128(bytes));
+  }
+  magnitude_row<scalar>(sx + x, sy + x, dst + x, width - x, (MagnitudeMode) mode);
+}
+
+template<>
+inline void magnitude_row<avx2>(const short *sx, const short *sy, uchar *dst, int width, MagnitudeMode mode) {
+  switch (mode) {
+    case MAGNITUDE_L1:magnitude_row_avx2<MAGNITUDE_L1>(sx, sy, dst, width);
+      break;
+    case MAGNITUDE_MAX_MIN:magnitude_row_avx2<MAGNITUDE_MAX_MIN>(sx, sy, dst, width);
+      break;
+    default:magnitude_row_avx2<MAGNITUDE_EXACT>(sx, sy, dst, width);
+      break;
+  }
+}
+#endif
+
+// a table lookup per element, vectors only help where they can shuffle bytes, see the specializations below
+template<class V>
+void lut_row(const uchar *src, uchar *dst, int width, const uchar table[256]) {
+  for (int x = 0; x < width; x++) {
+    dst[x] = table[src[x]];
+  }
+}
+
+#ifdef PROJ1_HAVE_AVX2
+// the rows 2h and 2h + 1 of the table looked up, picked by bit 4 of the value (moved to the top of the byte by select)
+inline __m256i lut_pair(const __m256i rows[16], int h, __m256i low, __m256i select) {
+  return _mm256_blendv_epi8(_mm256_shuffle_epi8(rows[2 * h], low), _mm256_shuffle_epi8(rows[2 * h + 1], low), select);
+}
+
+/*
+ * The table as 16 rows of 16 entries: every row is looked up with a shuffle on the low nibble of the value, then a tree
+ * of blends on the bits 4 to 7 picks the right row. The tree is spelled out, a loop over the rows is not unrolled at
+ * -O2 and reloads every row from the stack.
+ */
+template<>
+void lut_row<avx2>(const uchar *src, uchar *dst, int width, const uchar table[256]) {
+  __m256i rows[16];
+  for (int h = 0; h < 16; h++) {
+    rows[h] = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *) (table + 16 * h)));
+  }
+  const __m256i nibble = _mm256_set1_epi8(0x0f);
+  int x = 0;
+  for (; x + 32 <= width; x += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i *) (src + x));
+    __m256i low = _mm256_and_si256(v, nibble);
+    // blendv only looks at the top bit of each byte, a 16-bit shift moves bit 4, 5 or 6 of every byte there
+    __m256i bit4 = _mm256_slli_epi16(v, 3), bit5 = _mm256_slli_epi16(v, 2), bit6 = _mm256_slli_epi16(v, 1);
+    __m256i q0 = _mm256_blendv_epi8(lut_pair(rows, 0, low, bit4), lut_pair(rows, 1, low, bit4), bit5);
+    __m256i q1 = _mm256_blendv_epi8(lut_pair(rows, 2, low, bit4), lut_pair(rows, 3, low, bit4), bit5);
+    __m256i q2 = _mm256_blendv_epi8(lut_pair(rows, 4, low, bit4), lut_pair(rows, 5, low, bit4), bit5);
+    __m256i q3 = _mm256_blendv_epi8(lut_pair(rows, 6, low, bit4), lut_pair(rows, 7, low, bit4), bit5);
+    __m256i result = _mm256_blendv_epi8(_mm256_blendv_epi8(q0, q1, bit6), _mm256_blendv_epi8(q2, q3, bit6), v);
+    _mm256_storeu_si256((__m256i *) (dst + x), result);
+  }
+  lut_row<scalar>(src + x, dst + x, width - x, table);
+}
+#endif
+
+#if defined(PROJ1_HAVE_NEON) && defined(__aarch64__)
+// four 64-entry table lookups, tbx leaves the bytes whose index is out of its range alone
+template<>
+void lut_row<neon>(const uchar *src, uchar *dst, int width, const uchar table[256]) {
+  uint8x16x4_t quarters[4];
+  for (int q = 0; q < 4; q++) {
+    for (int r = 0; r < 4; r++) {
+      quarters[q].val[r] = vld1q_u8(table + 64 * q + 16 * r);
+    }
+  }
+  const uint8x16_t sixty_four = vdupq_n_u8(64);
+  int x = 0;
+  for (; x + 16 <= width; x += 16) {
+    uint8x16_t idx = vld1q_u8(src + x);
+    uint8x16_t result = vqtbl4q_u8(quarters[0], idx);
+    idx = vsubq_u8(idx, sixty_four);
+    result = vqtbx4q_u8(result, quarters[1], idx);
+    idx = vsubq_u8(idx, sixty_four);
+    result = vqtbx4q_u8(result, quarters[2], idx);
+    idx = vsubq_u8(idx, sixty_four);
+    result = vqtbx4q_u8(result, quarters[3], idx);
+    vst1q_u8(dst + x, result);
+  }
+  lut_row<scalar>(src + x, dst + x, width - x, table);
+}
+#endif
+
+// the box sums are at most 255 times the box and the box is odd, so rounding the float product never goes wrong
+template<class V>
+void box_h_row(const int *hi, const int *lo, uchar *dst, int width, float scale) {
+  for (int x = 0; x < width; x++) {
+    dst[x] = (uchar) ((float) (hi[x] - lo[x]) * scale + 0.5f);
+  }
+}
+
+template<class V>
+void box_v_row(const uchar *add, const uchar *sub, int *sum, uchar *dst, int width, float scale) {
+  for (int x = 0; x < width; x++) {
+    dst[x] = (uchar) ((float) sum[x] * scale + 0.5f);
+    sum[x] += add[x] - sub[x];
+  }
+}
+
+#ifdef PROJ1_HAVE_SSE2
+// 8 box sums to bytes, rounded the same way as the scalar version (the sums are never negative)
+inline __m128i box_round_sse2(__m128i low, __m128i high, __m128 scale) {
+  const __m128 half = _mm_set1_ps(0.5f);
+  low = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(low), scale), half));
+  high = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(high), scale), half));
+  __m128i words = _mm_packs_epi32(low, high);
+  return _mm_packus_epi16(words, words);
+}
+
+template<>
+inline void box_h_row<sse2>(const int *hi, const int *lo, uchar *dst, int width, float scale) {
+  const __m128 factor = _mm_set1_ps(scale);
+  int x = 0;
+  for (; x + 8 <= width; x += 8) {
+    __m128i low = _mm_sub_epi32(_mm_loadu_si128((const __m128i *) (hi + x)), _mm_loadu_si128((const __m128i *) (lo + x)));
+    __m128i high = _mm_sub_epi32(_mm_loadu_si128((const __m128i *) (hi + x + 4)),
+                                 _mm_loadu_si128((const __m128i *) (lo + x + 4)));
+    _mm_storel_epi64((__m128i *) (dst + x), box_round_sse2(low, high, factor));
+  }
+  box_h_row<scalar>(hi + x, lo + x, dst + x, width - x, scale);
+}
+
+template<>
+inline void box_v_row<sse2>(const uchar *add, const uchar *sub, int *sum, uchar *dst, int width, float scale) {
+  const __m128 factor = _mm_set1_ps(scale);
+  const __m128i zero = _mm_setzero_si128();
+  int x = 0;
+  for (; x + 8 <= width; x += 8) {
+    __m128i low = _mm_loadu_si128((const __m128i *) (sum + x)), high = _mm_loadu_si128((const __m128i *) (sum + x + 4));
+    _mm_storel_epi64((__m128i *) (dst + x), box_round_sse2(low, high, factor));
+    // add - sub as 8 shorts, then widened to ints with their sign
+    __m128i delta = _mm_sub_epi16(_mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *) (add + x)), zero),
+                                  _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *) (sub + x)), zero));
+    __m128i sign = _mm_srai_epi16(delta, 15);
+    _mm_storeu_si128((__m128i *) (sum + x), _mm_add_epi32(low, _mm_unpacklo_epi16(delta, sign)));
+    _mm_storeu_si128((__m128i *) (sum + x + 4), _mm_add_epi32(high, _mm_unpackhi_epi16(delta, sign)));
+  }
+  box_v_row<scalar>(add + x, sub + x, sum + x, dst + x, width - x, scale);
+}
+#endif
+
+#ifdef PROJ1_HAVE_AVX2
+// 16 box sums to bytes, rounded the same way as the scalar version (the sums are never negative)
+inline __m128i box_round_avx2(__m256i low, __m256i high, __m256 scale) {
+  const __m256 half = _mm256_set1_ps(0.5f);
+  low = _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(_mm256_cvtepi32_ps(low), scale), half));
+  high = _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(_mm256_cvtepi32_ps(high), scale), half));
+  // packs works within 128-bit lanes, the permute puts the 16 words back in order
+  __m256i words = _mm256_permute4x64_epi64(_mm256_packs_epi32(low, high), 0xd8);
+  return _mm_packus_epi16(_mm256_castsi256_si128(words), _mm256_extracti128_si256(words, 1));
+}
+
+template<>
+inline void box_h_row<avx2>(const int *hi, const int *lo, uchar *dst, int width, float scale) {
+  const __m256 factor = _mm256_set1_ps(scale);
+  int x = 0;
+  for (; x + 16 <= width; x += 16) {
+    __m256i low = _mm256_sub_epi32(_mm256_loadu_si256((const __m256i *) (hi + x)),
+                                   _mm256_loadu_si256((const __m256i *) (lo + x)));
+    __m256i high = _mm256_sub_epi32(_mm256_loadu_si256((const __m256i *) (hi + x + 8)),
+                                    _mm256_loadu_si256((const __m256i *) (lo + x + 8)));
+    _mm_storeu_si128((__m128i *) (dst + x), box_round_avx2(low, high, factor));
+  }
+  box_h_row<scalar>(hi + x, lo + x, dst + x, width - x, scale);
+}
+
+template<>
+inline void box_v_row<avx2>(const uchar *add, const uchar *sub, int *sum, uchar *dst, int width, float scale) {
+  const __m256 factor = _mm256_set1_ps(scale);
+  int x = 0;
+  for (; x + 16 <= width; x += 16) {
+    __m256i low = _mm256_loadu_si256((const __m256i *) (sum + x));
+    __m256i high = _mm256_loadu_si256((const __m256i *) (sum + x + 8));
+    _mm_storeu_si128((__m128i *) (dst + x), box_round_avx2(low, high, factor));
+    __m256i delta_low = _mm256_sub_epi32(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *) (add + x))),
+                                         _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *) (sub + x))));
+    __m256i delta_high = _mm256_sub_epi32(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *) (add + x + 8))),
+                                          _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *) (sub + x + 8))));
+    _mm256_storeu_si256((__m256i *) (sum + x), _mm256_add_epi32(low, delta_low));
+    _mm256_storeu_si256((__m256i *) (sum + x + 8), _mm256_add_epi32(high, delta_high));
+  }
+  box_v_row<scalar>(add + x, sub + x, sum + x, dst + x, width - x, scale);
+}
+#endif
+
+template<class V>
+int sad_row(const uchar *a, const uchar *b, int width) {
+  int sum = 0;
+  for (int x = 0; x < width; x++) {
+    sum += std::abs(a[x] - b[x]);
+  }
+  return sum;
+}
+
+#ifdef PROJ1_HAVE_SSE2
+// psadbw sums the absolute differences of 8 bytes into each 64-bit half
+template<>
+inline int sad_row<sse2>(const uchar *a, const uchar *b, int width) {
+  __m128i sums = _mm_setzero_si128();
+  int x = 0;
+  for (; x + 16 <= width; x += 16) {
+    sums = _mm_add_epi64(sums, _mm_sad_epu8(_mm_loadu_si128((const __m128i *) (a + x)),
+                                            _mm_loadu_si128((const __m128i *) (b + x))));
+  }
+  sums = _mm_add_epi64(sums, _mm_srli_si128(sums, 8));
+  return _mm_cvtsi128_si32(sums) + sad_row<scalar>(a + x, b + x, width - x);
+}
+#endif
+
+#ifdef PROJ1_HAVE_AVX2
+template<>
+inline int sad_row<avx2>(const uchar *a, const uchar *b, int width) {
+  __m256i sums = _mm256_setzero_si256();
+  int x = 0;
+  for (; x + 32 <= width; x += 32) {
+    sums = _mm256_add_epi64(sums, _mm256_sad_epu8(_mm256_loadu_si256((const __m256i *) (a + x)),
+                                                  _mm256_loadu_si256((const __m256i *) (b + x))));
+  }
+  __m128i half = _mm_add_epi64(_mm256_castsi256_si128(sums), _mm256_extracti128_si256(sums, 1));
+  half = _mm_add_epi64(half, _mm_srli_si128(half, 8));
+  return _mm_cvtsi128_si32(half) + sad_row<sse2>(a + x, b + x, width - x);
+}
+#endif
+
+template<class V>
+void blur_v_row(const uchar *const rows[5], uchar *dst, int width) {
+  blur_v<V>(rows, dst, width);
+}
+
+template<class V>
+void smooth_v_row(const short *const rows[3], short *dst, int width) {
+  smooth_v<V>(rows, dst, width);
+}
+
+template<class V>
+void diff_v_row(const short *const rows[3], short *dst, int width) {
+  diff_v<V>(rows, dst, width);
+}
+
+// the table of kernels for one vector type
+template<class V>
+RowKernels make_row_kernels() {
+  RowKernels kernels = {blur_h<V>, blur_v_row<V>, diff_h<V>, smooth_h<V>, smooth_v_row<V>, diff_v_row<V>,
+                        color_matrix_row<V>, magnitude_row<V>, lut_row<V>, blur_h<V, 1>, diff_h<V, 1>, smooth_h<V, 1>,
+                        emboss_plane<V>, deinterleave_row<V>, interleave_row<V>, box_h_row<V>, box_v_row<V>,
+                        sad_row<V>};
+  return kernels;
+}
+
+}
+}
+
+#endif //PROJ1_INCLUDE_ROW_KERNELS_H_
@@ -0,0 +1,168 @@
+#include <opencv2/opencv.hpp>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define PROJ1_HAVE_SSE2 1
+#endif
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define PROJ1_HAVE_AVX2 1
+#endif
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define PROJ1_HAVE_NEON 1
+#endif
+
+#ifndef PROJ1_INCLUDE_SIMD_H_
+#define PROJ1_INCLUDE_SIMD_H_
+
+/*
+ * A tiny vector abstraction over 16-bit lanes, just wide enough for the filters in filter.cpp. Every type exposes the
+ * same static functions, so a kernel written once as a template over V runs on plain ints (scalar), SSE2, AVX2 or NEON.
+ *
+ * Everything lives in an anonymous namespace on purpose: the AVX2 kernels are compiled in their own translation unit
+ * with -mavx2, and internal linkage stops the linker from merging an AVX2-compiled copy of a shared inline function
+ * into the code that runs on older CPUs.
+ */
+namespace simd {
+namespace {
+
+// one lane, the reference every vector type has to match
+struct scalar {
+  typedef int vec;
+  static const int lanes = 1;
+  static vec load_u8(const uchar *p) { return p[0]; }
+  static vec load(const short *p) { return p[0]; }
+  static void store(short *p, vec v) { p[0] = (short) v; }
+  static void store_u8(uchar *p, vec v) { p[0] = (uchar) v; }
+  static vec add(vec a, vec b) { return a + b; }
+  static vec sub(vec a, vec b) { return a - b; }
+  template<int n> static vec shl(vec a) { return a * (1 << n); }
+  template<int n> static vec shr(vec a) { return a >> n; }
+  // arithmetic shift by a count only known at runtime
+  static vec sra(vec a, int n) { return a >> n; }
+  // the high 16 bits of the signed 32-bit product
+  static vec mulhi(vec a, vec b) { return (a * b) >> 16; }
+  // a / 10 for 0 <= a <= 2550
+  static vec div10(vec a) { return a / 10; }
+  // a / 4 rounded towards zero, the way a float kernel truncates when it is stored into a short
+  static vec div4(vec a) { return a / 4; }
+};
+
+#ifdef PROJ1_HAVE_SSE2
+struct sse2 {
+  typedef __m128i vec;
+  static const int lanes = 8;
+  static vec load_u8(const uchar *p) {
+    return _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *) p), _mm_setzero_si128());
+  }
+  static vec load(const short *p) { return _mm_loadu_si128((const __m128i *) p); }
+  static void store(short *p, vec v) { _mm_storeu_si128((__m128i *) p, v); }
+  static void store_u8(uchar *p, vec v) { _mm_storel_epi64((__m128i *) p, _mm_packus_epi16(v, v)); }
+  static vec add(vec a, vec b) { return _mm_add_epi16(a, b); }
+  static vec sub(vec a, vec b) { return _mm_sub_epi16(a, b); }
+  template<int n> static vec shl(vec a) { return _mm_slli_epi16(a, n); }
+  template<int n> static vec shr(vec a) { return _mm_srli_epi16(a, n); }
+  static vec sra(vec a, int n) { return _mm_sra_epi16(a, _mm_cvtsi32_si128(n)); }
+  static vec mulhi(vec a, vec b) { return _mm_mulhi_epi16(a, b); }
+  // (a * 52429) >> 19 equals a / 10 for every a below 43690
+  static vec div10(vec a) { return _mm_srli_epi16(_mm_mulhi_epu16(a, _mm_set1_epi16((short) 52429)), 3); }
+  static vec div4(vec a) {
+    vec bias = _mm_and_si128(_mm_srai_epi16(a, 15), _mm_set1_epi16(3));
+    return _mm_srai_epi16(_mm_add_epi16(a, bias), 2);
+  }
+};
+#endif
+
+#ifdef PROJ1_HAVE_AVX2
+struct avx2 {
+  typedef __m256i vec;
+  static const int lanes = 16;
+  static vec load_u8(const uchar *p) { return _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *) p)); }
+  static vec load(const short *p) { return _mm256_loadu_si256((const __m256i *) p); }
+  static void store(short *p, vec v) { _mm256_storeu_si256((__m256i *) p, v); }
+  static void store_u8(uchar *p, vec v) {
+    _mm_storeu_si128((__m128i *) p, _mm_packus_epi16(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1)));
+  }
+  static vec add(vec a, vec b) { return _mm256_add_epi16(a, b); }
+  static vec sub(vec a, vec b) { return _mm256_sub_epi16(a, b); }
+  template<int n> static vec shl(vec a) { return _mm256_slli_epi16(a, n); }
+  template<int n> static vec shr(vec a) { return _mm256_srli_epi16(a, n); }
+  static vec sra(vec a, int n) { return _mm256_sra_epi16(a, _mm_cvtsi32_si128(n)); }
+  static vec mulhi(vec a, vec b) { return _mm256_mulhi_epi16(a, b); }
+  static vec div10(vec a) { return _mm256_srli_epi16(_mm256_mulhi_epu16(a, _mm256_set1_epi16((short) 52429)), 3); }
+  static vec div4(vec a) {
+    vec bias = _mm256_and_si256(_mm256_srai_epi16(a, 15), _mm256_set1_epi16(3));
+    return _mm256_srai_epi16(_mm256_add_epi16(a, bias), 2);
+  }
+};
+#endif
+
+#ifdef PROJ1_HAVE_NEON
+struct neon {
+  typedef int16x8_t vec;
+  static const int lanes = 8;
+  static vec load_u8(const uchar *p) { return vreinterpretq_s16_u16(vmovl_u8(vld1_u8(p))); }
+  static vec load(const short *p) { return vld1q_s16(p); }
+  static void store(short *p, vec v) { vst1q_s16(p, v); }
+  static void store_u8(uchar *p, vec v) { vst1_u8(p, vqmovun_s16(v)); }
+  static vec add(vec a, vec b) { return vaddq_s16(a, b); }
+  static vec sub(vec a, vec b) { return vsubq_s16(a, b); }
+  template<int n> static vec shl(vec a) { return vshlq_n_s16(a, n); }
+  template<int n> static vec shr(vec a) {
+    return vreinterpretq_s16_u16(vshrq_n_u16(vreinterpretq_u16_s16(a), n));
+  }
+  static vec sra(vec a, int n) { return vshlq_s16(a, vdupq_n_s16((short) -n)); }
+  static vec mulhi(vec a, vec b) {
+    return vcombine_s16(vshrn_n_s32(vmull_s16(vget_low_s16(a), vget_low_s16(b)), 16),
+                        vshrn_n_s32(vmull_s16(vget_high_s16(a), vget_high_s16(b)), 16));
+  }
+  static vec div10(vec a) {
+    uint16x8_t u = vreinterpretq_u16_s16(a);
+    uint16x4_t magic = vdup_n_u16(52429);
+    uint16x8_t high = vcombine_u16(vshrn_n_u32(vmull_u16(vget_low_u16(u), magic), 16),
+                                   vshrn_n_u32(vmull_u16(vget_high_u16(u), magic), 16));
+    return vreinterpretq_s16_u16(vshrq_n_u16(high, 3));
+  }
+  static vec div4(vec a) {
+    vec bias = vandq_s16(vshrq_n_s16(a, 15), vdupq_n_s16(3));
+    return vshrq_n_s16(vaddq_s16(a, bias), 2);
+  }
+};
+#endif
+
+}
+}
+
+enum SimdLevel {
+  SIMD_SCALAR = 0,
+  SIMD_SSE2 = 1,
+  SIMD_NEON = 2,
+  SIMD_AVX2 = 3,
+};
+
+/**
+ * Detect the widest instruction set that both this build and the running CPU support
+ * @return the best simd level
+ */
+SimdLevel detect_simd_level();
+
+/**
+ * Force the filters onto a given instruction set, e.g. SIMD_SCALAR to run the reference path
+ * @param level the requested simd level
+ * @return 0 if success, -1 if the build or the CPU does not support it (the current level is kept)
+ */
+int set_simd_level(SimdLevel level);
+
+/**
+ * @return the simd level the filters currently dispatch to
+ */
+SimdLevel get_simd_level();
+
+/**
+ * @param level a simd level
+ * @return a printable name like "avx2"
+ */
+const char *simd_level_name(SimdLevel level);
+
+#endif //PROJ1_INCLUDE_SIMD_H_
@@ -0,0 +1,428 @@
+#include <algorithm>
+#include <cctype>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <opencv2/opencv.hpp>
+#include "filter.h"
+#include "filter_graph.h"
+#include "frame_source.h"
+#include "parallel.h"
+
+/*
+ * Run an effect chain over recorded footage offline: decode a video, filter every frame and encode the result, e.g.
+ *   batch_process --source file:in.mp4 --chain cartoon,sepia --output out.avi
+ * Decoding and encoding are sequential, so each gets a thread of its own, and the frames in between are spread over
+ * a set of filter workers that each run the whole chain on one frame. Whole frames keep every core busy without the
+ * per-frame synchronisation of splitting a frame into strips, and the encoder puts the frames back in order.
+ */
+
+// how often the encoder reports its progress
+#define PROGRESS_SECONDS 5.0
+
+// the whole-frame filters a chain can hold besides the stages of FilterGraph
+enum FrameFilter {
+  FRAME_GRAPH = 0,
+  FRAME_CARTOON = 1,
+  FRAME_GAUSSIAN = 2,
+  FRAME_BOX = 3,
+};
+
+/*
+ * The effect chain of a batch: the stages of FilterGraph::parse() plus cartoon, gaussian[:<radius>] and
+ * box[:<radius>], which run on the whole frame. A run of graph stages becomes a single FilterGraph, so it keeps its
+ * single pass over the frame.
+ */
+class BatchChain {
+ public:
+  int parse(const std::string &chain) {
+    steps.clear();
+    std::string graph_stages;
+    size_t begin = 0;
+    while (begin < chain.size()) {
+      size_t end = std::min(chain.find(',', begin), chain.size());
+      std::string stage = chain.substr(begin, end - begin);
+      std::string name = stage.substr(0, stage.find(':'));
+      int argument = stage.size() > name.size() ? atoi(stage.c_str() + name.size() + 1) : 0;
+      Step step = {FRAME_GRAPH, 0, FilterGraph()};
+      if (name == "cartoon") {
+        step.filter = FRAME_CARTOON;
+      } else if (name == "gaussian") {
+        step.filter = FRAME_GAUSSIAN;
+        step.radius = argument > 0 ? argument : 20;
+      } else if (name == "box") {
+        step.filter = FRAME_BOX;
+        step.radius = argument > 0 ? argument : 20;
+      }
+      if (step.filter == FRAME_GRAPH) {
+        graph_stages += graph_stages.empty() ? stage : "," + stage;
+      } else {
+        if (flush(graph_stages) != 0) {
+          return -1;
+        }
+        steps.push_back(step);
+      }
+      begin = end + 1;
+    }
+    return flush(graph_stages);
+  }
+
+  /*
+   * Run the chain from src into dst, the steps in between going back and forth between dst and tmp so no step runs
+   * in place
+   */
+  void apply(cv::Mat &src, cv::Mat &dst, cv::Mat &tmp) const {
+    if (steps.empty()) {
+      src.copyTo(dst);
+      return;
+    }
+    cv::Mat *in = &src;
+    for (size_t i = 0; i < steps.size(); i++) {
+      cv::Mat *out = (steps.size() - i) % 2 == 1 ? &dst : &tmp;
+      const Step &step = steps[i];
+      switch (step.filter) {
+        case FRAME_CARTOON: {
+          cartoon(*in, *out, 15, 20);
+          break;
+        }
+        case FRAME_GAUSSIAN: {
+          gaussian_blur(*in, *out, step.radius);
+          break;
+        }
+        case FRAME_BOX: {
+          box_blur(*in, *out, step.radius);
+          break;
+        }
+        default: {
+          step.graph.apply(*in, *out);
+          break;
+        }
+      }
+      in = out;
+    }
+  }
+
+ private:
+  struct Step {
+    FrameFilter filter;
+    int radius;
+    FilterGraph graph;
+  };
+
+  // turn the graph stages gathered so far into a step
+  int flush(std::string &graph_stages) {
+    if (graph_stages.empty()) {
+      return 0;
+    }
+    Step step = {FRAME_GRAPH, 0, FilterGraph()};
+    if (step.graph.parse(graph_stages) != 0) {
+      return -1;
+    }
+    steps.push_back(step);
+    graph_stages.clear();
+    return 0;
+  }
+
+  std::vector<Step> steps;
+};
+
+// a decoded frame, the result of the chain and the scratch frame of the chain, reused for frame after frame
+struct BatchFrame {
+  cv::Mat input, output, tmp;
+  long index;
+};
+
+/*
+ * A blocking queue of frame slots between two stages. It holds at most every slot there is, so its ring never grows
+ * once created, and close() tells the consumers that nothing more will come.
+ */
+class SlotQueue {
+ public:
+  explicit SlotQueue(int capacity) : ring(capacity), head(0), count(0), closed(false) {}
+
+  void push(int slot) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      ring[(head + count) % ring.size()] = slot;
+      count++;
+    }
+    wake.notify_one();
+  }
+
+  // wait for a slot, false once the queue is closed and empty
+  bool pop(int &slot) {
+    std::unique_lock<std::mutex> lock(mutex);
+    wake.wait(lock, [this] { return count > 0 || closed; });
+    if (count == 0) {
+      return false;
+    }
+    slot = ring[head];
+    head = (head + 1) % ring.size();
+    count--;
+    return true;
+  }
+
+  void close() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      closed = true;
+    }
+    wake.notify_all();
+  }
+
+ private:
+  std::mutex mutex;
+  std::condition_variable wake;
+  std::vector<int> ring;
+  size_t head, count;
+  bool closed;
+};
+
+/*
+ * The filtered frames on their way to the encoder, which takes them in index order whatever order the workers finish
+ * them in. A frame is only decoded into a slot the encoder gave back, so the indices in flight always lie within
+ * one slot count of the next one to encode and index % slots never collides.
+ */
+class ReorderBuffer {
+ public:
+  ReorderBuffer(int slots, int workers) : finished(slots, -1), workers_left(workers) {}
+
+  void put(long index, int slot) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      finished[index % finished.size()] = slot;
+    }
+    wake.notify_one();
+  }
+
+  // a worker is done, once all of them are nothing more will come
+  void worker_done() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      workers_left--;
+    }
+    wake.notify_one();
+  }
+
+  // wait for the frame index, false if every worker is done and it never came
+  bool take(long index, int &slot) {
+    std::unique_lock<std::mutex> lock(mutex);
+    int &entry = finished[index % finished.size()];
+    wake.wait(lock, [this, &entry] { return entry >= 0 || workers_left == 0; });
+    if (entry < 0) {
+      return false;
+    }
+    slot = entry;
+    entry = -1;
+    return true;
+  }
+
+ private:
+  std::mutex mutex;
+  std::condition_variable wake;
+  std::vector<int> finished;
+  int workers_left;
+};
+
+// the time a stage spent on its frames, each stage (each worker) has its own
+struct StageTime {
+  double total_ms = 0;
+  long count = 0;
+
+  void add(int64 start, int64 end) {
+    total_ms += (double) (end - start) * 1000.0 / cv::getTickFrequency();
+    count++;
+  }
+
+  double average_ms() const {
+    return count ? total_ms / count : 0.0;
+  }
+};
+
+struct Batch {
+  FrameSource *source;
+  BatchChain chain;
+  std::vector<BatchFrame> frames;
+  // free slots to decode into, decoded frames waiting for a worker, filtered frames waiting for the encoder
+  SlotQueue free_slots, decoded;
+  ReorderBuffer filtered;
+  // where the result goes, "null" to drop it
+  std::string output;
+  std::string fourcc;
+  double fps;
+  StageTime decode_time, encode_time;
+  std::vector<StageTime> filter_times;
+  bool failed = false;
+
+  Batch(int slots, int workers)
+      : source(nullptr), frames(slots), free_slots(slots), decoded(slots), filtered(slots, workers), fps(0),
+        filter_times(workers) {}
+};
+
+// stage 1: decode the frames one after the other into free slots
+static void decode_loop(Batch *batch) {
+  long index = 0;
+  int slot;
+  while (batch->free_slots.pop(slot)) {
+    BatchFrame &frame = batch->frames[slot];
+    int64 start = cv::getTickCount();
+    if (!batch->source->next(frame.input)) {
+      break;
+    }
+    batch->decode_time.add(start, cv::getTickCount());
+    frame.index = index++;
+    batch->decoded.push(slot);
+  }
+  batch->decoded.close();
+}
+
+// stage 2, on every worker: run the whole chain on one decoded frame after another
+static void filter_loop(Batch *batch, int worker) {
+  int slot;
+  while (batch->decoded.pop(slot)) {
+    BatchFrame &frame = batch->frames[slot];
+    int64 start = cv::getTickCount();
+    batch->chain.apply(frame.input, frame.output, frame.tmp);
+    batch->filter_times[worker].add(start, cv::getTickCount());
+    batch->filtered.put(frame.index, slot);
+  }
+  batch->filtered.worker_done();
+}
+
+// stage 3: encode the filtered frames in order and hand their slots back to the decoder
+static void encode_loop(Batch *batch) {
+  cv::VideoWriter writer;
+  bool drop = batch->output == "null";
+  int64 begin = cv::getTickCount(), last_report = begin;
+  long index = 0;
+  int slot;
+  while (batch->filtered.take(index, slot)) {
+    BatchFrame &frame = batch->frames[slot];
+    int64 start = cv::getTickCount();
+    if (!drop && !writer.isOpened() && !batch->failed) {
+      // the size is only known for sure once the first frame is decoded
+      const char *code = batch->fourcc.c_str();
+      if (!writer.open(batch->output, cv::VideoWriter::fourcc(code[0], code[1], code[2], code[3]), batch->fps,
+                       frame.output.size())) {
+        printf("Unable to open %s for writing\n", batch->output.c_str());
+        // keep draining the workers so the other stages can finish
+        batch->failed = true;
+      }
+    }
+    if (writer.isOpened()) {
+      writer.write(frame.output);
+    }
+    int64 end = cv::getTickCount();
+    batch->encode_time.add(start, end);
+    batch->free_slots.push(slot);
+    index++;
+    if ((double) (end - last_report) / cv::getTickFrequency() >= PROGRESS_SECONDS) {
+      printf("%ld frames, %.1f frames/s\n", index, index * cv::getTickFrequency() / (double) (end - begin));
+      last_report = end;
+    }
+  }
+  // a decoder blocked on a free slot after a failure must still see the end
+  batch->free_slots.close();
+  writer.release();
+}
+
+// the codec for an output file: Motion JPEG in .avi, MPEG-4 otherwise
+static std::string default_fourcc(const std::string &path) {
+  std::string extension = path.substr(std::min(path.rfind('.'), path.size()));
+  for (char &c: extension) {
+    c = (char) tolower(c);
+  }
+  return extension == ".avi" ? "MJPG" : "mp4v";
+}
+
+int main(int argc, char *argv[]) {
+  // "--source <spec>" the footage to process, see open_frame_source(); a camera never ends, so it is refused
+  FrameOptions options;
+  take_frame_options(argc, argv, options);
+  // "--chain <stages>"   the effects, FilterGraph stages plus cartoon, gaussian[:<r>] and box[:<r>], none by default
+  // "--output <path>"    the video to write, "null" to only time the chain
+  // "--fourcc <code>"    the codec of the output, MJPG for .avi and mp4v for anything else by default
+  // "--fps <rate>"       the frame rate of the output, the one of the source by default
+  // "--workers <n>"      the threads filtering whole frames, one per hardware thread by default
+  // "--threads <n>"      the threads each filter splits a frame over, 1 by default since the workers fill the cores
+  std::string chain, output, fourcc;
+  double fps = 0;
+  int workers = std::max((int) std::thread::hardware_concurrency(), 1);
+  int threads = 1;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--chain") == 0 && i + 1 < argc) {
+      chain = argv[++i];
+    } else if (strcmp(argv[i], "--output") == 0 && i + 1 < argc) {
+      output = argv[++i];
+    } else if (strcmp(argv[i], "--fourcc") == 0 && i + 1 < argc) {
+      fourcc = argv[++i];
+    } else if (strcmp(argv[i], "--fps") == 0 && i + 1 < argc) {
+      fps = atof(argv[++i]);
+    } else if (strcmp(argv[i], "--workers") == 0 && i + 1 < argc) {
+      workers = std::max(atoi(argv[++i]), 1);
+    } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+      threads = atoi(argv[++i]);
+    } else {
+      printf("Unknown argument %s\n", argv[i]);
+      return (-1);
+    }
+  }
+  if (output.empty() || (!fourcc.empty() && fourcc.size() != 4)) {
+    printf("usage: %s --source <spec> --output <path>|null [--chain <stages>] [--fourcc <code>] [--fps <rate>] "
+           "[--workers <n>] [--threads <n>]\n", argv[0]);
+    return (-1);
+  }
+  // two frames per worker, one being filtered and one waiting, plus the ones in the hands of the decoder and encoder
+  Batch batch(2 * workers + 2, workers);
+  if (batch.chain.parse(chain) != 0) {
+    printf("Unknown stage in chain %s\n", chain.c_str());
+    return (-1);
+  }
+  FrameSource *source = open_frame_source(options.source);
+  if (source == nullptr || source->live()) {
+    printf("Unable to open %s as recorded footage\n", options.source.c_str());
+    delete source;
+    return (-1);
+  }
+  set_num_threads(threads);
+  batch.source = source;
+  batch.output = output;
+  batch.fourcc = fourcc.empty() ? default_fourcc(output) : fourcc;
+  batch.fps = fps > 0 ? fps : source->frame_rate() > 0 ? source->frame_rate() : 30;
+  for (size_t slot = 0; slot < batch.frames.size(); slot++) {
+    batch.free_slots.push((int) slot);
+  }
+  printf("Filtering on %d workers of %d threads each\n", workers, get_num_threads());
+
+  int64 start = cv::getTickCount();
+  std::thread decode_thread(decode_loop, &batch);
+  std::vector<std::thread> filter_threads;
+  for (int worker = 0; worker < workers; worker++) {
+    filter_threads.emplace_back(filter_loop, &batch, worker);
+  }
+  std::thread encode_thread(encode_loop, &batch);
+  decode_thread.join();
+  for (std::thread &thread: filter_threads) {
+    thread.join();
+  }
+  encode_thread.join();
+  double seconds = (double) (cv::getTickCount() - start) / cv::getTickFrequency();
+
+  StageTime filter_time;
+  for (const StageTime &time: batch.filter_times) {
+    filter_time.total_ms += time.total_ms;
+    filter_time.count += time.count;
+  }
+  long frames = batch.encode_time.count;
+  printf("decode %8.2f ms, filter %8.2f ms, encode %8.2f ms per frame\n", batch.decode_time.average_ms(),
+         filter_time.average_ms(), batch.encode_time.average_ms());
+  printf("processed %ld frames in %.2f s, %.1f frames/s end to end\n", frames, seconds,
+         seconds > 0 ? frames / seconds : 0.0);
+  delete source;
+  return batch.failed ? (-1) : (0);
+}
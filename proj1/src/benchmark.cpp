@@ -0,0 +1,318 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+#include <opencv2/opencv.hpp>
+#include "filter.h"
+#include "filter_graph.h"
+#include "frame_source.h"
+#include "parallel.h"
+#include "planar.h"
+#include "point_lut.h"
+#include "simd.h"
+
+/*
+ * Times every effect of video_display over a set of frame sizes and thread counts. The frames come from the synthetic
+ * frame source, so two runs on the same machine time the same pixels. Prints a table and optionally writes the
+ * results as JSON, one record per effect, size and thread count, to compare builds against each other.
+ */
+
+// the frames an effect reads and writes, allocated once per frame size
+struct BenchFrames {
+  cv::Mat src, dst, sobel_x, sobel_y, grey, tmp;
+  // the same frames as planes, see planar.h
+  PlanarFrame planar_src, planar_dst, planar_sobel_x, planar_sobel_y;
+};
+
+struct Bench {
+  const char *name;
+  // bytes read from and written to memory per pixel, counting each input and output frame once
+  int bytes_in, bytes_out;
+  void (*run)(BenchFrames &frames);
+};
+
+// the same cases as the effect switch of vidDisplay.cpp, the OpenCV built-ins included
+static const Bench benches[] = {
+    {"gray_cvtColor", 3, 3, [](BenchFrames &f) {
+      cv::cvtColor(f.src, f.grey, cv::COLOR_BGR2GRAY);
+      cv::Mat channels[3] = {f.grey, f.grey, f.grey};
+      cv::merge(channels, 3, f.dst);
+    }},
+    {"greyscale", 3, 3, [](BenchFrames &f) { greyscale(f.src, f.dst); }},
+    {"blur5x5", 3, 3, [](BenchFrames &f) { blur5x5(f.src, f.dst); }},
+    {"sobelX3x3", 3, 6, [](BenchFrames &f) { sobelX3x3(f.src, f.sobel_x); }},
+    {"sobelY3x3", 3, 6, [](BenchFrames &f) { sobelY3x3(f.src, f.sobel_y); }},
+    {"magnitude", 12, 3, [](BenchFrames &f) { magnitude(f.sobel_x, f.sobel_y, f.dst); }},
+    {"blurQuantize", 3, 3, [](BenchFrames &f) { blurQuantize(f.src, f.dst, 15); }},
+    {"cartoon", 3, 3, [](BenchFrames &f) { cartoon(f.src, f.dst, 15, 20); }},
+    {"negative", 3, 3, [](BenchFrames &f) { negative(f.src, f.dst); }},
+    {"add_contrast", 3, 3, [](BenchFrames &f) { PointLut::convert(2, 0).apply(f.src, f.dst); }},
+    {"dec_contrast", 3, 3, [](BenchFrames &f) { PointLut::convert(0.25, 0).apply(f.src, f.dst); }},
+    {"add_brightness", 3, 3, [](BenchFrames &f) { PointLut::convert(1, 100).apply(f.src, f.dst); }},
+    {"dec_brightness", 3, 3, [](BenchFrames &f) { PointLut::convert(1, -100).apply(f.src, f.dst); }},
+    {"sepia", 3, 3, [](BenchFrames &f) { sepia(f.src, f.dst); }},
+    // what the colour matrix and the point tables replaced
+    {"convertTo", 3, 3, [](BenchFrames &f) { f.src.convertTo(f.dst, -1, 2, 0); }},
+    {"sepia_reference", 3, 3, [](BenchFrames &f) { sepia_reference(f.src, f.dst); }},
+    {"emboss", 3, 3, [](BenchFrames &f) { emboss(f.src, f.dst); }},
+    {"emboss_reference", 3, 3, [](BenchFrames &f) { emboss_reference(f.src, f.dst); }},
+    // the default chain of the 'k' mode, once as separate full-frame filters and once through a FilterGraph
+    {"chain_separate", 3, 3, [](BenchFrames &f) {
+      blur5x5(f.src, f.tmp);
+      sepia(f.tmp, f.dst);
+      emboss(f.dst, f.tmp);
+    }},
+    {"chain", 3, 3, [](BenchFrames &f) {
+      static FilterGraph graph;
+      if (graph.empty()) {
+        graph.parse("blur,sepia,emboss");
+      }
+      graph.apply(f.src, f.dst);
+    }},
+    // the planar layout: the conversions on their own, the filters from planes to planes, and the filters from BGR to
+    // BGR through the planes (_io), which is what a pipeline pays unless it stays planar between filters
+    {"to_planar", 3, 3, [](BenchFrames &f) { to_planar(f.src, f.planar_dst); }},
+    {"to_interleaved", 3, 3, [](BenchFrames &f) { to_interleaved(f.planar_src, f.dst); }},
+    {"blur5x5_planar", 3, 3, [](BenchFrames &f) { blur5x5_planar(f.planar_src, f.planar_dst); }},
+    {"blur5x5_planar_io", 3, 3, [](BenchFrames &f) {
+      to_planar(f.src, f.planar_dst);
+      blur5x5_planar(f.planar_dst, f.planar_dst);
+      to_interleaved(f.planar_dst, f.dst);
+    }},
+    {"sobelX3x3_planar", 3, 6, [](BenchFrames &f) { sobelX3x3_planar(f.planar_src, f.planar_sobel_x); }},
+    {"sobelY3x3_planar", 3, 6, [](BenchFrames &f) { sobelY3x3_planar(f.planar_src, f.planar_sobel_y); }},
+    {"magnitude_planar", 12, 3, [](BenchFrames &f) {
+      magnitude_planar(f.planar_sobel_x, f.planar_sobel_y, f.planar_dst);
+    }},
+    {"emboss_planar", 3, 3, [](BenchFrames &f) { emboss_planar(f.planar_src, f.planar_dst); }},
+    {"emboss_planar_io", 3, 3, [](BenchFrames &f) {
+      to_planar(f.src, f.planar_dst);
+      emboss_planar(f.planar_dst, f.planar_dst);
+      to_interleaved(f.planar_dst, f.dst);
+    }},
+    // the 'm' mode, both sobels and the magnitude, in either layout
+    {"gradient", 3, 3, [](BenchFrames &f) {
+      sobelX3x3(f.src, f.sobel_x);
+      sobelY3x3(f.src, f.sobel_y);
+      magnitude(f.sobel_x, f.sobel_y, f.dst);
+    }},
+    {"gradient_planar_io", 3, 3, [](BenchFrames &f) {
+      to_planar(f.src, f.planar_dst);
+      sobelX3x3_planar(f.planar_dst, f.planar_sobel_x);
+      sobelY3x3_planar(f.planar_dst, f.planar_sobel_y);
+      magnitude_planar(f.planar_sobel_x, f.planar_sobel_y, f.planar_dst);
+      to_interleaved(f.planar_dst, f.dst);
+    }},
+    // the running-sum blurs should take the same time whatever the radius
+    {"box_r32", 3, 3, [](BenchFrames &f) { box_blur(f.src, f.dst, 32); }},
+    {"gaussian_r2", 3, 3, [](BenchFrames &f) { gaussian_blur(f.src, f.dst, 2); }},
+    {"gaussian_r8", 3, 3, [](BenchFrames &f) { gaussian_blur(f.src, f.dst, 8); }},
+    {"gaussian_r32", 3, 3, [](BenchFrames &f) { gaussian_blur(f.src, f.dst, 32); }},
+    {"gaussian_r128", 3, 3, [](BenchFrames &f) { gaussian_blur(f.src, f.dst, 128); }},
+    // the approximate magnitudes, and the 'm' mode without the two sobel frames in between
+    {"magnitude_l1", 12, 3, [](BenchFrames &f) { magnitude(f.sobel_x, f.sobel_y, f.dst, MAGNITUDE_L1); }},
+    {"magnitude_maxmin", 12, 3, [](BenchFrames &f) {
+      magnitude(f.sobel_x, f.sobel_y, f.dst, MAGNITUDE_MAX_MIN);
+    }},
+    {"sobel_magnitude", 3, 3, [](BenchFrames &f) { sobel_magnitude(f.src, f.dst); }},
+    {"sobel_magnitude_l1", 3, 3, [](BenchFrames &f) { sobel_magnitude(f.src, f.dst, MAGNITUDE_L1); }},
+    {"cartoon_maxmin", 3, 3, [](BenchFrames &f) { cartoon(f.src, f.dst, 15, 20, MAGNITUDE_MAX_MIN); }},
+};
+
+struct BenchSize {
+  const char *name;
+  int width, height;
+};
+
+static const BenchSize sizes[] = {
+    {"vga", 640, 480},
+    {"720p", 1280, 720},
+    {"1080p", 1920, 1080},
+    {"4k", 3840, 2160},
+};
+
+struct BenchResult {
+  const Bench *bench;
+  const BenchSize *size;
+  int threads;
+  int iterations;
+  double median_ms, min_ms;
+};
+
+// true if name is one of the comma separated entries of list, or list is empty
+static bool selected(const std::string &list, const char *name) {
+  if (list.empty()) {
+    return true;
+  }
+  std::string padded = "," + list + ",";
+  return padded.find("," + std::string(name) + ",") != std::string::npos;
+}
+
+static std::vector<int> parse_threads(const char *list) {
+  std::vector<int> threads;
+  for (const char *p = list; *p;) {
+    threads.push_back(std::max(atoi(p), 1));
+    p = strchr(p, ',');
+    if (p == nullptr) {
+      break;
+    }
+    p++;
+  }
+  return threads;
+}
+
+// 1, 2, 4, ... up to the number of hardware threads, which is always included
+static std::vector<int> default_threads() {
+  int hardware = std::max((int) std::thread::hardware_concurrency(), 1);
+  std::vector<int> threads;
+  for (int n = 1; n < hardware; n *= 2) {
+    threads.push_back(n);
+  }
+  threads.push_back(hardware);
+  return threads;
+}
+
+/*
+ * Run one effect until min_seconds have passed (and at least 5 times) after a warm-up run that lets the filters size
+ * their scratch buffers, and keep the median and the fastest run
+ */
+static BenchResult time_bench(const Bench &bench, BenchFrames &frames, double min_seconds) {
+  BenchResult result = {&bench, nullptr, get_num_threads(), 0, 0, 0};
+  bench.run(frames);
+  std::vector<double> times;
+  double total = 0;
+  while (times.size() < 5 || total < min_seconds) {
+    int64 start = cv::getTickCount();
+    bench.run(frames);
+    double seconds = (double) (cv::getTickCount() - start) / cv::getTickFrequency();
+    times.push_back(seconds * 1000.0);
+    total += seconds;
+  }
+  std::sort(times.begin(), times.end());
+  result.iterations = (int) times.size();
+  result.median_ms = times[times.size() / 2];
+  result.min_ms = times[0];
+  return result;
+}
+
+static double ns_per_pixel(const BenchResult &r) {
+  return r.median_ms * 1e6 / ((double) r.size->width * r.size->height);
+}
+
+static double frames_per_second(const BenchResult &r) {
+  return 1000.0 / r.median_ms;
+}
+
+// effective bandwidth: the frames read and written once each, divided by the median time
+static double bandwidth_gbs(const BenchResult &r) {
+  double bytes = (double) r.size->width * r.size->height * (r.bench->bytes_in + r.bench->bytes_out);
+  return bytes / (r.median_ms * 1e-3) / 1e9;
+}
+
+static int write_json(const char *path, const std::vector<BenchResult> &results) {
+  FILE *file = fopen(path, "w");
+  if (file == nullptr) {
+    printf("Unable to write %s\n", path);
+    return -1;
+  }
+  fprintf(file, "{\n  \"simd\": \"%s\",\n  \"hardware_threads\": %d,\n  \"results\": [\n",
+          simd_level_name(get_simd_level()), (int) std::thread::hardware_concurrency());
+  for (size_t i = 0; i < results.size(); i++) {
+    const BenchResult &r = results[i];
+    fprintf(file,
+            "    {\"filter\": \"%s\", \"size\": \"%s\", \"width\": %d, \"height\": %d, \"threads\": %d, "
+            "\"iterations\": %d, \"median_ms\": %.4f, \"min_ms\": %.4f, \"ns_per_pixel\": %.4f, \"fps\": %.2f, "
+            "\"bandwidth_gbs\": %.3f}%s\n",
+            r.bench->name, r.size->name, r.size->width, r.size->height, r.threads, r.iterations, r.median_ms,
+            r.min_ms, ns_per_pixel(r), frames_per_second(r), bandwidth_gbs(r), i + 1 < results.size() ? "," : "");
+  }
+  fprintf(file, "  ]\n}\n");
+  fclose(file);
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+  // "--filters a,b"   only time these effects, e.g. blur5x5,cartoon
+  // "--sizes a,b"     only these frame sizes out of vga, 720p, 1080p and 4k
+  // "--threads 1,4"   the thread counts, by default powers of two up to the number of hardware threads
+  // "--simd <level>"  scalar, sse2, neon or avx2 instead of the best one the CPU supports
+  // "--min-time <s>"  how long to run every case, 0.5 seconds by default
+  // "--json <file>"   also write the results as JSON
+  std::string filter_list, size_list;
+  std::vector<int> thread_counts = default_threads();
+  double min_seconds = 0.5;
+  const char *json_path = nullptr;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--filters") == 0 && i + 1 < argc) {
+      filter_list = argv[++i];
+    } else if (strcmp(argv[i], "--sizes") == 0 && i + 1 < argc) {
+      size_list = argv[++i];
+    } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+      thread_counts = parse_threads(argv[++i]);
+    } else if (strcmp(argv[i], "--simd") == 0 && i + 1 < argc) {
+      const char *name = argv[++i];
+      int level = SIMD_SCALAR;
+      while (level <= SIMD_AVX2 && strcmp(simd_level_name((SimdLevel) level), name) != 0) {
+        level++;
+      }
+      if (level > SIMD_AVX2 || set_simd_level((SimdLevel) level) != 0) {
+        printf("simd level %s is not supported here\n", name);
+        return (-1);
+      }
+    } else if (strcmp(argv[i], "--min-time") == 0 && i + 1 < argc) {
+      min_seconds = atof(argv[++i]);
+    } else if (strcmp(argv[i], "--json") == 0 && i + 1 < argc) {
+      json_path = argv[++i];
+    } else {
+      printf("Unknown argument %s\n", argv[i]);
+      return (-1);
+    }
+  }
+  printf("simd level %s, %d hardware threads\n", simd_level_name(get_simd_level()),
+         (int) std::thread::hardware_concurrency());
+  printf("%-18s %-6s %7s %10s %10s %9s %10s\n", "filter", "size", "threads", "median ms", "ns/pixel", "fps", "GB/s");
+
+  std::vector<BenchResult> results;
+  for (const BenchSize &size: sizes) {
+    if (!selected(size_list, size.name)) {
+      continue;
+    }
+    FrameSource *source = open_frame_source(
+        "synthetic:" + std::to_string(size.width) + "x" + std::to_string(size.height) + ":1");
+    BenchFrames frames;
+    source->next(frames.src);
+    delete source;
+    frames.dst.create(size.height, size.width, CV_8UC3);
+    frames.grey.create(size.height, size.width, CV_8UC1);
+    frames.tmp.create(size.height, size.width, CV_8UC3);
+    frames.sobel_x.create(size.height, size.width, CV_16SC3);
+    frames.sobel_y.create(size.height, size.width, CV_16SC3);
+    // magnitude reads real gradients rather than whatever the buffers held
+    sobelX3x3(frames.src, frames.sobel_x);
+    sobelY3x3(frames.src, frames.sobel_y);
+    to_planar(frames.src, frames.planar_src);
+    frames.planar_dst.create(size.height, size.width, CV_8UC1);
+    sobelX3x3_planar(frames.planar_src, frames.planar_sobel_x);
+    sobelY3x3_planar(frames.planar_src, frames.planar_sobel_y);
+    for (int threads: thread_counts) {
+      set_num_threads(threads);
+      for (const Bench &bench: benches) {
+        if (!selected(filter_list, bench.name)) {
+          continue;
+        }
+        BenchResult result = time_bench(bench, frames, min_seconds);
+        result.size = &size;
+        results.push_back(result);
+        printf("%-18s %-6s %7d %10.3f %10.3f %9.1f %10.2f\n", bench.name, size.name, result.threads, result.median_ms,
+               ns_per_pixel(result), frames_per_second(result), bandwidth_gbs(result));
+      }
+    }
+  }
+  if (json_path != nullptr && write_json(json_path, results) != 0) {
+    return (-1);
+  }
+  return (0);
+}
@@ -0,0 +1,75 @@
+#include "color_matrix.h"
+#include "parallel.h"
+#include <cmath>
+
+ColorMatrix::ColorMatrix() {
+  const double identity[3][3] = {{1, 0, 0}, {0, 1, 0}, {0, 0, 1}};
+  const double zero[3] = {0, 0, 0};
+  *this = ColorMatrix(identity, zero);
+}
+
+ColorMatrix::ColorMatrix(const double coefficients[3][3], const double offset[3]) {
+  // the largest scale 2^shift that keeps every tap, (v << 7) * coefficient * 2^(shift + 9) >> 16, and every sum in a
+  // short; the 6 fraction bits of sepia are plenty for a result within 1 of the exact one
+  int shift = 6;
+  for (; shift > 0; shift--) {
+    bool fits = true;
+    for (int c = 0; c < 3; c++) {
+      double range = std::fabs(offset[c]) + 1;
+      for (int k = 0; k < 3; k++) {
+        fits = fits && std::fabs(coefficients[c][k]) * (1 << (shift + 9)) <= 32767;
+        range += std::fabs(coefficients[c][k]) * 255;
+      }
+      fits = fits && range * (1 << shift) <= 32767;
+    }
+    if (fits) {
+      break;
+    }
+  }
+  kernel.shift = shift;
+  kernel.diagonal = true;
+  for (int c = 0; c < 3; c++) {
+    int used = 0;
+    for (int t = 0; t < 5; t++) {
+      kernel.taps[c][t] = 0;
+    }
+    for (int k = 0; k < 3; k++) {
+      long tap = std::lround(coefficients[c][k] * (1 << (shift + 9)));
+      kernel.taps[c][2 + k - c] = (short) std::min(std::max(tap, -32768L), 32767L);
+      used += tap != 0;
+      kernel.diagonal = kernel.diagonal && (k == c || tap == 0);
+    }
+    // every tap rounds its product down by half a unit on average, which the offset gives back
+    long scaled = std::lround(offset[c] * (1 << shift)) + used / 2;
+    kernel.offset[c] = (short) std::min(std::max(scaled, -32768L), 32767L);
+  }
+}
+
+ColorMatrix ColorMatrix::sepia() {
+  const double coefficients[3][3] = {{0.131, 0.534, 0.272},
+                                     {0.168, 0.686, 0.349},
+                                     {0.189, 0.769, 0.393}};
+  const double offset[3] = {0, 0, 0};
+  return ColorMatrix(coefficients, offset);
+}
+
+ColorMatrix ColorMatrix::greyscale() {
+  const double coefficients[3][3] = {{0, 1, 0}, {0, 1, 0}, {0, 1, 0}};
+  const double offset[3] = {0, 0, 0};
+  return ColorMatrix(coefficients, offset);
+}
+
+int ColorMatrix::apply(cv::Mat &src, cv::Mat &dst) const {
+  dst.create(src.rows, src.cols, CV_8UC3);
+  const RowKernels &k = row_kernels();
+  parallel_for_rows(src.rows, MIN_STRIP_ROWS, [&](int begin, int end) {
+    for (int i = begin; i < end; i++) {
+      k.color_matrix(src.ptr<uchar>(i), dst.ptr<uchar>(i), src.cols, kernel);
+    }
+  });
+  return 0;
+}
+
+void ColorMatrix::apply_row(const uchar *src, uchar *dst, int cols) const {
+  row_kernels().color_matrix(src, dst, cols, kernel);
+}
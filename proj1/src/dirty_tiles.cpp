@@ -0,0 +1,130 @@
+#include "dirty_tiles.h"
+#include "parallel.h"
+#include "row_kernels.h"
+#include <algorithm>
+#include <cstring>
+
+DirtyTiles::DirtyTiles(int tile_size, int threshold)
+    : tile_size(std::max(tile_size, 1)), threshold(std::max(threshold, 0)), all_dirty(true), tile_count(0),
+      dirty_count(0) {
+}
+
+// rect grown by by pixels on every side, clipped to bounds
+static cv::Rect grow(const cv::Rect &rect, int by, const cv::Rect &bounds) {
+  int x0 = std::max(rect.x - by, bounds.x), y0 = std::max(rect.y - by, bounds.y);
+  int x1 = std::min(rect.x + rect.width + by, bounds.x + bounds.width);
+  int y1 = std::min(rect.y + rect.height + by, bounds.y + bounds.height);
+  return cv::Rect(x0, y0, x1 - x0, y1 - y0);
+}
+
+double DirtyTiles::update(const cv::Mat &frame) {
+  int rows = frame.rows, cols = frame.cols;
+  if (reference.rows != rows || reference.cols != cols) {
+    reference.create(rows, cols, CV_8UC3);
+    all_dirty = true;
+  }
+  tiles = cv::Size((cols + tile_size - 1) / tile_size, (rows + tile_size - 1) / tile_size);
+  dirty.assign((size_t) tiles.width * tiles.height, 1);
+  // there are never more blocks than tiles, so once they are reserved a stream of frames does not allocate
+  blocks.reserve(dirty.size());
+  open_blocks.reserve(tiles.width);
+  next_open_blocks.reserve(tiles.width);
+  blocks.clear();
+  if (all_dirty) {
+    frame.copyTo(reference);
+    blocks.push_back(cv::Rect(0, 0, cols, rows));
+    all_dirty = false;
+    tile_count += (long long) dirty.size();
+    dirty_count += (long long) dirty.size();
+    return 1;
+  }
+
+  const RowKernels &k = row_kernels();
+  parallel_for_rows(tiles.height, 1, [&](int begin, int end) {
+    for (int ty = begin; ty < end; ty++) {
+      int y0 = ty * tile_size, y1 = std::min(y0 + tile_size, rows);
+      for (int tx = 0; tx < tiles.width; tx++) {
+        int x0 = tx * tile_size, bytes = 3 * (std::min(x0 + tile_size, cols) - x0);
+        long long limit = (long long) threshold * bytes * (y1 - y0), sum = 0;
+        // most tiles of a moving area are told apart after a few rows
+        for (int y = y0; y < y1 && sum <= limit; y++) {
+          sum += k.sad(frame.ptr<uchar>(y) + 3 * x0, reference.ptr<uchar>(y) + 3 * x0, bytes);
+        }
+        bool changed = sum > limit;
+        dirty[(size_t) ty * tiles.width + tx] = changed;
+        for (int y = y0; changed && y < y1; y++) {
+          memcpy(reference.ptr<uchar>(y) + 3 * x0, frame.ptr<uchar>(y) + 3 * x0, bytes);
+        }
+      }
+    }
+  });
+
+  // runs of dirty tiles along each row of tiles, a run directly below one of the same columns extends its block
+  long long found = 0;
+  open_blocks.clear();
+  for (int ty = 0; ty < tiles.height; ty++) {
+    int y = ty * tile_size, height = std::min(tile_size, rows - y);
+    const char *row = &dirty[(size_t) ty * tiles.width];
+    next_open_blocks.clear();
+    size_t open = 0;
+    for (int tx = 0; tx < tiles.width;) {
+      if (!row[tx]) {
+        tx++;
+        continue;
+      }
+      int run_end = tx;
+      while (run_end < tiles.width && row[run_end]) {
+        run_end++;
+      }
+      found += run_end - tx;
+      int x = tx * tile_size, width = std::min(run_end * tile_size, cols) - x;
+      while (open < open_blocks.size() && blocks[open_blocks[open]].x < x) {
+        open++;
+      }
+      if (open < open_blocks.size() && blocks[open_blocks[open]].x == x && blocks[open_blocks[open]].width == width) {
+        blocks[open_blocks[open]].height += height;
+        next_open_blocks.push_back(open_blocks[open]);
+      } else {
+        blocks.push_back(cv::Rect(x, y, width, height));
+        next_open_blocks.push_back((int) blocks.size() - 1);
+      }
+      tx = run_end;
+    }
+    open_blocks.swap(next_open_blocks);
+  }
+  tile_count += (long long) dirty.size();
+  dirty_count += found;
+  return (double) found / (double) dirty.size();
+}
+
+void DirtyTiles::invalidate() {
+  all_dirty = true;
+}
+
+void DirtyTiles::refilter(cv::Mat &frame, cv::Mat &output, int halo,
+                          void (*filter)(void *context, cv::Mat &src, cv::Mat &dst), void *context) {
+  cv::Rect whole(0, 0, frame.cols, frame.rows);
+  bool fresh = output.rows != frame.rows || output.cols != frame.cols || output.type() != CV_8UC3;
+  // the blocks grown by their halos can add up to more than the frame, filtering it whole is then cheaper
+  long long area = 0;
+  for (const cv::Rect &block: blocks) {
+    area += (long long) grow(block, 2 * halo, whole).area();
+  }
+  if (fresh || area >= (long long) whole.area()) {
+    output.create(frame.rows, frame.cols, CV_8UC3);
+    filter(context, frame, output);
+    return;
+  }
+  scratch.create(frame.rows, frame.cols, CV_8UC3);
+  for (const cv::Rect &block: blocks) {
+    cv::Rect source = grow(block, 2 * halo, whole), target = grow(block, halo, whole);
+    cv::Mat src = frame(source), dst = scratch(source);
+    filter(context, src, dst);
+    cv::Mat target_pixels = output(target);
+    dst(cv::Rect(target.x - source.x, target.y - source.y, target.width, target.height)).copyTo(target_pixels);
+  }
+}
+
+double DirtyTiles::dirty_ratio() const {
+  return tile_count > 0 ? (double) dirty_count / (double) tile_count : 0;
+}
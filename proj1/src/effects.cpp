@@ -0,0 +1,114 @@
+#include "effects.h"
+#include "filter.h"
+#include "point_lut.h"
+
+void apply_effect(const EffectSettings &settings, int effect, cv::Mat &frame, cv::Mat &converted_frame,
+                  FramePool &pool) {
+  switch (effect) {
+    case GRAY: {
+      cv::Mat converted_frame_one_channel = pool.acquire(CV_8UC1, frame.size());
+      // cvtColor will make the dst a 1 channel mat, which is fine for display but will cause the program crash
+      // when we switch to other mode immediately. Thus, I duplicate the channel to 3 channels mat with cv::merge()
+      cv::cvtColor(frame, converted_frame_one_channel, cv::COLOR_BGR2GRAY);
+      cv::Mat channels[3] = {converted_frame_one_channel, converted_frame_one_channel, converted_frame_one_channel};
+      cv::merge(channels, 3, converted_frame);
+      break;
+    }
+    case ALTERNATIVE_GREY: {
+      greyscale(frame, converted_frame);
+      break;
+    }
+    case BLUR: {
+      blur5x5(frame, converted_frame);
+      break;
+    }
+    case X_SOBEL: {
+      cv::Mat frame_16s = pool.acquire(CV_16SC3, frame.size());
+      sobelX3x3(frame, frame_16s);
+      transform(frame_16s, converted_frame);
+      break;
+    }
+    case Y_SOBEL: {
+      cv::Mat frame_16s = pool.acquire(CV_16SC3, frame.size());
+      sobelY3x3(frame, frame_16s);
+      transform(frame_16s, converted_frame);
+      break;
+    }
+    case MAGNITUDE: {
+      sobel_magnitude(frame, converted_frame, settings.magnitude_mode);
+      break;
+    }
+    case BLUR_QUANTIZE: {
+      blurQuantize(frame, converted_frame, settings.quantize_level);
+      break;
+    }
+    case CARTOON: {
+      cartoon(frame, converted_frame, settings.quantize_level, settings.threshold, settings.magnitude_mode);
+      break;
+    }
+    case NEGATIVE: {
+      negative(frame, converted_frame);
+      break;
+    }
+    case ADD_CONTRAST: {
+      static const PointLut add_contrast = PointLut::convert(2, 0);
+      add_contrast.apply(frame, converted_frame);
+      break;
+    }
+    case DEC_CONTRAST: {
+      static const PointLut dec_contrast = PointLut::convert(0.25, 0);
+      dec_contrast.apply(frame, converted_frame);
+      break;
+    }
+    case ADD_BRIGHTNESS: {
+      static const PointLut add_brightness = PointLut::convert(1, 100);
+      add_brightness.apply(frame, converted_frame);
+      break;
+    }
+    case DEC_BRIGHTNESS: {
+      static const PointLut dec_brightness = PointLut::convert(1, -100);
+      dec_brightness.apply(frame, converted_frame);
+      break;
+    }
+    case SEPIA: {
+      sepia(frame, converted_frame);
+      break;
+    }
+    case EMBOSS: {
+      emboss(frame, converted_frame);
+      break;
+    }
+    case CHAIN: {
+      settings.chain.apply(frame, converted_frame);
+      break;
+    }
+    case GAUSSIAN: {
+      gaussian_blur(frame, converted_frame, settings.blur_radius);
+      break;
+    }
+    default: {
+      frame.copyTo(converted_frame);
+      break;
+    }
+  }
+}
+
+int effect_halo(const EffectSettings &settings, int effect) {
+  switch (effect) {
+    case BLUR:
+    case BLUR_QUANTIZE:
+    case CARTOON:
+      return 2;
+    case X_SOBEL:
+    case Y_SOBEL:
+    case MAGNITUDE:
+    case EMBOSS:
+      return 1;
+    case CHAIN:
+      return settings.chain.halo();
+    case GAUSSIAN:
+      return gaussian_blur_halo(settings.blur_radius);
+    default:
+      return 0;
+  }
+}
@@ -1,54 +1,267 @@
 #include "../include/filter.h"
-#include<cmath>
+#include "../include/color_matrix.h"
+#include "../include/parallel.h"
+#include "../include/point_lut.h"
+#include "../include/row_kernels.h"
+#include <cmath>
+#include <algorithm>
+#include <cstring>
+#include <vector>
 
+// A stencil filter running in place would read rows that the strip above has already overwritten, so it keeps to a
+// single strip
+static int stencil_strip_rows(const cv::Mat &src, const cv::Mat &dst) {
+  return src.data == dst.data ? src.rows : MIN_STRIP_ROWS;
+}
+
+// greyscale and sepia are colour matrices, see color_matrix.h, and negative is a point table, see point_lut.h
 int greyscale(cv::Mat &src, cv::Mat &dst) {
-  for (int i = 0; i < src.rows; i++) {
-    for (int j = 0; j < src.cols; j++) {
-      cv::Vec3b pixel = src.at<cv::Vec3b>(i, j);
-      // copy green color channel to the other two channels
-      dst.at<cv::Vec3b>(i, j) = cv::Vec3b(pixel[1], pixel[1], pixel[1]);
+  static const ColorMatrix matrix = ColorMatrix::greyscale();
+  return matrix.apply(src, dst);
+}
+
+// Grow a scratch buffer on demand. The buffers are per thread and only grow, so a stream of same-sized frames never
+// allocates.
+template<typename T>
+static T *scratch(std::vector<T> &buffer, size_t size) {
+  if (buffer.size() < size) {
+    buffer.resize(size);
+  }
+  return buffer.data();
+}
+
+// A scratch frame that only grows: a header onto the top left rows x cols of buffer, so the regions of changing sizes
+// video_display filters in its incremental mode (dirty_tiles.h) all reuse the same memory
+static cv::Mat scratch_frame(cv::Mat &buffer, int rows, int cols, int type) {
+  if (buffer.rows < rows || buffer.cols < cols || buffer.type() != type) {
+    buffer.create(std::max(rows, buffer.rows), std::max(cols, buffer.cols), type);
+  }
+  return buffer(cv::Rect(0, 0, cols, rows));
+}
+
+static void copy_row(const uchar *src, uchar *dst, int width) {
+  if (src != dst) {
+    memcpy(dst, src, width);
+  }
+}
+
+/*
+ * Compute the rows [begin, end) of blur5x5. The horizontal pass of the 5 rows under the kernel is kept in a ring of 5
+ * rows (ring holds 5 * cols * 3 bytes), so the frame is read once and the intermediate never leaves the cache.
+ */
+static void blur5x5_rows(const cv::Mat &src, cv::Mat &dst, int begin, int end, uchar *ring) {
+  int rows = src.rows, cols = src.cols, width = cols * 3;
+  const RowKernels &k = row_kernels();
+  uchar *ring_rows[5];
+  for (int r = 0; r < 5; r++) {
+    ring_rows[r] = ring + r * width;
+  }
+  // the vertical pass only covers the rows [2, rows - 2), the others keep the source value
+  int first = std::max(begin, 2);
+  if (first < std::min(end, rows - 2)) {
+    for (int r = first - 2; r < first + 2; r++) {
+      blur_row(k, src.ptr<uchar>(r), ring_rows[r % 5], cols);
+    }
+  }
+  for (int i = begin; i < end; i++) {
+    if (i < 2 || i >= rows - 2) {
+      copy_row(src.ptr<uchar>(i), dst.ptr<uchar>(i), width);
+      continue;
+    }
+    blur_row(k, src.ptr<uchar>(i + 2), ring_rows[(i + 2) % 5], cols);
+    const uchar *taps[5] = {ring_rows[(i + 3) % 5], ring_rows[(i + 4) % 5], ring_rows[i % 5],
+                            ring_rows[(i + 1) % 5], ring_rows[(i + 2) % 5]};
+    k.blur_v(taps, dst.ptr<uchar>(i), width);
+  }
+}
+
+/*
+ * Compute the rows [begin, end) of sobelX3x3 or sobelY3x3 into a CV_16SC3 dst, with a ring of the 3 horizontally
+ * filtered rows under the kernel (ring holds 3 * cols * 3 shorts).
+ */
+static void sobel_rows(const cv::Mat &src, cv::Mat &dst, int begin, int end, bool y_direction, short *ring) {
+  int rows = src.rows, cols = src.cols, width = cols * 3;
+  const RowKernels &k = row_kernels();
+  short *ring_rows[3];
+  for (int r = 0; r < 3; r++) {
+    ring_rows[r] = ring + r * width;
+  }
+  // the vertical pass only covers the rows [1, rows - 1), the others keep the source value
+  int first = std::max(begin, 1);
+  if (first < std::min(end, rows - 1)) {
+    for (int r = first - 1; r < first + 1; r++) {
+      sobel_row(k, src.ptr<uchar>(r), ring_rows[r % 3], cols, y_direction);
+    }
+  }
+  for (int i = begin; i < end; i++) {
+    if (i < 1 || i >= rows - 1) {
+      widen_row(src.ptr<uchar>(i), dst.ptr<short>(i), width);
+      continue;
+    }
+    sobel_row(k, src.ptr<uchar>(i + 1), ring_rows[(i + 1) % 3], cols, y_direction);
+    const short *taps[3] = {ring_rows[(i + 2) % 3], ring_rows[i % 3], ring_rows[(i + 1) % 3]};
+    if (y_direction) {
+      k.diff_v(taps, dst.ptr<short>(i), width);
+    } else {
+      k.smooth_v(taps, dst.ptr<short>(i), width);
     }
   }
-  return 0;
 }
 
+static thread_local std::vector<uchar> blur_scratch;
+static thread_local std::vector<short> sobel_scratch;
+
 int blur5x5(cv::Mat &src, cv::Mat &dst) {
-  int kernel[] = {1, 2, 4, 2, 1};
-  cv::Mat converted;
-  // copy the src Mat to the converted and dst mat, which could make sure the values in the border pixel are not zero
-  src.copyTo(converted);
-  src.copyTo(dst);
+  dst.create(src.rows, src.cols, CV_8UC3);
+  parallel_for_rows(src.rows, stencil_strip_rows(src, dst), [&](int begin, int end) {
+    blur5x5_rows(src, dst, begin, end, scratch(blur_scratch, 5 * src.cols * 3));
+  });
+  return 0;
+}
 
-  // compute the product of the kernel and the area under it
-  for (int i = 0; i < src.rows; i++) {
-    for (int j = 0; j <= src.cols - 5; j++) {
-      int b_sum = 0, g_sum = 0, r_sum = 0;
-      for (int k = 0; k < 5; k++) {
-        b_sum += src.at<cv::Vec3b>(i, j + k)[0] * kernel[k];
-        g_sum += src.at<cv::Vec3b>(i, j + k)[1] * kernel[k];
-        r_sum += src.at<cv::Vec3b>(i, j + k)[2] * kernel[k];
-      }
-      converted.at<cv::Vec3b>(i, j + 2) =
-          // divide by 10 to narrow it to unsigned char
-          cv::Vec3b(b_sum / 10, g_sum / 10, r_sum / 10);
+// the width in bytes of the column bands the vertical box passes are split into, a band of 1080 rows is 135 KB
+#define BOX_BAND_WIDTH 128
+
+/*
+ * A box of 2 * radius + 1 pixels along a BGR row, the edge pixels repeated beyond both ends. The row is summed up once
+ * (prefix holds (cols + 2 * radius + 1) * 3 ints), every window is then the difference of two prefix sums, so a pixel
+ * costs the same whatever the radius. src and dst must not overlap.
+ */
+static void box_row(const RowKernels &k, const uchar *src, uchar *dst, int cols, int radius, int *prefix) {
+  // prefix[3 * q + c] sums the channel c of the first q pixels of the row with radius edge pixels on either side
+  int *p = prefix;
+  const uchar *first = src, *last = src + 3 * (cols - 1);
+  for (int q = 0; q <= radius; q++, p += 3) {
+    p[0] = q * first[0];
+    p[1] = q * first[1];
+    p[2] = q * first[2];
+  }
+  int b = p[-3], g = p[-2], r = p[-1];
+  for (const uchar *pixel = src; pixel < last; pixel += 3, p += 3) {
+    p[0] = b += pixel[0];
+    p[1] = g += pixel[1];
+    p[2] = r += pixel[2];
+  }
+  for (int q = 0; q <= radius; q++, p += 3) {
+    p[0] = b += last[0];
+    p[1] = g += last[1];
+    p[2] = r += last[2];
+  }
+  k.box_h(prefix + 3 * (2 * radius + 1), prefix, dst, cols * 3, 1.0f / (float) (2 * radius + 1));
+}
+
+/*
+ * The same box down width columns, one running sum per column (sum holds width ints), the edge rows repeated beyond
+ * the top and the bottom. src and dst must not overlap.
+ */
+static void box_columns(const RowKernels &k, const uchar *src, size_t src_step, uchar *dst, size_t dst_step, int rows,
+                        int width, int radius, int *sum) {
+  float scale = 1.0f / (float) (2 * radius + 1);
+  int last = rows - 1;
+  for (int x = 0; x < width; x++) {
+    sum[x] = (radius + 1) * src[x];
+  }
+  for (int y = 1; y <= radius; y++) {
+    const uchar *s = src + std::min(y, last) * src_step;
+    for (int x = 0; x < width; x++) {
+      sum[x] += s[x];
     }
   }
+  for (int y = 0; y < rows; y++) {
+    const uchar *add = src + std::min(y + radius + 1, last) * src_step, *sub = src + std::max(y - radius, 0) * src_step;
+    k.box_v(add, sub, sum, dst + y * dst_step, width, scale);
+  }
+}
 
-  // compute the product of the kernel transpose and the area under it
-  for (int i = 0; i <= src.rows - 5; i++) {
-    for (int j = 0; j < src.cols; j++) {
-      int b_sum = 0, g_sum = 0, r_sum = 0;
-      for (int k = 0; k < 5; k++) {
-        b_sum += converted.at<cv::Vec3b>(i + k, j)[0] * kernel[k];
-        g_sum += converted.at<cv::Vec3b>(i + k, j)[1] * kernel[k];
-        r_sum += converted.at<cv::Vec3b>(i + k, j)[2] * kernel[k];
+static thread_local cv::Mat box_scratch;
+static thread_local std::vector<uchar> box_rows_scratch, box_band_scratch;
+static thread_local std::vector<int> box_sums_scratch, box_prefix_scratch;
+
+/*
+ * passes boxes of the given radii one after the other. The horizontal passes run row by row on strips of rows, the
+ * vertical ones on bands of BOX_BAND_WIDTH columns from the top of the frame to the bottom, so a thread streams its
+ * band through all the vertical passes while it is in cache. dst may be src.
+ */
+static void stacked_box_blur(cv::Mat &src, cv::Mat &dst, const int *radii, int passes) {
+  int rows = src.rows, cols = src.cols, width = cols * 3;
+  const RowKernels &k = row_kernels();
+  int widest = *std::max_element(radii, radii + passes);
+  cv::Mat horizontal = scratch_frame(box_scratch, rows, cols, CV_8UC3);
+  parallel_for_rows(rows, MIN_STRIP_ROWS, [&](int begin, int end) {
+    uchar *ping = scratch(box_rows_scratch, 2 * (size_t) width), *pong = ping + width;
+    int *prefix = scratch(box_prefix_scratch, 3 * (size_t) (cols + 2 * widest + 1));
+    for (int i = begin; i < end; i++) {
+      const uchar *in = src.ptr<uchar>(i);
+      for (int p = 0; p < passes; p++) {
+        uchar *out = p == passes - 1 ? horizontal.ptr<uchar>(i) : p % 2 ? pong : ping;
+        box_row(k, in, out, cols, radii[p], prefix);
+        in = out;
+      }
+    }
+  });
+  dst.create(rows, cols, CV_8UC3);
+  int bands = (width + BOX_BAND_WIDTH - 1) / BOX_BAND_WIDTH;
+  parallel_for_rows(bands, 1, [&](int begin, int end) {
+    int *sum = scratch(box_sums_scratch, BOX_BAND_WIDTH);
+    uchar *band = scratch(box_band_scratch, 2 * (size_t) rows * BOX_BAND_WIDTH);
+    for (int b = begin; b < end; b++) {
+      int x = b * BOX_BAND_WIDTH, band_width = std::min(BOX_BAND_WIDTH, width - x);
+      const uchar *in = horizontal.ptr<uchar>(0) + x;
+      size_t in_step = horizontal.step;
+      for (int p = 0; p < passes; p++) {
+        bool last = p == passes - 1;
+        uchar *out = last ? dst.ptr<uchar>(0) + x : band + (size_t) (p % 2) * rows * BOX_BAND_WIDTH;
+        size_t out_step = last ? dst.step : BOX_BAND_WIDTH;
+        box_columns(k, in, in_step, out, out_step, rows, band_width, radii[p], sum);
+        in = out;
+        in_step = out_step;
       }
-      dst.at<cv::Vec3b>(i + 2, j) = cv::Vec3b(b_sum / 10, g_sum / 10, r_sum / 10);
     }
+  });
+}
+
+int box_blur(cv::Mat &src, cv::Mat &dst, int radius) {
+  if (radius < 1) {
+    src.copyTo(dst);
+    return 0;
   }
+  stacked_box_blur(src, dst, &radius, 1);
   return 0;
 }
 
+// three boxes whose widths bring the variance of their stack as close as odd widths can to sigma = radius / 2
+// (Kovesi, "Fast almost-Gaussian filtering")
+static void gaussian_box_radii(int radius, int radii[3]) {
+  double variance = radius * radius / 4.0;
+  int lower = (int) std::sqrt(4 * variance + 1);
+  if (lower % 2 == 0) {
+    lower--;
+  }
+  int lower_boxes = (int) std::lround((12 * variance - 3.0 * lower * lower - 12.0 * lower - 9) / (-4.0 * lower - 4));
+  for (int p = 0; p < 3; p++) {
+    radii[p] = p < lower_boxes ? (lower - 1) / 2 : (lower + 1) / 2;
+  }
+}
+
+int gaussian_blur(cv::Mat &src, cv::Mat &dst, int radius) {
+  if (radius <= 2) {
+    return blur5x5(src, dst);
+  }
+  int radii[3];
+  gaussian_box_radii(radius, radii);
+  stacked_box_blur(src, dst, radii, 3);
+  return 0;
+}
+
+int gaussian_blur_halo(int radius) {
+  if (radius <= 2) {
+    return 2;
+  }
+  int radii[3];
+  gaussian_box_radii(radius, radii);
+  return radii[0] + radii[1] + radii[2];
+}
+
 int separable_sobel(cv::Mat &src, cv::Mat &dst, const float horizontal_kernel[3], const float vertical_kernel[3]) {
   cv::Mat converted(src.rows, src.cols, CV_16SC3);
 
@@ -74,7 +287,7 @@ int separable_sobel(cv::Mat &src, cv::Mat &dst, const float horizontal_kernel[3]
 
   // vertical
   for (int i = 0; i <= src.rows - 3; i++) {
-    for (int j = 0; j <= src.cols; j++) {
+    for (int j = 0; j < src.cols; j++) {
       float b_sum = 0.0, g_sum = 0.0, r_sum = 0.0;
       for (int k = 0; k < 3; k++) {
         b_sum += converted.at<cv::Vec3s>(i + k, j)[0] * vertical_kernel[k];
@@ -88,24 +301,43 @@ int separable_sobel(cv::Mat &src, cv::Mat &dst, const float horizontal_kernel[3]
 }
 
 int transform(cv::Mat &src, cv::Mat &dst) {
-  for (int i = 0; i < src.rows; i++) {
-    for (int j = 0; j < src.cols; j++) {
-      cv::Vec3s pixel = src.at<cv::Vec3s>(i, j);
-      // For displaying, we convert the type of value from Vec3s to Vec3b by keeping the absolute value
-      dst.at<cv::Vec3b>(i, j) = cv::Vec3b(abs(pixel[0]), abs(pixel[1]), abs(pixel[2]));
+  parallel_for_rows(src.rows, MIN_STRIP_ROWS, [&](int begin, int end) {
+    for (int i = begin; i < end; i++) {
+      for (int j = 0; j < src.cols; j++) {
+        cv::Vec3s pixel = src.at<cv::Vec3s>(i, j);
+        // For displaying, we convert the type of value from Vec3s to Vec3b by keeping the absolute value
+        dst.at<cv::Vec3b>(i, j) = cv::Vec3b(abs(pixel[0]), abs(pixel[1]), abs(pixel[2]));
+      }
     }
-  }
+  });
   return 0;
 }
 
+// sobelX3x3 and sobelY3x3 run on the integer row kernels, they give the same result as the float kernels below
 int sobelX3x3(cv::Mat &src, cv::Mat &dst) {
+  dst.create(src.rows, src.cols, CV_16SC3);
+  parallel_for_rows(src.rows, MIN_STRIP_ROWS, [&](int begin, int end) {
+    sobel_rows(src, dst, begin, end, false, scratch(sobel_scratch, 3 * src.cols * 3));
+  });
+  return 0;
+}
+
+int sobelY3x3(cv::Mat &src, cv::Mat &dst) {
+  dst.create(src.rows, src.cols, CV_16SC3);
+  parallel_for_rows(src.rows, MIN_STRIP_ROWS, [&](int begin, int end) {
+    sobel_rows(src, dst, begin, end, true, scratch(sobel_scratch, 3 * src.cols * 3));
+  });
+  return 0;
+}
+
+int sobelX3x3_reference(cv::Mat &src, cv::Mat &dst) {
   float horizontal_kernel[3] = {1.0, 0.0, -1.0};
   float vertical_kernel[3] = {0.25, 0.5, 0.25};
   separable_sobel(src, dst, horizontal_kernel, vertical_kernel);
   return 0;
 }
 
-int sobelY3x3(cv::Mat &src, cv::Mat &dst) {
+int sobelY3x3_reference(cv::Mat &src, cv::Mat &dst) {
   float horizontal_kernel[3] = {0.25, 0.5, 0.25};
   float vertical_kernel[3] = {1.0, 0.0, -1.0};
   separable_sobel(src, dst, horizontal_kernel, vertical_kernel);
@@ -113,117 +345,280 @@ int sobelY3x3(cv::Mat &src, cv::Mat &dst) {
 }
 
 int magnitude(cv::Mat &sx, cv::Mat &sy, cv::Mat &dst) {
-  for (int i = 0; i < sx.rows; i++) {
-    for (int j = 0; j < sx.cols; j++) {
-      cv::Vec3s sx_pixel = sx.at<cv::Vec3s>(i, j);
-      cv::Vec3s sy_pixel = sy.at<cv::Vec3s>(i, j);
-      dst.at<cv::Vec3b>(i, j) = cv::Vec3b(
-          sqrt(sx_pixel[0] * sx_pixel[0] + sy_pixel[0] * sy_pixel[0]),
-          sqrt(sx_pixel[1] * sx_pixel[1] + sy_pixel[1] * sy_pixel[1]),
-          sqrt(sx_pixel[2] * sx_pixel[2] + sy_pixel[2] * sy_pixel[2]));
+  return magnitude(sx, sy, dst, MAGNITUDE_EXACT);
+}
+
+int magnitude(cv::Mat &sx, cv::Mat &sy, cv::Mat &dst, MagnitudeMode mode) {
+  dst.create(sx.rows, sx.cols, CV_8UC3);
+  const RowKernels &k = row_kernels();
+  parallel_for_rows(sx.rows, MIN_STRIP_ROWS, [&](int begin, int end) {
+    for (int i = begin; i < end; i++) {
+      k.magnitude(sx.ptr<short>(i), sy.ptr<short>(i), dst.ptr<uchar>(i), sx.cols * 3, mode);
+    }
+  });
+  return 0;
+}
+
+/*
+ * The rings of the fused gradient filters: the horizontal sobel passes of the 3 rows under the kernel for both
+ * directions, plus the gradients sx and sy of the current row (ring holds 8 * cols * 3 shorts)
+ */
+struct GradientRings {
+  short *dx_rows[3], *dy_rows[3];
+  short *sx, *sy;
+
+  explicit GradientRings(short *ring, int width) {
+    for (int r = 0; r < 3; r++) {
+      dx_rows[r] = ring + r * width;
+      dy_rows[r] = ring + (r + 3) * width;
     }
+    sx = ring + 6 * width;
+    sy = ring + 7 * width;
   }
+};
+
+// fill the rings for a strip starting at row begin, exactly like sobel_rows() does
+static void prime_gradient_rings(const RowKernels &k, const cv::Mat &src, GradientRings &g, int begin, int end) {
+  int first = std::max(begin, 1);
+  if (first < std::min(end, src.rows - 1)) {
+    for (int r = first - 1; r < first + 1; r++) {
+      sobel_row(k, src.ptr<uchar>(r), g.dx_rows[r % 3], src.cols, false);
+      sobel_row(k, src.ptr<uchar>(r), g.dy_rows[r % 3], src.cols, true);
+    }
+  }
+}
+
+/*
+ * g.sx and g.sy of row i, what sobelX3x3 and sobelY3x3 write to that row; on the border rows both of them leave the
+ * source value behind
+ */
+static void gradient_row(const RowKernels &k, const cv::Mat &src, GradientRings &g, int i) {
+  int width = src.cols * 3;
+  if (i < 1 || i >= src.rows - 1) {
+    widen_row(src.ptr<uchar>(i), g.sx, width);
+    widen_row(src.ptr<uchar>(i), g.sy, width);
+    return;
+  }
+  sobel_row(k, src.ptr<uchar>(i + 1), g.dx_rows[(i + 1) % 3], src.cols, false);
+  sobel_row(k, src.ptr<uchar>(i + 1), g.dy_rows[(i + 1) % 3], src.cols, true);
+  const short *dx_taps[3] = {g.dx_rows[(i + 2) % 3], g.dx_rows[i % 3], g.dx_rows[(i + 1) % 3]};
+  const short *dy_taps[3] = {g.dy_rows[(i + 2) % 3], g.dy_rows[i % 3], g.dy_rows[(i + 1) % 3]};
+  k.smooth_v(dx_taps, g.sx, width);
+  k.diff_v(dy_taps, g.sy, width);
+}
+
+static thread_local std::vector<short> gradient_scratch;
+
+int sobel_magnitude(cv::Mat &src, cv::Mat &dst, MagnitudeMode mode) {
+  dst.create(src.rows, src.cols, CV_8UC3);
+  const RowKernels &k = row_kernels();
+  int width = src.cols * 3;
+  parallel_for_rows(src.rows, stencil_strip_rows(src, dst), [&](int begin, int end) {
+    GradientRings g(scratch(gradient_scratch, 8 * (size_t) width), width);
+    prime_gradient_rings(k, src, g, begin, end);
+    for (int i = begin; i < end; i++) {
+      gradient_row(k, src, g, i);
+      k.magnitude(g.sx, g.sy, dst.ptr<uchar>(i), width, mode);
+    }
+  });
   return 0;
 }
 
+// the quantization table of the last levels asked for on this thread, only rebuilt when levels changes
+static const PointLut &quantize_lut(int levels) {
+  static thread_local int lut_levels = 0;
+  static thread_local PointLut lut;
+  if (levels != lut_levels) {
+    lut = PointLut::quantize(levels);
+    lut_levels = levels;
+  }
+  return lut;
+}
+
 int blurQuantize(cv::Mat &src, cv::Mat &dst, int levels) {
-  blur5x5(src, dst);
-  int b = 255 / levels;
-  for (int i = 0; i < dst.rows; i++) {
-    for (int j = 0; j < dst.cols; j++) {
-      dst.at<cv::Vec3b>(i, j)[0] /= b;
-      dst.at<cv::Vec3b>(i, j)[0] *= b;
-      dst.at<cv::Vec3b>(i, j)[1] /= b;
-      dst.at<cv::Vec3b>(i, j)[1] *= b;
-      dst.at<cv::Vec3b>(i, j)[2] /= b;
-      dst.at<cv::Vec3b>(i, j)[2] *= b;
-    }
-  }
-  return 0;
-}
-
-int cartoon(cv::Mat &src, cv::Mat &dst, int levels, int magThreshold) {
-  cv::Mat x_sobel_result(src.rows, src.cols, CV_16SC3);
-  sobelX3x3(src, x_sobel_result);
-  cv::Mat y_sobel_result(src.rows, src.cols, CV_16SC3);
-  sobelY3x3(src, y_sobel_result);
-  cv::Mat magnitude_result(src.rows, src.cols, CV_8UC3);
-  magnitude(x_sobel_result, y_sobel_result, magnitude_result);
-  blurQuantize(src, dst, levels);
-  for (int i = 0; i < dst.rows; i++) {
-    for (int j = 0; j < dst.cols; j++) {
-      for (int channel = 0; channel < 3; channel++) {
-        if (magnitude_result.at<cv::Vec3b>(i, j)[channel] > magThreshold) {
-          dst.at<cv::Vec3b>(i, j)[channel] = 0;
-        }
-      }
+  dst.create(src.rows, src.cols, CV_8UC3);
+  const PointLut &lut = quantize_lut(levels);
+  // quantize each strip right after blurring it, while it is still in cache
+  parallel_for_rows(src.rows, stencil_strip_rows(src, dst), [&](int begin, int end) {
+    blur5x5_rows(src, dst, begin, end, scratch(blur_scratch, 5 * src.cols * 3));
+    for (int i = begin; i < end; i++) {
+      lut.apply_row(dst.ptr<uchar>(i), dst.ptr<uchar>(i), dst.cols * 3);
     }
-  }
+  });
   return 0;
 }
 
-int negative(cv::Mat &src, cv::Mat &dst) {
-  for (int i = 0; i < dst.rows; i++) {
-    for (int j = 0; j < dst.cols; j++) {
-      dst.at<cv::Vec3b>(i, j) = cv::Vec3b(255 - src.at<cv::Vec3b>(i, j)[0],
-                                          255 - src.at<cv::Vec3b>(i, j)[1],
-                                          255 - src.at<cv::Vec3b>(i, j)[2]);
+/*
+ * Compute the rows [begin, end) of cartoon. The horizontal blur5x5 pass gets a ring of 5 rows, the two sobels the
+ * rings of sobel_magnitude(), and the gradient magnitude is only ever held for one row, so there are no full-frame
+ * intermediates. blur_ring holds 5 * cols * 3 bytes, ring holds 8 * cols * 3 shorts and magnitude cols * 3 bytes.
+ */
+static void cartoon_rows(const cv::Mat &src, cv::Mat &dst, int begin, int end, const PointLut &quantize,
+                         int magThreshold, MagnitudeMode mode, uchar *blur_ring, short *ring, uchar *magnitude) {
+  int rows = src.rows, cols = src.cols, width = cols * 3;
+  const RowKernels &k = row_kernels();
+  GradientRings g(ring, width);
+
+  uchar *blur_rows[5];
+  for (int r = 0; r < 5; r++) {
+    blur_rows[r] = blur_ring + r * width;
+  }
+
+  // prime both rings, exactly like blur5x5_rows() and sobel_rows() do
+  int blur_first = std::max(begin, 2);
+  if (blur_first < std::min(end, rows - 2)) {
+    for (int r = blur_first - 2; r < blur_first + 2; r++) {
+      blur_row(k, src.ptr<uchar>(r), blur_rows[r % 5], cols);
     }
   }
+  prime_gradient_rings(k, src, g, begin, end);
+  for (int i = begin; i < end; i++) {
+    uchar *d = dst.ptr<uchar>(i);
+    const uchar *s = src.ptr<uchar>(i);
+    if (i >= 2 && i < rows - 2) {
+      blur_row(k, src.ptr<uchar>(i + 2), blur_rows[(i + 2) % 5], cols);
+      const uchar *taps[5] = {blur_rows[(i + 3) % 5], blur_rows[(i + 4) % 5], blur_rows[i % 5],
+                              blur_rows[(i + 1) % 5], blur_rows[(i + 2) % 5]};
+      k.blur_v(taps, d, width);
+    } else {
+      copy_row(s, d, width);
+    }
+    gradient_row(k, src, g, i);
+    k.magnitude(g.sx, g.sy, magnitude, width, mode);
+    for (int x = 0; x < width; x++) {
+      d[x] = magnitude[x] > magThreshold ? 0 : quantize[d[x]];
+    }
+  }
+}
+
+static thread_local std::vector<short> cartoon_scratch;
+static thread_local std::vector<uchar> cartoon_magnitude_scratch;
+
+/*
+ * Fused version of sobelX3x3 + sobelY3x3 + magnitude + blurQuantize + edge masking in one pass over the frame. The
+ * result is identical to running the separate filters, including the unfiltered borders they leave behind.
+ */
+int cartoon(cv::Mat &src, cv::Mat &dst, int levels, int magThreshold, MagnitudeMode mode) {
+  dst.create(src.rows, src.cols, CV_8UC3);
+  const PointLut &quantize = quantize_lut(levels);
+  parallel_for_rows(src.rows, stencil_strip_rows(src, dst), [&](int begin, int end) {
+    cartoon_rows(src, dst, begin, end, quantize, magThreshold, mode, scratch(blur_scratch, 5 * src.cols * 3),
+                 scratch(cartoon_scratch, 8 * src.cols * 3), scratch(cartoon_magnitude_scratch, src.cols * 3));
+  });
   return 0;
 }
 
-// Sepia is not a filter operation, it is a weighted sum of the whole three channels
+int negative(cv::Mat &src, cv::Mat &dst) {
+  static const PointLut lut = PointLut::negative();
+  return lut.apply(src, dst);
+}
+
 int sepia(cv::Mat &src, cv::Mat &dst) {
-  for (int i = 0; i < src.rows; i++) {
-    for (int j = 0; j < src.cols; j++) {
-      double b_sum, g_sum, r_sum;
-      b_sum =
-          src.at<cv::Vec3b>(i, j)[2] * 0.272 + src.at<cv::Vec3b>(i, j)[1] * 0.534 + src.at<cv::Vec3b>(i, j)[0] * 0.131;
-      g_sum =
-          src.at<cv::Vec3b>(i, j)[2] * 0.349 + src.at<cv::Vec3b>(i, j)[1] * 0.686 + src.at<cv::Vec3b>(i, j)[0] * 0.168;
-      r_sum =
-          src.at<cv::Vec3b>(i, j)[2] * 0.393 + src.at<cv::Vec3b>(i, j)[1] * 0.769 + src.at<cv::Vec3b>(i, j)[0] * 0.189;
-      b_sum = fmin(255, b_sum);
-      g_sum = fmin(255, g_sum);
-      r_sum = fmin(255, r_sum);
-      dst.at<cv::Vec3b>(i, j) = cv::Vec3b(b_sum, g_sum, r_sum);
+  static const ColorMatrix matrix = ColorMatrix::sepia();
+  return matrix.apply(src, dst);
+}
+
+// Sepia is not a filter operation, it is a weighted sum of the whole three channels
+int sepia_reference(cv::Mat &src, cv::Mat &dst) {
+  parallel_for_rows(src.rows, MIN_STRIP_ROWS, [&](int begin, int end) {
+    for (int i = begin; i < end; i++) {
+      for (int j = 0; j < src.cols; j++) {
+        double b_sum, g_sum, r_sum;
+        b_sum =
+            src.at<cv::Vec3b>(i, j)[2] * 0.272 + src.at<cv::Vec3b>(i, j)[1] * 0.534 + src.at<cv::Vec3b>(i, j)[0] * 0.131;
+        g_sum =
+            src.at<cv::Vec3b>(i, j)[2] * 0.349 + src.at<cv::Vec3b>(i, j)[1] * 0.686 + src.at<cv::Vec3b>(i, j)[0] * 0.168;
+        r_sum =
+            src.at<cv::Vec3b>(i, j)[2] * 0.393 + src.at<cv::Vec3b>(i, j)[1] * 0.769 + src.at<cv::Vec3b>(i, j)[0] * 0.189;
+        b_sum = fmin(255, b_sum);
+        g_sum = fmin(255, g_sum);
+        r_sum = fmin(255, r_sum);
+        dst.at<cv::Vec3b>(i, j) = cv::Vec3b(b_sum, g_sum, r_sum);
+      }
     }
-  }
+  });
   return 0;
 }
 
+/*
+ * Compute the rows [begin, end) of emboss. The green channel of the 3 rows under the kernel is kept as planar rows in a
+ * ring, padded with the edge pixel repeated on both ends, and the rows above the first and below the last row of the
+ * frame are that row again, so the border pixels are filtered like any other. The kernel runs once per pixel on 16-bit
+ * lanes and its result is copied to the three channels as it is stored. ring holds 3 * (cols + 2) bytes, spare
+ * 3 * cols: the blue and red the deinterleave drops and the filtered row.
+ */
+static void emboss_rows(const cv::Mat &src, cv::Mat &dst, int begin, int end, uchar *ring, uchar *spare) {
+  int rows = src.rows, cols = src.cols, padded = cols + 2;
+  const RowKernels &k = row_kernels();
+  uchar *blue = spare, *red = spare + cols, *result = spare + 2 * cols;
+  auto load_green = [&](int r) {
+    uchar *green = ring + ((r + 3) % 3) * padded;
+    uchar *planes[3] = {blue, green + 1, red};
+    k.deinterleave(src.ptr<uchar>(std::min(std::max(r, 0), rows - 1)), planes, cols);
+    green[0] = green[1];
+    green[cols + 1] = green[cols];
+  };
+  load_green(begin - 1);
+  load_green(begin);
+  for (int i = begin; i < end; i++) {
+    // read before row i is written, so the filter can run in place
+    load_green(i + 1);
+    const uchar *taps[3] = {ring + ((i + 2) % 3) * padded, ring + (i % 3) * padded, ring + ((i + 1) % 3) * padded};
+    k.emboss_plane(taps, result - 1, 1, cols + 1);
+    const uchar *planes[3] = {result, result, result};
+    k.interleave(planes, dst.ptr<uchar>(i), cols);
+  }
+}
+
+static thread_local std::vector<uchar> emboss_ring_scratch;
+
 int emboss(cv::Mat &src, cv::Mat &dst) {
-  cv::Mat converted(src.rows, src.cols, CV_8UC3);
+  dst.create(src.rows, src.cols, CV_8UC3);
+  int cols = src.cols;
+  parallel_for_rows(src.rows, stencil_strip_rows(src, dst), [&](int begin, int end) {
+    uchar *ring = scratch(emboss_ring_scratch, 3 * (size_t) (cols + 2) + 3 * (size_t) cols);
+    emboss_rows(src, dst, begin, end, ring, ring + 3 * (cols + 2));
+  });
+  return 0;
+}
+
+// the greyscale copy emboss_reference works on, kept between frames so it is only allocated when the frame size changes
+static thread_local cv::Mat emboss_scratch;
+
+// The greyscale copy holds the green channel three times, so the kernel computes the same value for every channel
+int emboss_reference(cv::Mat &src, cv::Mat &dst) {
+  cv::Mat converted = scratch_frame(emboss_scratch, src.rows, src.cols, CV_8UC3);
   // do the greyscale for this 3-channels mat at first
   greyscale(src, converted);
   double kernel[3][3] = {{-2, -1, 0},
                          {-1, 1, 1},
                          {0, 1, 2}};
-  double b_sum = 0, g_sum = 0, r_sum = 0;
-  // filtering
-  for (int i = 1; i < converted.rows-1; i++) {
-    for (int j = 1; j < converted.cols-1; j++) {
-      b_sum = 0;
-      g_sum = 0;
-      r_sum = 0;
-      for (int dx = -1; dx < 2; dx++) {
-        for (int dy = -1; dy < 2; dy++) {
-          int new_row = i + dx, new_col = j + dy;
-            b_sum += converted.at<cv::Vec3b>(new_row, new_col)[0] * kernel[1+dx][1+dy];
-            g_sum += converted.at<cv::Vec3b>(new_row, new_col)[1] * kernel[1+dx][1+dy];
-            r_sum += converted.at<cv::Vec3b>(new_row, new_col)[2] * kernel[1+dx][1+dy];
+  // filtering, the strips only read the greyscale copy so they can be written in any order
+  parallel_for_rows(converted.rows, MIN_STRIP_ROWS, [&](int begin, int end) {
+    double b_sum = 0, g_sum = 0, r_sum = 0;
+    for (int i = std::max(begin, 1); i < std::min(end, converted.rows - 1); i++) {
+      for (int j = 1; j < converted.cols - 1; j++) {
+        b_sum = 0;
+        g_sum = 0;
+        r_sum = 0;
+        for (int dx = -1; dx < 2; dx++) {
+          for (int dy = -1; dy < 2; dy++) {
+            int new_row = i + dx, new_col = j + dy;
+            b_sum += converted.at<cv::Vec3b>(new_row, new_col)[0] * kernel[1 + dx][1 + dy];
+            g_sum += converted.at<cv::Vec3b>(new_row, new_col)[1] * kernel[1 + dx][1 + dy];
+            r_sum += converted.at<cv::Vec3b>(new_row, new_col)[2] * kernel[1 + dx][1 + dy];
+          }
         }
+        // since the coefficients in the kernel could be negative, I narrow the final value into [0, 255]
+        b_sum = fmax(b_sum, 0);
+        b_sum = fmin(b_sum, 255);
+        g_sum = fmax(g_sum, 0);
+        g_sum = fmin(g_sum, 255);
+        r_sum = fmax(r_sum, 0);
+        r_sum = fmin(r_sum, 255);
+        dst.at<cv::Vec3b>(i, j) = cv::Vec3b((uchar) b_sum, (uchar) g_sum, (uchar) r_sum);
       }
-      // since the coefficients in the kernel could be negative, I narrow the final value into [0, 255]
-      b_sum = fmax(b_sum, 0);
-      b_sum = fmin(b_sum, 255);
-      g_sum = fmax(g_sum, 0);
-      g_sum = fmin(g_sum, 255);
-      r_sum = fmax(r_sum, 0);
-      r_sum = fmin(r_sum, 255);
-      dst.at<cv::Vec3b>(i, j) = cv::Vec3b((uchar) b_sum, (uchar) g_sum, (uchar) r_sum);
     }
-  }
+  });
   return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,418 @@
+#include "filter_graph.h"
+#include "parallel.h"
+#include "row_kernels.h"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+// the bytes of intermediate rows a strip may keep, about what an L2 cache holds
+#define GRAPH_STRIP_BYTES (512 * 1024)
+
+namespace {
+
+// consecutive rows of a frame, row(y) is the row y of the whole frame as long as the band holds it
+struct Band {
+  uchar *data;
+  int first;
+  size_t step;
+
+  uchar *row(int y) const {
+    return data + (size_t) (y - first) * step;
+  }
+};
+
+// one pass over the frame: an optional stencil stage followed by the point-wise stages [first_point, end_point)
+struct Pass {
+  int stencil;
+  int radius;
+  size_t first_point, end_point;
+};
+
+bool is_point(StageType type) {
+  return type < STAGE_BLUR;
+}
+
+int stencil_radius(StageType type) {
+  return type == STAGE_BLUR ? 2 : 1;
+}
+
+template<typename T>
+T *scratch(std::vector<T> &buffer, size_t size) {
+  if (buffer.size() < size) {
+    buffer.resize(size);
+  }
+  return buffer.data();
+}
+
+thread_local std::vector<uchar> intermediate_scratch, blur_ring_scratch, emboss_ring_scratch;
+thread_local std::vector<short> sobel_ring_scratch;
+// the passes of the chain being applied, and the first and end row every pass has to produce for the current strip
+thread_local std::vector<Pass> pass_scratch;
+thread_local std::vector<int> need_scratch;
+// the copy of the input an in-place chain with stencils reads from
+thread_local cv::Mat input_copy;
+
+bool is_table(StageType type) {
+  return type == STAGE_NEGATIVE || type == STAGE_CONVERT || type == STAGE_QUANTIZE;
+}
+
+// append a stage that is a point table, or fold it into the table of the stage before when that is one too
+void push_table_stage(std::vector<GraphStage> &stages, const GraphStage &stage) {
+  if (!stages.empty() && is_table(stages.back().type)) {
+    stages.back().lut = stages.back().lut.then(stage.lut);
+  } else {
+    stages.push_back(stage);
+  }
+}
+
+// the point-wise stages, the colour matrices of greyscale() and sepia() and the tables of the per-channel ones
+void apply_point(const GraphStage &stage, uchar *row, int cols) {
+  if (is_table(stage.type)) {
+    stage.lut.apply_row(row, row, cols * 3);
+  } else {
+    stage.matrix.apply_row(row, row, cols);
+  }
+}
+
+void copy_row(const uchar *src, uchar *dst, int width) {
+  if (src != dst) {
+    memcpy(dst, src, width);
+  }
+}
+
+// blur5x5 of the rows [begin, end), with the ring of horizontally filtered rows of blur5x5_rows() in filter.cpp
+void blur_pass(const Band &in, const Band &out, int begin, int end, int rows, int cols) {
+  int width = cols * 3;
+  const RowKernels &k = row_kernels();
+  uchar *ring = scratch(blur_ring_scratch, 5 * (size_t) width);
+  uchar *ring_rows[5];
+  for (int r = 0; r < 5; r++) {
+    ring_rows[r] = ring + r * width;
+  }
+  int first = std::max(begin, 2);
+  if (first < std::min(end, rows - 2)) {
+    for (int r = first - 2; r < first + 2; r++) {
+      blur_row(k, in.row(r), ring_rows[r % 5], cols);
+    }
+  }
+  for (int i = begin; i < end; i++) {
+    if (i < 2 || i >= rows - 2) {
+      copy_row(in.row(i), out.row(i), width);
+      continue;
+    }
+    blur_row(k, in.row(i + 2), ring_rows[(i + 2) % 5], cols);
+    const uchar *taps[5] = {ring_rows[(i + 3) % 5], ring_rows[(i + 4) % 5], ring_rows[i % 5],
+                            ring_rows[(i + 1) % 5], ring_rows[(i + 2) % 5]};
+    k.blur_v(taps, out.row(i), width);
+  }
+}
+
+// sobelX3x3 or sobelY3x3 followed by transform(), or both followed by magnitude(), of the rows [begin, end)
+void sobel_pass(const GraphStage &stage, const Band &in, const Band &out, int begin, int end, int rows, int cols) {
+  StageType type = stage.type;
+  int width = cols * 3;
+  const RowKernels &k = row_kernels();
+  bool need_x = type != STAGE_SOBEL_Y, need_y = type != STAGE_SOBEL_X;
+  short *ring = scratch(sobel_ring_scratch, 8 * (size_t) width);
+  short *dx_rows[3], *dy_rows[3];
+  for (int r = 0; r < 3; r++) {
+    dx_rows[r] = ring + r * width;
+    dy_rows[r] = ring + (r + 3) * width;
+  }
+  short *sx = ring + 6 * width, *sy = ring + 7 * width;
+  int first = std::max(begin, 1);
+  if (first < std::min(end, rows - 1)) {
+    for (int r = first - 1; r < first + 1; r++) {
+      if (need_x) {
+        sobel_row(k, in.row(r), dx_rows[r % 3], cols, false);
+      }
+      if (need_y) {
+        sobel_row(k, in.row(r), dy_rows[r % 3], cols, true);
+      }
+    }
+  }
+  for (int i = begin; i < end; i++) {
+    const uchar *s = in.row(i);
+    uchar *d = out.row(i);
+    bool inside = i >= 1 && i < rows - 1;
+    if (inside) {
+      if (need_x) {
+        sobel_row(k, in.row(i + 1), dx_rows[(i + 1) % 3], cols, false);
+        const short *taps[3] = {dx_rows[(i + 2) % 3], dx_rows[i % 3], dx_rows[(i + 1) % 3]};
+        k.smooth_v(taps, sx, width);
+      }
+      if (need_y) {
+        sobel_row(k, in.row(i + 1), dy_rows[(i + 1) % 3], cols, true);
+        const short *taps[3] = {dy_rows[(i + 2) % 3], dy_rows[i % 3], dy_rows[(i + 1) % 3]};
+        k.diff_v(taps, sy, width);
+      }
+    }
+    if (type != STAGE_MAGNITUDE) {
+      // on the border rows the sobel filters leave the source value, which transform() gives back unchanged
+      if (!inside) {
+        copy_row(s, d, width);
+        continue;
+      }
+      const short *g = type == STAGE_SOBEL_X ? sx : sy;
+      for (int x = 0; x < width; x++) {
+        d[x] = (uchar) abs(g[x]);
+      }
+      continue;
+    }
+    if (!inside) {
+      // both sobels leave the source value on the border rows
+      widen_row(s, sx, width);
+      widen_row(s, sy, width);
+    }
+    k.magnitude(sx, sy, d, width, stage.magnitude_mode);
+  }
+}
+
+// emboss of the rows [begin, end), with the ring of padded green rows of emboss_rows() in filter.cpp
+void emboss_pass(const Band &in, const Band &out, int begin, int end, int rows, int cols) {
+  const RowKernels &k = row_kernels();
+  int padded = cols + 2;
+  uchar *ring = scratch(emboss_ring_scratch, 3 * (size_t) padded + 3 * (size_t) cols);
+  uchar *blue = ring + 3 * padded, *red = blue + cols, *result = red + cols;
+  // the rows beyond the frame are its edge rows again, which the band of the pass before always holds
+  auto load_green = [&](int r) {
+    uchar *green = ring + ((r + 3) % 3) * padded;
+    uchar *planes[3] = {blue, green + 1, red};
+    k.deinterleave(in.row(std::min(std::max(r, 0), rows - 1)), planes, cols);
+    green[0] = green[1];
+    green[cols + 1] = green[cols];
+  };
+  load_green(begin - 1);
+  load_green(begin);
+  for (int i = begin; i < end; i++) {
+    load_green(i + 1);
+    const uchar *taps[3] = {ring + ((i + 2) % 3) * padded, ring + (i % 3) * padded, ring + ((i + 1) % 3) * padded};
+    k.emboss_plane(taps, result - 1, 1, cols + 1);
+    const uchar *planes[3] = {result, result, result};
+    k.interleave(planes, out.row(i), cols);
+  }
+}
+
+}
+
+FilterGraph &FilterGraph::add_magnitude(MagnitudeMode mode) {
+  GraphStage stage;
+  stage.type = STAGE_MAGNITUDE;
+  stage.magnitude_mode = mode;
+  stages.push_back(stage);
+  return *this;
+}
+
+FilterGraph &FilterGraph::add(StageType type) {
+  GraphStage stage;
+  stage.type = type;
+  if (type == STAGE_GREYSCALE) {
+    stage.matrix = ColorMatrix::greyscale();
+  } else if (type == STAGE_SEPIA) {
+    stage.matrix = ColorMatrix::sepia();
+  } else if (type == STAGE_NEGATIVE) {
+    stage.lut = PointLut::negative();
+    push_table_stage(stages, stage);
+    return *this;
+  }
+  stages.push_back(stage);
+  return *this;
+}
+
+FilterGraph &FilterGraph::add_convert(double alpha, double beta) {
+  GraphStage stage;
+  stage.type = STAGE_CONVERT;
+  stage.alpha = alpha;
+  stage.beta = beta;
+  stage.lut = PointLut::convert(alpha, beta);
+  push_table_stage(stages, stage);
+  return *this;
+}
+
+FilterGraph &FilterGraph::add_quantize(int levels) {
+  GraphStage stage;
+  stage.type = STAGE_QUANTIZE;
+  stage.levels = std::max(std::min(levels, 255), 1);
+  stage.lut = PointLut::quantize(stage.levels);
+  push_table_stage(stages, stage);
+  return *this;
+}
+
+int FilterGraph::parse(const std::string &chain) {
+  static const struct {
+    const char *name;
+    StageType type;
+  } names[] = {
+      {"greyscale", STAGE_GREYSCALE},
+      {"negative", STAGE_NEGATIVE},
+      {"sepia", STAGE_SEPIA},
+      {"blur", STAGE_BLUR},
+      {"sobel_x", STAGE_SOBEL_X},
+      {"sobel_y", STAGE_SOBEL_Y},
+      {"magnitude", STAGE_MAGNITUDE},
+      {"emboss", STAGE_EMBOSS},
+  };
+  clear();
+  size_t begin = 0;
+  while (begin <= chain.size()) {
+    size_t end = chain.find(',', begin);
+    if (end == std::string::npos) {
+      end = chain.size();
+    }
+    std::string name = chain.substr(begin, end - begin);
+    std::string argument;
+    size_t colon = name.find(':');
+    if (colon != std::string::npos) {
+      argument = name.substr(colon + 1);
+      name = name.substr(0, colon);
+    }
+    bool known = false;
+    for (const auto &entry: names) {
+      if (name == entry.name && argument.empty()) {
+        add(entry.type);
+        known = true;
+      }
+    }
+    if (name == "contrast" && !argument.empty()) {
+      add_convert(atof(argument.c_str()), 0);
+      known = true;
+    } else if (name == "brightness" && !argument.empty()) {
+      add_convert(1, atof(argument.c_str()));
+      known = true;
+    } else if (name == "quantize") {
+      add_quantize(argument.empty() ? 15 : atoi(argument.c_str()));
+      known = true;
+    } else if (name == "magnitude" && !argument.empty()) {
+      MagnitudeMode mode;
+      if (parse_magnitude_mode(argument.c_str(), mode) == 0) {
+        add_magnitude(mode);
+        known = true;
+      }
+    }
+    if (!known) {
+      clear();
+      return -1;
+    }
+    begin = end + 1;
+  }
+  return 0;
+}
+
+void FilterGraph::clear() {
+  stages.clear();
+}
+
+bool FilterGraph::empty() const {
+  return stages.empty();
+}
+
+int FilterGraph::halo() const {
+  int halo = 0;
+  for (const GraphStage &stage: stages) {
+    if (!is_point(stage.type)) {
+      halo += stencil_radius(stage.type);
+    }
+  }
+  return halo;
+}
+
+int FilterGraph::apply(cv::Mat &src, cv::Mat &dst) const {
+  // split the chain into passes, each stencil stage starting a new one; leading point-wise stages get a pass of
+  // their own
+  std::vector<Pass> &passes = pass_scratch;
+  passes.clear();
+  for (size_t i = 0; i < stages.size(); i++) {
+    if (is_point(stages[i].type)) {
+      if (passes.empty()) {
+        Pass pass = {-1, 0, i, i};
+        passes.push_back(pass);
+      }
+    } else {
+      Pass pass = {stages[i].type, stencil_radius(stages[i].type), i + 1, i + 1};
+      passes.push_back(pass);
+    }
+    passes.back().end_point = i + 1;
+  }
+  if (passes.empty()) {
+    src.copyTo(dst);
+    return 0;
+  }
+  const cv::Mat *input = &src;
+  if (src.data == dst.data && passes.back().stencil >= 0) {
+    // a stencil would read rows that another strip has already overwritten
+    input_copy.create(src.rows, src.cols, CV_8UC3);
+    src.copyTo(input_copy);
+    input = &input_copy;
+  }
+  dst.create(src.rows, src.cols, CV_8UC3);
+
+  int rows = src.rows, cols = src.cols, width = cols * 3;
+  int intermediates = (int) passes.size() - 1;
+  int halo = 0;
+  for (const Pass &pass: passes) {
+    halo += pass.radius;
+  }
+  // a strip keeps the intermediate rows of every pass but the last, about GRAPH_STRIP_BYTES of them; a chain fused into
+  // a single pass has none, and its strips are only sized by the number of threads
+  int strip_rows = MIN_STRIP_ROWS;
+  if (intermediates > 0) {
+    strip_rows = std::max(MIN_STRIP_ROWS, GRAPH_STRIP_BYTES / (width * intermediates) - 2 * halo);
+  }
+  // and never more than a thread's share of the frame, so a small frame or a narrow chain still runs on every thread
+  int threads = get_num_threads();
+  strip_rows = std::min(strip_rows, std::max(MIN_STRIP_ROWS, (rows + threads - 1) / threads));
+  const std::vector<GraphStage> &chain = stages;
+  Band source = {input->data, 0, input->step};
+  Band target = {dst.data, 0, dst.step};
+
+  parallel_for_rows(rows, strip_rows, [&](int strip_begin, int strip_end) {
+    int *need_begin = scratch(need_scratch, 2 * passes.size()), *need_end = need_begin + passes.size();
+    size_t last = passes.size() - 1;
+    for (int begin = strip_begin; begin < strip_end; begin += strip_rows) {
+      int end = std::min(begin + strip_rows, strip_end);
+      // walk the chain backwards to find the rows every pass has to produce for this strip
+      need_begin[last] = begin;
+      need_end[last] = end;
+      for (size_t p = last; p > 0; p--) {
+        need_begin[p - 1] = std::max(need_begin[p] - passes[p].radius, 0);
+        need_end[p - 1] = std::min(need_end[p] + passes[p].radius, rows);
+      }
+      size_t buffer_rows = 0;
+      for (size_t p = 0; p + 1 < passes.size(); p++) {
+        buffer_rows += need_end[p] - need_begin[p];
+      }
+      uchar *buffer = scratch(intermediate_scratch, buffer_rows * width);
+
+      Band in = source;
+      for (size_t p = 0; p < passes.size(); p++) {
+        Band out = target;
+        if (p + 1 < passes.size()) {
+          out.data = buffer;
+          out.first = need_begin[p];
+          out.step = width;
+          buffer += (size_t) (need_end[p] - need_begin[p]) * width;
+        }
+        const Pass &pass = passes[p];
+        if (pass.stencil == STAGE_BLUR) {
+          blur_pass(in, out, need_begin[p], need_end[p], rows, cols);
+        } else if (pass.stencil == STAGE_EMBOSS) {
+          emboss_pass(in, out, need_begin[p], need_end[p], rows, cols);
+        } else if (pass.stencil >= 0) {
+          // the stencil stage of a pass is the one right before its point-wise stages
+          sobel_pass(chain[pass.first_point - 1], in, out, need_begin[p], need_end[p], rows, cols);
+        }
+        // the point-wise stages work on every output row while it is still in L1
+        for (int i = need_begin[p]; i < need_end[p]; i++) {
+          if (pass.stencil < 0) {
+            copy_row(in.row(i), out.row(i), width);
+          }
+          for (size_t s = pass.first_point; s < pass.end_point; s++) {
+            apply_point(chain[s], out.row(i), cols);
+          }
+        }
+        in = out;
+      }
+    }
+  });
+  return 0;
+}
@@ -0,0 +1,42 @@
+#include "frame_pool.h"
+#include <algorithm>
+
+FramePool::FramePool(const std::vector<int> &types)
+    : buffer_types(types), buffers(types.size()), in_use(types.size(), 0), grown(0) {
+}
+
+void FramePool::reserve(cv::Size size) {
+  if (size.width == frame_size.width && size.height == frame_size.height) {
+    return;
+  }
+  frame_size = size;
+  for (size_t i = 0; i < buffers.size(); i++) {
+    buffers[i].create(size.height, size.width, buffer_types[i]);
+  }
+}
+
+cv::Mat FramePool::acquire(int type) {
+  for (size_t i = 0; i < buffers.size(); i++) {
+    if (!in_use[i] && buffer_types[i] == type) {
+      in_use[i] = 1;
+      return buffers[i];
+    }
+  }
+  grown++;
+  buffer_types.push_back(type);
+  buffers.push_back(cv::Mat(frame_size.height, frame_size.width, type));
+  in_use.push_back(1);
+  return buffers.back();
+}
+
+cv::Mat FramePool::acquire(int type, cv::Size size) {
+  return acquire(type)(cv::Rect(0, 0, size.width, size.height));
+}
+
+void FramePool::release_all() {
+  std::fill(in_use.begin(), in_use.end(), 0);
+}
+
+int FramePool::grow_count() const {
+  return grown;
+}
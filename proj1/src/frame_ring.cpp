@@ -0,0 +1,90 @@
+#include "frame_ring.h"
+
+/*
+ * capacity + 3 buffers: at most capacity in the queue, one being filled by the producer and up to two held by the
+ * consumer (the one it is done with and the one it just popped, between the two steps of pop()). Whatever is left
+ * sits in free_frames, so the producer always finds a buffer there after a push. Only the consumer gives buffers back
+ * to free_frames, the producer keeps the frames it drops for itself.
+ */
+FrameRing::FrameRing(int capacity)
+    : frames(capacity + 3), queued(capacity), free_frames(capacity + 3), producer_index(0), consumer_index(-1),
+      drop_count(0) {
+  for (int i = 1; i < (int) frames.size(); i++) {
+    free_frames.push(i);
+  }
+}
+
+Frame &FrameRing::producer_frame() {
+  return frames[producer_index];
+}
+
+void FrameRing::push() {
+  int oldest = -1;
+  while (!queued.push(producer_index)) {
+    // full: take the oldest frame back, unless the consumer got to it first, and fill it next
+    if (queued.pop(oldest)) {
+      drop_count.fetch_add(1, std::memory_order_relaxed);
+    }
+  }
+  if (oldest >= 0) {
+    producer_index = oldest;
+    return;
+  }
+  while (!free_frames.pop(producer_index)) {
+    // cannot happen with capacity + 3 buffers, see the constructor
+  }
+}
+
+bool FrameRing::full() const {
+  return queued.full();
+}
+
+Frame *FrameRing::pop() {
+  int next;
+  if (!queued.pop(next)) {
+    return nullptr;
+  }
+  if (consumer_index >= 0) {
+    free_frames.push(consumer_index);
+  }
+  consumer_index = next;
+  return &frames[consumer_index];
+}
+
+long FrameRing::dropped() const {
+  return drop_count.load(std::memory_order_relaxed);
+}
+
+FrameRing::IndexQueue::IndexQueue(int capacity)
+    : slots(new std::atomic<int>[capacity]), capacity(capacity), head(0), tail(0) {
+}
+
+bool FrameRing::IndexQueue::push(int index) {
+  unsigned long long h = head.load(std::memory_order_relaxed);
+  if (h - tail.load(std::memory_order_acquire) == capacity) {
+    return false;
+  }
+  slots[h % capacity].store(index, std::memory_order_relaxed);
+  // publishes the slot, and the pixels of the frame it points to
+  head.store(h + 1, std::memory_order_release);
+  return true;
+}
+
+bool FrameRing::IndexQueue::pop(int &index) {
+  unsigned long long t = tail.load(std::memory_order_acquire);
+  for (;;) {
+    if (t == head.load(std::memory_order_acquire)) {
+      return false;
+    }
+    int slot = slots[t % capacity].load(std::memory_order_relaxed);
+    // the producer dropping the oldest frame pops too, whoever moves tail first owns the frame
+    if (tail.compare_exchange_weak(t, t + 1, std::memory_order_acq_rel, std::memory_order_acquire)) {
+      index = slot;
+      return true;
+    }
+  }
+}
+
+bool FrameRing::IndexQueue::full() const {
+  return head.load(std::memory_order_relaxed) - tail.load(std::memory_order_acquire) == capacity;
+}
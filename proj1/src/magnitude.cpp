@@ -0,0 +1,20 @@
+#include "magnitude.h"
+#include <cstring>
+
+const char *magnitude_mode_name(MagnitudeMode mode) {
+  switch (mode) {
+    case MAGNITUDE_L1:return "l1";
+    case MAGNITUDE_MAX_MIN:return "maxmin";
+    default:return "exact";
+  }
+}
+
+int parse_magnitude_mode(const char *name, MagnitudeMode &mode) {
+  for (int m = MAGNITUDE_EXACT; m <= MAGNITUDE_MAX_MIN; m++) {
+    if (strcmp(name, magnitude_mode_name((MagnitudeMode) m)) == 0) {
+      mode = (MagnitudeMode) m;
+      return 0;
+    }
+  }
+  return -1;
+}
@@ -0,0 +1,170 @@
+#include "parallel.h"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// strips handed out per thread, more than one so that a thread stuck on a slow strip does not hold up the others
+#define STRIPS_PER_THREAD 4
+
+namespace {
+
+// set while a thread runs strips of a job, so a filter called from a strip runs its own strips in place instead of
+// taking run_mutex again, which that thread may already hold
+thread_local bool in_job = false;
+
+/*
+ * A fixed set of worker threads sleeping on a condition variable. A job is a range of strips; the calling thread and
+ * each worker first run the strip of their own index (0 for the caller, 1 and up for the workers), then pull strip
+ * indices from a shared atomic counter until none are left. The fixed first strip means every thread takes part in every
+ * job with at least as many strips as threads, so the per-thread scratch rows of the filters are all sized on the first
+ * frame and never grow later, whichever thread happens to wake up first.
+ */
+class WorkerPool {
+ public:
+  WorkerPool()
+      : generation(0), stopping(false), active(0), body(nullptr), context(nullptr), rows(0), strip_rows(1),
+        next_strip(0) {
+    start(default_threads() - 1);
+  }
+
+  ~WorkerPool() {
+    stop();
+  }
+
+  void resize(int threads) {
+    std::lock_guard<std::mutex> job(run_mutex);
+    stop();
+    start(std::max(threads, 1) - 1);
+  }
+
+  int threads() const {
+    return (int) workers.size() + 1;
+  }
+
+  void run(int total_rows, int strip_height, void (*strip_body)(void *, int, int), void *strip_context) {
+    std::unique_lock<std::mutex> job;
+    if (!in_job && !workers.empty() && total_rows > strip_height) {
+      job = std::unique_lock<std::mutex>(run_mutex, std::try_to_lock);
+    }
+    if (!job.owns_lock()) {
+      for (int begin = 0; begin < total_rows; begin += strip_height) {
+        strip_body(strip_context, begin, std::min(begin + strip_height, total_rows));
+      }
+      return;
+    }
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      body = strip_body;
+      context = strip_context;
+      rows = total_rows;
+      strip_rows = strip_height;
+      next_strip = (int) workers.size() + 1;
+      active = (int) workers.size();
+      generation++;
+    }
+    wake.notify_all();
+    in_job = true;
+    run_strips(0);
+    in_job = false;
+    // every worker has to check in, so none of them can still be looking at this job once we return
+    std::unique_lock<std::mutex> lock(mutex);
+    done.wait(lock, [this] { return active == 0; });
+  }
+
+ private:
+  static int default_threads() {
+    return std::max((int) std::thread::hardware_concurrency(), 1);
+  }
+
+  void start(int count) {
+    stopping = false;
+    for (int i = 0; i < count; i++) {
+      workers.emplace_back(&WorkerPool::worker_loop, this, generation, i + 1);
+    }
+  }
+
+  void stop() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    wake.notify_all();
+    for (std::thread &worker: workers) {
+      worker.join();
+    }
+    workers.clear();
+  }
+
+  void run_strips(int first_strip) {
+    for (int strip = first_strip;; strip = next_strip.fetch_add(1)) {
+      int begin = strip * strip_rows;
+      if (begin >= rows) {
+        return;
+      }
+      body(context, begin, std::min(begin + strip_rows, rows));
+    }
+  }
+
+  void worker_loop(unsigned long seen, int index) {
+    // a worker only ever runs strips of a job
+    in_job = true;
+    for (;;) {
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        wake.wait(lock, [this, seen] { return stopping || generation != seen; });
+        if (stopping) {
+          return;
+        }
+        seen = generation;
+      }
+      run_strips(index);
+      std::lock_guard<std::mutex> lock(mutex);
+      if (--active == 0) {
+        done.notify_one();
+      }
+    }
+  }
+
+  std::vector<std::thread> workers;
+  // held for the whole job, so only one job runs on the pool at a time
+  std::mutex run_mutex;
+  std::mutex mutex;
+  std::condition_variable wake, done;
+  unsigned long generation;
+  bool stopping;
+  int active;
+  void (*body)(void *, int, int);
+  void *context;
+  int rows, strip_rows;
+  std::atomic<int> next_strip;
+};
+
+WorkerPool &pool() {
+  static WorkerPool worker_pool;
+  return worker_pool;
+}
+
+}
+
+void set_num_threads(int threads) {
+  if (threads <= 0) {
+    threads = (int) std::thread::hardware_concurrency();
+  }
+  pool().resize(threads);
+}
+
+int get_num_threads() {
+  return pool().threads();
+}
+
+void parallel_for_rows(int rows, int min_strip_rows, void (*body)(void *context, int begin, int end), void *context) {
+  if (rows <= 0) {
+    return;
+  }
+  int strips = get_num_threads() * STRIPS_PER_THREAD;
+  int strip_rows = std::max((rows + strips - 1) / strips, std::max(min_strip_rows, 1));
+  pool().run(rows, strip_rows, body, context);
+}
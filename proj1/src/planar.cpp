@@ -0,0 +1,221 @@
+#include "planar.h"
+#include "parallel.h"
+#include "row_kernels.h"
+#include <cstring>
+#include <vector>
+
+void PlanarFrame::create(int rows, int cols, int type) {
+  for (cv::Mat &plane: planes) {
+    plane.create(rows, cols, type);
+  }
+}
+
+int PlanarFrame::rows() const {
+  return planes[0].rows;
+}
+
+int PlanarFrame::cols() const {
+  return planes[0].cols;
+}
+
+// Grow a scratch buffer on demand, per thread and only ever growing, like the ones of filter.cpp
+template<typename T>
+static T *scratch(std::vector<T> &buffer, size_t size) {
+  if (buffer.size() < size) {
+    buffer.resize(size);
+  }
+  return buffer.data();
+}
+
+// a stencil running in place keeps to a single strip, see stencil_strip_rows() in filter.cpp
+static int stencil_strip_rows(const PlanarFrame &src, const PlanarFrame &dst) {
+  return src.planes[0].data == dst.planes[0].data ? src.rows() : MIN_STRIP_ROWS;
+}
+
+int to_planar(cv::Mat &src, PlanarFrame &dst) {
+  dst.create(src.rows, src.cols, CV_8UC1);
+  const RowKernels &k = row_kernels();
+  parallel_for_rows(src.rows, MIN_STRIP_ROWS, [&](int begin, int end) {
+    for (int i = begin; i < end; i++) {
+      uchar *const planes[3] = {dst.planes[0].ptr<uchar>(i), dst.planes[1].ptr<uchar>(i), dst.planes[2].ptr<uchar>(i)};
+      k.deinterleave(src.ptr<uchar>(i), planes, src.cols);
+    }
+  });
+  return 0;
+}
+
+int to_interleaved(PlanarFrame &src, cv::Mat &dst) {
+  int rows = src.rows(), cols = src.cols();
+  if (src.planes[0].type() == CV_16SC1) {
+    // only the sobel results come back as shorts, to be compared with the interleaved ones
+    dst.create(rows, cols, CV_16SC3);
+    parallel_for_rows(rows, MIN_STRIP_ROWS, [&](int begin, int end) {
+      for (int i = begin; i < end; i++) {
+        const short *b = src.planes[0].ptr<short>(i), *g = src.planes[1].ptr<short>(i), *r = src.planes[2].ptr<short>(i);
+        short *d = dst.ptr<short>(i);
+        for (int x = 0; x < cols; x++, d += 3) {
+          d[0] = b[x];
+          d[1] = g[x];
+          d[2] = r[x];
+        }
+      }
+    });
+    return 0;
+  }
+  dst.create(rows, cols, CV_8UC3);
+  const RowKernels &k = row_kernels();
+  parallel_for_rows(rows, MIN_STRIP_ROWS, [&](int begin, int end) {
+    for (int i = begin; i < end; i++) {
+      const uchar *const planes[3] = {src.planes[0].ptr<uchar>(i), src.planes[1].ptr<uchar>(i),
+                                      src.planes[2].ptr<uchar>(i)};
+      k.interleave(planes, dst.ptr<uchar>(i), cols);
+    }
+  });
+  return 0;
+}
+
+/*
+ * The rows [begin, end) of blur5x5 on one plane, the same ring of 5 horizontally filtered rows as blur5x5_rows() in
+ * filter.cpp (ring holds 5 * cols bytes)
+ */
+static void blur5x5_plane_rows(const cv::Mat &src, cv::Mat &dst, int begin, int end, uchar *ring) {
+  int rows = src.rows, cols = src.cols;
+  const RowKernels &k = row_kernels();
+  uchar *ring_rows[5];
+  for (int r = 0; r < 5; r++) {
+    ring_rows[r] = ring + r * cols;
+  }
+  int first = std::max(begin, 2);
+  if (first < std::min(end, rows - 2)) {
+    for (int r = first - 2; r < first + 2; r++) {
+      blur_plane_row(k, src.ptr<uchar>(r), ring_rows[r % 5], cols);
+    }
+  }
+  for (int i = begin; i < end; i++) {
+    if (i < 2 || i >= rows - 2) {
+      if (src.data != dst.data) {
+        memcpy(dst.ptr<uchar>(i), src.ptr<uchar>(i), cols);
+      }
+      continue;
+    }
+    blur_plane_row(k, src.ptr<uchar>(i + 2), ring_rows[(i + 2) % 5], cols);
+    const uchar *taps[5] = {ring_rows[(i + 3) % 5], ring_rows[(i + 4) % 5], ring_rows[i % 5],
+                            ring_rows[(i + 1) % 5], ring_rows[(i + 2) % 5]};
+    k.blur_v(taps, dst.ptr<uchar>(i), cols);
+  }
+}
+
+// The rows [begin, end) of a sobel on one plane, with a ring of 3 rows (ring holds 3 * cols shorts)
+static void sobel_plane_rows(const cv::Mat &src, cv::Mat &dst, int begin, int end, bool y_direction, short *ring) {
+  int rows = src.rows, cols = src.cols;
+  const RowKernels &k = row_kernels();
+  short *ring_rows[3];
+  for (int r = 0; r < 3; r++) {
+    ring_rows[r] = ring + r * cols;
+  }
+  int first = std::max(begin, 1);
+  if (first < std::min(end, rows - 1)) {
+    for (int r = first - 1; r < first + 1; r++) {
+      sobel_plane_row(k, src.ptr<uchar>(r), ring_rows[r % 3], cols, y_direction);
+    }
+  }
+  for (int i = begin; i < end; i++) {
+    if (i < 1 || i >= rows - 1) {
+      widen_row(src.ptr<uchar>(i), dst.ptr<short>(i), cols);
+      continue;
+    }
+    sobel_plane_row(k, src.ptr<uchar>(i + 1), ring_rows[(i + 1) % 3], cols, y_direction);
+    const short *taps[3] = {ring_rows[(i + 2) % 3], ring_rows[i % 3], ring_rows[(i + 1) % 3]};
+    if (y_direction) {
+      k.diff_v(taps, dst.ptr<short>(i), cols);
+    } else {
+      k.smooth_v(taps, dst.ptr<short>(i), cols);
+    }
+  }
+}
+
+static thread_local std::vector<uchar> blur_scratch;
+static thread_local std::vector<short> sobel_scratch;
+
+// every strip runs the three planes one after the other, so a ring only ever holds one plane
+int blur5x5_planar(PlanarFrame &src, PlanarFrame &dst) {
+  dst.create(src.rows(), src.cols(), CV_8UC1);
+  parallel_for_rows(src.rows(), stencil_strip_rows(src, dst), [&](int begin, int end) {
+    uchar *ring = scratch(blur_scratch, 5 * (size_t) src.cols());
+    for (int c = 0; c < 3; c++) {
+      blur5x5_plane_rows(src.planes[c], dst.planes[c], begin, end, ring);
+    }
+  });
+  return 0;
+}
+
+static int sobel_planar(PlanarFrame &src, PlanarFrame &dst, bool y_direction) {
+  dst.create(src.rows(), src.cols(), CV_16SC1);
+  parallel_for_rows(src.rows(), MIN_STRIP_ROWS, [&](int begin, int end) {
+    short *ring = scratch(sobel_scratch, 3 * (size_t) src.cols());
+    for (int c = 0; c < 3; c++) {
+      sobel_plane_rows(src.planes[c], dst.planes[c], begin, end, y_direction, ring);
+    }
+  });
+  return 0;
+}
+
+int sobelX3x3_planar(PlanarFrame &src, PlanarFrame &dst) {
+  return sobel_planar(src, dst, false);
+}
+
+int sobelY3x3_planar(PlanarFrame &src, PlanarFrame &dst) {
+  return sobel_planar(src, dst, true);
+}
+
+int magnitude_planar(PlanarFrame &sx, PlanarFrame &sy, PlanarFrame &dst) {
+  dst.create(sx.rows(), sx.cols(), CV_8UC1);
+  int cols = sx.cols();
+  parallel_for_rows(sx.rows(), MIN_STRIP_ROWS, [&](int begin, int end) {
+    const RowKernels &k = row_kernels();
+    for (int c = 0; c < 3; c++) {
+      for (int i = begin; i < end; i++) {
+        k.magnitude(sx.planes[c].ptr<short>(i), sy.planes[c].ptr<short>(i), dst.planes[c].ptr<uchar>(i), cols,
+                    MAGNITUDE_EXACT);
+      }
+    }
+  });
+  return 0;
+}
+
+// the copy of the green plane emboss_planar reads when it runs in place, kept between frames so it is only allocated
+// when the frame size changes
+static thread_local cv::Mat emboss_scratch;
+// the 3 green rows under the kernel padded with their edge pixels, and the filtered row
+static thread_local std::vector<uchar> emboss_rows_scratch;
+
+int emboss_planar(PlanarFrame &src, PlanarFrame &dst) {
+  int rows = src.rows(), cols = src.cols();
+  const cv::Mat *green = &src.planes[1];
+  if (src.planes[1].data == dst.planes[1].data) {
+    src.planes[1].copyTo(emboss_scratch);
+    green = &emboss_scratch;
+  }
+  dst.create(rows, cols, CV_8UC1);
+  const RowKernels &k = row_kernels();
+  int padded = cols + 2;
+  parallel_for_rows(rows, MIN_STRIP_ROWS, [&](int begin, int end) {
+    uchar *ring = scratch(emboss_rows_scratch, 4 * (size_t) padded), *result = ring + 3 * padded;
+    for (int i = begin; i < end; i++) {
+      // the edge pixels and rows repeated beyond the frame, like emboss()
+      const uchar *taps[3];
+      for (int r = 0; r < 3; r++) {
+        uchar *row = ring + r * padded;
+        memcpy(row + 1, green->ptr<uchar>(std::min(std::max(i + r - 1, 0), rows - 1)), cols);
+        row[0] = row[1];
+        row[cols + 1] = row[cols];
+        taps[r] = row;
+      }
+      k.emboss_plane(taps, result, 1, cols + 1);
+      for (int p = 0; p < 3; p++) {
+        memcpy(dst.planes[p].ptr<uchar>(i), result + 1, cols);
+      }
+    }
+  });
+  return 0;
+}
@@ -0,0 +1,60 @@
+#include "point_lut.h"
+#include "parallel.h"
+#include "row_kernels.h"
+#include <algorithm>
+
+PointLut::PointLut() {
+  for (int v = 0; v < 256; v++) {
+    table[v] = (uchar) v;
+  }
+}
+
+PointLut PointLut::negative() {
+  PointLut lut;
+  for (int v = 0; v < 256; v++) {
+    lut.table[v] = (uchar) (255 - v);
+  }
+  return lut;
+}
+
+PointLut PointLut::convert(double alpha, double beta) {
+  PointLut lut;
+  // convertTo() works in single precision for 8-bit frames
+  float a = (float) alpha, b = (float) beta;
+  for (int v = 0; v < 256; v++) {
+    lut.table[v] = cv::saturate_cast<uchar>(v * a + b);
+  }
+  return lut;
+}
+
+PointLut PointLut::quantize(int levels) {
+  PointLut lut;
+  int b = 255 / std::max(std::min(levels, 255), 1);
+  for (int v = 0; v < 256; v++) {
+    lut.table[v] = (uchar) (v / b * b);
+  }
+  return lut;
+}
+
+PointLut PointLut::then(const PointLut &next) const {
+  PointLut lut;
+  for (int v = 0; v < 256; v++) {
+    lut.table[v] = next.table[table[v]];
+  }
+  return lut;
+}
+
+int PointLut::apply(cv::Mat &src, cv::Mat &dst) const {
+  dst.create(src.rows, src.cols, CV_8UC3);
+  const RowKernels &k = row_kernels();
+  parallel_for_rows(src.rows, MIN_STRIP_ROWS, [&](int begin, int end) {
+    for (int i = begin; i < end; i++) {
+      k.lut(src.ptr<uchar>(i), dst.ptr<uchar>(i), src.cols * 3, table);
+    }
+  });
+  return 0;
+}
+
+void PointLut::apply_row(const uchar *src, uchar *dst, int width) const {
+  row_kernels().lut(src, dst, width, table);
+}
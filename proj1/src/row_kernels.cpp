@@ -0,0 +1,150 @@
+#include "row_kernels.h"
+#include <cstring>
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#endif
+
+#ifdef PROJ1_HAVE_AVX2_KERNELS
+extern const RowKernels avx2_row_kernels;
+#endif
+
+static const RowKernels scalar_row_kernels = simd::make_row_kernels<simd::scalar>();
+#ifdef PROJ1_HAVE_SSE2
+static const RowKernels sse2_row_kernels = simd::make_row_kernels<simd::sse2>();
+#endif
+#ifdef PROJ1_HAVE_NEON
+static const RowKernels neon_row_kernels = simd::make_row_kernels<simd::neon>();
+#endif
+
+static bool cpu_has_avx2() {
+#if defined(PROJ1_HAVE_AVX2_KERNELS) && (defined(__GNUC__) || defined(__clang__))
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2");
+#elif defined(PROJ1_HAVE_AVX2_KERNELS) && defined(_MSC_VER)
+  int info[4];
+  __cpuid(info, 0);
+  if (info[0] < 7) {
+    return false;
+  }
+  __cpuid(info, 1);
+  // the OS has to save the ymm registers (OSXSAVE + AVX, then XCR0 bits 1 and 2)
+  if ((info[2] & (1 << 27)) == 0 || (info[2] & (1 << 28)) == 0 || (_xgetbv(0) & 6) != 6) {
+    return false;
+  }
+  __cpuidex(info, 7, 0);
+  return (info[1] & (1 << 5)) != 0;
+#else
+  return false;
+#endif
+}
+
+SimdLevel detect_simd_level() {
+  if (cpu_has_avx2()) {
+    return SIMD_AVX2;
+  }
+#if defined(PROJ1_HAVE_SSE2)
+  return SIMD_SSE2;
+#elif defined(PROJ1_HAVE_NEON)
+  return SIMD_NEON;
+#else
+  return SIMD_SCALAR;
+#endif
+}
+
+static SimdLevel current_level = detect_simd_level();
+
+int set_simd_level(SimdLevel level) {
+  SimdLevel best = detect_simd_level();
+  // AVX2 builds on SSE2, NEON stands alone
+  bool supported = level == SIMD_SCALAR || level == best || (level == SIMD_SSE2 && best == SIMD_AVX2);
+  if (!supported) {
+    return -1;
+  }
+  current_level = level;
+  return 0;
+}
+
+SimdLevel get_simd_level() {
+  return current_level;
+}
+
+const char *simd_level_name(SimdLevel level) {
+  switch (level) {
+    case SIMD_SSE2:return "sse2";
+    case SIMD_NEON:return "neon";
+    case SIMD_AVX2:return "avx2";
+    default:return "scalar";
+  }
+}
+
+const RowKernels &row_kernels() {
+  switch (current_level) {
+#ifdef PROJ1_HAVE_AVX2_KERNELS
+    case SIMD_AVX2:return avx2_row_kernels;
+#endif
+#ifdef PROJ1_HAVE_SSE2
+    case SIMD_SSE2:return sse2_row_kernels;
+#endif
+#ifdef PROJ1_HAVE_NEON
+    case SIMD_NEON:return neon_row_kernels;
+#endif
+    default:return scalar_row_kernels;
+  }
+}
+
+void widen_row(const uchar *src, short *dst, int width) {
+  for (int x = 0; x < width; x++) {
+    dst[x] = src[x];
+  }
+}
+
+void blur_row(const RowKernels &k, const uchar *src, uchar *dst, int cols) {
+  int width = cols * 3;
+  if (cols < 5) {
+    memcpy(dst, src, width);
+    return;
+  }
+  memcpy(dst, src, 6);
+  k.blur_h(src, dst, 6, width - 6);
+  memcpy(dst + width - 6, src + width - 6, 6);
+}
+
+void sobel_row(const RowKernels &k, const uchar *src, short *dst, int cols, bool y_direction) {
+  int width = cols * 3;
+  if (cols < 3) {
+    widen_row(src, dst, width);
+    return;
+  }
+  widen_row(src, dst, 3);
+  widen_row(src + width - 3, dst + width - 3, 3);
+  if (y_direction) {
+    k.smooth_h(src, dst, 3, width - 3);
+  } else {
+    k.diff_h(src, dst, 3, width - 3);
+  }
+}
+
+void blur_plane_row(const RowKernels &k, const uchar *src, uchar *dst, int cols) {
+  if (cols < 5) {
+    memcpy(dst, src, cols);
+    return;
+  }
+  memcpy(dst, src, 2);
+  k.blur_h_plane(src, dst, 2, cols - 2);
+  memcpy(dst + cols - 2, src + cols - 2, 2);
+}
+
+void sobel_plane_row(const RowKernels &k, const uchar *src, short *dst, int cols, bool y_direction) {
+  if (cols < 3) {
+    widen_row(src, dst, cols);
+    return;
+  }
+  dst[0] = src[0];
+  dst[cols - 1] = src[cols - 1];
+  if (y_direction) {
+    k.smooth_h_plane(src, dst, 1, cols - 1);
+  } else {
+    k.diff_h_plane(src, dst, 1, cols - 1);
+  }
+}
@@ -0,0 +1,6 @@
+// This file is compiled with AVX2 enabled, its kernels are only used after detect_simd_level() has checked the CPU
+#include "row_kernels.h"
+
+#ifdef PROJ1_HAVE_AVX2
+extern const RowKernels avx2_row_kernels = simd::make_row_kernels<simd::avx2>();
+#endif
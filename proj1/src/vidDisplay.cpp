@@ -1,181 +1,383 @@
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <iostream>
+#include <mutex>
+#include <thread>
 #include <opencv2/opencv.hpp>
-#include "filter.h"
+#include "dirty_tiles.h"
+#include "effects.h"
+#include "frame_pool.h"
+#include "frame_ring.h"
+#include "frame_source.h"
+#include "parallel.h"
+#include "stage_timer.h"
 
 using namespace cv;
 
-enum effect {
-  ORIGIN = 1,
-  GRAY = 2,
-  ALTERNATIVE_GREY = 3,
-  BLUR = 4,
-  X_SOBEL = 5,
-  Y_SOBEL = 6,
-  MAGNITUDE = 7,
-  BLUR_QUANTIZE = 8,
-  CARTOON = 9,
-  NEGATIVE = 10,
-  ADD_CONTRAST = 11,
-  DEC_CONTRAST = 12,
-  ADD_BRIGHTNESS = 13,
-  DEC_BRIGHTNESS = 14,
-  SEPIA = 15,
-  EMBOSS = 16,
-} effect;
+// the width and height in pixels of the tiles the incremental mode compares between frames
+#define DIRTY_TILE_SIZE 16
+
+// a full-resolution frame waiting for the snapshot thread, and the effect to run on it before it is written
+struct Snapshot {
+  std::mutex mutex;
+  std::condition_variable wake;
+  bool pending = false, stopping = false;
+  cv::Mat frame;
+  int effect = ORIGIN;
+};
+
+// the state shared by the three stages, their durations go to the stage timers (see stage_timer.h)
+struct Pipeline {
+  FrameSource *source;
+  // capture -> process and process -> display, each holding a single frame so every stage works on the freshest one
+  FrameRing captured{1}, processed{1};
+  std::atomic<bool> running{true};
+  std::atomic<int> effect{ORIGIN};
+  // the levels, threshold, chain, radius and magnitude mode of the effects, from the command line
+  EffectSettings settings;
+  // run the effects on a frame halved by pyrDown for the window, set by --preview and toggled by 'v'
+  std::atomic<bool> preview{false};
+  // set by 's', the process stage then hands its next full-resolution frame to the snapshot thread
+  std::atomic<bool> save_requested{false};
+  Snapshot snapshot;
+  // re-filter only the tiles that changed and keep the previous output elsewhere, set by --incremental and toggled
+  // by 'd'
+  std::atomic<bool> incremental{false};
+  // the mean absolute difference per byte above which a tile counts as changed, set by --dirty-threshold
+  int dirty_threshold = 2;
+  // the share of the tiles the last frame re-filtered in incremental mode, for the HUD
+  std::atomic<float> dirty_ratio{0};
+};
+
+// the share of the tiles the incremental mode re-filtered, in the bottom left corner of the HUD
+static void draw_dirty_ratio(cv::Mat &frame, float ratio) {
+  char text[32];
+  snprintf(text, sizeof(text), "dirty tiles %5.1f%%", 100.0 * ratio);
+  cv::rectangle(frame, cv::Rect(0, std::max(frame.rows - 20, 0), std::min(140, frame.cols), std::min(20, frame.rows)),
+                cv::Scalar(0, 0, 0), cv::FILLED);
+  cv::putText(frame, text, cv::Point(5, frame.rows - 6), cv::FONT_HERSHEY_SIMPLEX, 0.4, cv::Scalar(255, 255, 255));
+}
+
+// stage 1: read the frame source as fast as it delivers, dropping camera frames the process stage had no time for
+static void capture_loop(Pipeline *pipeline) {
+  name_timer_thread("capture");
+  long index = 0;
+  while (pipeline->running) {
+    if (!pipeline->source->live() && pipeline->captured.full()) {
+      // a file or generated frames can wait, so a headless run processes every one of them
+      std::this_thread::sleep_for(std::chrono::microseconds(200));
+      continue;
+    }
+    STAGE_TIMER("capture");
+    Frame &slot = pipeline->captured.producer_frame();
+    // get a new frame from the source, treat as a stream
+    if (!pipeline->source->next(slot.image)) {
+      printf("frame is empty\n");
+      pipeline->running = false;
+      break;
+    }
+    slot.index = index++;
+    slot.captured = cv::getTickCount();
+    pipeline->captured.push();
+  }
+}
+
+/*
+ * Hand a full-resolution copy of frame to the snapshot thread unless it is still busy with the previous one, so the
+ * process stage never waits for a save.
+ */
+static void request_snapshot(Pipeline *pipeline, const cv::Mat &frame, int effect) {
+  Snapshot &snapshot = pipeline->snapshot;
+  {
+    std::lock_guard<std::mutex> lock(snapshot.mutex);
+    if (snapshot.pending) {
+      printf("still saving the previous screenshot\n");
+      return;
+    }
+    frame.copyTo(snapshot.frame);
+    snapshot.effect = effect;
+    snapshot.pending = true;
+  }
+  snapshot.wake.notify_one();
+}
+
+// the 's' key: run the effect on the full-resolution frame and write it, off the preview path
+static void snapshot_loop(Pipeline *pipeline) {
+  name_timer_thread("snapshot");
+  Snapshot &snapshot = pipeline->snapshot;
+  FramePool pool({CV_16SC3, CV_8UC1});
+  cv::Mat result;
+  std::unique_lock<std::mutex> lock(snapshot.mutex);
+  for (;;) {
+    snapshot.wake.wait(lock, [&snapshot] { return snapshot.pending || snapshot.stopping; });
+    // a save asked for just before quitting is still written
+    if (!snapshot.pending) {
+      break;
+    }
+    lock.unlock();
+    STAGE_TIMER("snapshot");
+    // the filters run on this thread alone while the process stage holds the worker pool
+    pool.reserve(snapshot.frame.size());
+    pool.release_all();
+    result.create(snapshot.frame.rows, snapshot.frame.cols, CV_8UC3);
+    apply_effect(pipeline->settings, snapshot.effect, snapshot.frame, result, pool);
+    cv::imwrite("../img/screenshot.png", result);
+    printf("saved a %dx%d screenshot to ../img/screenshot.png\n", result.cols, result.rows);
+    lock.lock();
+    snapshot.pending = false;
+  }
+}
+
+// stage 2: run the selected effect on the newest captured frame, or on half of it in preview mode
+static void process_loop(Pipeline *pipeline) {
+  name_timer_thread("process");
+  // the scratch frames of the effects: the sobel result of X_SOBEL and Y_SOBEL and the one channel image of GRAY
+  FramePool pool({CV_16SC3, CV_8UC1});
+  int frames_in_effect = 0;
+  int previous_effect = pipeline->effect;
+  // the pyrDown of the input in preview mode, allocated again only when the camera resolution changes
+  cv::Mat half_frame;
+  // the incremental mode: which tiles changed, and the output the others keep from the frames before
+  DirtyTiles tiles(DIRTY_TILE_SIZE, pipeline->dirty_threshold);
+  cv::Mat incremental_output;
+  bool was_incremental = false, used_incremental = false;
+  while (pipeline->running) {
+    Frame *input = pipeline->captured.pop();
+    if (input == nullptr) {
+      std::this_thread::sleep_for(std::chrono::microseconds(200));
+      continue;
+    }
+    STAGE_TIMER("process");
+    Frame &output = pipeline->processed.producer_frame();
+    cv::Mat &full_frame = input->image;
+    cv::Mat &converted_frame = output.image;
+    bool preview = pipeline->preview;
+    if (preview) {
+      cv::pyrDown(full_frame, half_frame);
+    }
+    cv::Mat &frame = preview ? half_frame : full_frame;
+    // both only allocate when the camera resolution or the preview mode changes
+    pool.reserve(frame.size());
+    converted_frame.create(frame.rows, frame.cols, CV_8UC3);
+    pool.release_all();
+    int effect = pipeline->effect;
+    frames_in_effect = effect == previous_effect ? frames_in_effect + 1 : 0;
+    previous_effect = effect;
+
+    bool incremental = pipeline->incremental;
+    {
+      STAGE_TIMER("effect");
+      if (incremental) {
+        // the output kept for the clean tiles is only good for the effect that produced it
+        if (!was_incremental || frames_in_effect == 0) {
+          tiles.invalidate();
+        }
+        double ratio;
+        {
+          STAGE_TIMER("diff");
+          ratio = tiles.update(frame);
+        }
+        pipeline->dirty_ratio = (float) ratio;
+        tiles.refilter(frame, incremental_output, effect_halo(pipeline->settings, effect), [&](cv::Mat &src, cv::Mat &dst) {
+          pool.release_all();
+          apply_effect(pipeline->settings, effect, src, dst, pool);
+        });
+        // the output ring hands out its buffers in turn, the kept output has to live elsewhere
+        incremental_output.copyTo(converted_frame);
+        used_incremental = true;
+      } else {
+        apply_effect(pipeline->settings, effect, frame, converted_frame, pool);
+      }
+    }
+    was_incremental = incremental;
+    if (pipeline->save_requested.exchange(false)) {
+      request_snapshot(pipeline, full_frame, effect);
+    }
+    output.index = input->index;
+    output.captured = input->captured;
+    output.processed = cv::getTickCount();
+    pipeline->processed.push();
+  }
+  if (pool.grow_count() > 0) {
+    printf("the frame pool had to grow by %d buffers\n", pool.grow_count());
+  }
+  if (used_incremental) {
+    printf("the incremental mode re-filtered %.1f%% of the tiles\n", 100.0 * tiles.dirty_ratio());
+  }
+}
 
 int main(int argc, char *argv[]) {
-  cv::VideoCapture *capdev;
-  // open the video device
-  capdev = new cv::VideoCapture(0);
-  if (!capdev->isOpened()) {
-    printf("Unable to open video device\n");
+  Pipeline pipeline;
+  // "--source <spec>", "--sink <spec>" and "--keys <keys>" run the loop on a file or generated frames without a
+  // screen, see frame_source.h
+  FrameOptions options;
+  take_frame_options(argc, argv, options);
+  // "--threads <n>" sets the number of threads the filters run on, by default one per hardware thread
+  // "--chain <stages>" sets the effects the 'k' mode runs one after the other, see FilterGraph::parse()
+  // "--blur-radius <r>" sets the radius of the Gaussian blur of the 'f' mode
+  // "--magnitude exact|l1|maxmin" sets how the 'm' and 'c' modes compute the gradient magnitude, see magnitude.h
+  // "--trace <file.json>" writes a Chrome trace of the stages at the end, "--hud" starts with their times drawn on the
+  // frame, see stage_timer.h
+  StageTimerOptions timer_options;
+  take_stage_timer_options(argc, argv, timer_options);
+  // "--preview" starts in preview mode, the effects run on half the resolution until 's' asks for a full one
+  // "--incremental" starts in incremental mode, the effects only run on the tiles that changed, see dirty_tiles.h
+  // "--dirty-threshold <t>" sets the mean difference per byte above which a tile of the incremental mode changed
+  std::string chain = "blur,sepia,emboss";
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+      set_num_threads(atoi(argv[++i]));
+    } else if (strcmp(argv[i], "--chain") == 0 && i + 1 < argc) {
+      chain = argv[++i];
+    } else if (strcmp(argv[i], "--blur-radius") == 0 && i + 1 < argc) {
+      pipeline.settings.blur_radius = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--magnitude") == 0 && i + 1 < argc) {
+      if (parse_magnitude_mode(argv[++i], pipeline.settings.magnitude_mode) != 0) {
+        printf("Unknown magnitude mode %s\n", argv[i]);
+        return (-1);
+      }
+    } else if (strcmp(argv[i], "--preview") == 0) {
+      pipeline.preview = true;
+    } else if (strcmp(argv[i], "--incremental") == 0) {
+      pipeline.incremental = true;
+    } else if (strcmp(argv[i], "--dirty-threshold") == 0 && i + 1 < argc) {
+      pipeline.dirty_threshold = atoi(argv[++i]);
+    }
+  }
+  if (pipeline.settings.chain.parse(chain) != 0) {
+    printf("Unknown stage in chain %s\n", chain.c_str());
+    return (-1);
+  }
+  printf("Filters run on %d threads\n", get_num_threads());
+  // open the video device, or whatever source was asked for
+  FrameSource *source = open_frame_source(options.source);
+  if (source == nullptr) {
+    printf("Unable to open frame source %s\n", options.source.c_str());
+    return (-1);
+  }
+  FrameSink *sink = open_frame_sink(options.sink, options.keys);
+  if (sink == nullptr) {
+    printf("Unknown frame sink %s\n", options.sink.c_str());
+    delete source;
     return (-1);
   }
   // get some properties of the image
-  cv::Size refS((int) capdev->get(cv::CAP_PROP_FRAME_WIDTH),
-                (int) capdev->get(cv::CAP_PROP_FRAME_HEIGHT));
+  cv::Size refS = source->size();
   printf("Expected size: %d %d\n", refS.width, refS.height);
-  cv::namedWindow("Video", 1); // identifies a window
-  cv::Mat frame;
-  cv::Mat converted_frame(refS.height, refS.width, CV_8UC3);
-  int quantize_level = 15;
-  int threshold = 20;
-  effect = ORIGIN;
-  for (;;) {
-    *capdev >> frame; // get a new frame from the camera, treat as a stream
-    if (frame.empty()) {
-      printf("frame is empty\n");
-      break;
+  pipeline.source = source;
+  if (!timer_options.trace.empty()) {
+    start_stage_trace(timer_options.trace);
+  }
+  bool hud = timer_options.hud;
+  std::thread capture_thread(capture_loop, &pipeline);
+  std::thread process_thread(process_loop, &pipeline);
+  std::thread snapshot_thread(snapshot_loop, &pipeline);
+
+  // stage 3, on the main thread since that is where HighGUI wants its windows: show the newest processed frame
+  name_timer_thread("display");
+  static const int display_stage = stage_timer_id("display");
+  static const int frame_age_stage = stage_timer_id("frame age", false);
+  Frame *shown = nullptr;
+  while (pipeline.running) {
+    Frame *next = pipeline.processed.pop();
+    if (next != nullptr) {
+      shown = next;
+      int64 start = cv::getTickCount();
+      if (hud) {
+        draw_stage_hud(shown->image);
+        if (pipeline.incremental) {
+          draw_dirty_ratio(shown->image, pipeline.dirty_ratio);
+        }
+      }
+      sink->show("Video", shown->image);
+      int64 end = cv::getTickCount();
+      record_stage(display_stage, start, end);
+      record_stage(frame_age_stage, shown->captured, end);
+    }
+    // see if there is a waiting keystroke, only long enough to let the window handle its events
+    int key = sink->wait_key(1);
+    if (next == nullptr && key < 0) {
+      // a headless sink returns at once, do not spin while the process stage works
+      std::this_thread::sleep_for(std::chrono::microseconds(200));
     }
-    // see if there is a waiting keystroke
-    int key = cv::waitKey(10);
     // if user types 'q', quit the program
     if (key == 'q') {
       break;
     }
-    // if user types 's', save the open image to img/screenshot.png
+    // if user types 's', save the current effect at full resolution to img/screenshot.png, in the background
     if (key == 's') {
-      cv::imwrite("../img/screenshot.png", converted_frame);
+      pipeline.save_requested = true;
+    }
+    // if user types 'i', show or hide the times of the stages on the frame
+    if (key == 'i') {
+      hud = !hud;
+    }
+    // if user types 'v', switch between the half-resolution preview and the full resolution
+    if (key == 'v') {
+      pipeline.preview = !pipeline.preview;
+    }
+    // if user types 'd', switch between re-filtering the changed tiles only and the whole frame
+    if (key == 'd') {
+      pipeline.incremental = !pipeline.incremental;
     }
     switch (key) {
-      case 'g':effect = GRAY;
-        break;
-      case 'b':effect = BLUR;
-        break;
-      case 'h':effect = ALTERNATIVE_GREY;
-        break;
-      case 'x':effect = X_SOBEL;
-        break;
-      case 'y':effect = Y_SOBEL;
-        break;
-      case 'm':effect = MAGNITUDE;
+      case 'g':pipeline.effect = GRAY;
         break;
-      case 'l':effect = BLUR_QUANTIZE;
+      case 'b':pipeline.effect = BLUR;
         break;
-      case 'c':effect = CARTOON;
-        break;
-      case 'n':effect = NEGATIVE;
-        break;
-      case '<':effect = DEC_CONTRAST;
-        break;
-      case '>':effect = ADD_CONTRAST;
-        break;
-      case '+':effect = ADD_BRIGHTNESS;
-        break;
-      case '-':effect = DEC_BRIGHTNESS;
-        break;
-      case 'p':effect = SEPIA;
-        break;
-      case 'e':effect = EMBOSS;
-        break;
-      case ' ':effect = ORIGIN;
-        break;
-    }
-
-    switch (effect) {
-      case GRAY: {
-        cv::Mat converted_frame_one_channel(refS.height, refS.width, CV_8UC1);
-        // cvtColor will make the dst a 1 channel mat, which is fine for display but will cause the program crash
-        // when we switch to other mode immediately. Thus, I duplicate the channel to 3 channels mat with cv::merge()
-        cv::cvtColor(frame.clone(), converted_frame_one_channel, COLOR_BGR2GRAY);
-        std::vector<cv::Mat> channels;
-        channels.push_back(converted_frame_one_channel);
-        channels.push_back(converted_frame_one_channel);
-        channels.push_back(converted_frame_one_channel);
-        cv::merge(channels, converted_frame);
+      case 'h':pipeline.effect = ALTERNATIVE_GREY;
         break;
-      }
-      case ALTERNATIVE_GREY: {
-        greyscale(frame, converted_frame);
+      case 'x':pipeline.effect = X_SOBEL;
         break;
-      }
-      case BLUR: {
-        blur5x5(frame, converted_frame);
+      case 'y':pipeline.effect = Y_SOBEL;
         break;
-      }
-      case X_SOBEL: {
-        cv::Mat frame_16s(frame.rows, frame.cols, CV_16SC3);
-        sobelX3x3(frame, frame_16s);
-        transform(frame_16s, converted_frame);
+      case 'm':pipeline.effect = MAGNITUDE;
         break;
-      }
-      case Y_SOBEL: {
-        cv::Mat frame_16s(frame.rows, frame.cols, CV_16SC3);
-        sobelY3x3(frame, frame_16s);
-        transform(frame_16s, converted_frame);
+      case 'l':pipeline.effect = BLUR_QUANTIZE;
         break;
-      }
-      case MAGNITUDE: {
-        cv::Mat x_sobel_frame_16s(frame.rows, frame.cols, CV_16SC3);
-        sobelX3x3(frame, x_sobel_frame_16s);
-        cv::Mat y_sobel_frame_16s(frame.rows, frame.cols, CV_16SC3);
-        sobelY3x3(frame, y_sobel_frame_16s);
-        magnitude(x_sobel_frame_16s, y_sobel_frame_16s, converted_frame);
+      case 'c':pipeline.effect = CARTOON;
         break;
-      }
-      case BLUR_QUANTIZE: {
-        blurQuantize(frame, converted_frame, quantize_level);
+      case 'n':pipeline.effect = NEGATIVE;
         break;
-      }
-      case CARTOON: {
-        cartoon(frame, converted_frame, quantize_level, threshold);
+      case '<':pipeline.effect = DEC_CONTRAST;
         break;
-      }
-      case NEGATIVE: {
-        negative(frame, converted_frame);
+      case '>':pipeline.effect = ADD_CONTRAST;
         break;
-      }
-      case ADD_CONTRAST: {
-        frame.convertTo(converted_frame, -1, 2, 0);
+      case '+':pipeline.effect = ADD_BRIGHTNESS;
         break;
-      }
-      case DEC_CONTRAST: {
-        frame.convertTo(converted_frame, -1, 0.25, 0);
+      case '-':pipeline.effect = DEC_BRIGHTNESS;
         break;
-      }
-      case ADD_BRIGHTNESS: {
-        frame.convertTo(converted_frame, -1, 1, 100);
+      case 'p':pipeline.effect = SEPIA;
         break;
-      }
-      case DEC_BRIGHTNESS: {
-        frame.convertTo(converted_frame, -1, 1, -100);
+      case 'e':pipeline.effect = EMBOSS;
         break;
-      }
-      case SEPIA: {
-        sepia(frame, converted_frame);
+      case 'k':pipeline.effect = CHAIN;
         break;
-      }
-      case EMBOSS: {
-        emboss(frame, converted_frame);
+      case 'f':pipeline.effect = GAUSSIAN;
         break;
-      }
-      default: {
-        frame.copyTo(converted_frame);
+      case ' ':pipeline.effect = ORIGIN;
         break;
-      }
     }
-    cv::imshow("Video", converted_frame);
   }
-  delete capdev;
+  pipeline.running = false;
+  capture_thread.join();
+  process_thread.join();
+  {
+    std::lock_guard<std::mutex> lock(pipeline.snapshot.mutex);
+    pipeline.snapshot.stopping = true;
+  }
+  pipeline.snapshot.wake.notify_one();
+  snapshot_thread.join();
+
+  print_stage_report();
+  if (!timer_options.trace.empty()) {
+    write_stage_trace();
+  }
+  printf("dropped %ld frames before processing and %ld before display\n", pipeline.captured.dropped(),
+         pipeline.processed.dropped());
+  printf("read %d frames at %.1f fps\n", source->frame_count(), source->fps());
+  delete sink;
+  delete source;
   return (0);
-}
\ No newline at end of file
+}
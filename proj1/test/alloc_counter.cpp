@@ -0,0 +1,88 @@
+#include "alloc_counter.h"
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include <opencv2/opencv.hpp>
+
+static std::atomic<long> allocations(0);
+
+/*
+ * Replace the global operator new/delete with plain malloc/free plus a counter. Linking this file in is all it takes,
+ * the cost is one relaxed atomic increment per allocation.
+ */
+static void *counted_malloc(size_t size) {
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  return std::malloc(size == 0 ? 1 : size);
+}
+
+void *operator new(size_t size) {
+  void *p = counted_malloc(size);
+  if (p == nullptr) {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+
+void *operator new[](size_t size) {
+  return operator new(size);
+}
+
+void *operator new(size_t size, const std::nothrow_t &) noexcept {
+  return counted_malloc(size);
+}
+
+void *operator new[](size_t size, const std::nothrow_t &) noexcept {
+  return counted_malloc(size);
+}
+
+void operator delete(void *p) noexcept {
+  std::free(p);
+}
+
+void operator delete[](void *p) noexcept {
+  std::free(p);
+}
+
+void operator delete(void *p, const std::nothrow_t &) noexcept {
+  std::free(p);
+}
+
+void operator delete[](void *p, const std::nothrow_t &) noexcept {
+  std::free(p);
+}
+
+namespace {
+
+// forwards everything to the allocator it wraps and counts the new buffers on the way
+class CountingMatAllocator : public cv::MatAllocator {
+ public:
+  explicit CountingMatAllocator(cv::MatAllocator *inner) : inner(inner) {}
+
+  cv::UMatData *allocate(int dims, const int *sizes, int type, void *data, size_t *step, cv::AccessFlag flags,
+                         cv::UMatUsageFlags usage_flags) const CV_OVERRIDE {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    return inner->allocate(dims, sizes, type, data, step, flags, usage_flags);
+  }
+
+  bool allocate(cv::UMatData *data, cv::AccessFlag access_flags, cv::UMatUsageFlags usage_flags) const CV_OVERRIDE {
+    return inner->allocate(data, access_flags, usage_flags);
+  }
+
+  void deallocate(cv::UMatData *data) const CV_OVERRIDE {
+    inner->deallocate(data);
+  }
+
+ private:
+  cv::MatAllocator *inner;
+};
+
+}
+
+void install_allocation_counter() {
+  static CountingMatAllocator counting_allocator(cv::Mat::getDefaultAllocator());
+  cv::Mat::setDefaultAllocator(&counting_allocator);
+}
+
+long allocation_count() {
+  return allocations.load(std::memory_order_relaxed);
+}
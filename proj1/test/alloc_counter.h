@@ -0,0 +1,22 @@
+#ifndef PROJ1_TEST_ALLOC_COUNTER_H_
+#define PROJ1_TEST_ALLOC_COUNTER_H_
+
+/*
+ * A heap allocation counter for the tests. alloc_counter.cpp replaces the global operator new/delete, so it is only
+ * linked into test executables, never into the programs.
+ */
+
+/**
+ * Also count the pixel buffers of cv::Mat. OpenCV allocates those through its own cv::MatAllocator rather than
+ * operator new, so this wraps the default allocator with a counting one. Heap allocations made through operator new
+ * are counted from the start of the program either way.
+ */
+void install_allocation_counter();
+
+/**
+ * @return the number of heap allocations counted so far on every thread, take the difference of two calls to count a
+ * code section
+ */
+long allocation_count();
+
+#endif //PROJ1_TEST_ALLOC_COUNTER_H_
@@ -0,0 +1,65 @@
+#include <cstdio>
+#include <opencv2/opencv.hpp>
+#include "alloc_counter.h"
+#include "effects.h"
+#include "frame_pool.h"
+#include "frame_source.h"
+#include "parallel.h"
+
+/*
+ * Checks that the effects of video_display stop allocating once they are warmed up. Every effect runs through
+ * apply_effect() with a FramePool, the way the process stage of video_display calls it, on WARM_UP_FRAMES generated
+ * frames during which the filters may size their scratch rows, then on STEADY_FRAMES more during which the heap must
+ * not be touched at all, operator new and cv::Mat buffers on every thread counted. Exits with 1 if an effect
+ * allocated.
+ */
+
+#define WARM_UP_FRAMES 10
+#define STEADY_FRAMES 20
+#define TEST_THREADS 4
+
+static const struct {
+  int effect;
+  const char *name;
+} tested_effects[] = {
+    {ORIGIN, "origin"}, {GRAY, "gray"}, {ALTERNATIVE_GREY, "alternative_grey"}, {BLUR, "blur"},
+    {X_SOBEL, "x_sobel"}, {Y_SOBEL, "y_sobel"}, {MAGNITUDE, "magnitude"}, {BLUR_QUANTIZE, "blur_quantize"},
+    {CARTOON, "cartoon"}, {NEGATIVE, "negative"}, {ADD_CONTRAST, "add_contrast"}, {DEC_CONTRAST, "dec_contrast"},
+    {ADD_BRIGHTNESS, "add_brightness"}, {DEC_BRIGHTNESS, "dec_brightness"}, {SEPIA, "sepia"}, {EMBOSS, "emboss"},
+    {CHAIN, "chain"}, {GAUSSIAN, "gaussian"},
+};
+
+int main() {
+  install_allocation_counter();
+  set_num_threads(TEST_THREADS);
+  EffectSettings settings;
+  settings.chain.parse("blur,sepia,emboss");
+  int failures = 0;
+  for (const auto &tested: tested_effects) {
+    // a fresh pool and source per effect, like switching effects in video_display
+    FrameSource *source = open_frame_source("synthetic:640x480");
+    FramePool pool({CV_16SC3, CV_8UC1});
+    cv::Mat frame, converted_frame;
+    long steady_allocations = 0;
+    for (int i = 0; i < WARM_UP_FRAMES + STEADY_FRAMES; i++) {
+      source->next(frame);
+      pool.reserve(frame.size());
+      converted_frame.create(frame.rows, frame.cols, CV_8UC3);
+      pool.release_all();
+      long before = allocation_count();
+      apply_effect(settings, tested.effect, frame, converted_frame, pool);
+      if (i >= WARM_UP_FRAMES) {
+        steady_allocations += allocation_count() - before;
+      }
+    }
+    if (steady_allocations != 0 || pool.grow_count() != 0) {
+      printf("FAIL %s made %ld heap allocations in %d frames after warming up, its pool grew by %d buffers\n",
+             tested.name, steady_allocations, STEADY_FRAMES, pool.grow_count());
+      failures++;
+    }
+    delete source;
+  }
+  printf("%d effects on %d threads, %d steady frames each: %d allocated\n",
+         (int) (sizeof(tested_effects) / sizeof(tested_effects[0])), get_num_threads(), STEADY_FRAMES, failures);
+  return failures == 0 ? 0 : 1;
+}
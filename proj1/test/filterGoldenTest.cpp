@@ -0,0 +1,553 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <opencv2/opencv.hpp>
+#include "color_matrix.h"
+#include "filter.h"
+#include "filter_graph.h"
+#include "magnitude.h"
+#include "parallel.h"
+#include "planar.h"
+#include "point_lut.h"
+#include "simd.h"
+
+/*
+ * Golden-image test of the SIMD filters. Every case runs at every simd level this build and CPU support, on 1 and 3
+ * threads, and must give byte for byte what it gives at the scalar level on one thread, which in turn must equal the
+ * reference implementation of the case when it has one. The frames are random, a checkerboard of 0 and 255 and
+ * gradients, at sizes chosen so the vector loops hit every tail length, down to single rows and columns.
+ * Exits with 1 if any comparison failed.
+ */
+
+// a filter from a BGR frame to dst; dst is allocated with the type of the case before the call
+typedef void (*Filter)(cv::Mat &src, cv::Mat &dst);
+
+struct GoldenCase {
+  const char *name;
+  // the type of dst
+  int type;
+  Filter run;
+  // what the scalar level must give, nullptr when the scalar level is its own reference
+  Filter reference;
+  // how far a byte of the scalar level may be from the reference, 0 unless the case is an approximation of it
+  int tolerance;
+  // a point-wise filter, also run on a frame holding each of the 2^24 BGR colours once
+  bool every_colour;
+
+  GoldenCase(const char *name, int type, Filter run, Filter reference, int tolerance = 0, bool every_colour = false)
+      : name(name), type(type), run(run), reference(reference), tolerance(tolerance), every_colour(every_colour) {}
+};
+
+// blur5x5 as it was before the row kernels, a horizontal then a vertical pass, the border pixels left as in src
+static void blur5x5_reference(cv::Mat &src, cv::Mat &dst) {
+  int kernel[] = {1, 2, 4, 2, 1};
+  cv::Mat converted;
+  src.copyTo(converted);
+  src.copyTo(dst);
+  for (int i = 0; i < src.rows; i++) {
+    for (int j = 0; j <= src.cols - 5; j++) {
+      for (int c = 0; c < 3; c++) {
+        int sum = 0;
+        for (int k = 0; k < 5; k++) {
+          sum += src.at<cv::Vec3b>(i, j + k)[c] * kernel[k];
+        }
+        converted.at<cv::Vec3b>(i, j + 2)[c] = (uchar) (sum / 10);
+      }
+    }
+  }
+  for (int i = 0; i <= src.rows - 5; i++) {
+    for (int j = 0; j < src.cols; j++) {
+      for (int c = 0; c < 3; c++) {
+        int sum = 0;
+        for (int k = 0; k < 5; k++) {
+          sum += converted.at<cv::Vec3b>(i + k, j)[c] * kernel[k];
+        }
+        dst.at<cv::Vec3b>(i + 2, j)[c] = (uchar) (sum / 10);
+      }
+    }
+  }
+}
+
+// magnitude() in every mode as magnitude.h describes it, the exact one the double square root it was before the row
+// kernels, each keeping the low 8 bits of its result
+static void magnitude_reference(cv::Mat &sx, cv::Mat &sy, cv::Mat &dst, MagnitudeMode mode) {
+  for (int i = 0; i < sx.rows; i++) {
+    for (int j = 0; j < sx.cols; j++) {
+      for (int c = 0; c < 3; c++) {
+        int x = std::abs(sx.at<cv::Vec3s>(i, j)[c]), y = std::abs(sy.at<cv::Vec3s>(i, j)[c]);
+        int value;
+        switch (mode) {
+          case MAGNITUDE_L1:value = x + y;
+            break;
+          case MAGNITUDE_MAX_MIN:value = (123 * std::max(x, y) + 51 * std::min(x, y)) / 128;
+            break;
+          default:value = (int) std::sqrt((double) (x * x + y * y));
+            break;
+        }
+        dst.at<cv::Vec3b>(i, j)[c] = (uchar) value;
+      }
+    }
+  }
+}
+
+// both float sobels and magnitude_reference(), what sobel_magnitude() fuses
+static void sobel_magnitude_reference(cv::Mat &src, cv::Mat &dst, MagnitudeMode mode) {
+  cv::Mat sx(src.rows, src.cols, CV_16SC3), sy(src.rows, src.cols, CV_16SC3);
+  sobelX3x3_reference(src, sx);
+  sobelY3x3_reference(src, sy);
+  magnitude_reference(sx, sy, dst, mode);
+}
+
+#define CARTOON_LEVELS 15
+#define CARTOON_THRESHOLD 20
+
+// cartoon as the chain of separate filters it was before it was fused: both float sobels, the magnitude, blurQuantize
+// and the edge mask
+static void cartoon_reference(cv::Mat &src, cv::Mat &dst, MagnitudeMode mode) {
+  cv::Mat edges(src.rows, src.cols, CV_8UC3);
+  sobel_magnitude_reference(src, edges, mode);
+  blur5x5_reference(src, dst);
+  int b = 255 / CARTOON_LEVELS;
+  for (int i = 0; i < dst.rows; i++) {
+    uchar *d = dst.ptr<uchar>(i);
+    const uchar *e = edges.ptr<uchar>(i);
+    for (int x = 0; x < dst.cols * 3; x++) {
+      d[x] = e[x] > CARTOON_THRESHOLD ? 0 : (uchar) (d[x] / b * b);
+    }
+  }
+}
+
+// one box of 2 * radius + 1 pixels along the rows (vertical false) or down the columns, summed pixel by pixel with the
+// edge pixels repeated beyond the frame and rounded to the nearest value
+static void box_pass_reference(const cv::Mat &src, cv::Mat &dst, int radius, bool vertical) {
+  int size = 2 * radius + 1;
+  for (int i = 0; i < src.rows; i++) {
+    for (int j = 0; j < src.cols; j++) {
+      for (int c = 0; c < 3; c++) {
+        int sum = 0;
+        for (int k = -radius; k <= radius; k++) {
+          int row = vertical ? std::min(std::max(i + k, 0), src.rows - 1) : i;
+          int col = vertical ? j : std::min(std::max(j + k, 0), src.cols - 1);
+          sum += src.at<cv::Vec3b>(row, col)[c];
+        }
+        dst.at<cv::Vec3b>(i, j)[c] = (uchar) ((2 * sum + size) / (2 * size));
+      }
+    }
+  }
+}
+
+// boxes of the given radii stacked like box_blur() and gaussian_blur() stack them, all the horizontal passes first
+static void stacked_box_reference(cv::Mat &src, cv::Mat &dst, const int *radii, int passes) {
+  cv::Mat in = src.clone(), out(src.rows, src.cols, CV_8UC3);
+  for (int vertical = 0; vertical < 2; vertical++) {
+    for (int p = 0; p < passes; p++) {
+      box_pass_reference(in, out, radii[p], vertical != 0);
+      std::swap(in, out);
+    }
+  }
+  in.copyTo(dst);
+}
+
+// the three box radii Kovesi's method gives a Gaussian of sigma radius / 2, as gaussian_blur() picks them
+static void gaussian_reference(cv::Mat &src, cv::Mat &dst, int radius) {
+  double variance = radius * radius / 4.0;
+  int lower = (int) std::sqrt(4 * variance + 1);
+  lower -= lower % 2 == 0 ? 1 : 0;
+  double lower_boxes = (12 * variance - 3.0 * lower * lower - 12.0 * lower - 9) / (-4.0 * lower - 4);
+  int radii[3];
+  for (int p = 0; p < 3; p++) {
+    radii[p] = p < std::lround(lower_boxes) ? (lower - 1) / 2 : (lower + 1) / 2;
+  }
+  stacked_box_reference(src, dst, radii, 3);
+}
+
+// green copied to all three channels, what greyscale() always gave
+static void greyscale_reference(cv::Mat &src, cv::Mat &dst) {
+  for (int i = 0; i < src.rows; i++) {
+    for (int j = 0; j < src.cols; j++) {
+      uchar green = src.at<cv::Vec3b>(i, j)[1];
+      dst.at<cv::Vec3b>(i, j) = cv::Vec3b(green, green, green);
+    }
+  }
+}
+
+// a colour matrix with negative weights and offsets, which needs the signed lanes and saturation at both ends
+static const double MIXING_COEFFICIENTS[3][3] = {{0.5, -0.25, 0.3}, {-0.6, 1.2, 0.1}, {0.2, 0.2, 0.2}};
+static const double MIXING_OFFSET[3] = {10, -20, 128.5};
+
+// MIXING_COEFFICIENTS in double, rounded down and saturated
+static void mixing_reference(cv::Mat &src, cv::Mat &dst) {
+  for (int i = 0; i < src.rows; i++) {
+    for (int j = 0; j < src.cols; j++) {
+      cv::Vec3b pixel = src.at<cv::Vec3b>(i, j);
+      for (int c = 0; c < 3; c++) {
+        double sum = MIXING_OFFSET[c];
+        for (int k = 0; k < 3; k++) {
+          sum += MIXING_COEFFICIENTS[c][k] * pixel[k];
+        }
+        dst.at<cv::Vec3b>(i, j)[c] = (uchar) std::min(255.0, std::max(0.0, std::floor(sum)));
+      }
+    }
+  }
+}
+
+// 255 - v on every element
+static void negative_reference(cv::Mat &src, cv::Mat &dst) {
+  for (int i = 0; i < src.rows; i++) {
+    for (int x = 0; x < src.cols * 3; x++) {
+      dst.ptr<uchar>(i)[x] = (uchar) (255 - src.ptr<uchar>(i)[x]);
+    }
+  }
+}
+
+// the quantization blurQuantize() did before it was a table
+static void quantize_reference(cv::Mat &src, cv::Mat &dst, int levels) {
+  int b = 255 / levels;
+  for (int i = 0; i < src.rows; i++) {
+    for (int x = 0; x < src.cols * 3; x++) {
+      dst.ptr<uchar>(i)[x] = (uchar) (src.ptr<uchar>(i)[x] / b * b);
+    }
+  }
+}
+
+// the emboss kernel on the green channel with the edge pixels repeated beyond the frame, what emboss() gives on the
+// border; emboss_reference() then overwrites the inner pixels with what it always gave there
+static void emboss_reference_with_border(cv::Mat &src, cv::Mat &dst) {
+  const int kernel[3][3] = {{-2, -1, 0}, {-1, 1, 1}, {0, 1, 2}};
+  for (int i = 0; i < src.rows; i++) {
+    for (int j = 0; j < src.cols; j++) {
+      int sum = 0;
+      for (int dy = -1; dy < 2; dy++) {
+        for (int dx = -1; dx < 2; dx++) {
+          int row = std::min(std::max(i + dy, 0), src.rows - 1), col = std::min(std::max(j + dx, 0), src.cols - 1);
+          sum += src.at<cv::Vec3b>(row, col)[1] * kernel[1 + dy][1 + dx];
+        }
+      }
+      uchar value = (uchar) std::min(std::max(sum, 0), 255);
+      dst.at<cv::Vec3b>(i, j) = cv::Vec3b(value, value, value);
+    }
+  }
+  emboss_reference(src, dst);
+}
+
+// a filter of planar.h between to_planar() and to_interleaved()
+static void run_planar(int (*filter)(PlanarFrame &, PlanarFrame &), cv::Mat &src, cv::Mat &dst) {
+  PlanarFrame planes, filtered;
+  to_planar(src, planes);
+  filter(planes, filtered);
+  to_interleaved(filtered, dst);
+}
+
+// sobelX3x3 and sobelY3x3 into their own frames, then magnitude()
+static void sobel_then_magnitude(cv::Mat &src, cv::Mat &dst, MagnitudeMode mode) {
+  cv::Mat sx, sy;
+  sobelX3x3(src, sx);
+  sobelY3x3(src, sy);
+  magnitude(sx, sy, dst, mode);
+}
+
+// a FilterGraph parsed once per chain
+static void run_chain(const char *chain, cv::Mat &src, cv::Mat &dst) {
+  FilterGraph graph;
+  graph.parse(chain);
+  graph.apply(src, dst);
+}
+
+static const GoldenCase golden_cases[] = {
+    {"blur5x5", CV_8UC3, [](cv::Mat &src, cv::Mat &dst) { blur5x5(src, dst); }, blur5x5_reference},
+    {"sobelX3x3", CV_16SC3, [](cv::Mat &src, cv::Mat &dst) { sobelX3x3(src, dst); },
+     [](cv::Mat &src, cv::Mat &dst) { sobelX3x3_reference(src, dst); }},
+    {"sobelY3x3", CV_16SC3, [](cv::Mat &src, cv::Mat &dst) { sobelY3x3(src, dst); },
+     [](cv::Mat &src, cv::Mat &dst) { sobelY3x3_reference(src, dst); }},
+    {"cartoon", CV_8UC3, [](cv::Mat &src, cv::Mat &dst) { cartoon(src, dst, CARTOON_LEVELS, CARTOON_THRESHOLD); },
+     [](cv::Mat &src, cv::Mat &dst) { cartoon_reference(src, dst, MAGNITUDE_EXACT); }},
+    // the magnitude modes, on their own, fused with the sobels and in cartoon
+    {"magnitude exact", CV_8UC3, [](cv::Mat &src, cv::Mat &dst) { sobel_then_magnitude(src, dst, MAGNITUDE_EXACT); },
+     [](cv::Mat &src, cv::Mat &dst) { sobel_magnitude_reference(src, dst, MAGNITUDE_EXACT); }},
+    {"magnitude l1", CV_8UC3, [](cv::Mat &src, cv::Mat &dst) { sobel_then_magnitude(src, dst, MAGNITUDE_L1); },
+     [](cv::Mat &src, cv::Mat &dst) { sobel_magnitude_reference(src, dst, MAGNITUDE_L1); }},
+    {"magnitude maxmin", CV_8UC3, [](cv::Mat &src, cv::Mat &dst) { sobel_then_magnitude(src, dst, MAGNITUDE_MAX_MIN); },
+     [](cv::Mat &src, cv::Mat &dst) { sobel_magnitude_reference(src, dst, MAGNITUDE_MAX_MIN); }},
+    {"sobel_magnitude exact", CV_8UC3, [](cv::Mat &src, cv::Mat &dst) { sobel_magnitude(src, dst, MAGNITUDE_EXACT); },
+     [](cv::Mat &src, cv::Mat &dst) { sobel_magnitude_reference(src, dst, MAGNITUDE_EXACT); }},
+    {"sobel_magnitude l1", CV_8UC3, [](cv::Mat &src, cv::Mat &dst) { sobel_magnitude(src, dst, MAGNITUDE_L1); },
+     [](cv::Mat &src, cv::Mat &dst) { sobel_magnitude_reference(src, dst, MAGNITUDE_L1); }},
+    {"sobel_magnitude maxmin", CV_8UC3, [](cv::Mat &src, cv::Mat &dst) {
+      sobel_magnitude(src, dst, MAGNITUDE_MAX_MIN);
+    }, [](cv::Mat &src, cv::Mat &dst) { sobel_magnitude_reference(src, dst, MAGNITUDE_MAX_MIN); }},
+    {"cartoon l1", CV_8UC3, [](cv::Mat &src, cv::Mat &dst) {
+      cartoon(src, dst, CARTOON_LEVELS, CARTOON_THRESHOLD, MAGNITUDE_L1);
+    }, [](cv::Mat &src, cv::Mat &dst) { cartoon_reference(src, dst, MAGNITUDE_L1); }},
+    {"cartoon maxmin", CV_8UC3, [](cv::Mat &src, cv::Mat &dst) {
+      cartoon(src, dst, CARTOON_LEVELS, CARTOON_THRESHOLD, MAGNITUDE_MAX_MIN);
+    }, [](cv::Mat &src, cv::Mat &dst) { cartoon_reference(src, dst, MAGNITUDE_MAX_MIN); }},
+    // the running-sum boxes against boxes summed pixel by pixel, radii past the frame edges included; a Gaussian of
+    // radius 2 is blur5x5
+    {"box_blur r1", CV_8UC3, [](cv::Mat &src, cv::Mat &dst) { box_blur(src, dst, 1); }, [](cv::Mat &src, cv::Mat &dst) {
+      const int radius = 1;
+      stacked_box_reference(src, dst, &radius, 1);
+    }},
+    {"box_blur r32", CV_8UC3, [](cv::Mat &src, cv::Mat &dst) { box_blur(src, dst, 32); },
+     [](cv::Mat &src, cv::Mat &dst) {
+       const int radius = 32;
+       stacked_box_reference(src, dst, &radius, 1);
+     }},
+    {"gaussian_blur r2", CV_8UC3, [](cv::Mat &src, cv::Mat &dst) { gaussian_blur(src, dst, 2); }, blur5x5_reference},
+    {"gaussian_blur r8", CV_8UC3, [](cv::Mat &src, cv::Mat &dst) { gaussian_blur(src, dst, 8); },
+     [](cv::Mat &src, cv::Mat &dst) { gaussian_reference(src, dst, 8); }},
+    {"gaussian_blur r32", CV_8UC3, [](cv::Mat &src, cv::Mat &dst) { gaussian_blur(src, dst, 32); },
+     [](cv::Mat &src, cv::Mat &dst) { gaussian_reference(src, dst, 32); }},
+    // colour matrices, point-wise, so also on every colour
+    {"greyscale", CV_8UC3, [](cv::Mat &src, cv::Mat &dst) { greyscale(src, dst); }, greyscale_reference, 0, true},
+    {"sepia", CV_8UC3, [](cv::Mat &src, cv::Mat &dst) { sepia(src, dst); },
+     [](cv::Mat &src, cv::Mat &dst) { sepia_reference(src, dst); }, 1, true},
+    {"colour matrix mixing", CV_8UC3, [](cv::Mat &src, cv::Mat &dst) {
+      ColorMatrix(MIXING_COEFFICIENTS, MIXING_OFFSET).apply(src, dst);
+    }, mixing_reference, 1, true},
+    // point tables, the contrast and brightness modes of video_display against what convertTo() gave them before
+    {"negative", CV_8UC3, [](cv::Mat &src, cv::Mat &dst) { negative(src, dst); }, negative_reference},
+    {"lut add_contrast", CV_8UC3, [](cv::Mat &src, cv::Mat &dst) { PointLut::convert(2, 0).apply(src, dst); },
+     [](cv::Mat &src, cv::Mat &dst) { src.convertTo(dst, -1, 2, 0); }},
+    {"lut dec_contrast", CV_8UC3, [](cv::Mat &src, cv::Mat &dst) { PointLut::convert(0.25, 0).apply(src, dst); },
+     [](cv::Mat &src, cv::Mat &dst) { src.convertTo(dst, -1, 0.25, 0); }},
+    {"lut add_brightness", CV_8UC3, [](cv::Mat &src, cv::Mat &dst) { PointLut::convert(1, 100).apply(src, dst); },
+     [](cv::Mat &src, cv::Mat &dst) { src.convertTo(dst, -1, 1, 100); }},
+    {"lut dec_brightness", CV_8UC3, [](cv::Mat &src, cv::Mat &dst) { PointLut::convert(1, -100).apply(src, dst); },
+     [](cv::Mat &src, cv::Mat &dst) { src.convertTo(dst, -1, 1, -100); }},
+    {"lut quantize:15", CV_8UC3, [](cv::Mat &src, cv::Mat &dst) { PointLut::quantize(15).apply(src, dst); },
+     [](cv::Mat &src, cv::Mat &dst) { quantize_reference(src, dst, 15); }},
+    {"lut negative then contrast:1.5,brightness:-20 then quantize:6", CV_8UC3, [](cv::Mat &src, cv::Mat &dst) {
+      PointLut::negative().then(PointLut::convert(1.5, -20)).then(PointLut::quantize(6)).apply(src, dst);
+    }, [](cv::Mat &src, cv::Mat &dst) {
+      negative_reference(src, dst);
+      dst.convertTo(dst, -1, 1.5, -20);
+      quantize_reference(dst, dst, 6);
+    }},
+    // emboss, fused with the greyscale, as a graph stage and on planes, its border pixels filtered like the others,
+    // then the other filters of planar.h between to_planar() and to_interleaved()
+    {"emboss", CV_8UC3, [](cv::Mat &src, cv::Mat &dst) { emboss(src, dst); }, emboss_reference_with_border},
+    {"chain emboss", CV_8UC3, [](cv::Mat &src, cv::Mat &dst) { run_chain("emboss", src, dst); },
+     emboss_reference_with_border},
+    {"planar round trip", CV_8UC3, [](cv::Mat &src, cv::Mat &dst) {
+      PlanarFrame planes;
+      to_planar(src, planes);
+      to_interleaved(planes, dst);
+    }, [](cv::Mat &src, cv::Mat &dst) { src.copyTo(dst); }},
+    {"blur5x5_planar", CV_8UC3, [](cv::Mat &src, cv::Mat &dst) { run_planar(blur5x5_planar, src, dst); },
+     blur5x5_reference},
+    {"sobelX3x3_planar", CV_16SC3, [](cv::Mat &src, cv::Mat &dst) { run_planar(sobelX3x3_planar, src, dst); },
+     [](cv::Mat &src, cv::Mat &dst) { sobelX3x3_reference(src, dst); }},
+    {"sobelY3x3_planar", CV_16SC3, [](cv::Mat &src, cv::Mat &dst) { run_planar(sobelY3x3_planar, src, dst); },
+     [](cv::Mat &src, cv::Mat &dst) { sobelY3x3_reference(src, dst); }},
+    {"magnitude_planar", CV_8UC3, [](cv::Mat &src, cv::Mat &dst) {
+      PlanarFrame planes, sx, sy, magnitudes;
+      to_planar(src, planes);
+      sobelX3x3_planar(planes, sx);
+      sobelY3x3_planar(planes, sy);
+      magnitude_planar(sx, sy, magnitudes);
+      to_interleaved(magnitudes, dst);
+    }, [](cv::Mat &src, cv::Mat &dst) { sobel_magnitude_reference(src, dst, MAGNITUDE_EXACT); }},
+    {"emboss_planar", CV_8UC3, [](cv::Mat &src, cv::Mat &dst) { run_planar(emboss_planar, src, dst); },
+     emboss_reference_with_border},
+    // filter graphs against the separate filters they chain, on one pass (point-wise stages only), two passes and
+    // three, which keep intermediate rows between the passes of a strip
+    {"chain blur,sepia,emboss", CV_8UC3, [](cv::Mat &src, cv::Mat &dst) { run_chain("blur,sepia,emboss", src, dst); },
+     [](cv::Mat &src, cv::Mat &dst) {
+       cv::Mat blurred;
+       blur5x5(src, blurred);
+       sepia(blurred, blurred);
+       emboss(blurred, dst);
+     }},
+    {"chain sepia,negative", CV_8UC3, [](cv::Mat &src, cv::Mat &dst) { run_chain("sepia,negative", src, dst); },
+     [](cv::Mat &src, cv::Mat &dst) {
+       sepia(src, dst);
+       negative(dst, dst);
+     }},
+    {"chain contrast:2,brightness:-30,quantize:6,greyscale", CV_8UC3, [](cv::Mat &src, cv::Mat &dst) {
+      run_chain("contrast:2,brightness:-30,quantize:6,greyscale", src, dst);
+    }, [](cv::Mat &src, cv::Mat &dst) {
+      PointLut::convert(2, 0).apply(src, dst);
+      PointLut::convert(1, -30).apply(dst, dst);
+      PointLut::quantize(6).apply(dst, dst);
+      greyscale(dst, dst);
+    }},
+    {"chain emboss,blur,blur", CV_8UC3, [](cv::Mat &src, cv::Mat &dst) { run_chain("emboss,blur,blur", src, dst); },
+     [](cv::Mat &src, cv::Mat &dst) {
+       cv::Mat embossed, blurred;
+       emboss(src, embossed);
+       blur5x5(embossed, blurred);
+       blur5x5(blurred, dst);
+     }},
+};
+
+struct Frame {
+  const char *pattern;
+  cv::Mat pixels;
+};
+
+static cv::Mat random_frame(int rows, int cols, unsigned seed) {
+  cv::Mat frame(rows, cols, CV_8UC3);
+  unsigned x = seed * 2654435761u | 1;
+  for (int i = 0; i < rows; i++) {
+    uchar *p = frame.ptr<uchar>(i);
+    for (int j = 0; j < cols * 3; j++) {
+      x ^= x << 13;
+      x ^= x >> 17;
+      x ^= x << 5;
+      p[j] = (uchar) (x >> 24);
+    }
+  }
+  return frame;
+}
+
+// 0 and 255 on alternate pixels, the largest gradients the sobels can see, the three channels out of phase
+static cv::Mat checkerboard_frame(int rows, int cols) {
+  cv::Mat frame(rows, cols, CV_8UC3);
+  for (int i = 0; i < rows; i++) {
+    uchar *p = frame.ptr<uchar>(i);
+    for (int j = 0; j < cols; j++) {
+      for (int c = 0; c < 3; c++) {
+        p[3 * j + c] = (i + j + c) % 2 ? 255 : 0;
+      }
+    }
+  }
+  return frame;
+}
+
+// a different slope on every channel, wrapping around at 256
+static cv::Mat gradient_frame(int rows, int cols) {
+  cv::Mat frame(rows, cols, CV_8UC3);
+  for (int i = 0; i < rows; i++) {
+    uchar *p = frame.ptr<uchar>(i);
+    for (int j = 0; j < cols; j++) {
+      p[3 * j] = (uchar) (i * 3 + j * 5);
+      p[3 * j + 1] = (uchar) (i * 11 - j * 7);
+      p[3 * j + 2] = (uchar) (255 - j * 2 + i);
+    }
+  }
+  return frame;
+}
+
+static std::vector<Frame> golden_frames() {
+  static const int sizes[][2] = {{1, 1}, {1, 37}, {37, 1}, {2, 2}, {2, 9}, {9, 2}, {3, 3}, {4, 6}, {5, 5}, {6, 4},
+                                 {7, 17}, {17, 7}, {13, 31}, {32, 33}, {48, 97}, {61, 129}, {300, 2600}};
+  std::vector<Frame> frames;
+  unsigned seed = 1;
+  for (const int *size: sizes) {
+    frames.push_back({"random", random_frame(size[0], size[1], seed++)});
+    frames.push_back({"checkerboard", checkerboard_frame(size[0], size[1])});
+    frames.push_back({"gradient", gradient_frame(size[0], size[1])});
+  }
+  return frames;
+}
+
+// 4096x4096 pixels, blue counting up along the row, then green, then red
+static cv::Mat every_colour_frame() {
+  cv::Mat frame(4096, 4096, CV_8UC3);
+  for (int i = 0; i < frame.rows; i++) {
+    uchar *p = frame.ptr<uchar>(i);
+    for (int j = 0; j < frame.cols; j++) {
+      int colour = i * frame.cols + j;
+      p[3 * j] = (uchar) colour;
+      p[3 * j + 1] = (uchar) (colour >> 8);
+      p[3 * j + 2] = (uchar) (colour >> 16);
+    }
+  }
+  return frame;
+}
+
+// the simd levels this build and the CPU support, scalar first
+static std::vector<SimdLevel> supported_levels() {
+  std::vector<SimdLevel> levels;
+  SimdLevel all[] = {SIMD_SCALAR, SIMD_SSE2, SIMD_NEON, SIMD_AVX2};
+  for (SimdLevel level: all) {
+    if (set_simd_level(level) == 0) {
+      levels.push_back(level);
+    }
+  }
+  return levels;
+}
+
+// 0 if no byte of a is more than tolerance away from the same byte of b, otherwise print the first difference and
+// return 1
+static int compare(const cv::Mat &a, const cv::Mat &b, const char *name, const Frame &frame, const char *against,
+                   int tolerance = 0) {
+  size_t width = (size_t) a.cols * a.elemSize();
+  for (int i = 0; i < a.rows; i++) {
+    const uchar *p = a.ptr<uchar>(i), *q = b.ptr<uchar>(i);
+    for (size_t x = 0; x < width; x++) {
+      if (std::abs(p[x] - q[x]) > tolerance) {
+        printf("FAIL %s on a %dx%d %s frame at %s, %d threads: byte %d of row %d is %d, %s gives %d\n", name,
+               frame.pixels.cols, frame.pixels.rows, frame.pattern, simd_level_name(get_simd_level()),
+               get_num_threads(), (int) x, i, p[x], against, q[x]);
+        return 1;
+      }
+    }
+  }
+  return 0;
+}
+
+// dst filled with a value no filter computes everywhere, so a pixel a filter forgets to write shows up
+static cv::Mat output_frame(const cv::Mat &src, int type) {
+  return cv::Mat(src.rows, src.cols, type, cv::Scalar::all(77));
+}
+
+// run a case on a frame at every level and thread count, returns the number of failed comparisons
+static int run_case(const GoldenCase &test, const Frame &frame, const std::vector<SimdLevel> &levels,
+                    int &comparisons) {
+  const int thread_counts[] = {1, 3};
+  int failures = 0;
+  cv::Mat src = frame.pixels.clone();
+  set_simd_level(SIMD_SCALAR);
+  set_num_threads(1);
+  cv::Mat expected = output_frame(src, test.type);
+  test.run(src, expected);
+  if (test.reference != nullptr) {
+    cv::Mat reference = output_frame(src, test.type);
+    test.reference(src, reference);
+    failures += compare(expected, reference, test.name, frame, "the reference", test.tolerance);
+    comparisons++;
+  }
+  for (SimdLevel level: levels) {
+    set_simd_level(level);
+    for (int threads: thread_counts) {
+      set_num_threads(threads);
+      cv::Mat dst = output_frame(src, test.type);
+      test.run(src, dst);
+      failures += compare(dst, expected, test.name, frame, "the scalar level");
+      comparisons++;
+      // a filter writing a frame like its own input must also work in place
+      if (test.type == src.type()) {
+        cv::Mat in_place = src.clone();
+        test.run(in_place, in_place);
+        failures += compare(in_place, expected, test.name, frame, "the scalar level out of place");
+        comparisons++;
+      }
+    }
+  }
+  return failures;
+}
+
+int main() {
+  std::vector<SimdLevel> levels = supported_levels();
+  std::vector<Frame> frames = golden_frames();
+  Frame colours = {"every colour", every_colour_frame()};
+  int comparisons = 0, failures = 0;
+  for (const GoldenCase &test: golden_cases) {
+    for (const Frame &frame: frames) {
+      failures += run_case(test, frame, levels, comparisons);
+    }
+    if (test.every_colour) {
+      failures += run_case(test, colours, levels, comparisons);
+    }
+  }
+  printf("%d cases on %d frames at", (int) (sizeof(golden_cases) / sizeof(golden_cases[0])), (int) frames.size());
+  for (SimdLevel level: levels) {
+    printf(" %s", simd_level_name(level));
+  }
+  printf(": %d comparisons, %d failed\n", comparisons, failures);
+  return failures == 0 ? 0 : 1;
+}
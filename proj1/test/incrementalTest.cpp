@@ -0,0 +1,82 @@
+#include <cstdio>
+#include <opencv2/opencv.hpp>
+#include "dirty_tiles.h"
+#include "effects.h"
+#include "frame_pool.h"
+#include "frame_source.h"
+#include "parallel.h"
+
+/*
+ * Checks that the incremental mode of video_display gives the output of the whole frame. Every effect runs on the
+ * generated frames of a still scene and of a moving one, once through apply_effect() on the whole frame and once
+ * through DirtyTiles::refilter() with a threshold of 0, so every tile that changed at all is filtered again, and the
+ * two outputs must be byte for byte the same on every frame. Exits with 1 if an effect differed.
+ */
+
+#define TEST_FRAMES 12
+#define TEST_TILE_SIZE 16
+#define TEST_THREADS 3
+
+static const struct {
+  int effect;
+  const char *name;
+} tested_effects[] = {
+    {ORIGIN, "origin"}, {GRAY, "gray"}, {ALTERNATIVE_GREY, "alternative_grey"}, {BLUR, "blur"},
+    {X_SOBEL, "x_sobel"}, {Y_SOBEL, "y_sobel"}, {MAGNITUDE, "magnitude"}, {BLUR_QUANTIZE, "blur_quantize"},
+    {CARTOON, "cartoon"}, {NEGATIVE, "negative"}, {ADD_CONTRAST, "add_contrast"}, {DEC_CONTRAST, "dec_contrast"},
+    {ADD_BRIGHTNESS, "add_brightness"}, {DEC_BRIGHTNESS, "dec_brightness"}, {SEPIA, "sepia"}, {EMBOSS, "emboss"},
+    {CHAIN, "chain"}, {GAUSSIAN, "gaussian"},
+};
+
+static const char *tested_sources[] = {"synthetic:640x480:12:still", "synthetic:320x240:12"};
+
+// the first pixel where a and b differ, or (-1, -1)
+static cv::Point first_difference(const cv::Mat &a, const cv::Mat &b) {
+  for (int i = 0; i < a.rows; i++) {
+    const uchar *p = a.ptr<uchar>(i), *q = b.ptr<uchar>(i);
+    for (int x = 0; x < a.cols * 3; x++) {
+      if (p[x] != q[x]) {
+        return cv::Point(x / 3, i);
+      }
+    }
+  }
+  return cv::Point(-1, -1);
+}
+
+int main() {
+  set_num_threads(TEST_THREADS);
+  EffectSettings settings;
+  settings.chain.parse("blur,sepia,emboss");
+  int failures = 0;
+  for (const char *source_name: tested_sources) {
+    for (const auto &tested: tested_effects) {
+      FrameSource *source = open_frame_source(source_name);
+      FramePool pool({CV_16SC3, CV_8UC1});
+      DirtyTiles tiles(TEST_TILE_SIZE, 0);
+      cv::Mat frame, full, incremental;
+      for (int i = 0; i < TEST_FRAMES && source->next(frame); i++) {
+        pool.reserve(frame.size());
+        full.create(frame.rows, frame.cols, CV_8UC3);
+        pool.release_all();
+        apply_effect(settings, tested.effect, frame, full, pool);
+        tiles.update(frame);
+        tiles.refilter(frame, incremental, effect_halo(settings, tested.effect), [&](cv::Mat &src, cv::Mat &dst) {
+          pool.release_all();
+          apply_effect(settings, tested.effect, src, dst, pool);
+        });
+        cv::Point at = first_difference(incremental, full);
+        if (at.x >= 0) {
+          printf("FAIL %s on %s: frame %d differs from the whole frame at (%d, %d)\n", tested.name, source_name, i,
+                 at.x, at.y);
+          failures++;
+          break;
+        }
+      }
+      delete source;
+    }
+  }
+  printf("%d effects on %d sources, %d frames each: %d differed\n",
+         (int) (sizeof(tested_effects) / sizeof(tested_effects[0])),
+         (int) (sizeof(tested_sources) / sizeof(tested_sources[0])), TEST_FRAMES, failures);
+  return failures == 0 ? 0 : 1;
+}
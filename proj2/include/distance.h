@@ -0,0 +1,65 @@
+#include <cstddef>
+
+#ifndef PROJ2_INCLUDE_DISTANCE_H_
+#define PROJ2_INCLUDE_DISTANCE_H_
+
+// how two feature vectors of non-negative floats are compared, a is the query and b the database vector
+enum Distance {
+  // sum of min(a, b), a similarity, 1 for two equal normalized histograms
+  DISTANCE_INTERSECTION = 0,
+  // sum of |a - b|
+  DISTANCE_L1 = 1,
+  // sqrt of the sum of (a - b)^2
+  DISTANCE_L2 = 2,
+  // sum of (a - b)^2 / (a + b), the bins empty in both vectors count 0
+  DISTANCE_CHI_SQUARE = 3,
+  // sum of (a - b)^2, the baseline task
+  DISTANCE_SSD = 4,
+  DISTANCES = 5,
+};
+
+// the instruction sets the distance kernels are compiled for, each level a superset of the ones before
+enum SimdLevel {
+  SIMD_SCALAR = 0,
+  SIMD_AVX2 = 1,
+  SIMD_AVX512 = 2,
+};
+
+/*
+ * Every level sums the elements the same way: element i into the accumulator i % 16, the 16 accumulators added in
+ * halves, and the elements after the last full 16 one after another at the end. So a distance is the same float on any
+ * CPU and at any level, and the matches of a query do not depend on where it runs.
+ */
+typedef float (*DistanceKernel)(const float *a, const float *b, int length);
+// the distances of query to count vectors of length floats, stride floats apart, into scores
+typedef void (*DistanceBlockKernel)(const float *query, const float *vectors, size_t stride, int count, int length,
+                                    float *scores);
+
+struct DistanceKernels {
+  DistanceKernel pair[DISTANCES];
+  DistanceBlockKernel block[DISTANCES];
+};
+
+// the widest level both this build and the running CPU support; the kernels start on it, or on AVX2 if that is
+// AVX-512, which is slower on these short vectors
+SimdLevel detect_simd_level();
+// run the kernels on a given level, e.g. SIMD_SCALAR for the reference, returns -1 (and keeps the current level) if
+// the build or the CPU does not support it
+int set_simd_level(SimdLevel level);
+SimdLevel get_simd_level();
+// "scalar", "avx2" or "avx512"
+const char *simd_level_name(SimdLevel level);
+// take --threads <n> and --simd <scalar|avx2|avx512> out of the command line wherever they are, setting the number of
+// threads (parallel.h) and the level of the kernels, and leave the other arguments in place for the program to check;
+// returns -1 (after printing why) if the level is unknown or not supported
+int take_parallel_options(int &argc, char *argv[]);
+
+// the kernels of the current level
+const DistanceKernels &distance_kernels();
+
+float distance(Distance type, const float *a, const float *b, int length);
+// the same as distance() for each vector of a block, the query is loaded once for several vectors
+void distance_block(Distance type, const float *query, const float *vectors, size_t stride, int count, int length,
+                    float *scores);
+
+#endif //PROJ2_INCLUDE_DISTANCE_H_
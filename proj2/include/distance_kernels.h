@@ -0,0 +1,238 @@
+#include "distance.h"
+#include <cmath>
+#if defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h>
+#endif
+#if defined(__AVX2__)
+#define PROJ2_HAVE_AVX2 1
+#endif
+#if defined(__AVX512F__)
+#define PROJ2_HAVE_AVX512 1
+#endif
+
+#ifndef PROJ2_INCLUDE_DISTANCE_KERNELS_H_
+#define PROJ2_INCLUDE_DISTANCE_KERNELS_H_
+
+/*
+ * The distance kernels, written once over a vector of 16 float lanes and instantiated for plain floats, AVX2 (two
+ * registers) and AVX-512 (one register). Only distance.cpp and the translation units compiled with -mavx2 and -mavx512f
+ * include this file; everything is in an anonymous namespace so the linker cannot merge an AVX-512 copy of a function
+ * into the code that runs on older CPUs.
+ */
+namespace distance_simd {
+namespace {
+
+// the reference, 16 floats one after another
+struct scalar {
+  struct vec {
+    float v[16];
+  };
+  static vec zero() {
+    vec r;
+    for (int i = 0; i < 16; i++) r.v[i] = 0.f;
+    return r;
+  }
+  static vec load(const float *p) {
+    vec r;
+    for (int i = 0; i < 16; i++) r.v[i] = p[i];
+    return r;
+  }
+  static vec add(vec a, vec b) {
+    for (int i = 0; i < 16; i++) a.v[i] += b.v[i];
+    return a;
+  }
+  static vec sub(vec a, vec b) {
+    for (int i = 0; i < 16; i++) a.v[i] -= b.v[i];
+    return a;
+  }
+  static vec mul(vec a, vec b) {
+    for (int i = 0; i < 16; i++) a.v[i] *= b.v[i];
+    return a;
+  }
+  // b < a ? b : a like std::min(a, b), and like minps with the operands swapped
+  static vec min(vec a, vec b) {
+    for (int i = 0; i < 16; i++) a.v[i] = b.v[i] < a.v[i] ? b.v[i] : a.v[i];
+    return a;
+  }
+  static vec abs(vec a) {
+    for (int i = 0; i < 16; i++) a.v[i] = std::fabs(a.v[i]);
+    return a;
+  }
+  // a / b, 0 where b is 0
+  static vec div_or_zero(vec a, vec b) {
+    for (int i = 0; i < 16; i++) a.v[i] = b.v[i] != 0.f ? a.v[i] / b.v[i] : 0.f;
+    return a;
+  }
+  // lanes i and i + 8, then i and i + 4, i and i + 2, and the last two
+  static float sum(vec a) {
+    for (int half = 8; half > 0; half /= 2) {
+      for (int i = 0; i < half; i++) a.v[i] += a.v[i + half];
+    }
+    return a.v[0];
+  }
+};
+
+#ifdef PROJ2_HAVE_AVX2
+// the 8 lanes of an __m256 added the way scalar::sum adds its first 8
+inline float sum_avx2(__m256 a) {
+  __m128 h = _mm_add_ps(_mm256_castps256_ps128(a), _mm256_extractf128_ps(a, 1));
+  h = _mm_add_ps(h, _mm_movehl_ps(h, h));
+  h = _mm_add_ss(h, _mm_shuffle_ps(h, h, 1));
+  return _mm_cvtss_f32(h);
+}
+
+struct avx2 {
+  // lanes 0 to 7 and 8 to 15
+  struct vec {
+    __m256 lo, hi;
+  };
+  static vec make(__m256 lo, __m256 hi) {
+    vec r = {lo, hi};
+    return r;
+  }
+  static vec zero() { return make(_mm256_setzero_ps(), _mm256_setzero_ps()); }
+  static vec load(const float *p) { return make(_mm256_loadu_ps(p), _mm256_loadu_ps(p + 8)); }
+  static vec add(vec a, vec b) { return make(_mm256_add_ps(a.lo, b.lo), _mm256_add_ps(a.hi, b.hi)); }
+  static vec sub(vec a, vec b) { return make(_mm256_sub_ps(a.lo, b.lo), _mm256_sub_ps(a.hi, b.hi)); }
+  static vec mul(vec a, vec b) { return make(_mm256_mul_ps(a.lo, b.lo), _mm256_mul_ps(a.hi, b.hi)); }
+  static vec min(vec a, vec b) { return make(_mm256_min_ps(b.lo, a.lo), _mm256_min_ps(b.hi, a.hi)); }
+  static vec abs(vec a) {
+    __m256 sign = _mm256_set1_ps(-0.f);
+    return make(_mm256_andnot_ps(sign, a.lo), _mm256_andnot_ps(sign, a.hi));
+  }
+  static vec div_or_zero(vec a, vec b) {
+    __m256 zero = _mm256_setzero_ps();
+    return make(_mm256_and_ps(_mm256_cmp_ps(b.lo, zero, _CMP_NEQ_UQ), _mm256_div_ps(a.lo, b.lo)),
+                _mm256_and_ps(_mm256_cmp_ps(b.hi, zero, _CMP_NEQ_UQ), _mm256_div_ps(a.hi, b.hi)));
+  }
+  static float sum(vec a) { return sum_avx2(_mm256_add_ps(a.lo, a.hi)); }
+};
+#endif
+
+#ifdef PROJ2_HAVE_AVX512
+// min and the shuffles use the masked forms with all lanes set, the plain ones trip -Wuninitialized in GCC 12 headers
+struct avx512 {
+  typedef __m512 vec;
+  static vec zero() { return _mm512_setzero_ps(); }
+  static vec load(const float *p) { return _mm512_loadu_ps(p); }
+  static vec add(vec a, vec b) { return _mm512_add_ps(a, b); }
+  static vec sub(vec a, vec b) { return _mm512_sub_ps(a, b); }
+  static vec mul(vec a, vec b) { return _mm512_mul_ps(a, b); }
+  static vec min(vec a, vec b) { return _mm512_mask_min_ps(a, 0xffff, b, a); }
+  static vec abs(vec a) { return _mm512_abs_ps(a); }
+  static vec div_or_zero(vec a, vec b) {
+    return _mm512_maskz_div_ps(_mm512_cmp_ps_mask(b, _mm512_setzero_ps(), _CMP_NEQ_UQ), a, b);
+  }
+  // the tree of scalar::sum, by swapping the 256-bit halves, the 128-bit quarters and the pairs within each quarter
+  static float sum(vec a) {
+    a = _mm512_add_ps(a, _mm512_mask_shuffle_f32x4(a, 0xffff, a, a, _MM_SHUFFLE(1, 0, 3, 2)));
+    a = _mm512_add_ps(a, _mm512_mask_shuffle_f32x4(a, 0xffff, a, a, _MM_SHUFFLE(2, 3, 0, 1)));
+    a = _mm512_add_ps(a, _mm512_mask_permute_ps(a, 0xffff, a, _MM_SHUFFLE(1, 0, 3, 2)));
+    a = _mm512_add_ps(a, _mm512_mask_permute_ps(a, 0xffff, a, _MM_SHUFFLE(2, 3, 0, 1)));
+    return _mm512_cvtss_f32(a);
+  }
+};
+#endif
+
+// what each distance adds up, for 16 lanes and for the single elements after them, and its final step
+struct intersection_op {
+  template<typename V> static typename V::vec lanes(typename V::vec a, typename V::vec b) { return V::min(a, b); }
+  static float element(float a, float b) { return b < a ? b : a; }
+  static float finish(float sum) { return sum; }
+};
+
+struct l1_op {
+  template<typename V> static typename V::vec lanes(typename V::vec a, typename V::vec b) {
+    return V::abs(V::sub(a, b));
+  }
+  static float element(float a, float b) { return std::fabs(a - b); }
+  static float finish(float sum) { return sum; }
+};
+
+struct ssd_op {
+  template<typename V> static typename V::vec lanes(typename V::vec a, typename V::vec b) {
+    typename V::vec d = V::sub(a, b);
+    return V::mul(d, d);
+  }
+  static float element(float a, float b) { return (a - b) * (a - b); }
+  static float finish(float sum) { return sum; }
+};
+
+struct l2_op : ssd_op {
+  static float finish(float sum) { return std::sqrt(sum); }
+};
+
+struct chi_square_op {
+  template<typename V> static typename V::vec lanes(typename V::vec a, typename V::vec b) {
+    typename V::vec d = V::sub(a, b);
+    return V::div_or_zero(V::mul(d, d), V::add(a, b));
+  }
+  static float element(float a, float b) {
+    float s = a + b;
+    return s != 0.f ? (a - b) * (a - b) / s : 0.f;
+  }
+  static float finish(float sum) { return sum; }
+};
+
+template<typename V, typename Op>
+float pair_kernel(const float *a, const float *b, int length) {
+  typename V::vec sum = V::zero();
+  int i = 0;
+  for (; i + 16 <= length; i += 16) {
+    sum = V::add(sum, Op::template lanes<V>(V::load(a + i), V::load(b + i)));
+  }
+  float tail = 0.f;
+  for (; i < length; i++) {
+    tail += Op::element(a[i], b[i]);
+  }
+  return Op::finish(V::sum(sum) + tail);
+}
+
+// 4 vectors at a time against each 16 floats of the query, every vector summed exactly like pair_kernel() does
+template<typename V, typename Op>
+void block_kernel(const float *query, const float *vectors, size_t stride, int count, int length, float *scores) {
+  int j = 0;
+  for (; j + 4 <= count; j += 4) {
+    const float *b0 = vectors + j * stride, *b1 = b0 + stride, *b2 = b1 + stride, *b3 = b2 + stride;
+    typename V::vec s0 = V::zero(), s1 = V::zero(), s2 = V::zero(), s3 = V::zero();
+    int i = 0;
+    for (; i + 16 <= length; i += 16) {
+      typename V::vec q = V::load(query + i);
+      s0 = V::add(s0, Op::template lanes<V>(q, V::load(b0 + i)));
+      s1 = V::add(s1, Op::template lanes<V>(q, V::load(b1 + i)));
+      s2 = V::add(s2, Op::template lanes<V>(q, V::load(b2 + i)));
+      s3 = V::add(s3, Op::template lanes<V>(q, V::load(b3 + i)));
+    }
+    float t0 = 0.f, t1 = 0.f, t2 = 0.f, t3 = 0.f;
+    for (; i < length; i++) {
+      t0 += Op::element(query[i], b0[i]);
+      t1 += Op::element(query[i], b1[i]);
+      t2 += Op::element(query[i], b2[i]);
+      t3 += Op::element(query[i], b3[i]);
+    }
+    scores[j] = Op::finish(V::sum(s0) + t0);
+    scores[j + 1] = Op::finish(V::sum(s1) + t1);
+    scores[j + 2] = Op::finish(V::sum(s2) + t2);
+    scores[j + 3] = Op::finish(V::sum(s3) + t3);
+  }
+  for (; j < count; j++) {
+    scores[j] = pair_kernel<V, Op>(query, vectors + j * stride, length);
+  }
+}
+
+// in the order of enum Distance
+template<typename V>
+DistanceKernels make_distance_kernels() {
+  DistanceKernels kernels = {
+      {pair_kernel<V, intersection_op>, pair_kernel<V, l1_op>, pair_kernel<V, l2_op>, pair_kernel<V, chi_square_op>,
+       pair_kernel<V, ssd_op>},
+      {block_kernel<V, intersection_op>, block_kernel<V, l1_op>, block_kernel<V, l2_op>,
+       block_kernel<V, chi_square_op>, block_kernel<V, ssd_op>},
+  };
+  return kernels;
+}
+
+}
+}
+
+#endif //PROJ2_INCLUDE_DISTANCE_KERNELS_H_
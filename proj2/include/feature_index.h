@@ -0,0 +1,76 @@
+#include "distance.h"
+#include "features.h"
+#include <string>
+#include <vector>
+
+#ifndef PROJ2_INCLUDE_FEATURE_INDEX_H_
+#define PROJ2_INCLUDE_FEATURE_INDEX_H_
+
+// the width and height of the centre patch the baseline task compares
+#define PATCH_SIZE 9
+
+// the features the tasks compare, each a vector of floats of feature_length() elements
+enum FeatureType {
+  // the B, G and R values of the PATCH_SIZE x PATCH_SIZE pixels at the centre of the image, row by row (task 1)
+  FEATURE_BASELINE = 0,
+  // the normalized BINS x BINS rg chromaticity histogram (tasks 2, 4 and 5)
+  FEATURE_RG = 1,
+  // the normalized BINS^3 RGB histograms of the top and the bottom half of the image (task 3)
+  FEATURE_TOP_RGB = 2,
+  FEATURE_BOTTOM_RGB = 3,
+  // the normalized BINS histograms of the sobel magnitude (task 4), the Laws filter (task 5) and the horizontal and
+  // vertical Gabor filters (task 6)
+  FEATURE_SOBEL_TEXTURE = 4,
+  FEATURE_LAWS_TEXTURE = 5,
+  FEATURE_GABOR_HORIZONTAL = 6,
+  FEATURE_GABOR_VERTICAL = 7,
+  FEATURE_TYPES = 8,
+};
+
+int feature_length(FeatureType type);
+
+// the features a task from 1 to 6 compares, one bit per FeatureType
+unsigned mode_features(int mode);
+
+// true for the tasks where a lower score is a better match, the distance of task 1, false for the similarities
+bool lower_is_better(int mode);
+
+// the feature vectors of one image, one pointer per type, null for the types that were not computed
+struct FeatureView {
+  const float *vectors[FEATURE_TYPES];
+};
+
+// the features of one image, all of them in a single buffer
+struct ImageFeatures {
+  std::vector<float> values;
+  unsigned types = 0;
+
+  FeatureView view() const;
+};
+
+// compute the features given by types (see mode_features(), ~0u for all) of a BGR image the way the tasks do
+int compute_features(const cv::Mat &img, unsigned types, MagnitudeMode magnitude_mode, ImageFeatures &features);
+
+// the features a task compares, with the distance and the weight of each; one feature has a second weight of 0
+struct ModeScore {
+  Distance distance;
+  FeatureType first;
+  float first_weight;
+  FeatureType second;
+  float second_weight;
+};
+
+// what score_features() computes for a task from 1 to 6, false for any other mode
+bool mode_score(int mode, ModeScore &score);
+
+// the score of an image against the query for a task from 1 to 6, from the features mode_features() lists
+float score_features(int mode, const FeatureView &query, const FeatureView &image);
+// the scores of count images whose features are strides[type] floats apart, starting at first_image, the same as
+// score_features() gives each, with every feature of the query compared against a block of images at a time
+void score_features_block(int mode, const FeatureView &query, const FeatureView &first_image,
+                          const int strides[FEATURE_TYPES], int count, float *scores);
+
+// add the paths of the images (.jpg, .png, .ppm and .tif) of a directory to files, exits if it cannot be opened
+int read_files(char *img_dir, std::vector<std::string> &files);
+
+#endif //PROJ2_INCLUDE_FEATURE_INDEX_H_
@@ -0,0 +1,109 @@
+#include "feature_index.h"
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#ifndef PROJ2_INCLUDE_FEATURE_STORE_H_
+#define PROJ2_INCLUDE_FEATURE_STORE_H_
+
+// the first bytes of a feature file, and the version of its layout and of the features in it (3: the texture
+// histograms count every pixel once)
+#define FEATURE_FILE_MAGIC "CBIRFEAT"
+#define FEATURE_FILE_VERSION 3
+// every column, and every vector in it, starts on a multiple of this many bytes, a cache line and an AVX-512 register
+#define FEATURE_ALIGNMENT 64
+
+/*
+ * The header at the start of a feature file. The file is laid out by column: for every FeatureType the vectors of all
+ * the images one after another, each stride floats apart (its length rounded up to FEATURE_ALIGNMENT bytes, the padding
+ * zeroed), then the string table of the image paths, count + 1 offsets into the characters after them, each path
+ * ending with a 0. Every offset is in bytes from the start of the file and all the numbers are in the byte order of the
+ * machine that wrote it.
+ */
+struct FeatureFileHeader {
+  char magic[8];
+  int32_t version;
+  int32_t count;
+  // how the sobel texture of task 4 was computed, queries have to use the same
+  int32_t magnitude_mode;
+  int32_t reserved;
+  int32_t lengths[FEATURE_TYPES];
+  int32_t strides[FEATURE_TYPES];
+  int64_t columns[FEATURE_TYPES];
+  int64_t path_offsets;
+  int64_t path_chars;
+  int64_t file_size;
+};
+
+/*
+ * Writes a feature file one image at a time, in the layout FeatureFileHeader describes: open() makes room in every
+ * column for a number of images, add() writes the vectors of the next one and keeps its path, and close() writes the
+ * string table and the header. write_feature_file() and the test fixtures both write their files through it.
+ */
+class FeatureFileWriter {
+ public:
+  FeatureFileWriter() = default;
+  FeatureFileWriter(const FeatureFileWriter &) = delete;
+  FeatureFileWriter &operator=(const FeatureFileWriter &) = delete;
+
+  // returns -1 if path cannot be written
+  int open(const char *path, int capacity, MagnitudeMode magnitude_mode);
+  // every type of features must be there, feature_length() floats each; returns -1 once capacity images were added
+  int add(const FeatureView &features, const std::string &image_path);
+  // returns the number of images written, -1 if the file could not be written
+  int close();
+
+ private:
+  std::ofstream file;
+  std::string file_path;
+  FeatureFileHeader header = FeatureFileHeader();
+  int capacity = 0;
+  std::vector<std::string> paths;
+  std::vector<float> row;
+};
+
+// compute every feature of the images and write them to a feature file, skipping the ones that cannot be read
+// returns the number of images written, -1 if the file cannot be written
+int write_feature_file(const char *path, const std::vector<std::string> &files, MagnitudeMode magnitude_mode);
+
+/*
+ * A feature file mapped into memory. Opening it maps the file and checks the header without reading anything else, so
+ * it takes the same time whatever the size of the database, and the pages come in from the page cache as a scan
+ * touches them, shared with every other process that maps the same file. A scan over one feature type only reads its
+ * column.
+ */
+class FeatureStore {
+ public:
+  FeatureStore() = default;
+  FeatureStore(const FeatureStore &) = delete;
+  FeatureStore &operator=(const FeatureStore &) = delete;
+  ~FeatureStore();
+
+  // returns -1 if path is not a feature file, -2 if it is one of another version, truncated or damaged
+  int open(const char *path);
+  void close();
+
+  const FeatureFileHeader &header() const;
+  int count() const;
+  // the floats from one vector of a type to the next
+  int stride(FeatureType type) const;
+  // the first vector of a type, FEATURE_ALIGNMENT aligned, the one of image i is stride(type) * i floats further
+  const float *column(FeatureType type) const;
+  const char *path(int image) const;
+  // the vectors of every type of one image
+  FeatureView view(int image) const;
+
+ private:
+  const unsigned char *data = nullptr;
+  size_t size = 0;
+  const FeatureFileHeader *file_header = nullptr;
+  const int64_t *path_offsets = nullptr;
+#ifdef _WIN32
+  void *file = nullptr, *mapping = nullptr;
+#else
+  int file = -1;
+#endif
+};
+
+#endif //PROJ2_INCLUDE_FEATURE_STORE_H_
@@ -15,6 +15,16 @@
 #define CUSTOM_HIST_IMAGE "..\\olympus\\pic.0746.jpg"
 #define EXTENSION_IMAGE "..\\olympus\\pic.1070.jpg"
 
+// how magnitude() and sobel_magnitude() combine the two gradients, each keeps the low 8 bits of its result
+enum MagnitudeMode {
+  // sqrt(gx * gx + gy * gy), truncated
+  MAGNITUDE_EXACT = 0,
+  // |gx| + |gy|, up to 41% above the exact value
+  MAGNITUDE_L1 = 1,
+  // (123 * max(|gx|, |gy|) + 51 * min(|gx|, |gy|)) / 128, within 4% of the exact value
+  MAGNITUDE_MAX_MIN = 2,
+};
+
 float sum_of_square_difference(const cv::Mat &src, const cv::Mat &dst);
 float intersection_distance(const cv::Mat &m1, const cv::Mat &m2, bool is_3d);
 int hist_normalize(cv::Mat &src, cv::Mat &dst, bool is_3d);
@@ -25,4 +35,9 @@ int texture_histogram(const cv::Mat &src, int *bins, float *normalized_bins);
 int sobelX3x3(cv::Mat &src, cv::Mat &dst);
 int sobelY3x3(cv::Mat &src, cv::Mat &dst);
 int magnitude(cv::Mat &sx, cv::Mat &sy, cv::Mat &dst);
+int magnitude(cv::Mat &sx, cv::Mat &sy, cv::Mat &dst, MagnitudeMode mode);
+// the magnitude of sobelX3x3 and sobelY3x3 in one pass without the CV_16SC3 images, the border pixels are 0
+int sobel_magnitude(const cv::Mat &src, cv::Mat &dst, MagnitudeMode mode = MAGNITUDE_EXACT);
+// "exact", "l1" or "maxmin", returns -1 for any other name
+int parse_magnitude_mode(const char *name, MagnitudeMode &mode);
 #endif //PROJ2_INCLUDE_FEATURES_H_
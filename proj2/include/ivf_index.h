@@ -0,0 +1,73 @@
+#include "feature_store.h"
+#include "top_k.h"
+#include <cstdint>
+#include <vector>
+
+#ifndef PROJ2_INCLUDE_IVF_INDEX_H_
+#define PROJ2_INCLUDE_IVF_INDEX_H_
+
+#define IVF_FILE_MAGIC "CBIRIVF1"
+#define IVF_FILE_VERSION 3
+
+// the beginning of an index file, followed by the centroids, the list offsets and the image indices
+struct IvfFileHeader {
+  char magic[8];
+  int32_t version;
+  // the task the index answers
+  int32_t mode;
+  int32_t count;
+  int32_t lists;
+  // the floats of an embedded vector and of a centroid, padded with zeros to a multiple of 16
+  int32_t dim;
+  int32_t stride;
+  // the feature file it was built on: a hash of its header and of the histograms of the task of every image
+  uint64_t feature_file_hash;
+};
+
+/*
+ * An approximate nearest-neighbour index over a feature file for one of the histogram tasks, 2 to 6: an inverted file
+ * (IVF) of k-means lists. The histograms of a task are embedded with the Hellinger (square root) transform: each
+ * histogram h with weight w in the task score becomes sqrt(w * h), concatenated. The embedded vectors have unit length,
+ * and the Euclidean distance between two of them is the Hellinger distance of the weighted histograms, which ranks
+ * images close to the way histogram intersection does. The images are clustered by k-means on their embedding, and the
+ * index keeps only the centroids and the images of every list, so its memory is O(lists * dim + count) however long
+ * the histograms are. A query goes to the probes lists whose centroids are nearest to its own embedding and scores
+ * their images on the rows of the mapped feature file with the distance kernels of the linear scan, so every score is
+ * exactly the one of the scan and only the images of the lists that were not probed can be missed. The feature file
+ * given to build() or load() has to stay open while the index is queried.
+ */
+class IvfIndex {
+ public:
+  // cluster the images of a feature file for a task into lists lists (0 for about sqrt(count)), on all threads
+  int build(const FeatureStore &store, int mode, int lists, int iterations = 10);
+  int save(const char *path) const;
+  // read an index written by save(), -1 if it was not built on this feature file as it is now
+  int load(const char *path, const FeatureStore &store);
+
+  int mode() const;
+  int lists() const;
+  // the images of list l
+  int list_size(int l) const;
+
+  // the k best matches among the images of the probes lists nearest to the query, best first; scanned, if given, is
+  // set to the number of images that were scored
+  std::vector<Match> query(const FeatureView &query, int k, int probes, int *scanned = nullptr) const;
+
+ private:
+  // the embedding of the histograms of the task, stride floats
+  void embed(const FeatureView &features, float *vector) const;
+  void nearest_lists(const float *vector, int probes, std::vector<Match> &nearest) const;
+  // score the lists on the rows of this feature file
+  void use_store(const FeatureStore &feature_store);
+
+  IvfFileHeader header = IvfFileHeader();
+  std::vector<float> centroids;
+  // the images of list l are ids[offsets[l]] to ids[offsets[l + 1] - 1], in the order of the feature file
+  std::vector<int32_t> offsets;
+  std::vector<int32_t> ids;
+  // the feature file the lists point into, and the floats from one of its vectors to the next
+  const FeatureStore *store = nullptr;
+  int strides[FEATURE_TYPES] = {0};
+};
+
+#endif //PROJ2_INCLUDE_IVF_INDEX_H_
@@ -0,0 +1,29 @@
+#ifndef PROJ2_INCLUDE_PARALLEL_H_
+#define PROJ2_INCLUDE_PARALLEL_H_
+
+// set the number of threads the database is scanned on, the calling thread included, 0 for one per hardware thread
+void set_num_threads(int threads);
+int get_num_threads();
+
+/*
+ * Run body(context, thread, begin, end) over the items [0, count) in chunks of at most chunk items, spread over a
+ * work-stealing pool and the calling thread, and return when all are done. Every thread starts with an equal share of
+ * the items and takes chunks off the front of it; a thread that runs out steals the back half of the largest share
+ * left, so a few slow items (a big image to decode) do not hold up the rest. thread is the index of the thread running
+ * the chunk, below get_num_threads(), for per-thread partial results. If the pool is already busy (a parallel_for()
+ * called from a chunk, or from a second thread), the chunks run one after another on the calling thread as thread 0.
+ */
+void parallel_for(int count, int chunk, void (*body)(void *context, int thread, int begin, int end), void *context);
+
+// same as above for any callable taking (thread, begin, end), usually a lambda
+template<typename Body>
+void parallel_for(int count, int chunk, const Body &body) {
+  struct Trampoline {
+    static void call(void *context, int thread, int begin, int end) {
+      (*static_cast<const Body *>(context))(thread, begin, end);
+    }
+  };
+  parallel_for(count, chunk, &Trampoline::call, const_cast<Body *>(&body));
+}
+
+#endif //PROJ2_INCLUDE_PARALLEL_H_
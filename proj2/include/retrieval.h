@@ -0,0 +1,46 @@
+#include "feature_store.h"
+#include "top_k.h"
+#include <string>
+#include <vector>
+
+#ifndef PROJ2_INCLUDE_RETRIEVAL_H_
+#define PROJ2_INCLUDE_RETRIEVAL_H_
+
+/*
+ * The database a query runs against: a feature file written by build_index, or the images of a directory, which are
+ * then decoded and their features computed on every query. A query streams over the database a chunk of images at a
+ * time on all threads and keeps only the k best matches of each thread, so it needs O(k) memory per thread (and query)
+ * whatever the size of the database.
+ */
+class ImageDatabase {
+ public:
+  // open a feature file, or list the images of a directory when path is not one, which exits if it cannot be opened;
+  // returns -1 for a feature file this version cannot read
+  int open(char *path);
+
+  // true for a feature file
+  bool indexed() const;
+  int count() const;
+  std::string path(int image) const;
+
+  // how the sobel texture of task 4 is computed, fixed by a feature file, exact by default for a directory
+  MagnitudeMode magnitude_mode() const;
+  // returns -1 for a feature file built with another mode
+  int set_magnitude_mode(MagnitudeMode mode);
+
+  // the k best matches of a BGR image for a task from 1 to 6, best first, see TopK for the order
+  std::vector<Match> query(const cv::Mat &image, int mode, int k) const;
+  // the same for the features of a query image computed with compute_features(), which needs mode_features(mode)
+  std::vector<Match> query(const FeatureView &features, int mode, int k) const;
+  // the k best matches of each of several queries in a single pass over the database: a block of feature file rows is
+  // scored against every query while it is in the cache, and a directory image is decoded once for all of them
+  std::vector<std::vector<Match>> query_batch(const std::vector<FeatureView> &queries, int mode, int k) const;
+
+ private:
+  FeatureStore store;
+  bool feature_file = false;
+  std::vector<std::string> files;
+  MagnitudeMode texture_mode = MAGNITUDE_EXACT;
+};
+
+#endif //PROJ2_INCLUDE_RETRIEVAL_H_
@@ -0,0 +1,36 @@
+#include <vector>
+
+#ifndef PROJ2_INCLUDE_TOP_K_H_
+#define PROJ2_INCLUDE_TOP_K_H_
+
+// the score of one database image, index is its position in the database
+struct Match {
+  float score;
+  int index;
+};
+
+/*
+ * The k best matches of a scan, kept in a heap with the worst of them on top, so a scan over n images costs
+ * O(n log k) and O(k) memory. Better is the lower score for a distance and the higher one for a similarity; on equal
+ * scores the image listed first in the database wins, and NaN scores lose to all others, so the order is the same
+ * whatever order the images were pushed in and the partial results of several threads can be merged.
+ */
+class TopK {
+ public:
+  TopK(int k, bool lower_is_better);
+
+  void push(float score, int index);
+  // add the matches of another TopK of the same k and order, e.g. the partial result of another thread
+  void merge(const TopK &other);
+  // the matches, best first
+  std::vector<Match> sorted() const;
+
+ private:
+  bool better(const Match &a, const Match &b) const;
+
+  int k;
+  bool ascending;
+  std::vector<Match> heap;
+};
+
+#endif //PROJ2_INCLUDE_TOP_K_H_
@@ -0,0 +1,93 @@
+#include "distance.h"
+#include "ivf_index.h"
+#include "parallel.h"
+#include "retrieval.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+static double elapsed_ms(int64 start) {
+  return (double) (cv::getTickCount() - start) * 1000.0 / cv::getTickFrequency();
+}
+
+/*
+ * The recall and the latency of an IVF index against the exact scan of its feature file, e.g.
+ *   ann_benchmark ..\olympus.features ..\olympus.task2.ivf 10 200
+ * The queries are images of the file itself, evenly spread over it. Recall@k is the share of the k exact matches the
+ * index finds, averaged over the queries, for 1, 2, 4, ... probed lists up to all of them. Everything runs on one
+ * thread unless --threads says otherwise, so the times are the latency of a single query.
+ */
+int main(int argc, char *argv[]) {
+  // --threads <n> and --simd <scalar|avx2|avx512> anywhere on the command line, one thread by default
+  set_num_threads(1);
+  if (take_parallel_options(argc, argv) != 0) {
+    exit(-1);
+  }
+
+  if (argc < 3) {
+    printf("usage: %s <feature file> <index file> [k] [queries] [--threads <n>] [--simd <level>]\n", argv[0]);
+    exit(-1);
+  }
+  ImageDatabase database;
+  FeatureStore store;
+  IvfIndex index;
+  if (store.open(argv[1]) != 0 || database.open(argv[1]) != 0 || !database.indexed()) {
+    printf("Cannot read the feature file %s\n", argv[1]);
+    exit(-1);
+  }
+  if (index.load(argv[2], store) != 0) {
+    printf("Cannot read the index %s, or it was built on another feature file\n", argv[2]);
+    exit(-1);
+  }
+  int k = argc > 3 ? atoi(argv[3]) : 10;
+  int queries = std::min(argc > 4 ? atoi(argv[4]) : 200, store.count());
+  int mode = index.mode();
+  if (k < 1 || queries < 1) {
+    printf("k and the number of queries should be at least 1");
+    exit(-1);
+  }
+
+  std::vector<FeatureView> views(queries);
+  for (int q = 0; q < queries; q++) {
+    views[q] = store.view((int) ((int64_t) q * store.count() / queries));
+  }
+  // the exact matches of every query, as sorted image indices
+  std::vector<std::vector<int>> exact(queries);
+  int64 start = cv::getTickCount();
+  for (int q = 0; q < queries; q++) {
+    for (const Match &match: database.query(views[q], mode, k)) {
+      exact[q].push_back(match.index);
+    }
+  }
+  double exact_ms = elapsed_ms(start) / queries;
+  for (std::vector<int> &matches: exact) {
+    std::sort(matches.begin(), matches.end());
+  }
+  printf("Exact scan of %d images for task %d: %.3f ms per query on %d threads with %s, %d queries\n", store.count(),
+         mode, exact_ms, get_num_threads(), simd_level_name(get_simd_level()), queries);
+  printf("%8s %10s %10s %9s %9s\n", "probes", "recall", "ms/query", "speedup", "scanned");
+
+  for (int probes = 1;; probes = std::min(probes * 2, index.lists())) {
+    std::vector<std::vector<Match>> approximate(queries);
+    std::vector<int> scanned(queries);
+    start = cv::getTickCount();
+    for (int q = 0; q < queries; q++) {
+      approximate[q] = index.query(views[q], k, probes, &scanned[q]);
+    }
+    double ann_ms = elapsed_ms(start) / queries;
+    double found = 0.0, scored = 0.0;
+    for (int q = 0; q < queries; q++) {
+      for (const Match &match: approximate[q]) {
+        found += std::binary_search(exact[q].begin(), exact[q].end(), match.index) ? 1.0 : 0.0;
+      }
+      scored += scanned[q];
+    }
+    printf("%8d %10.4f %10.4f %8.1fx %8.2f%%\n", probes, found / ((double) queries * std::min(k, store.count())),
+           ann_ms, exact_ms / ann_ms, 100.0 * scored / ((double) queries * store.count()));
+    if (probes == index.lists()) {
+      break;
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,98 @@
+#include "distance.h"
+#include "parallel.h"
+#include "retrieval.h"
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <vector>
+
+/*
+ * Answer a list of query images for a task in one pass over the database, e.g.
+ *   batch_query ..\olympus.features 2 queries.txt 4
+ * queries.txt holds one image path per line. Every line of the output is a query followed by its k best matches (the
+ * query itself first if it is in the database) and their scores, separated by tabs.
+ */
+int main(int argc, char *argv[]) {
+  // --threads <n> anywhere on the command line sets the number of threads, one per hardware thread by default, and
+  // --simd <scalar|avx2|avx512> the instruction set of the distance kernels
+  if (take_parallel_options(argc, argv) != 0) {
+    exit(-1);
+  }
+
+  if (argc < 4) {
+    printf("usage: %s <directory path|feature file> <task> <query list> [k] [--threads <n>] [--simd <level>]\n",
+           argv[0]);
+    exit(-1);
+  }
+  int mode = atoi(argv[2]);
+  if (mode < 1 || mode > 6) {
+    printf("Mode should be one of the number from 1 to 6");
+    exit(-1);
+  }
+  int k = argc > 4 ? atoi(argv[4]) : 4;
+  if (k < 1) {
+    printf("k should be at least 1");
+    exit(-1);
+  }
+
+  ImageDatabase database;
+  if (database.open(argv[1]) != 0) {
+    exit(-1);
+  }
+  std::ifstream list(argv[3]);
+  if (!list) {
+    printf("Cannot open the query list %s\n", argv[3]);
+    exit(-1);
+  }
+  std::vector<std::string> paths;
+  std::string line;
+  while (std::getline(list, line)) {
+    // a list written on Windows
+    if (!line.empty() && line.back() == '\r') {
+      line.pop_back();
+    }
+    if (!line.empty()) {
+      paths.push_back(line);
+    }
+  }
+
+  // the queries are decoded and their features computed on all threads, the way the database images were
+  int64 start = cv::getTickCount();
+  std::vector<ImageFeatures> features(paths.size());
+  std::vector<char> decoded(paths.size());
+  parallel_for((int) paths.size(), 1, [&](int, int begin, int end) {
+    for (int i = begin; i < end; i++) {
+      cv::Mat img = cv::imread(paths[i]);
+      decoded[i] = !img.empty();
+      if (decoded[i]) {
+        compute_features(img, mode_features(mode), database.magnitude_mode(), features[i]);
+      }
+    }
+  });
+  std::vector<FeatureView> queries;
+  std::vector<int> query_paths;
+  for (size_t i = 0; i < paths.size(); i++) {
+    if (!decoded[i]) {
+      printf("Cannot read %s, skipped\n", paths[i].c_str());
+      continue;
+    }
+    queries.push_back(features[i].view());
+    query_paths.push_back((int) i);
+  }
+  int64 scan_start = cv::getTickCount();
+  std::vector<std::vector<Match>> matches = database.query_batch(queries, mode, k);
+  int64 done = cv::getTickCount();
+
+  for (size_t q = 0; q < matches.size(); q++) {
+    printf("%s", paths[query_paths[q]].c_str());
+    for (const Match &match: matches[q]) {
+      printf("\t%s\t%g", database.path(match.index).c_str(), match.score);
+    }
+    printf("\n");
+  }
+  printf("Scored %d queries against %d images on %d threads with %s in %.1f ms (%.1f ms for the queries)\n",
+         (int) queries.size(), database.count(), get_num_threads(), simd_level_name(get_simd_level()),
+         (double) (done - scan_start) * 1000.0 / cv::getTickFrequency(),
+         (double) (scan_start - start) * 1000.0 / cv::getTickFrequency());
+  return 0;
+}
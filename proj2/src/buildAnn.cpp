@@ -0,0 +1,44 @@
+#include "distance.h"
+#include "ivf_index.h"
+#include "parallel.h"
+#include <cstdio>
+#include <cstdlib>
+
+/*
+ * Cluster the images of a feature file for a histogram task into an IVF index, e.g.
+ *   build_ann ..\olympus.features ..\olympus.task2.ivf 2
+ * the optional fourth argument is the number of lists, about the square root of the number of images by default.
+ */
+int main(int argc, char *argv[]) {
+  // --threads <n> anywhere on the command line sets the number of threads, one per hardware thread by default, and
+  // --simd <scalar|avx2|avx512> the instruction set of the distance kernels the clustering runs on
+  if (take_parallel_options(argc, argv) != 0) {
+    exit(-1);
+  }
+
+  if (argc < 4) {
+    printf("usage: %s <feature file> <index file> <task> [lists] [--threads <n>] [--simd <level>]\n", argv[0]);
+    exit(-1);
+  }
+  FeatureStore store;
+  if (store.open(argv[1]) != 0) {
+    printf("Cannot read the feature file %s, run build_index first\n", argv[1]);
+    exit(-1);
+  }
+  int mode = atoi(argv[3]);
+  int lists = argc > 4 ? atoi(argv[4]) : 0;
+
+  IvfIndex index;
+  int64 start = cv::getTickCount();
+  if (index.build(store, mode, lists) != 0 || index.save(argv[2]) != 0) {
+    exit(-1);
+  }
+  int largest = 0;
+  for (int l = 0; l < index.lists(); l++) {
+    largest = std::max(largest, index.list_size(l));
+  }
+  printf("Clustered %d images into %d lists (the largest of %d) for task %d on %d threads in %.1f s\n", store.count(),
+         index.lists(), largest, mode, get_num_threads(),
+         (double) (cv::getTickCount() - start) / cv::getTickFrequency());
+  return 0;
+}
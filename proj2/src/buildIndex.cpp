@@ -0,0 +1,41 @@
+#include "distance.h"
+#include "feature_store.h"
+#include "parallel.h"
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+/*
+ * Compute the features of every task once for all the images of a directory and write them to a feature file, e.g.
+ *   build_index ..\olympus ..\olympus.features maxmin
+ * main then takes the feature file in place of the directory and only decodes the query image.
+ */
+int main(int argc, char *argv[]) {
+  // --threads <n> anywhere on the command line sets the number of threads, one per hardware thread by default, and
+  // --simd <scalar|avx2|avx512> the instruction set of the distance kernels
+  if (take_parallel_options(argc, argv) != 0) {
+    exit(-1);
+  }
+
+  if (argc < 3) {
+    printf("usage: %s <directory path> <feature file> [exact|l1|maxmin] [--threads <n>] [--simd <level>]\n", argv[0]);
+    exit(-1);
+  }
+  // the magnitude mode of the texture of task 4, the queries on the file will use the same
+  MagnitudeMode magnitude_mode = MAGNITUDE_EXACT;
+  if (argc > 3 && parse_magnitude_mode(argv[3], magnitude_mode) != 0) {
+    printf("Magnitude mode should be exact, l1 or maxmin");
+    exit(-1);
+  }
+
+  std::vector<std::string> files;
+  read_files(argv[1], files);
+  int64 start = cv::getTickCount();
+  int count = write_feature_file(argv[2], files, magnitude_mode);
+  if (count < 0) {
+    exit(-1);
+  }
+  printf("Indexed %d images into %s on %d threads in %.1f s\n", count, argv[2], get_num_threads(),
+         (double) (cv::getTickCount() - start) / cv::getTickFrequency());
+  return 0;
+}
@@ -0,0 +1,144 @@
+#include "distance_kernels.h"
+#include "parallel.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#endif
+
+#ifdef PROJ2_HAVE_AVX2_KERNELS
+extern const DistanceKernels avx2_distance_kernels;
+#endif
+#ifdef PROJ2_HAVE_AVX512_KERNELS
+extern const DistanceKernels avx512_distance_kernels;
+#endif
+
+static const DistanceKernels scalar_distance_kernels = distance_simd::make_distance_kernels<distance_simd::scalar>();
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+// the cpuid bit of leaf 7 (ebx) and the register state the OS has to save (XCR0)
+static bool msvc_cpu_supports(int leaf7_bit, unsigned long long state) {
+  int info[4];
+  __cpuid(info, 0);
+  if (info[0] < 7) {
+    return false;
+  }
+  __cpuid(info, 1);
+  // OSXSAVE and AVX
+  if ((info[2] & (1 << 27)) == 0 || (info[2] & (1 << 28)) == 0 || (_xgetbv(0) & state) != state) {
+    return false;
+  }
+  __cpuidex(info, 7, 0);
+  return (info[1] & (1 << leaf7_bit)) != 0;
+}
+#endif
+
+static bool cpu_has_avx2() {
+#if defined(PROJ2_HAVE_AVX2_KERNELS) && (defined(__GNUC__) || defined(__clang__))
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2");
+#elif defined(PROJ2_HAVE_AVX2_KERNELS) && defined(_MSC_VER)
+  // the ymm registers
+  return msvc_cpu_supports(5, 0x6);
+#else
+  return false;
+#endif
+}
+
+static bool cpu_has_avx512() {
+#if defined(PROJ2_HAVE_AVX512_KERNELS) && (defined(__GNUC__) || defined(__clang__))
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx512f");
+#elif defined(PROJ2_HAVE_AVX512_KERNELS) && defined(_MSC_VER)
+  // the ymm and zmm registers and the mask registers
+  return msvc_cpu_supports(16, 0xe6);
+#else
+  return false;
+#endif
+}
+
+SimdLevel detect_simd_level() {
+  if (cpu_has_avx512()) {
+    return SIMD_AVX512;
+  }
+  if (cpu_has_avx2()) {
+    return SIMD_AVX2;
+  }
+  return SIMD_SCALAR;
+}
+
+// AVX2 where the CPU has AVX-512 as well: the histograms are short and mostly memory bound, and with the 16 lanes of
+// one zmm register summed one after another AVX-512 scored 1.3-1.6x slower than the two ymm registers of AVX2
+static SimdLevel default_simd_level() {
+  SimdLevel best = detect_simd_level();
+  return best == SIMD_AVX512 && cpu_has_avx2() ? SIMD_AVX2 : best;
+}
+
+static SimdLevel current_level = default_simd_level();
+
+int set_simd_level(SimdLevel level) {
+  if (level < SIMD_SCALAR || level > detect_simd_level()) {
+    return -1;
+  }
+  current_level = level;
+  return 0;
+}
+
+SimdLevel get_simd_level() {
+  return current_level;
+}
+
+const char *simd_level_name(SimdLevel level) {
+  switch (level) {
+    case SIMD_AVX2:return "avx2";
+    case SIMD_AVX512:return "avx512";
+    default:return "scalar";
+  }
+}
+
+int take_parallel_options(int &argc, char *argv[]) {
+  int kept = 1;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+      set_num_threads(atoi(argv[++i]));
+    } else if (strcmp(argv[i], "--simd") == 0 && i + 1 < argc) {
+      const char *name = argv[++i];
+      int level = SIMD_SCALAR;
+      while (level <= SIMD_AVX512 && strcmp(simd_level_name((SimdLevel) level), name) != 0) {
+        level++;
+      }
+      if (level > SIMD_AVX512 || set_simd_level((SimdLevel) level) != 0) {
+        printf("simd level %s is not supported here\n", name);
+        return -1;
+      }
+    } else {
+      argv[kept++] = argv[i];
+    }
+  }
+  argc = kept;
+  argv[argc] = nullptr;
+  return 0;
+}
+
+const DistanceKernels &distance_kernels() {
+  switch (current_level) {
+#ifdef PROJ2_HAVE_AVX512_KERNELS
+    case SIMD_AVX512:return avx512_distance_kernels;
+#endif
+#ifdef PROJ2_HAVE_AVX2_KERNELS
+    case SIMD_AVX2:return avx2_distance_kernels;
+#endif
+    default:return scalar_distance_kernels;
+  }
+}
+
+float distance(Distance type, const float *a, const float *b, int length) {
+  return distance_kernels().pair[type](a, b, length);
+}
+
+void distance_block(Distance type, const float *query, const float *vectors, size_t stride, int count, int length,
+                    float *scores) {
+  distance_kernels().block[type](query, vectors, stride, count, length, scores);
+}
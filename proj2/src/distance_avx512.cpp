@@ -0,0 +1,6 @@
+// This file is compiled with AVX-512 enabled, its kernels are only used after detect_simd_level() has checked the CPU
+#include "distance_kernels.h"
+
+#ifdef PROJ2_HAVE_AVX512
+extern const DistanceKernels avx512_distance_kernels = distance_simd::make_distance_kernels<distance_simd::avx512>();
+#endif
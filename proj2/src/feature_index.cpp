@@ -0,0 +1,303 @@
+#include "feature_index.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <dirent.h>
+
+// the images score_features_block() scores one feature of before it moves on to the next
+#define SCORE_BLOCK 64
+
+int feature_length(FeatureType type) {
+  switch (type) {
+    case FEATURE_BASELINE: {
+      return PATCH_SIZE * PATCH_SIZE * 3;
+    }
+    case FEATURE_RG: {
+      return BINS * BINS;
+    }
+    case FEATURE_TOP_RGB:
+    case FEATURE_BOTTOM_RGB: {
+      return BINS * BINS * BINS;
+    }
+    default: {
+      return BINS;
+    }
+  }
+}
+
+unsigned mode_features(int mode) {
+  switch (mode) {
+    case 1: {
+      return 1u << FEATURE_BASELINE;
+    }
+    case 2: {
+      return 1u << FEATURE_RG;
+    }
+    case 3: {
+      return 1u << FEATURE_TOP_RGB | 1u << FEATURE_BOTTOM_RGB;
+    }
+    case 4: {
+      return 1u << FEATURE_RG | 1u << FEATURE_SOBEL_TEXTURE;
+    }
+    case 5: {
+      return 1u << FEATURE_RG | 1u << FEATURE_LAWS_TEXTURE;
+    }
+    case 6: {
+      return 1u << FEATURE_GABOR_HORIZONTAL | 1u << FEATURE_GABOR_VERTICAL;
+    }
+    default: {
+      return 0;
+    }
+  }
+}
+
+bool lower_is_better(int mode) {
+  return mode == 1;
+}
+
+FeatureView ImageFeatures::view() const {
+  FeatureView view;
+  const float *next = values.data();
+  for (int t = 0; t < FEATURE_TYPES; t++) {
+    view.vectors[t] = types & 1u << t ? next : nullptr;
+    if (types & 1u << t) {
+      next += feature_length((FeatureType) t);
+    }
+  }
+  return view;
+}
+
+static double deginrad(int degree) {
+  return 2.0 * CV_PI / 360 * degree;
+}
+
+// the Laws E5 x L5 kernel of task 5 and the Gabor kernels of task 6, built once
+static const cv::Mat &laws_kernel() {
+  static const cv::Mat kernel = [] {
+    float L5_arr[5] = {-1, -2, 0, 2, 1};
+    cv::Mat L5(1, 5, CV_32F, L5_arr);
+    cv::Mat E5_T(5, 1, CV_32F, L5_arr);
+    return cv::Mat(E5_T * L5);
+  }();
+  return kernel;
+}
+
+static const cv::Mat &gabor_kernel(bool vertical) {
+  int kernel_size = 64;
+  double sigma = 2.5, lambda = 5, gamma = 0.2, psi = 0;
+  static const cv::Mat vertical_kernel =
+      cv::getGaborKernel(cv::Size(kernel_size, kernel_size), sigma, 0, lambda, gamma, psi, CV_32F);
+  static const cv::Mat horizontal_kernel =
+      cv::getGaborKernel(cv::Size(kernel_size, kernel_size), sigma, deginrad(90), lambda, gamma, psi, CV_32F);
+  return vertical ? vertical_kernel : horizontal_kernel;
+}
+
+// the texture histogram of a Gabor response stretched over [0, 255]
+static void gabor_texture(const cv::Mat &greyscale, bool vertical, float *normalized_bins) {
+  cv::Mat response;
+  cv::filter2D(greyscale, response, CV_32F, gabor_kernel(vertical));
+  double mins[4], maxs[4];
+  minMaxIdx(response, mins, maxs);
+  cv::Mat stretched;
+  response.convertTo(stretched, CV_8UC1, 255.0 / (maxs[0] - mins[0]), -255 * mins[0] / (maxs[0] - mins[0]));
+  int bins[BINS] = {0};
+  texture_histogram(stretched, bins, normalized_bins);
+}
+
+int compute_features(const cv::Mat &img, unsigned types, MagnitudeMode magnitude_mode, ImageFeatures &features) {
+  size_t total = 0;
+  for (int t = 0; t < FEATURE_TYPES; t++) {
+    if (types & 1u << t) {
+      total += feature_length((FeatureType) t);
+    }
+  }
+  features.types = types;
+  features.values.assign(total, 0.f);
+  // the same layout as view(), with pointers the vectors are filled in through
+  float *vectors[FEATURE_TYPES], *next = features.values.data();
+  for (int t = 0; t < FEATURE_TYPES; t++) {
+    vectors[t] = types & 1u << t ? next : nullptr;
+    if (types & 1u << t) {
+      next += feature_length((FeatureType) t);
+    }
+  }
+
+  if (vectors[FEATURE_BASELINE] != nullptr) {
+    int mid_row = img.rows / 2;
+    int mid_col = img.cols / 2;
+    float *patch = vectors[FEATURE_BASELINE];
+    for (int i = mid_row - PATCH_SIZE / 2; i <= mid_row + PATCH_SIZE / 2; i++) {
+      for (int j = mid_col - PATCH_SIZE / 2; j <= mid_col + PATCH_SIZE / 2; j++) {
+        for (int c = 0; c < 3; c++) {
+          *patch++ = img.at<cv::Vec3b>(i, j)[c];
+        }
+      }
+    }
+  }
+  if (vectors[FEATURE_RG] != nullptr) {
+    cv::Mat hist(BINS, BINS, CV_32SC1, cv::Scalar(0));
+    cv::Mat normalized(BINS, BINS, CV_32F, vectors[FEATURE_RG]);
+    rg_chrom_histogram(img, hist);
+    hist_normalize(hist, normalized, false);
+  }
+  if (vectors[FEATURE_TOP_RGB] != nullptr || vectors[FEATURE_BOTTOM_RGB] != nullptr) {
+    int size[] = {BINS, BINS, BINS};
+    cv::Mat top(3, size, CV_32SC1, cv::Scalar(0));
+    cv::Mat bottom(3, size, CV_32SC1, cv::Scalar(0));
+    halves_rgb_histogram(img, top, bottom);
+    if (vectors[FEATURE_TOP_RGB] != nullptr) {
+      cv::Mat normalized_top(3, size, CV_32F, vectors[FEATURE_TOP_RGB]);
+      hist_normalize(top, normalized_top, true);
+    }
+    if (vectors[FEATURE_BOTTOM_RGB] != nullptr) {
+      cv::Mat normalized_bottom(3, size, CV_32F, vectors[FEATURE_BOTTOM_RGB]);
+      hist_normalize(bottom, normalized_bottom, true);
+    }
+  }
+  if (vectors[FEATURE_SOBEL_TEXTURE] != nullptr) {
+    // both sobels and the magnitude in one pass, then the magnitude image to greyscale
+    cv::Mat converted_frame(img.rows, img.cols, CV_8UC3, cv::Scalar(0));
+    sobel_magnitude(img, converted_frame, magnitude_mode);
+    cv::Mat greyscale_magnitude(img.rows, img.cols, CV_8UC1);
+    cv::cvtColor(converted_frame, greyscale_magnitude, cv::COLOR_BGR2GRAY);
+    int bins[BINS] = {0};
+    texture_histogram(greyscale_magnitude, bins, vectors[FEATURE_SOBEL_TEXTURE]);
+  }
+  unsigned greyscale_types = 1u << FEATURE_LAWS_TEXTURE | 1u << FEATURE_GABOR_HORIZONTAL | 1u << FEATURE_GABOR_VERTICAL;
+  if (types & greyscale_types) {
+    cv::Mat greyscale(img.rows, img.cols, CV_8UC1);
+    cv::cvtColor(img, greyscale, cv::COLOR_BGR2GRAY);
+    if (vectors[FEATURE_LAWS_TEXTURE] != nullptr) {
+      cv::Mat laws;
+      cv::filter2D(greyscale, laws, CV_32F, laws_kernel());
+      cv::Mat laws_result(img.rows, img.cols, CV_8UC1, cv::Scalar(0));
+      for (int i = 0; i < laws.rows; i++) {
+        for (int j = 0; j < laws.cols; j++) {
+          laws_result.at<uchar>(i, j) = (uchar) std::min(std::fabs(laws.at<float>(i, j)), 255.f);
+        }
+      }
+      int bins[BINS] = {0};
+      texture_histogram(laws_result, bins, vectors[FEATURE_LAWS_TEXTURE]);
+    }
+    if (vectors[FEATURE_GABOR_HORIZONTAL] != nullptr) {
+      gabor_texture(greyscale, false, vectors[FEATURE_GABOR_HORIZONTAL]);
+    }
+    if (vectors[FEATURE_GABOR_VERTICAL] != nullptr) {
+      gabor_texture(greyscale, true, vectors[FEATURE_GABOR_VERTICAL]);
+    }
+  }
+  return 0;
+}
+
+bool mode_score(int mode, ModeScore &score) {
+  switch (mode) {
+    case 1: {
+      score = {DISTANCE_SSD, FEATURE_BASELINE, 1.f, FEATURE_BASELINE, 0.f};
+      return true;
+    }
+    case 2: {
+      score = {DISTANCE_INTERSECTION, FEATURE_RG, 1.f, FEATURE_RG, 0.f};
+      return true;
+    }
+    case 3: {
+      score = {DISTANCE_INTERSECTION, FEATURE_TOP_RGB, 0.5f, FEATURE_BOTTOM_RGB, 0.5f};
+      return true;
+    }
+    case 4: {
+      score = {DISTANCE_INTERSECTION, FEATURE_SOBEL_TEXTURE, 0.5f, FEATURE_RG, 0.5f};
+      return true;
+    }
+    case 5: {
+      score = {DISTANCE_INTERSECTION, FEATURE_LAWS_TEXTURE, 0.3f, FEATURE_RG, 0.7f};
+      return true;
+    }
+    case 6: {
+      score = {DISTANCE_INTERSECTION, FEATURE_GABOR_HORIZONTAL, 0.5f, FEATURE_GABOR_VERTICAL, 0.5f};
+      return true;
+    }
+    default: {
+      return false;
+    }
+  }
+}
+
+float score_features(int mode, const FeatureView &query, const FeatureView &image) {
+  ModeScore score;
+  if (!mode_score(mode, score)) {
+    return 0.f;
+  }
+  float first = distance(score.distance, query.vectors[score.first], image.vectors[score.first],
+                         feature_length(score.first)) * score.first_weight;
+  if (score.second_weight == 0.f) {
+    return first;
+  }
+  return first + distance(score.distance, query.vectors[score.second], image.vectors[score.second],
+                          feature_length(score.second)) * score.second_weight;
+}
+
+void score_features_block(int mode, const FeatureView &query, const FeatureView &first_image,
+                          const int strides[FEATURE_TYPES], int count, float *scores) {
+  ModeScore score;
+  if (!mode_score(mode, score)) {
+    std::fill(scores, scores + count, 0.f);
+    return;
+  }
+  float second[SCORE_BLOCK];
+  for (int begin = 0; begin < count; begin += SCORE_BLOCK) {
+    int images = std::min(count - begin, SCORE_BLOCK);
+    float *first = scores + begin;
+    distance_block(score.distance, query.vectors[score.first],
+                   first_image.vectors[score.first] + (size_t) begin * strides[score.first], strides[score.first],
+                   images, feature_length(score.first), first);
+    if (score.second_weight == 0.f) {
+      for (int i = 0; i < images; i++) {
+        first[i] *= score.first_weight;
+      }
+      continue;
+    }
+    distance_block(score.distance, query.vectors[score.second],
+                   first_image.vectors[score.second] + (size_t) begin * strides[score.second], strides[score.second],
+                   images, feature_length(score.second), second);
+    // the same sum as score_features()
+    for (int i = 0; i < images; i++) {
+      first[i] = first[i] * score.first_weight + second[i] * score.second_weight;
+    }
+  }
+}
+
+int read_files(char *img_dir, std::vector<std::string> &files) {
+  char dirname[256];
+  char buffer[256];
+  DIR *dirp;
+  struct dirent *dp;
+
+  strcpy(dirname, img_dir);
+  printf("Processing directory %s\n", dirname);
+
+  // open the directory
+  dirp = opendir(dirname);
+  if (dirp == nullptr) {
+    printf("Cannot open directory %s\n", dirname);
+    exit(-1);
+  }
+
+  // loop over all the files in the image file listing
+  while ((dp = readdir(dirp)) != nullptr) {
+
+    // check if the file is an image
+    if (strstr(dp->d_name, ".jpg") ||
+        strstr(dp->d_name, ".png") ||
+        strstr(dp->d_name, ".ppm") ||
+        strstr(dp->d_name, ".tif")) {
+
+      // build the overall filename
+      strcpy(buffer, dirname);
+      // change this line since the delimiter of file path in windows os is '\' instead of '/'
+      strcat(buffer, "\\");
+      strcat(buffer, dp->d_name);
+
+      files.emplace_back(buffer);
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,243 @@
+#include "feature_store.h"
+#include "parallel.h"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// the images every thread decodes per batch of write_feature_file(), a batch of features is about 35 KB per image
+#define INDEX_BATCH_PER_THREAD 8
+
+static int64_t align_up(int64_t value) {
+  return (value + FEATURE_ALIGNMENT - 1) / FEATURE_ALIGNMENT * FEATURE_ALIGNMENT;
+}
+
+int FeatureFileWriter::open(const char *path, int image_capacity, MagnitudeMode magnitude_mode) {
+  file.open(path, std::ios::binary | std::ios::trunc);
+  if (!file) {
+    printf("Cannot write the feature file %s\n", path);
+    return -1;
+  }
+  file_path = path;
+  capacity = image_capacity;
+  paths.clear();
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, FEATURE_FILE_MAGIC, sizeof(header.magic));
+  header.version = FEATURE_FILE_VERSION;
+  header.magnitude_mode = magnitude_mode;
+  // the columns have room for capacity images, the rows of the images never added stay unused at the end
+  int64_t offset = align_up(sizeof(header));
+  for (int t = 0; t < FEATURE_TYPES; t++) {
+    header.lengths[t] = feature_length((FeatureType) t);
+    header.strides[t] = (int32_t) (align_up(header.lengths[t] * (int64_t) sizeof(float)) / sizeof(float));
+    header.columns[t] = offset;
+    offset += (int64_t) capacity * header.strides[t] * (int64_t) sizeof(float);
+  }
+  header.path_offsets = offset;
+  return 0;
+}
+
+int FeatureFileWriter::add(const FeatureView &features, const std::string &image_path) {
+  if ((int) paths.size() >= capacity) {
+    return -1;
+  }
+  for (int t = 0; t < FEATURE_TYPES; t++) {
+    // the whole stride, so the padding is written as zeros
+    row.assign(features.vectors[t], features.vectors[t] + header.lengths[t]);
+    row.resize(header.strides[t], 0.f);
+    file.seekp(header.columns[t] + (int64_t) paths.size() * header.strides[t] * (int64_t) sizeof(float));
+    file.write((const char *) row.data(), (std::streamsize) (row.size() * sizeof(float)));
+  }
+  paths.push_back(image_path);
+  return 0;
+}
+
+int FeatureFileWriter::close() {
+  // the string table
+  header.count = (int32_t) paths.size();
+  std::vector<int64_t> path_offsets(paths.size() + 1, 0);
+  for (size_t i = 0; i < paths.size(); i++) {
+    path_offsets[i + 1] = path_offsets[i] + (int64_t) paths[i].size() + 1;
+  }
+  header.path_chars = header.path_offsets + (int64_t) (path_offsets.size() * sizeof(int64_t));
+  header.file_size = header.path_chars + path_offsets.back();
+  file.seekp(header.path_offsets);
+  file.write((const char *) path_offsets.data(), (std::streamsize) (path_offsets.size() * sizeof(int64_t)));
+  for (const std::string &image_path: paths) {
+    file.write(image_path.c_str(), (std::streamsize) image_path.size() + 1);
+  }
+  file.seekp(0);
+  file.write((const char *) &header, sizeof(header));
+  file.close();
+  if (!file) {
+    printf("Cannot write the feature file %s\n", file_path.c_str());
+    return -1;
+  }
+  return header.count;
+}
+
+int write_feature_file(const char *path, const std::vector<std::string> &files, MagnitudeMode magnitude_mode) {
+  FeatureFileWriter writer;
+  if (writer.open(path, (int) files.size(), magnitude_mode) != 0) {
+    return -1;
+  }
+  // the images are decoded and their features computed a batch at a time on all threads, then written in the order of
+  // files, so the file is the same whatever the number of threads
+  int batch_size = get_num_threads() * INDEX_BATCH_PER_THREAD;
+  std::vector<ImageFeatures> batch(batch_size);
+  std::vector<char> decoded(batch_size);
+  for (size_t first = 0; first < files.size(); first += batch_size) {
+    int images = (int) std::min(files.size() - first, (size_t) batch_size);
+    parallel_for(images, 1, [&](int, int begin, int end) {
+      for (int i = begin; i < end; i++) {
+        cv::Mat img = cv::imread(files[first + i]);
+        decoded[i] = !img.empty();
+        if (decoded[i]) {
+          compute_features(img, ~0u, magnitude_mode, batch[i]);
+        }
+      }
+    });
+    for (int i = 0; i < images; i++) {
+      if (!decoded[i]) {
+        printf("Cannot read %s, skipped\n", files[first + i].c_str());
+        continue;
+      }
+      writer.add(batch[i].view(), files[first + i]);
+    }
+  }
+  return writer.close();
+}
+
+FeatureStore::~FeatureStore() {
+  close();
+}
+
+int FeatureStore::open(const char *path) {
+  close();
+#ifdef _WIN32
+  file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+  LARGE_INTEGER file_size;
+  if (file == INVALID_HANDLE_VALUE) {
+    file = nullptr;
+    return -1;
+  }
+  if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart < (LONGLONG) sizeof(FeatureFileHeader)) {
+    close();
+    return -1;
+  }
+  size = (size_t) file_size.QuadPart;
+  mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  data = mapping != nullptr ? (const unsigned char *) MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+#else
+  file = ::open(path, O_RDONLY);
+  struct stat file_stat;
+  if (file < 0) {
+    return -1;
+  }
+  if (fstat(file, &file_stat) != 0 || file_stat.st_size < (off_t) sizeof(FeatureFileHeader)) {
+    close();
+    return -1;
+  }
+  size = (size_t) file_stat.st_size;
+  void *mapped = mmap(nullptr, size, PROT_READ, MAP_SHARED, file, 0);
+  data = mapped != MAP_FAILED ? (const unsigned char *) mapped : nullptr;
+#endif
+  if (data == nullptr) {
+    close();
+    return -1;
+  }
+
+  // only the header and the path offsets are checked, the columns and the paths are not read until a scan gets to them
+  file_header = (const FeatureFileHeader *) data;
+  const FeatureFileHeader &h = *file_header;
+  int64_t file_size = (int64_t) size;
+  if (memcmp(h.magic, FEATURE_FILE_MAGIC, sizeof(h.magic)) != 0) {
+    close();
+    return -1;
+  }
+  bool valid = h.version == FEATURE_FILE_VERSION && h.count >= 0 && h.file_size == file_size;
+  for (int t = 0; valid && t < FEATURE_TYPES; t++) {
+    valid = h.lengths[t] == feature_length((FeatureType) t) && h.strides[t] >= h.lengths[t]
+        && h.strides[t] * sizeof(float) % FEATURE_ALIGNMENT == 0 && h.columns[t] % FEATURE_ALIGNMENT == 0
+        && h.columns[t] >= (int64_t) sizeof(FeatureFileHeader)
+        && h.columns[t] + (int64_t) h.count * h.strides[t] * (int64_t) sizeof(float) <= file_size;
+  }
+  valid = valid && h.path_offsets % sizeof(int64_t) == 0 && h.path_offsets >= (int64_t) sizeof(FeatureFileHeader)
+      && h.path_chars >= h.path_offsets + (int64_t) ((h.count + 1) * sizeof(int64_t)) && h.path_chars <= file_size;
+  if (valid) {
+    // the offsets never go back, so every path lies within the file, and the last one ends with the file
+    path_offsets = (const int64_t *) (data + h.path_offsets);
+    valid = path_offsets[0] == 0 && path_offsets[h.count] == file_size - h.path_chars
+        && (h.count == 0 || data[size - 1] == 0);
+    for (int i = 0; valid && i < h.count; i++) {
+      valid = path_offsets[i] < path_offsets[i + 1];
+    }
+  }
+  if (!valid) {
+    close();
+    return -2;
+  }
+  return 0;
+}
+
+void FeatureStore::close() {
+#ifdef _WIN32
+  if (data != nullptr) {
+    UnmapViewOfFile(data);
+  }
+  if (mapping != nullptr) {
+    CloseHandle(mapping);
+  }
+  if (file != nullptr) {
+    CloseHandle(file);
+  }
+  file = mapping = nullptr;
+#else
+  if (data != nullptr) {
+    munmap((void *) data, size);
+  }
+  if (file >= 0) {
+    ::close(file);
+  }
+  file = -1;
+#endif
+  data = nullptr;
+  size = 0;
+  file_header = nullptr;
+  path_offsets = nullptr;
+}
+
+const FeatureFileHeader &FeatureStore::header() const {
+  return *file_header;
+}
+
+int FeatureStore::count() const {
+  return file_header->count;
+}
+
+int FeatureStore::stride(FeatureType type) const {
+  return file_header->strides[type];
+}
+
+const float *FeatureStore::column(FeatureType type) const {
+  return (const float *) (data + file_header->columns[type]);
+}
+
+const char *FeatureStore::path(int image) const {
+  return (const char *) data + file_header->path_chars + path_offsets[image];
+}
+
+FeatureView FeatureStore::view(int image) const {
+  FeatureView view;
+  for (int t = 0; t < FEATURE_TYPES; t++) {
+    view.vectors[t] = column((FeatureType) t) + (size_t) image * file_header->strides[t];
+  }
+  return view;
+}
@@ -1,18 +1,27 @@
 #include "features.h"
+#include "distance.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
 
 float sum_of_square_difference(const cv::Mat &src, const cv::Mat &dst) {
+  // the 9 x 9 centre patches as two flat vectors, compared with the SSD kernel; every difference is an integer and the
+  // sum stays below 2^24, so it is exact
+  float a[9 * 9 * 3], b[9 * 9 * 3];
   int mid_row = dst.rows / 2;
   int mid_col = dst.cols / 2;
-  float sums[] = {0.f, 0.f, 0.f};
+  int length = 0;
   for (int i = mid_row - 4; i <= mid_row + 4; i++) {
-    for (int j = mid_col - 4; j <= mid_col + 4; j++) {
-      for (int c = 0; c < dst.channels(); c++) {
-        int diff = dst.at<cv::Vec3b>(i, j)[c] - src.at<cv::Vec3b>(i, j)[c];
-        sums[c] += (float)(diff * diff);
-      }
+    const uchar *src_row = src.ptr<uchar>(i) + (mid_col - 4) * 3;
+    const uchar *dst_row = dst.ptr<uchar>(i) + (mid_col - 4) * 3;
+    for (int j = 0; j < 9 * 3; j++, length++) {
+      a[length] = dst_row[j];
+      b[length] = src_row[j];
     }
   }
-  return sums[0] + sums[1] + sums[2];
+  return distance(DISTANCE_SSD, a, b, length);
 }
 
 int hist_normalize(cv::Mat &src, cv::Mat &dst, bool is_3d) {
@@ -54,21 +63,15 @@ int hist_normalize(cv::Mat &src, cv::Mat &dst, bool is_3d) {
 }
 
 float intersection_distance(const cv::Mat &m1, const cv::Mat &m2, bool is_3d) {
+  // a normalized histogram is one contiguous block of floats, rows x cols of them in 2D and all three sizes in 3D
+  size_t length = is_3d ? (size_t) m1.size[0] * m1.size[1] * m1.size[2] : (size_t) m1.rows * m1.cols;
+  if (m1.isContinuous() && m2.isContinuous()) {
+    return distance(DISTANCE_INTERSECTION, m1.ptr<float>(), m2.ptr<float>(), (int) length);
+  }
+  // a 2D view into a larger histogram, row by row
   float intersection = 0.f;
-  if (is_3d) {
-    for (int i = 0; i < m1.size[0]; i++) {
-      for (int j = 0; j < m1.size[1]; j++) {
-        for (int k = 0; k < m1.size[2]; k++) {
-          intersection += std::min(m1.at<float>(i, j, k), m2.at<float>(i, j, k));
-        }
-      }
-    }
-  } else {
-    for (int i = 0; i < m1.rows; i++) {
-      for (int j = 0; j < m1.cols; j++) {
-        intersection += std::min(m1.at<float>(i, j), m2.at<float>(i, j));
-      }
-    }
+  for (int i = 0; !is_3d && i < m1.rows; i++) {
+    intersection += distance(DISTANCE_INTERSECTION, m1.ptr<float>(i), m2.ptr<float>(i), m1.cols);
   }
   return intersection;
 }
@@ -107,12 +110,12 @@ int halves_rgb_histogram(const cv::Mat &src, cv::Mat &top, cv::Mat &bottom) {
 }
 
 int texture_histogram(const cv::Mat &src, int *bins, float *normalized_bins) {
+  // every channel of every pixel, the textures are single channel images which cv::Vec3b would read three times past
+  int width = src.cols * src.channels();
   for (int i = 0; i < src.rows; i++) {
-    for (int j = 0; j < src.cols; j++) {
-      for (int c = 0; c < src.channels(); c++) {
-        int denominator = src.at<cv::Vec3b>(i, j)[c] * BINS;
-        bins[denominator / 256] += 1;
-      }
+    const uchar *row = src.ptr<uchar>(i);
+    for (int x = 0; x < width; x++) {
+      bins[row[x] * BINS / 256] += 1;
     }
   }
   int total_value = 1;
@@ -177,16 +180,92 @@ int sobelY3x3(cv::Mat &src, cv::Mat &dst) {
   return 0;
 }
 
+// one element of magnitude(), the mode is a template argument so the loops below have no branch in them
+template<MagnitudeMode mode>
+static inline uchar magnitude_value(int gx, int gy) {
+  if (mode == MAGNITUDE_EXACT) {
+    return (uchar)(int)std::sqrt((float)(gx * gx + gy * gy));
+  }
+  gx = std::abs(gx);
+  gy = std::abs(gy);
+  if (mode == MAGNITUDE_L1) {
+    return (uchar)(gx + gy);
+  }
+  return (uchar)((123 * std::max(gx, gy) + 51 * std::min(gx, gy)) >> 7);
+}
+
+template<MagnitudeMode mode>
+static void magnitude_row(const short *sx, const short *sy, uchar *dst, int width) {
+  for (int x = 0; x < width; x++) {
+    dst[x] = magnitude_value<mode>(sx[x], sy[x]);
+  }
+}
+
+static void magnitude_row(const short *sx, const short *sy, uchar *dst, int width, MagnitudeMode mode) {
+  switch (mode) {
+    case MAGNITUDE_L1: {
+      magnitude_row<MAGNITUDE_L1>(sx, sy, dst, width);
+      break;
+    }
+    case MAGNITUDE_MAX_MIN: {
+      magnitude_row<MAGNITUDE_MAX_MIN>(sx, sy, dst, width);
+      break;
+    }
+    default: {
+      magnitude_row<MAGNITUDE_EXACT>(sx, sy, dst, width);
+      break;
+    }
+  }
+}
+
 int magnitude(cv::Mat &sx, cv::Mat &sy, cv::Mat &dst) {
+  return magnitude(sx, sy, dst, MAGNITUDE_EXACT);
+}
+
+int magnitude(cv::Mat &sx, cv::Mat &sy, cv::Mat &dst, MagnitudeMode mode) {
+  dst.create(sx.rows, sx.cols, CV_8UC3);
   for (int i = 0; i < sx.rows; i++) {
-    for (int j = 0; j < sx.cols; j++) {
-      cv::Vec3s sx_pixel = sx.at<cv::Vec3s>(i, j);
-      cv::Vec3s sy_pixel = sy.at<cv::Vec3s>(i, j);
-      dst.at<cv::Vec3b>(i, j) = cv::Vec3b(
-          sqrt(sx_pixel[0] * sx_pixel[0] + sy_pixel[0] * sy_pixel[0]),
-          sqrt(sx_pixel[1] * sx_pixel[1] + sy_pixel[1] * sy_pixel[1]),
-          sqrt(sx_pixel[2] * sx_pixel[2] + sy_pixel[2] * sy_pixel[2]));
+    magnitude_row(sx.ptr<short>(i), sy.ptr<short>(i), dst.ptr<uchar>(i), sx.cols * 3, mode);
+  }
+  return 0;
+}
+
+int sobel_magnitude(const cv::Mat &src, cv::Mat &dst, MagnitudeMode mode) {
+  dst.create(src.rows, src.cols, CV_8UC3);
+  int width = src.cols * 3;
+  // the first and last pixel of every row stay 0 in both gradients, and so in the magnitude
+  std::vector<short> sx(width, 0), sy(width, 0);
+  for (int i = 0; i < src.rows; i++) {
+    uchar *d = dst.ptr<uchar>(i);
+    if (i < 1 || i >= src.rows - 1) {
+      memset(d, 0, width);
+      continue;
     }
+    const uchar *above = src.ptr<uchar>(i - 1), *here = src.ptr<uchar>(i), *below = src.ptr<uchar>(i + 1);
+    // the integer form of separable_sobel(): the difference of the left and right neighbours, smoothed by
+    // 1/4 1/2 1/4 across the rows for x, the other way round for y, truncated towards 0 like the float sums
+    for (int x = 3; x < width - 3; x++) {
+      int dx_above = above[x - 3] - above[x + 3], dx_here = here[x - 3] - here[x + 3];
+      int dx_below = below[x - 3] - below[x + 3];
+      sx[x] = (short)((dx_above + 2 * dx_here + dx_below) / 4);
+      int smooth_above = (above[x - 3] + 2 * above[x] + above[x + 3]) >> 2;
+      int smooth_below = (below[x - 3] + 2 * below[x] + below[x + 3]) >> 2;
+      sy[x] = (short)(smooth_above - smooth_below);
+    }
+    magnitude_row(sx.data(), sy.data(), d, width, mode);
+  }
+  return 0;
+}
+
+int parse_magnitude_mode(const char *name, MagnitudeMode &mode) {
+  if (strcmp(name, "exact") == 0) {
+    mode = MAGNITUDE_EXACT;
+  } else if (strcmp(name, "l1") == 0) {
+    mode = MAGNITUDE_L1;
+  } else if (strcmp(name, "maxmin") == 0) {
+    mode = MAGNITUDE_MAX_MIN;
+  } else {
+    return -1;
   }
   return 0;
 }
\ No newline at end of file
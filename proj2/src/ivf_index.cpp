@@ -0,0 +1,372 @@
+#include "ivf_index.h"
+#include "distance.h"
+#include "parallel.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <random>
+#if defined(__SSE__) || defined(_M_X64) || defined(_M_IX86)
+#include <xmmintrin.h>
+#endif
+
+// the images k-means trains on per list, at most IVF_TRAIN_BYTES of embedded vectors
+#define IVF_TRAIN_PER_LIST 64
+#define IVF_TRAIN_BYTES (256 << 20)
+// the images a thread embeds or assigns to a list between two looks at the work left
+#define IVF_CHUNK 64
+// how many images down a list from the one being scored a query starts loading the rows of
+#define IVF_PREFETCH_AHEAD 4
+// the seed of the k-means++ initialization, fixed so the same feature file always gives the same index
+#define IVF_SEED 2022
+// the 64-bit FNV-1a hash
+#define FNV_OFFSET_BASIS 14695981039346656037ull
+#define FNV_PRIME 1099511628211ull
+
+// start loading a vector into the cache, one line per FEATURE_ALIGNMENT bytes
+static void prefetch(const float *vector, int length) {
+#if defined(__SSE__) || defined(_M_X64) || defined(_M_IX86)
+  for (size_t b = 0; b < length * sizeof(float); b += FEATURE_ALIGNMENT) {
+    _mm_prefetch((const char *) vector + b, _MM_HINT_T0);
+  }
+#else
+  (void) vector;
+  (void) length;
+#endif
+}
+
+static int padded(int dim) {
+  return (dim + 15) / 16 * 16;
+}
+
+// the histograms a task compares, 1 or 2 of them, 0 for a task that is not a histogram intersection
+static int task_types(int mode, FeatureType types[2]) {
+  ModeScore score;
+  if (!mode_score(mode, score) || score.distance != DISTANCE_INTERSECTION) {
+    return 0;
+  }
+  types[0] = score.first;
+  types[1] = score.second;
+  return score.second_weight != 0.f ? 2 : 1;
+}
+
+// the floats of the embedding of a task, 0 for a task that is not a histogram intersection
+static int embedding_length(int mode) {
+  FeatureType types[2];
+  int length = 0;
+  for (int f = 0; f < task_types(mode, types); f++) {
+    length += feature_length(types[f]);
+  }
+  return length;
+}
+
+static uint64_t fnv1a(uint64_t hash, const void *data, size_t size) {
+  const unsigned char *bytes = (const unsigned char *) data;
+  for (size_t i = 0; i < size; i++) {
+    hash = (hash ^ bytes[i]) * FNV_PRIME;
+  }
+  return hash;
+}
+
+// the hash of the header of a feature file and of the histograms of a task, which tells the files an index of the task
+// can be loaded on: the rows are hashed on all threads, then their hashes in the order of the file
+static uint64_t feature_file_hash(const FeatureStore &feature_store, int mode) {
+  FeatureType types[2];
+  int histograms = task_types(mode, types);
+  std::vector<uint64_t> rows(feature_store.count());
+  parallel_for(feature_store.count(), IVF_CHUNK, [&](int, int begin, int end) {
+    for (int i = begin; i < end; i++) {
+      FeatureView features = feature_store.view(i);
+      uint64_t hash = FNV_OFFSET_BASIS;
+      for (int f = 0; f < histograms; f++) {
+        hash = fnv1a(hash, features.vectors[types[f]], feature_length(types[f]) * sizeof(float));
+      }
+      rows[i] = hash;
+    }
+  });
+  uint64_t hash = fnv1a(FNV_OFFSET_BASIS, &feature_store.header(), sizeof(FeatureFileHeader));
+  return fnv1a(hash, rows.data(), rows.size() * sizeof(uint64_t));
+}
+
+// the centroid nearest to an embedded vector, the first of equally near ones, with distances room for all of them
+static int nearest_centroid(const float *vector, const float *centroids, int stride, int lists, float *distances) {
+  distance_block(DISTANCE_SSD, vector, centroids, stride, lists, stride, distances);
+  int best = 0;
+  for (int c = 1; c < lists; c++) {
+    if (distances[c] < distances[best]) {
+      best = c;
+    }
+  }
+  return best;
+}
+
+void IvfIndex::embed(const FeatureView &features, float *vector) const {
+  ModeScore score;
+  mode_score(header.mode, score);
+  FeatureType types[2] = {score.first, score.second};
+  float weights[2] = {score.first_weight, score.second_weight};
+  int n = 0;
+  for (int f = 0; f < 2 && weights[f] != 0.f; f++) {
+    const float *histogram = features.vectors[types[f]];
+    for (int i = 0; i < feature_length(types[f]); i++) {
+      vector[n++] = std::sqrt(weights[f] * std::max(histogram[i], 0.f));
+    }
+  }
+  std::fill(vector + n, vector + header.stride, 0.f);
+}
+
+int IvfIndex::build(const FeatureStore &feature_store, int mode, int lists, int iterations) {
+  int dim = embedding_length(mode), count = feature_store.count();
+  if (dim == 0) {
+    printf("The index only answers the histogram tasks, 2 to 6\n");
+    return -1;
+  }
+  if (count == 0) {
+    printf("The feature file is empty\n");
+    return -1;
+  }
+  if (lists <= 0) {
+    lists = (int) std::lround(std::sqrt((double) count));
+  }
+  lists = std::max(1, std::min(lists, count));
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, IVF_FILE_MAGIC, sizeof(header.magic));
+  header.version = IVF_FILE_VERSION;
+  header.mode = mode;
+  header.count = count;
+  header.lists = lists;
+  header.dim = dim;
+  header.stride = padded(dim);
+  header.feature_file_hash = feature_file_hash(feature_store, mode);
+  size_t stride = header.stride;
+
+  // the training images, evenly spread over the file
+  size_t sample = std::min((size_t) count, (size_t) lists * IVF_TRAIN_PER_LIST);
+  sample = std::max((size_t) lists, std::min(sample, IVF_TRAIN_BYTES / (stride * sizeof(float))));
+  std::vector<float> train(sample * stride);
+  parallel_for((int) sample, IVF_CHUNK, [&](int, int begin, int end) {
+    for (int i = begin; i < end; i++) {
+      embed(feature_store.view((int) ((int64_t) i * count / (int64_t) sample)), &train[i * stride]);
+    }
+  });
+
+  // k-means++: the first centroid is a random image, every next one an image picked with a probability that grows with
+  // its squared distance to the nearest centroid so far
+  centroids.assign(lists * stride, 0.f);
+  std::mt19937 rng(IVF_SEED);
+  std::vector<float> nearest(sample, std::numeric_limits<float>::max());
+  size_t chosen = rng() % sample;
+  for (int c = 0; c < lists; c++) {
+    float *centroid = &centroids[c * stride];
+    std::copy(&train[chosen * stride], &train[chosen * stride] + stride, centroid);
+    parallel_for((int) sample, IVF_CHUNK, [&](int, int begin, int end) {
+      for (int i = begin; i < end; i++) {
+        nearest[i] = std::min(nearest[i], distance(DISTANCE_SSD, &train[i * stride], centroid, (int) stride));
+      }
+    });
+    double total = 0.0;
+    for (size_t i = 0; i < sample; i++) {
+      total += nearest[i];
+    }
+    // all the images left are copies of a centroid
+    if (total == 0.0) {
+      chosen = (chosen + 1) % sample;
+      continue;
+    }
+    double pick = rng() / 4294967296.0 * total;
+    for (chosen = 0; chosen + 1 < sample && pick >= nearest[chosen]; chosen++) {
+      pick -= nearest[chosen];
+    }
+  }
+
+  // Lloyd iterations: every image to its nearest centroid on all threads, then every centroid to the mean of its
+  // images, summed in doubles in the order of the file; a list left empty restarts at the image farthest from its own
+  std::vector<int> assignment(sample, -1), next(sample);
+  std::vector<float> distances(sample);
+  std::vector<double> sums(lists * stride);
+  std::vector<int> sizes(lists);
+  for (int iteration = 0; iteration < iterations; iteration++) {
+    parallel_for((int) sample, IVF_CHUNK, [&](int, int begin, int end) {
+      std::vector<float> to_centroids(lists);
+      for (int i = begin; i < end; i++) {
+        next[i] = nearest_centroid(&train[i * stride], centroids.data(), (int) stride, lists, to_centroids.data());
+        distances[i] = to_centroids[next[i]];
+      }
+    });
+    if (next == assignment) {
+      break;
+    }
+    assignment.swap(next);
+    std::fill(sums.begin(), sums.end(), 0.0);
+    std::fill(sizes.begin(), sizes.end(), 0);
+    for (size_t i = 0; i < sample; i++) {
+      double *sum = &sums[assignment[i] * stride];
+      const float *vector = &train[i * stride];
+      for (size_t j = 0; j < stride; j++) {
+        sum[j] += vector[j];
+      }
+      sizes[assignment[i]]++;
+    }
+    for (int c = 0; c < lists; c++) {
+      float *centroid = &centroids[c * stride];
+      if (sizes[c] > 0) {
+        for (size_t j = 0; j < stride; j++) {
+          centroid[j] = (float) (sums[c * stride + j] / sizes[c]);
+        }
+        continue;
+      }
+      size_t farthest = std::max_element(distances.begin(), distances.end()) - distances.begin();
+      std::copy(&train[farthest * stride], &train[farthest * stride] + stride, centroid);
+      distances[farthest] = 0.f;
+    }
+  }
+
+  // every image of the file to its list, then the lists one after another, each in the order of the file
+  std::vector<int32_t> list_of(count);
+  parallel_for(count, IVF_CHUNK, [&](int, int begin, int end) {
+    std::vector<float> vector(stride), to_centroids(lists);
+    for (int i = begin; i < end; i++) {
+      embed(feature_store.view(i), vector.data());
+      list_of[i] = nearest_centroid(vector.data(), centroids.data(), (int) stride, lists, to_centroids.data());
+    }
+  });
+  offsets.assign(lists + 1, 0);
+  for (int i = 0; i < count; i++) {
+    offsets[list_of[i] + 1]++;
+  }
+  for (int c = 0; c < lists; c++) {
+    offsets[c + 1] += offsets[c];
+  }
+  std::vector<int32_t> fill(offsets.begin(), offsets.end() - 1);
+  ids.resize(count);
+  for (int i = 0; i < count; i++) {
+    ids[fill[list_of[i]]++] = i;
+  }
+
+  use_store(feature_store);
+  return 0;
+}
+
+void IvfIndex::use_store(const FeatureStore &feature_store) {
+  store = &feature_store;
+  for (int t = 0; t < FEATURE_TYPES; t++) {
+    strides[t] = feature_store.stride((FeatureType) t);
+  }
+}
+
+int IvfIndex::save(const char *path) const {
+  std::ofstream file(path, std::ios::binary | std::ios::trunc);
+  file.write((const char *) &header, sizeof(header));
+  file.write((const char *) centroids.data(), (std::streamsize) (centroids.size() * sizeof(float)));
+  file.write((const char *) offsets.data(), (std::streamsize) (offsets.size() * sizeof(int32_t)));
+  file.write((const char *) ids.data(), (std::streamsize) (ids.size() * sizeof(int32_t)));
+  file.close();
+  if (!file) {
+    printf("Cannot write the index file %s\n", path);
+    return -1;
+  }
+  return 0;
+}
+
+int IvfIndex::load(const char *path, const FeatureStore &feature_store) {
+  std::ifstream file(path, std::ios::binary);
+  IvfFileHeader h;
+  if (!file.read((char *) &h, sizeof(h))) {
+    return -1;
+  }
+  // the index has to be the one of this very feature file, built again whenever the file is, even to the same size
+  bool valid = memcmp(h.magic, IVF_FILE_MAGIC, sizeof(h.magic)) == 0 && h.version == IVF_FILE_VERSION
+      && embedding_length(h.mode) == h.dim && h.dim > 0 && padded(h.dim) == h.stride && h.count == feature_store.count()
+      && h.lists >= 1 && h.lists <= std::max(h.count, 1)
+      && h.feature_file_hash == feature_file_hash(feature_store, h.mode);
+  if (!valid) {
+    return -1;
+  }
+  std::vector<float> file_centroids((size_t) h.lists * h.stride);
+  std::vector<int32_t> file_offsets(h.lists + 1), file_ids(h.count);
+  file.read((char *) file_centroids.data(), (std::streamsize) (file_centroids.size() * sizeof(float)));
+  file.read((char *) file_offsets.data(), (std::streamsize) (file_offsets.size() * sizeof(int32_t)));
+  file.read((char *) file_ids.data(), (std::streamsize) (file_ids.size() * sizeof(int32_t)));
+  valid = (bool) file && file_offsets[0] == 0 && file_offsets[h.lists] == h.count;
+  for (int c = 0; valid && c < h.lists; c++) {
+    valid = file_offsets[c] <= file_offsets[c + 1];
+  }
+  for (int i = 0; valid && i < h.count; i++) {
+    valid = file_ids[i] >= 0 && file_ids[i] < h.count;
+  }
+  if (!valid) {
+    return -1;
+  }
+  header = h;
+  use_store(feature_store);
+  centroids.swap(file_centroids);
+  offsets.swap(file_offsets);
+  ids.swap(file_ids);
+  return 0;
+}
+
+int IvfIndex::mode() const {
+  return header.mode;
+}
+
+int IvfIndex::lists() const {
+  return header.lists;
+}
+
+int IvfIndex::list_size(int l) const {
+  return offsets[l + 1] - offsets[l];
+}
+
+void IvfIndex::nearest_lists(const float *vector, int probes, std::vector<Match> &nearest) const {
+  std::vector<float> distances(header.lists);
+  distance_block(DISTANCE_SSD, vector, centroids.data(), header.stride, header.lists, header.stride, distances.data());
+  TopK top(probes, true);
+  for (int c = 0; c < header.lists; c++) {
+    top.push(distances[c], c);
+  }
+  nearest = top.sorted();
+}
+
+std::vector<Match> IvfIndex::query(const FeatureView &query, int k, int probes, int *scanned) const {
+  std::vector<float> vector(header.stride);
+  embed(query, vector.data());
+  std::vector<Match> nearest;
+  nearest_lists(vector.data(), probes, nearest);
+  TopK top(k, lower_is_better(header.mode));
+  if (scanned != nullptr) {
+    *scanned = 0;
+  }
+  // the rows of the images are scattered over the columns of the file: every image is scored on its own with the pair
+  // kernel, which gives the same float as the block kernels of the linear scan, while the rows of the images a few
+  // places further down the list are loaded
+  ModeScore score;
+  mode_score(header.mode, score);
+  DistanceKernel kernel = distance_kernels().pair[score.distance];
+  const float *first_column = store->column(score.first), *second_column = store->column(score.second);
+  int first_length = feature_length(score.first), second_length = feature_length(score.second);
+  for (const Match &list: nearest) {
+    if (scanned != nullptr) {
+      *scanned += list_size(list.index);
+    }
+    int end = offsets[list.index + 1];
+    for (int i = offsets[list.index]; i < end; i++) {
+      if (i + IVF_PREFETCH_AHEAD < end) {
+        size_t ahead = (size_t) ids[i + IVF_PREFETCH_AHEAD];
+        prefetch(first_column + ahead * strides[score.first], first_length);
+        if (score.second_weight != 0.f) {
+          prefetch(second_column + ahead * strides[score.second], second_length);
+        }
+      }
+      size_t image = (size_t) ids[i];
+      float value = kernel(query.vectors[score.first], first_column + image * strides[score.first], first_length)
+          * score.first_weight;
+      if (score.second_weight != 0.f) {
+        value += kernel(query.vectors[score.second], second_column + image * strides[score.second], second_length)
+            * score.second_weight;
+      }
+      top.push(value, ids[i]);
+    }
+  }
+  return top.sorted();
+}
@@ -0,0 +1,219 @@
+#include "parallel.h"
+#include <algorithm>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace {
+
+// set while a thread runs chunks of a job, so a parallel_for() called from a chunk runs in place instead of taking
+// run_mutex again, which that thread may already hold
+thread_local bool in_job = false;
+
+// the items a thread has left, padded so the shares of two threads never sit on the same cache line
+struct Share {
+  std::mutex mutex;
+  int begin = 0, end = 0;
+  char padding[64];
+};
+
+/*
+ * A fixed set of worker threads sleeping on a condition variable. A job hands every thread, the calling one included,
+ * a share of the items; the threads work through their own shares chunk by chunk and then steal from the others.
+ */
+class WorkerPool {
+ public:
+  WorkerPool() {
+    start(default_threads() - 1);
+  }
+
+  ~WorkerPool() {
+    stop();
+  }
+
+  void resize(int threads) {
+    std::lock_guard<std::mutex> job(run_mutex);
+    stop();
+    start(std::max(threads, 1) - 1);
+  }
+
+  int threads() const {
+    return (int) workers.size() + 1;
+  }
+
+  void run(int count, int chunk_items, void (*chunk_body)(void *, int, int, int), void *chunk_context) {
+    std::unique_lock<std::mutex> job;
+    if (!in_job && !workers.empty() && count > chunk_items) {
+      job = std::unique_lock<std::mutex>(run_mutex, std::try_to_lock);
+    }
+    if (!job.owns_lock()) {
+      for (int begin = 0; begin < count; begin += chunk_items) {
+        chunk_body(chunk_context, 0, begin, std::min(begin + chunk_items, count));
+      }
+      return;
+    }
+    int participants = threads();
+    for (int t = 0; t < participants; t++) {
+      shares[t].begin = (int) ((long long) count * t / participants);
+      shares[t].end = (int) ((long long) count * (t + 1) / participants);
+    }
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      body = chunk_body;
+      context = chunk_context;
+      chunk = chunk_items;
+      active = (int) workers.size();
+      generation++;
+    }
+    wake.notify_all();
+    in_job = true;
+    run_chunks(0);
+    in_job = false;
+    // every worker has to check in, so none of them can still be looking at this job once we return
+    std::unique_lock<std::mutex> lock(mutex);
+    done.wait(lock, [this] { return active == 0; });
+  }
+
+ private:
+  static int default_threads() {
+    return std::max((int) std::thread::hardware_concurrency(), 1);
+  }
+
+  void start(int count) {
+    stopping = false;
+    shares.reset(new Share[count + 1]);
+    for (int i = 0; i < count; i++) {
+      workers.emplace_back(&WorkerPool::worker_loop, this, i + 1, generation);
+    }
+  }
+
+  void stop() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    wake.notify_all();
+    for (std::thread &worker: workers) {
+      worker.join();
+    }
+    workers.clear();
+  }
+
+  // the next chunk off the front of a thread's own share, false once it is empty
+  bool take(int thread, int &begin, int &end) {
+    Share &own = shares[thread];
+    std::lock_guard<std::mutex> lock(own.mutex);
+    if (own.begin >= own.end) {
+      return false;
+    }
+    begin = own.begin;
+    end = std::min(begin + chunk, own.end);
+    own.begin = end;
+    return true;
+  }
+
+  // move the back half of the largest share left to a thread's own share, false once every share is empty
+  bool steal(int thread) {
+    int participants = threads();
+    for (;;) {
+      int victim = -1, most = 0;
+      for (int t = 0; t < participants; t++) {
+        std::lock_guard<std::mutex> lock(shares[t].mutex);
+        if (t != thread && shares[t].end - shares[t].begin > most) {
+          victim = t;
+          most = shares[t].end - shares[t].begin;
+        }
+      }
+      if (victim < 0) {
+        return false;
+      }
+      int begin, end;
+      {
+        std::lock_guard<std::mutex> lock(shares[victim].mutex);
+        int left = shares[victim].end - shares[victim].begin;
+        if (left <= 0) {
+          // emptied since it was looked at, look again
+          continue;
+        }
+        end = shares[victim].end;
+        begin = end - (left + 1) / 2;
+        shares[victim].end = begin;
+      }
+      std::lock_guard<std::mutex> lock(shares[thread].mutex);
+      shares[thread].begin = begin;
+      shares[thread].end = end;
+      return true;
+    }
+  }
+
+  void run_chunks(int thread) {
+    int begin, end;
+    for (;;) {
+      if (take(thread, begin, end)) {
+        body(context, thread, begin, end);
+      } else if (!steal(thread)) {
+        return;
+      }
+    }
+  }
+
+  void worker_loop(int thread, unsigned long seen) {
+    // a worker only ever runs chunks of a job
+    in_job = true;
+    for (;;) {
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        wake.wait(lock, [this, seen] { return stopping || generation != seen; });
+        if (stopping) {
+          return;
+        }
+        seen = generation;
+      }
+      run_chunks(thread);
+      std::lock_guard<std::mutex> lock(mutex);
+      if (--active == 0) {
+        done.notify_one();
+      }
+    }
+  }
+
+  std::vector<std::thread> workers;
+  std::unique_ptr<Share[]> shares;
+  // held for the whole job, so only one job runs on the pool at a time
+  std::mutex run_mutex;
+  std::mutex mutex;
+  std::condition_variable wake, done;
+  unsigned long generation = 0;
+  bool stopping = false;
+  int active = 0;
+  void (*body)(void *, int, int, int) = nullptr;
+  void *context = nullptr;
+  int chunk = 1;
+};
+
+WorkerPool &pool() {
+  static WorkerPool worker_pool;
+  return worker_pool;
+}
+
+}
+
+void set_num_threads(int threads) {
+  if (threads <= 0) {
+    threads = (int) std::thread::hardware_concurrency();
+  }
+  pool().resize(threads);
+}
+
+int get_num_threads() {
+  return pool().threads();
+}
+
+void parallel_for(int count, int chunk, void (*body)(void *context, int thread, int begin, int end), void *context) {
+  if (count <= 0) {
+    return;
+  }
+  pool().run(count, std::max(chunk, 1), body, context);
+}
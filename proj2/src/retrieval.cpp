@@ -0,0 +1,116 @@
+#include "retrieval.h"
+#include "parallel.h"
+#include <algorithm>
+#include <cstdio>
+
+// the images of a feature file a thread scores between two looks at the work left
+#define SCAN_CHUNK 256
+// the bytes of feature file rows a batch scores against all its queries before it moves on, about half an L2 cache
+#define BATCH_BLOCK_BYTES (256 * 1024)
+
+int ImageDatabase::open(char *path) {
+  files.clear();
+  int opened = store.open(path);
+  feature_file = opened == 0;
+  if (feature_file) {
+    texture_mode = (MagnitudeMode) store.header().magnitude_mode;
+    return 0;
+  }
+  // not a directory to read either
+  if (opened == -2) {
+    printf("%s is a feature file of another version, or a damaged one, run build_index again\n", path);
+    return -1;
+  }
+  return read_files(path, files);
+}
+
+bool ImageDatabase::indexed() const {
+  return feature_file;
+}
+
+int ImageDatabase::count() const {
+  return feature_file ? store.count() : (int) files.size();
+}
+
+std::string ImageDatabase::path(int image) const {
+  return feature_file ? store.path(image) : files[image];
+}
+
+MagnitudeMode ImageDatabase::magnitude_mode() const {
+  return texture_mode;
+}
+
+int ImageDatabase::set_magnitude_mode(MagnitudeMode mode) {
+  if (feature_file && mode != texture_mode) {
+    return -1;
+  }
+  texture_mode = mode;
+  return 0;
+}
+
+std::vector<Match> ImageDatabase::query(const cv::Mat &image, int mode, int k) const {
+  ImageFeatures features;
+  compute_features(image, mode_features(mode), texture_mode, features);
+  return query(features.view(), mode, k);
+}
+
+std::vector<Match> ImageDatabase::query(const FeatureView &features, int mode, int k) const {
+  return query_batch(std::vector<FeatureView>(1, features), mode, k)[0];
+}
+
+std::vector<std::vector<Match>> ImageDatabase::query_batch(const std::vector<FeatureView> &queries, int mode,
+                                                           int k) const {
+  // a partial top k per thread and query, merged once all images are scored; the order of the matches does not depend
+  // on which thread scored which image, so the result is the same on any number of threads
+  int batch = (int) queries.size(), threads = get_num_threads();
+  std::vector<TopK> partial((size_t) threads * batch, TopK(k, lower_is_better(mode)));
+  if (feature_file) {
+    int strides[FEATURE_TYPES];
+    size_t row_bytes = 0;
+    for (int t = 0; t < FEATURE_TYPES; t++) {
+      strides[t] = store.stride((FeatureType) t);
+      if (mode_features(mode) & 1u << t) {
+        row_bytes += strides[t] * sizeof(float);
+      }
+    }
+    // the rows of a block follow each other in every column, 256 of the rg histograms, 8 of the halves histograms
+    size_t block_rows = row_bytes > 0 ? BATCH_BLOCK_BYTES / row_bytes : SCAN_CHUNK;
+    int block = (int) std::max<size_t>(1, std::min<size_t>(SCAN_CHUNK, block_rows));
+    parallel_for(store.count(), SCAN_CHUNK, [&](int thread, int begin, int end) {
+      TopK *top = &partial[(size_t) thread * batch];
+      float scores[SCAN_CHUNK];
+      for (int first = begin; first < end; first += block) {
+        int images = std::min(end - first, block);
+        FeatureView rows = store.view(first);
+        for (int q = 0; q < batch; q++) {
+          score_features_block(mode, queries[q], rows, strides, images, scores);
+          for (int i = 0; i < images; i++) {
+            top[q].push(scores[i], first + i);
+          }
+        }
+      }
+    });
+  } else {
+    // every image is a chunk of its own, decoding it takes long enough
+    parallel_for((int) files.size(), 1, [&](int thread, int begin, int end) {
+      TopK *top = &partial[(size_t) thread * batch];
+      ImageFeatures image;
+      for (int i = begin; i < end; i++) {
+        cv::Mat img = cv::imread(files[i]);
+        compute_features(img, mode_features(mode), texture_mode, image);
+        FeatureView view = image.view();
+        for (int q = 0; q < batch; q++) {
+          top[q].push(score_features(mode, queries[q], view), i);
+        }
+      }
+    });
+  }
+  std::vector<std::vector<Match>> matches(batch);
+  for (int q = 0; q < batch; q++) {
+    for (int t = 1; t < threads; t++) {
+      partial[q].merge(partial[(size_t) t * batch + q]);
+    }
+    matches[q] = partial[q].sorted();
+  }
+  return matches;
+}
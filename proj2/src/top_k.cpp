@@ -0,0 +1,44 @@
+#include "top_k.h"
+#include <algorithm>
+#include <cmath>
+
+TopK::TopK(int k, bool lower_is_better) : k(std::max(k, 0)), ascending(lower_is_better) {
+  heap.reserve(this->k);
+}
+
+bool TopK::better(const Match &a, const Match &b) const {
+  bool a_nan = std::isnan(a.score), b_nan = std::isnan(b.score);
+  if (a_nan || b_nan) {
+    return a_nan != b_nan ? b_nan : a.index < b.index;
+  }
+  if (a.score != b.score) {
+    return ascending ? a.score < b.score : a.score > b.score;
+  }
+  return a.index < b.index;
+}
+
+void TopK::push(float score, int index) {
+  Match match = {score, index};
+  // ordered by better(), the heap keeps the worst match on top
+  auto order = [this](const Match &a, const Match &b) { return better(a, b); };
+  if ((int) heap.size() < k) {
+    heap.push_back(match);
+    std::push_heap(heap.begin(), heap.end(), order);
+  } else if (k > 0 && better(match, heap.front())) {
+    std::pop_heap(heap.begin(), heap.end(), order);
+    heap.back() = match;
+    std::push_heap(heap.begin(), heap.end(), order);
+  }
+}
+
+void TopK::merge(const TopK &other) {
+  for (const Match &match: other.heap) {
+    push(match.score, match.index);
+  }
+}
+
+std::vector<Match> TopK::sorted() const {
+  std::vector<Match> matches = heap;
+  std::sort(matches.begin(), matches.end(), [this](const Match &a, const Match &b) { return better(a, b); });
+  return matches;
+}
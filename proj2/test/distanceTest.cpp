@@ -0,0 +1,105 @@
+#include "distance.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <vector>
+
+/*
+ * Checks the distance kernels at every simd level this build and the CPU support. Random vectors, a third of their
+ * bins empty, of lengths around the 16 accumulators and the lengths of the real features, are compared one pair at a
+ * time and one query against a block of vectors at odd strides. The scalar pair has to be close to the distance summed
+ * in double, and every other result has to be the very same float as the scalar pair. Exits with 1 if a kernel
+ * differed.
+ */
+
+#define TRIALS_PER_LENGTH 20
+// how far the float sums may be from the double ones, relative to the size of the distance
+#define REFERENCE_TOLERANCE 1e-4
+
+static const char *distance_names[DISTANCES] = {"intersection", "l1", "l2", "chi_square", "ssd"};
+
+// the distance of a and b summed in double, the way distance.h describes it
+static double reference_distance(Distance type, const float *a, const float *b, int length) {
+  double sum = 0;
+  for (int i = 0; i < length; i++) {
+    double x = a[i], y = b[i];
+    switch (type) {
+      case DISTANCE_INTERSECTION:
+        sum += std::min(x, y);
+        break;
+      case DISTANCE_L1:
+        sum += std::fabs(x - y);
+        break;
+      case DISTANCE_CHI_SQUARE:
+        sum += x + y > 0 ? (x - y) * (x - y) / (x + y) : 0;
+        break;
+      default:
+        sum += (x - y) * (x - y);
+        break;
+    }
+  }
+  return type == DISTANCE_L2 ? std::sqrt(sum) : sum;
+}
+
+// a vector of non-negative floats, about a third of them 0 like the empty bins of a histogram
+static void fill_histogram(std::mt19937 &rng, std::vector<float> &values) {
+  std::uniform_real_distribution<float> uniform(0, 1);
+  for (float &value: values) {
+    value = uniform(rng) < 0.3f ? 0.0f : uniform(rng);
+  }
+}
+
+int main() {
+  const int lengths[] = {0, 1, 5, 15, 16, 17, 31, 33, 243, 256, 4096};
+  std::vector<SimdLevel> levels;
+  for (SimdLevel level: {SIMD_SCALAR, SIMD_AVX2, SIMD_AVX512}) {
+    if (set_simd_level(level) == 0) {
+      levels.push_back(level);
+    }
+  }
+  std::mt19937 rng(7);
+  int failures = 0, checks = 0;
+  for (int length: lengths) {
+    for (int trial = 0; trial < TRIALS_PER_LENGTH; trial++) {
+      int count = 1 + trial * 3;
+      size_t stride = length + trial % 5;
+      std::vector<float> query(length), vectors(stride * count + 1), scalar(count), scores(count);
+      fill_histogram(rng, query);
+      fill_histogram(rng, vectors);
+      for (int d = 0; d < DISTANCES; d++) {
+        Distance type = (Distance) d;
+        for (SimdLevel level: levels) {
+          set_simd_level(level);
+          distance_block(type, query.data(), vectors.data(), stride, count, length, scores.data());
+          for (int j = 0; j < count; j++) {
+            const float *vector = vectors.data() + j * stride;
+            float pair = distance(type, query.data(), vector, length);
+            checks++;
+            if (level == SIMD_SCALAR) {
+              scalar[j] = pair;
+              double expected = reference_distance(type, query.data(), vector, length);
+              if (std::fabs(expected - pair) > REFERENCE_TOLERANCE * (1 + std::fabs(expected))) {
+                printf("FAIL %s of length %d: %.9g, summed in double %.9g\n", distance_names[d], length, pair,
+                       expected);
+                failures++;
+              }
+            } else if (memcmp(&pair, &scalar[j], sizeof(float)) != 0) {
+              printf("FAIL %s of length %d at %s: %.9g, scalar %.9g\n", distance_names[d], length,
+                     simd_level_name(level), pair, scalar[j]);
+              failures++;
+            }
+            if (memcmp(&pair, &scores[j], sizeof(float)) != 0) {
+              printf("FAIL %s of length %d at %s: block %.9g, pair %.9g at stride %d\n", distance_names[d], length,
+                     simd_level_name(level), scores[j], pair, (int) stride);
+              failures++;
+            }
+          }
+        }
+      }
+    }
+  }
+  printf("%d distances at %d simd levels: %d differed\n", checks, (int) levels.size(), failures);
+  return failures == 0 ? 0 : 1;
+}
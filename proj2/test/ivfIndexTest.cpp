@@ -0,0 +1,107 @@
+#include "ivf_index.h"
+#include "parallel.h"
+#include "retrieval.h"
+#include "synthetic_features.h"
+#include <cstdio>
+#include <vector>
+
+/*
+ * Checks the IVF index on a synthetic feature file, for every histogram task. Every image has to be in exactly one
+ * list, a query probing every list has to return the matches of the exact scan of ImageDatabase, scores included, and
+ * one probing a single list only exact scores. An index saved and loaded again has to answer the same, an index for
+ * task 1 cannot be built and an index cannot be loaded on another feature file, even one of the same size. Exits with 1
+ * if a check failed.
+ */
+
+#define TEST_FEATURE_FILE "ivf_index_test.features"
+#define OTHER_FEATURE_FILE "ivf_index_test.other.features"
+#define TEST_INDEX_FILE "ivf_index_test.ivf"
+#define TEST_IMAGES 3000
+#define TEST_SCENES 100
+#define TEST_QUERIES 40
+#define TEST_K 10
+
+// the number of failed checks of the index of one task, checks counts them
+static int check_task(const FeatureStore &store, const ImageDatabase &database, int mode, int &checks) {
+  IvfIndex index, loaded;
+  checks++;
+  if (index.build(store, mode, 0) != 0 || index.save(TEST_INDEX_FILE) != 0
+      || loaded.load(TEST_INDEX_FILE, store) != 0) {
+    printf("FAIL task %d: cannot build, save and load the index\n", mode);
+    return 1;
+  }
+  int failures = 0, listed = 0;
+  for (int l = 0; l < index.lists(); l++) {
+    listed += index.list_size(l);
+  }
+  checks++;
+  if (listed != store.count() || loaded.lists() != index.lists() || loaded.mode() != mode) {
+    printf("FAIL task %d: %d of %d images in the lists, %d lists loaded of %d\n", mode, listed, store.count(),
+           loaded.lists(), index.lists());
+    failures++;
+  }
+  for (int q = 0; q < TEST_QUERIES; q++) {
+    FeatureView query = store.view(q * (store.count() / TEST_QUERIES) + q % 10);
+    std::vector<Match> exact = database.query(query, mode, TEST_K);
+    int scanned = 0;
+    checks += 3;
+    if (!same_matches(index.query(query, TEST_K, index.lists(), &scanned), exact) || scanned != store.count()) {
+      printf("FAIL task %d: probing every list differs from the exact scan for query %d\n", mode, q);
+      failures++;
+    }
+    if (!same_matches(loaded.query(query, TEST_K, loaded.lists()), exact)) {
+      printf("FAIL task %d: the loaded index differs from the exact scan for query %d\n", mode, q);
+      failures++;
+    }
+    for (const Match &match: index.query(query, TEST_K, 1)) {
+      if (match.score != score_features(mode, query, store.view(match.index))) {
+        printf("FAIL task %d: image %d scored %g probing one list for query %d\n", mode, match.index, match.score, q);
+        failures++;
+        break;
+      }
+    }
+  }
+  return failures;
+}
+
+// the number of failed checks, checks counts them
+static int check_index(char *path, const char *other_path, int &checks) {
+  FeatureStore store, other;
+  ImageDatabase database;
+  if (store.open(path) != 0 || other.open(other_path) != 0 || database.open(path) != 0) {
+    printf("FAIL cannot open %s and %s\n", path, other_path);
+    return 1;
+  }
+  int failures = 0;
+  for (int mode = 2; mode <= 6; mode++) {
+    failures += check_task(store, database, mode, checks);
+  }
+  IvfIndex index;
+  checks += 2;
+  if (index.build(store, 1, 0) != -1) {
+    printf("FAIL an index for task 1 was built\n");
+    failures++;
+  }
+  // the index of task 6 left by the last check_task(), on a file of other images with the very same size
+  if (index.load(TEST_INDEX_FILE, other) != -1 || other.header().file_size != store.header().file_size) {
+    printf("FAIL an index was loaded on another feature file of the same size\n");
+    failures++;
+  }
+  return failures;
+}
+
+int main() {
+  char path[] = TEST_FEATURE_FILE;
+  set_num_threads(3);
+  if (write_synthetic_features(path, TEST_IMAGES, TEST_SCENES, 15, 1) < 0
+      || write_synthetic_features(OTHER_FEATURE_FILE, TEST_IMAGES, TEST_SCENES, 15, 2) < 0) {
+    return 1;
+  }
+  int checks = 0;
+  int failures = check_index(path, OTHER_FEATURE_FILE, checks);
+  std::remove(path);
+  std::remove(OTHER_FEATURE_FILE);
+  std::remove(TEST_INDEX_FILE);
+  printf("%d checks of the index of %d images: %d failed\n", checks, TEST_IMAGES, failures);
+  return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,140 @@
+#include "parallel.h"
+#include "top_k.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+/*
+ * Checks the work-stealing pool and the bounded top-k the database scans are built on. parallel_for must run every
+ * item exactly once, in chunks of at most chunk items on a thread index below get_num_threads(), for item counts,
+ * chunk sizes and thread counts around the edges, with a few slow items so the threads steal from each other, and
+ * from inside the chunks of another parallel_for(), where it runs in place. TopK heaps filled from three parts of a
+ * shuffled list and merged must give the start of a stable sort of the list, with many equal scores and some NaNs.
+ * Exits with 1 if anything differed.
+ */
+
+// every SLOW_ITEM-th item takes a while, so the other threads run out of work and steal
+#define SLOW_ITEM 97
+#define TOP_K_TRIALS 200
+
+// 0 if parallel_for ran every item of count once, in valid chunks
+static int check_parallel_for(int count, int chunk) {
+  std::vector<std::atomic<int>> runs(count);
+  for (std::atomic<int> &run: runs) {
+    run = 0;
+  }
+  std::atomic<int> bad_chunks(0);
+  parallel_for(count, chunk, [&](int thread, int begin, int end) {
+    if (thread < 0 || thread >= get_num_threads() || begin >= end || end - begin > chunk) {
+      bad_chunks++;
+    }
+    for (int i = begin; i < end; i++) {
+      runs[i]++;
+      if (i % SLOW_ITEM == 0) {
+        volatile double sum = 0;
+        for (int k = 0; k < 20000; k++) {
+          sum += std::sqrt((double) k);
+        }
+      }
+    }
+  });
+  int wrong = 0;
+  for (int i = 0; i < count; i++) {
+    wrong += runs[i] != 1;
+  }
+  if (wrong != 0 || bad_chunks != 0) {
+    printf("FAIL parallel_for of %d items in chunks of %d on %d threads: %d items did not run once, %d bad chunks\n",
+           count, chunk, get_num_threads(), wrong, (int) bad_chunks);
+    return 1;
+  }
+  return 0;
+}
+
+// 0 if a parallel_for() in every chunk of another one ran every inner item once per outer item
+static int check_nested_parallel_for() {
+  const int outer = 100, inner = 50;
+  std::atomic<int> runs(0);
+  parallel_for(outer, 3, [&](int, int begin, int end) {
+    for (int i = begin; i < end; i++) {
+      parallel_for(inner, 7, [&](int thread, int inner_begin, int inner_end) {
+        runs += thread == 0 ? inner_end - inner_begin : outer * inner;
+      });
+    }
+  });
+  if (runs != outer * inner) {
+    printf("FAIL nested parallel_for on %d threads: %d inner items ran instead of %d, or not in place\n",
+           get_num_threads(), (int) runs, outer * inner);
+    return 1;
+  }
+  return 0;
+}
+
+// the order TopK promises: the better score first, NaN last, and the order of the list on equal scores
+static std::vector<Match> stable_sorted(std::vector<Match> matches, bool ascending) {
+  std::stable_sort(matches.begin(), matches.end(), [&](const Match &a, const Match &b) {
+    if (std::isnan(a.score) || std::isnan(b.score)) {
+      return !std::isnan(a.score) && std::isnan(b.score);
+    }
+    return ascending ? a.score < b.score : a.score > b.score;
+  });
+  return matches;
+}
+
+// 0 if three partial TopK merged give the k first matches of a stable sort
+static int check_top_k(std::mt19937 &rng, int trial) {
+  int n = (int) (rng() % 500), k = (int) (rng() % 20);
+  bool ascending = trial % 2 == 1;
+  std::vector<Match> matches(n);
+  for (int i = 0; i < n; i++) {
+    matches[i].score = rng() % 7 == 0 ? NAN : (float) (rng() % 10);
+    matches[i].index = i;
+  }
+  std::vector<Match> expected = stable_sorted(matches, ascending);
+  expected.resize(std::min(n, k));
+  TopK parts[3] = {TopK(k, ascending), TopK(k, ascending), TopK(k, ascending)};
+  std::shuffle(matches.begin(), matches.end(), rng);
+  for (int i = 0; i < n; i++) {
+    parts[i % 3].push(matches[i].score, matches[i].index);
+  }
+  parts[0].merge(parts[1]);
+  parts[0].merge(parts[2]);
+  std::vector<Match> got = parts[0].sorted();
+  bool same = got.size() == expected.size();
+  for (size_t i = 0; same && i < got.size(); i++) {
+    same = got[i].index == expected[i].index;
+  }
+  if (!same) {
+    printf("FAIL top %d of %d %s scores: the merged heaps differ from a stable sort\n", k, n,
+           ascending ? "ascending" : "descending");
+    return 1;
+  }
+  return 0;
+}
+
+int main() {
+  const int thread_counts[] = {1, 2, 5, 9};
+  const int counts[] = {0, 1, 2, 7, 100, 1001, 50000};
+  const int chunks[] = {1, 3, 64, 100000};
+  int failures = 0, checks = 0;
+  for (int threads: thread_counts) {
+    set_num_threads(threads);
+    for (int count: counts) {
+      for (int chunk: chunks) {
+        failures += check_parallel_for(count, chunk);
+        checks++;
+      }
+    }
+    failures += check_nested_parallel_for();
+    checks++;
+  }
+  std::mt19937 rng(1);
+  for (int trial = 0; trial < TOP_K_TRIALS; trial++) {
+    failures += check_top_k(rng, trial);
+    checks++;
+  }
+  printf("%d checks of parallel_for and TopK: %d failed\n", checks, failures);
+  return failures == 0 ? 0 : 1;
+}
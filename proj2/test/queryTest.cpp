@@ -0,0 +1,85 @@
+#include "parallel.h"
+#include "retrieval.h"
+#include "synthetic_features.h"
+#include <algorithm>
+#include <cstdio>
+#include <vector>
+
+/*
+ * Checks the queries of ImageDatabase on a feature file. A synthetic feature file is queried with some of its own
+ * images for every task, on 1 and 3 threads, once with query_batch() and once with query() per image, and both have to
+ * return the matches of a plain scan: score_features() on every image, stable sorted best first. Every tenth image of
+ * the file repeats the one before it, so the order of equal scores is checked as well. Exits with 1 if a query
+ * differed.
+ */
+
+#define TEST_FEATURE_FILE "query_test.features"
+#define TEST_IMAGES 3000
+#define TEST_SCENES 100
+#define TEST_QUERIES 24
+#define TEST_K 10
+
+// the k best matches of a scan over every image, in the order TopK promises
+static std::vector<Match> scan(const FeatureStore &store, const FeatureView &query, int mode, int k) {
+  std::vector<Match> matches(store.count());
+  for (int i = 0; i < store.count(); i++) {
+    matches[i].score = score_features(mode, query, store.view(i));
+    matches[i].index = i;
+  }
+  bool ascending = lower_is_better(mode);
+  std::stable_sort(matches.begin(), matches.end(), [&](const Match &a, const Match &b) {
+    return ascending ? a.score < b.score : a.score > b.score;
+  });
+  matches.resize(std::min(k, store.count()));
+  return matches;
+}
+
+// the number of queries that differed from the scan, checks counts the queries
+static int check_queries(char *path, int &checks) {
+  FeatureStore store;
+  ImageDatabase database;
+  if (store.open(path) != 0 || database.open(path) != 0 || !database.indexed()) {
+    printf("FAIL cannot open %s\n", path);
+    return 1;
+  }
+  std::vector<FeatureView> queries;
+  for (int q = 0; q < TEST_QUERIES; q++) {
+    queries.push_back(store.view(q * (TEST_IMAGES / TEST_QUERIES) + q % 10));
+  }
+  const int thread_counts[] = {1, 3};
+  int failures = 0;
+  for (int mode = 1; mode <= 6; mode++) {
+    std::vector<std::vector<Match>> expected;
+    for (const FeatureView &query: queries) {
+      expected.push_back(scan(store, query, mode, TEST_K));
+    }
+    for (int threads: thread_counts) {
+      set_num_threads(threads);
+      std::vector<std::vector<Match>> batch = database.query_batch(queries, mode, TEST_K);
+      for (int q = 0; q < TEST_QUERIES; q++) {
+        checks += 2;
+        if (!same_matches(batch[q], expected[q])) {
+          printf("FAIL task %d on %d threads: query_batch differs from the scan for query %d\n", mode, threads, q);
+          failures++;
+        }
+        if (!same_matches(database.query(queries[q], mode, TEST_K), expected[q])) {
+          printf("FAIL task %d on %d threads: query differs from the scan for query %d\n", mode, threads, q);
+          failures++;
+        }
+      }
+    }
+  }
+  return failures;
+}
+
+int main() {
+  char path[] = TEST_FEATURE_FILE;
+  if (write_synthetic_features(path, TEST_IMAGES, TEST_SCENES, 15, 1) < 0) {
+    return 1;
+  }
+  int checks = 0;
+  int failures = check_queries(path, checks);
+  std::remove(path);
+  printf("%d queries of %d images: %d differed\n", checks, TEST_IMAGES, failures);
+  return failures == 0 ? 0 : 1;
+}
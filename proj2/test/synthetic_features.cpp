@@ -0,0 +1,98 @@
+#include "synthetic_features.h"
+#include "feature_store.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <string>
+
+// every DUPLICATE_EVERY-th image is a copy of the one before it
+#define DUPLICATE_EVERY 10
+// how far a pixel of the centre patch strays from the one of its scene
+#define PATCH_NOISE 12.0
+
+// a random histogram of alpha.size() bins that sum to 1, around alpha / sum(alpha)
+static void dirichlet(std::mt19937 &rng, const std::vector<double> &alpha, float *histogram) {
+  std::vector<double> draws(alpha.size());
+  double total = 0;
+  for (size_t i = 0; i < alpha.size(); i++) {
+    std::gamma_distribution<double> gamma(alpha[i], 1.0);
+    draws[i] = gamma(rng);
+    total += draws[i];
+  }
+  for (size_t i = 0; i < alpha.size(); i++) {
+    histogram[i] = (float) (draws[i] / total);
+  }
+}
+
+int write_synthetic_features(const char *path, int count, int scenes, double concentration, unsigned seed) {
+  FeatureFileWriter writer;
+  if (writer.open(path, count, MAGNITUDE_EXACT) != 0) {
+    return -1;
+  }
+  std::mt19937 rng(seed);
+  // the features of every scene: the pixels of the patch, the Dirichlet parameters of every histogram
+  std::vector<std::vector<double>> scene_features[FEATURE_TYPES];
+  std::vector<float> draw;
+  for (int t = 0; t < FEATURE_TYPES; t++) {
+    int length = feature_length((FeatureType) t);
+    scene_features[t].assign(scenes, std::vector<double>(length));
+    draw.resize(length);
+    for (std::vector<double> &scene: scene_features[t]) {
+      if (t == FEATURE_BASELINE) {
+        std::uniform_real_distribution<double> pixel(0, 255);
+        for (double &value: scene) {
+          value = pixel(rng);
+        }
+      } else {
+        dirichlet(rng, std::vector<double>(length, 0.3), draw.data());
+        for (int i = 0; i < length; i++) {
+          scene[i] = concentration * draw[i] + 0.02;
+        }
+      }
+    }
+  }
+
+  ImageFeatures image;
+  image.types = ~0u;
+  size_t total = 0;
+  for (int t = 0; t < FEATURE_TYPES; t++) {
+    total += feature_length((FeatureType) t);
+  }
+  image.values.resize(total);
+  for (int i = 0; i < count; i++) {
+    // a duplicate keeps the features of the image before it
+    if (i % DUPLICATE_EVERY != DUPLICATE_EVERY - 1) {
+      int scene = (int) (rng() % scenes);
+      float *vector = image.values.data();
+      for (int t = 0; t < FEATURE_TYPES; t++) {
+        const std::vector<double> &features = scene_features[t][scene];
+        if (t == FEATURE_BASELINE) {
+          std::normal_distribution<double> noise(0, PATCH_NOISE);
+          for (size_t k = 0; k < features.size(); k++) {
+            vector[k] = (float) std::min(255.0, std::max(0.0, std::round(features[k] + noise(rng))));
+          }
+        } else {
+          dirichlet(rng, features, vector);
+        }
+        vector += features.size();
+      }
+    }
+    char image_path[32];
+    snprintf(image_path, sizeof(image_path), "img%07d.jpg", i);
+    writer.add(image.view(), image_path);
+  }
+  return writer.close();
+}
+
+bool same_matches(const std::vector<Match> &a, const std::vector<Match> &b) {
+  if (a.size() != b.size()) {
+    return false;
+  }
+  for (size_t i = 0; i < a.size(); i++) {
+    if (a[i].index != b[i].index || a[i].score != b[i].score) {
+      return false;
+    }
+  }
+  return true;
+}
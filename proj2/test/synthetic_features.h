@@ -0,0 +1,19 @@
+#include "top_k.h"
+#include <vector>
+
+#ifndef PROJ2_TEST_SYNTHETIC_FEATURES_H_
+#define PROJ2_TEST_SYNTHETIC_FEATURES_H_
+
+/*
+ * Write a feature file of count made-up images for the tests, so they need neither images nor OpenCV to decode them.
+ * Every image belongs to one of scenes random scenes: its histograms are Dirichlet draws around the histograms of its
+ * scene (the larger concentration, the closer) and its centre patch is the patch of the scene plus some noise. Every
+ * tenth image repeats the one before it, so the queries meet equal scores. The same arguments give the same file, and
+ * it is written by FeatureFileWriter like the files of build_index. Returns count, -1 if the file cannot be written.
+ */
+int write_synthetic_features(const char *path, int count, int scenes, double concentration, unsigned seed);
+
+// true if a and b hold the same images with the very same scores, in the same order
+bool same_matches(const std::vector<Match> &a, const std::vector<Match> &b);
+
+#endif //PROJ2_TEST_SYNTHETIC_FEATURES_H_
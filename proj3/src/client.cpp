@@ -2,6 +2,8 @@
 #include <opencv2/opencv.hpp>
 #include "retrieval.h"
 #include "classifier.h"
+#include "frame_source.h"
+#include "stage_timer.h"
 
 enum mode {
   SEGMENTATION = 1,
@@ -15,6 +17,14 @@ enum mode {
 } mode;
 
 int main(int argc, char *argv[]) {
+  // "--source <spec>", "--sink <spec>" and "--keys <keys>" run the loop on a file or generated frames without a
+  // screen, see frame_source.h
+  FrameOptions options;
+  take_frame_options(argc, argv, options);
+  // "--trace <file.json>" writes a Chrome trace of the stages, "--hud" draws their latencies on the video, see
+  // stage_timer.h
+  StageTimerOptions timer_options;
+  take_stage_timer_options(argc, argv, timer_options);
   // if the feature file exists and evaluation result file exist, clear them at first
   clear_file(FEATURE_FILE_NAME);
   clear_file(EVALUATE_FILE_NAME);
@@ -31,44 +41,73 @@ int main(int argc, char *argv[]) {
   // set up steps to shrink or grow
   int steps = 5;
 
-  cv::VideoCapture *capdev;
-  // open the video device
-  capdev = new cv::VideoCapture(0);
-  if (!capdev->isOpened()) {
-    printf("Unable to open video device\n");
+  // open the video device, or whatever source was asked for
+  FrameSource *source = open_frame_source(options.source);
+  if (source == nullptr) {
+    printf("Unable to open frame source %s\n", options.source.c_str());
+    return (-1);
+  }
+  FrameSink *sink = open_frame_sink(options.sink, options.keys);
+  if (sink == nullptr) {
+    printf("Unknown frame sink %s\n", options.sink.c_str());
+    delete source;
     return (-1);
   }
   // get some properties of the image
-  cv::Size refS((int) capdev->get(cv::CAP_PROP_FRAME_WIDTH),
-                (int) capdev->get(cv::CAP_PROP_FRAME_HEIGHT));
+  cv::Size refS = source->size();
   printf("Expected size: %d %d\n", refS.width, refS.height);
-  cv::namedWindow("Video", 1); // identifies a window
-  cv::Mat frame;
+  if (!timer_options.trace.empty()) {
+    start_stage_trace(timer_options.trace);
+  }
+  bool hud = timer_options.hud;
+  cv::Mat frame, hud_frame;
   std::vector<double> single_feature_vector;
   for (;;) {
-    *capdev >> frame; // get a new frame from the camera, treat as a stream
-    if (frame.empty()) {
-      printf("frame is empty\n");
-      break;
+    // the whole iteration, key wait included
+    STAGE_TIMER("frame");
+    {
+      STAGE_TIMER("read");
+      // get a new frame from the source, treat as a stream
+      if (!source->next(frame)) {
+        printf("frame is empty\n");
+        break;
+      }
     }
 
     // thresholding the image
     cv::Mat threshold_image(frame.rows, frame.cols, CV_8UC1, cv::Scalar(0));
-    threshold(frame, threshold_image, THRESHOLD);
+    {
+      STAGE_TIMER("threshold");
+      threshold(frame, threshold_image, THRESHOLD);
+    }
 
     // clean the image with shrink and grow
     cv::Mat cleaned_img(frame.rows, frame.cols, CV_8UC1, cv::Scalar(0));
-    cleanup(threshold_image, cleaned_img, steps);
+    {
+      STAGE_TIMER("cleanup");
+      cleanup(threshold_image, cleaned_img, steps);
+    }
 
-    cv::imshow("Video", frame);
-    cv::imshow("Threshold", threshold_image);
-    cv::imshow("cleanup", cleaned_img);
+    // the HUD goes on a copy, the frame itself is still saved by 'a'
+    if (hud) {
+      frame.copyTo(hud_frame);
+      draw_stage_hud(hud_frame);
+      sink->show("Video", hud_frame);
+    } else {
+      sink->show("Video", frame);
+    }
+    sink->show("Threshold", threshold_image);
+    sink->show("cleanup", cleaned_img);
 
     // segment the mat into different components, the major component is the one with the largest area(excluding background)
     std::map<int, cv::Mat> regions;
     cv::Mat components_img(frame.rows, frame.cols, CV_8UC3, cv::Scalar(0));
     cv::Mat major_component(frame.rows, frame.cols, CV_8UC1, cv::Scalar(0));
-    int status = segment(cleaned_img, components_img, component_num, regions, min_area, major_component);
+    int status;
+    {
+      STAGE_TIMER("segment");
+      status = segment(cleaned_img, components_img, component_num, regions, min_area, major_component);
+    }
 
     int window_size = (int)regions.size();
     cv::Mat segmentation_img = cv::Mat(frame.rows, window_size * frame.cols, CV_8UC1);
@@ -82,9 +121,10 @@ int main(int argc, char *argv[]) {
                   cv::FONT_HERSHEY_COMPLEX_SMALL,
                   1.0,
                   cv::Scalar(0, 0, 255));
-      cv::imshow("components", pure_black);
-      cv::imshow("segmentation", pure_black);
+      sink->show("components", pure_black);
+      sink->show("segmentation", pure_black);
     } else {
+      STAGE_TIMER("classify");
       // if you are in training data or test data preparation, it will only mark the major component
       if (mode == TRAIN_DATA_PREP || mode == TEST_DATA_PREP) {
         std::vector<cv::Point> draw_vertices;
@@ -164,12 +204,12 @@ int main(int argc, char *argv[]) {
         index++;
       }
 //        cv::imshow("segmentation", segmentation_img);
-      cv::imshow("segmentation", segmentation_img);
-      cv::imshow("components", components_img);
+      sink->show("segmentation", segmentation_img);
+      sink->show("components", components_img);
     }
 
     // see if there is a waiting keystroke
-    int key = cv::waitKey(10);
+    int key = sink->wait_key(10);
     // if user types 'q', quit the program
     if (key == 'q') {
       break;
@@ -218,6 +258,8 @@ int main(int argc, char *argv[]) {
         std::cout << "You are in EVALUATE mode!" << std::endl;
         std::cout << "Confusion Matrix generated in: " << EVALUATE_OUTPUT_FILE_NAME << std::endl;
       }
+    } else if (key == 'i') {
+      hud = !hud;
     } else if (key == 'a') {
       cv::imwrite("../origin.jpg", frame);
       cv::imwrite("../threshold.jpg", threshold_image);
@@ -226,6 +268,12 @@ int main(int argc, char *argv[]) {
       cv::imwrite("../components.jpg", components_img);
     }
   }
-  delete capdev;
+  printf("read %d frames at %.1f fps\n", source->frame_count(), source->fps());
+  print_stage_report();
+  if (!timer_options.trace.empty()) {
+    write_stage_trace();
+  }
+  delete sink;
+  delete source;
   return (0);
 }
\ No newline at end of file
@@ -1,7 +1,17 @@
 #include <iostream>
+#include "frame_source.h"
+#include "stage_timer.h"
 #include "utils.h"
 
 int main(int argc, char *argv[]) {
+  // "--source <spec>", "--sink <spec>" and "--keys <keys>" run the loop on a file or generated frames without a
+  // screen, see frame_source.h
+  FrameOptions options;
+  take_frame_options(argc, argv, options);
+  // "--trace <file.json>" writes a Chrome trace of the stages, "--hud" draws their latencies on the video, see
+  // stage_timer.h
+  StageTimerOptions timer_options;
+  take_stage_timer_options(argc, argv, timer_options);
   if (argc != 3) {
     std::cout << "Usage: ./ar.exe <target> <obj_name>" << std::endl;
     std::cout << "<target> should be chessboard or circlesgrid, <obj_name> should be one in objs folder" << std::endl;
@@ -49,68 +59,89 @@ int main(int argc, char *argv[]) {
     read_obj("../objs/" + std::string(argv[2]) + ".obj", vertices, faces, 3.5f, -5.f);
   }
 
-  cv::VideoCapture *capdev;
-  // open the video device
-  capdev = new cv::VideoCapture(0);
-  if (!capdev->isOpened()) {
-    printf("Unable to open video device\n");
+  // open the video device, or whatever source was asked for
+  FrameSource *source = open_frame_source(options.source);
+  if (source == nullptr) {
+    printf("Unable to open frame source %s\n", options.source.c_str());
+    return (-1);
+  }
+  FrameSink *sink = open_frame_sink(options.sink, options.keys);
+  if (sink == nullptr) {
+    printf("Unknown frame sink %s\n", options.sink.c_str());
+    delete source;
     return (-1);
   }
   // get some properties of the image
-  cv::Size refS((int) capdev->get(cv::CAP_PROP_FRAME_WIDTH),
-                (int) capdev->get(cv::CAP_PROP_FRAME_HEIGHT));
+  cv::Size refS = source->size();
   printf("Expected size: %d %d\n", refS.width, refS.height);
-  cv::namedWindow("Video", 1); // identifies a window
   cv::Mat frame;
   cv::Mat grey_scale;
 
   // read in the intrinsic parameters
   read_intrinsic_paras("camera_intrinsic_paras_" + target + ".csv", camera_matrix, distortion_coefficients);
 
+  if (!timer_options.trace.empty()) {
+    start_stage_trace(timer_options.trace);
+  }
+  bool hud = timer_options.hud;
   for (;;) {
-    *capdev >> frame; // get a new frame from the camera, treat as a stream
-    if (frame.empty()) {
-      printf("frame is empty\n");
-      break;
+    // the whole iteration, key wait included
+    STAGE_TIMER("frame");
+    {
+      STAGE_TIMER("read");
+      // get a new frame from the source, treat as a stream
+      if (!source->next(frame)) {
+        printf("frame is empty\n");
+        break;
+      }
     }
-    cv::cvtColor(frame, grey_scale, cv::COLOR_BGR2GRAY);
 
     corner_set.clear();
     point_set.clear();
 
     bool corner_find_flag;
-    if (target == "chessboard") {
-      corner_find_flag = cv::findChessboardCorners(frame, pattern_size, corner_set);
-    } else {
-      corner_find_flag = cv::findCirclesGrid(frame, pattern_size, corner_set, cv::CALIB_CB_ASYMMETRIC_GRID, detector);
+    {
+      STAGE_TIMER("detect");
+      cv::cvtColor(frame, grey_scale, cv::COLOR_BGR2GRAY);
+      if (target == "chessboard") {
+        corner_find_flag = cv::findChessboardCorners(frame, pattern_size, corner_set);
+      } else {
+        corner_find_flag = cv::findCirclesGrid(frame, pattern_size, corner_set, cv::CALIB_CB_ASYMMETRIC_GRID, detector);
+      }
     }
 //    bool corner_find_flag = cv::findChessboardCorners(frame, pattern_size, corner_set);
     if (corner_find_flag) {
-      cv::cornerSubPix(grey_scale, corner_set, cv::Size(5, 5), cv::Size(-1, -1), termcrit);
-      cv::drawChessboardCorners(frame, pattern_size, corner_set, corner_find_flag);
+      {
+        STAGE_TIMER("pose");
+        cv::cornerSubPix(grey_scale, corner_set, cv::Size(5, 5), cv::Size(-1, -1), termcrit);
 
-      if (target == "chessboard") {
-        for (int i = 0; i < points_per_column; i++) {
-          for (int j = 0; j < points_per_row; j++) {
-            point_set.push_back(cv::Point3f((float) j, (float) (-i), 0));
+        if (target == "chessboard") {
+          for (int i = 0; i < points_per_column; i++) {
+            for (int j = 0; j < points_per_row; j++) {
+              point_set.push_back(cv::Point3f((float) j, (float) (-i), 0));
+            }
           }
-        }
-      } else {
-        for (int i = 0; i < points_per_column; i++) {
-          int j = (i % 2) == 0 ? 0 : 1;
-          for (; j < points_per_row * 2; j = j + 2) {
-            point_set.push_back(cv::Point3f((float) j, (float) (-i), 0.f));
+        } else {
+          for (int i = 0; i < points_per_column; i++) {
+            int j = (i % 2) == 0 ? 0 : 1;
+            for (; j < points_per_row * 2; j = j + 2) {
+              point_set.push_back(cv::Point3f((float) j, (float) (-i), 0.f));
+            }
           }
         }
+        cv::solvePnP(point_set, corner_set, camera_matrix, distortion_coefficients, rvec, tvec);
       }
-      cv::solvePnP(point_set, corner_set, camera_matrix, distortion_coefficients, rvec, tvec);
       print_matrix("rotation matrix", rvec);
       print_matrix("translation matrix", tvec);
-      draw_axes(rvec, tvec, camera_matrix, distortion_coefficients, frame, corner_set[0]);
+      {
+        STAGE_TIMER("draw");
+        cv::drawChessboardCorners(frame, pattern_size, corner_set, corner_find_flag);
+        draw_axes(rvec, tvec, camera_matrix, distortion_coefficients, frame, corner_set[0]);
+      }
     }
 
     // see if there is a waiting keystroke
-    int key = cv::waitKey(10);
+    int key = sink->wait_key(10);
     // if user types 'q', quit the program
     if (key == 'q') {
       break;
@@ -125,14 +156,28 @@ int main(int argc, char *argv[]) {
         std::cout << "No Corners found!" << std::endl;
       } else {
         show_obj = true;
+        STAGE_TIMER("object");
         draw_object(rvec, tvec, camera_matrix, distortion_coefficients, vertices, faces, frame);
       }
     }
     if (key == 's') {
       cv::imwrite("../ar_captured_" + std::to_string(count++) + ".jpg", frame);
     }
-    cv::imshow("Video", frame);
+    // 'i' turns the stage latencies on the video on and off
+    if (key == 'i') {
+      hud = !hud;
+    }
+    if (hud) {
+      draw_stage_hud(frame);
+    }
+    sink->show("Video", frame);
+  }
+  printf("read %d frames at %.1f fps\n", source->frame_count(), source->fps());
+  print_stage_report();
+  if (!timer_options.trace.empty()) {
+    write_stage_trace();
   }
-  delete capdev;
+  delete sink;
+  delete source;
   return (0);
 }
\ No newline at end of file
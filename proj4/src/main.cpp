@@ -1,7 +1,12 @@
 #include <iostream>
+#include "frame_source.h"
 #include "utils.h"
 
 int main(int argc, char *argv[]) {
+  // "--source <spec>", "--sink <spec>" and "--keys <keys>" run the loop on a file or generated frames without a
+  // screen, see frame_source.h
+  FrameOptions options;
+  take_frame_options(argc, argv, options);
   if (argc != 2) {
     std::cout << "Usage: ./main.exe <target>" << std::endl;
     std::cout << "<target> should be chessboard or circlesgrid" << std::endl;
@@ -40,26 +45,29 @@ int main(int argc, char *argv[]) {
   }
   cv::Size pattern_size = cv::Size(points_per_row, points_per_column);
 
-  cv::VideoCapture *capdev;
-  // open the video device
-  capdev = new cv::VideoCapture(0);
-  if (!capdev->isOpened()) {
-    printf("Unable to open video device\n");
+  // open the video device, or whatever source was asked for
+  FrameSource *source = open_frame_source(options.source);
+  if (source == nullptr) {
+    printf("Unable to open frame source %s\n", options.source.c_str());
+    return (-1);
+  }
+  FrameSink *sink = open_frame_sink(options.sink, options.keys);
+  if (sink == nullptr) {
+    printf("Unknown frame sink %s\n", options.sink.c_str());
+    delete source;
     return (-1);
   }
   // get some properties of the image
-  cv::Size refS((int) capdev->get(cv::CAP_PROP_FRAME_WIDTH),
-                (int) capdev->get(cv::CAP_PROP_FRAME_HEIGHT));
+  cv::Size refS = source->size();
   printf("Expected size: %d %d\n", refS.width, refS.height);
-  cv::namedWindow("Video", 1); // identifies a window
   cv::Mat frame;
   cv::Mat grey_scale;
   int count = 0;
   std::string delimiter(50, '-');
 
   for (;;) {
-    *capdev >> frame; // get a new frame from the camera, treat as a stream
-    if (frame.empty()) {
+    // get a new frame from the source, treat as a stream
+    if (!source->next(frame)) {
       printf("frame is empty\n");
       break;
     }
@@ -87,7 +95,7 @@ int main(int argc, char *argv[]) {
     }
 
     // see if there is a waiting keystroke
-    int key = cv::waitKey(10);
+    int key = sink->wait_key(10);
     // if user types 'q', quit the program
     if (key == 'q') {
       break;
@@ -158,8 +166,10 @@ int main(int argc, char *argv[]) {
                   << std::endl;
       }
     }
-    cv::imshow("Video", frame);
+    sink->show("Video", frame);
   }
-  delete capdev;
+  printf("read %d frames at %.1f fps\n", source->frame_count(), source->fps());
+  delete sink;
+  delete source;
   return (0);
 }
\ No newline at end of file